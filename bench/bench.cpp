@@ -0,0 +1,715 @@
+// Microbenchmarks for the parser, encoders, storage (also shared by several threads), hashes, sorted sets, lists,
+// Pub/Sub fan-out, command dispatch and RDB loading.
+//
+// Usage: bench [--filter <substring>] [--min-time-ms <ms>] [--repetitions <n>] [--out <file>]
+//              [--memory-hashes <n>]
+// Results are written as JSON (to stdout by default) so runs from different commits can be diffed.
+// --memory-hashes also measures the memory held by n hashes of 10 fields against 10n flat keys, which takes a while.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/commands.h"
+#include "../src/logger.h"
+#include "../src/message_parser.h"
+#include "../src/pubsub.h"
+#include "../src/rdb_parser.h"
+#include "../src/server.h"
+#include "../src/stats.h"
+#include "../src/storage.h"
+#include "concurrent_storage.h"
+
+namespace {
+
+// Keeps the compiler from optimising away a result the benchmark never reads
+template <typename T>
+void do_not_optimize(T &&value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Options {
+    std::string filter;
+    double min_time_ms = 200;
+    int repetitions = 5;
+    std::string out;
+    size_t memory_hashes = 0;  // 0 skips the memory benchmark
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;  // median over the repetitions
+    double min_ns_per_op;
+    double items_per_second;
+    double bytes_per_second;  // 0 if the benchmark does not process a byte stream
+};
+
+struct MemoryResult {
+    std::string name;
+    uint64_t items;
+    uint64_t bytes;
+};
+
+class Runner {
+   public:
+    Runner(const Options &options) : options(options) {}
+
+    /**
+     * Times fn, which performs one operation covering items items and bytes bytes.
+     * The iteration count is doubled until a batch takes min_time_ms, then that batch is repeated and the median kept.
+     */
+    template <typename Fn>
+    void run(const std::string &name, Fn &&fn, uint64_t items = 1, uint64_t bytes = 0) {
+        if (!this->options.filter.empty() && name.find(this->options.filter) == std::string::npos) return;
+
+        uint64_t iterations = 1;
+        while (true) {
+            const double ns = time_batch(fn, iterations);
+            if (ns >= this->options.min_time_ms * 1e6 || iterations >= (1ULL << 40)) break;
+            // Jump close to the target instead of doubling all the way when a batch is far too short
+            const double scale = ns > 0 ? this->options.min_time_ms * 1e6 / ns : 1000;
+            iterations = std::max<uint64_t>(iterations * 2, iterations * std::min(scale * 1.2, 1000.0));
+        }
+
+        std::vector<double> samples;
+        for (int i = 0; i < this->options.repetitions; i++) {
+            samples.push_back(time_batch(fn, iterations) / iterations);
+        }
+        std::sort(samples.begin(), samples.end());
+        const double median = samples[samples.size() / 2];
+
+        this->results.push_back({name, iterations, median, samples.front(), items * 1e9 / median,
+                                 bytes * 1e9 / median});
+        std::cerr << name << ": " << median << " ns/op" << std::endl;
+    }
+
+    void record_memory(const std::string &name, uint64_t items, uint64_t bytes) {
+        this->memory_results.push_back({name, items, bytes});
+        std::cerr << name << ": " << bytes << " bytes, " << static_cast<double>(bytes) / items << " bytes/item"
+                  << std::endl;
+    }
+
+    void write_json(std::ostream &out) const {
+        out << "{\n  \"context\": {\"date\": " << std::chrono::system_clock::now().time_since_epoch().count()
+            << ", \"min_time_ms\": " << this->options.min_time_ms
+            << ", \"repetitions\": " << this->options.repetitions << "},\n  \"benchmarks\": [\n";
+        for (size_t i = 0; i < this->results.size(); i++) {
+            const Result &r = this->results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+                << ", \"ns_per_op\": " << r.ns_per_op << ", \"min_ns_per_op\": " << r.min_ns_per_op
+                << ", \"items_per_second\": " << r.items_per_second
+                << ", \"bytes_per_second\": " << r.bytes_per_second << "}"
+                << (i + 1 < this->results.size() ? ",\n" : "\n");
+        }
+        out << "  ],\n  \"memory\": [\n";
+        for (size_t i = 0; i < this->memory_results.size(); i++) {
+            const MemoryResult &r = this->memory_results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"items\": " << r.items << ", \"bytes\": " << r.bytes
+                << ", \"bytes_per_item\": " << static_cast<double>(r.bytes) / r.items << "}"
+                << (i + 1 < this->memory_results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+   private:
+    const Options &options;
+    std::vector<Result> results;
+    std::vector<MemoryResult> memory_results;
+
+    template <typename Fn>
+    static double time_batch(Fn &fn, uint64_t iterations) {
+        const auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++) {
+            fn();
+        }
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+std::string make_key(size_t i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key:%012zu", i);
+    return buf;
+}
+
+// A pipeline of count requests as a client would send them, alternating SET and GET
+std::string make_pipeline(size_t count, size_t value_size) {
+    std::string pipeline;
+    const std::string value(value_size, 'x');
+    for (size_t i = 0; i < count; i++) {
+        if (i % 2 == 0) {
+            pipeline += MessageParser::encode_array({"SET", make_key(i), value});
+        } else {
+            pipeline += MessageParser::encode_array({"GET", make_key(i - 1)});
+        }
+    }
+    return pipeline;
+}
+
+void bench_parser(Runner &runner) {
+    for (size_t count : {1, 16, 128}) {
+        for (size_t value_size : {16, 1024}) {
+            const std::string pipeline = make_pipeline(count, value_size);
+            runner.run(
+                "parse_message/pipeline:" + std::to_string(count) + "/value:" + std::to_string(value_size),
+                [&] {
+                    size_t bytes_consumed = 0;
+                    auto messages = MessageParser::parse_message(pipeline, bytes_consumed);
+                    do_not_optimize(messages);
+                },
+                count, pipeline.size());
+        }
+    }
+
+    // A few large values, whose payloads are skipped by their declared length
+    for (size_t value_size : {64 * 1024, 1024 * 1024}) {
+        const std::string pipeline = make_pipeline(4, value_size);
+        runner.run(
+            "parse_message/large_values:4/value:" + std::to_string(value_size),
+            [&] {
+                size_t bytes_consumed = 0;
+                auto messages = MessageParser::parse_message(pipeline, bytes_consumed);
+                do_not_optimize(messages);
+            },
+            4, pipeline.size());
+    }
+
+    // A large request split across reads: only the first part has arrived
+    const std::string pipeline = make_pipeline(128, 16);
+    const std::string_view partial(pipeline.data(), pipeline.size() / 2);
+    runner.run(
+        "parse_message/partial_pipeline:128",
+        [&] {
+            size_t bytes_consumed = 0;
+            auto messages = MessageParser::parse_message(partial, bytes_consumed);
+            do_not_optimize(messages);
+        },
+        1, partial.size());
+}
+
+void bench_encoders(Runner &runner) {
+    runner.run("encode_simple_string", [] {
+        auto message = MessageParser::encode_simple_string("OK");
+        do_not_optimize(message);
+    });
+    runner.run("encode_simple_error", [] {
+        auto message = MessageParser::encode_simple_error("ERR unknown command");
+        do_not_optimize(message);
+    });
+    for (size_t size : {16, 1024, 65536}) {
+        const std::string value(size, 'x');
+        runner.run(
+            "encode_bulk_string/" + std::to_string(size),
+            [&] {
+                auto message = MessageParser::encode_bulk_string(value);
+                do_not_optimize(message);
+            },
+            1, size);
+    }
+    for (long long num : {7LL, 123456789LL}) {
+        runner.run("encode_integer/" + std::to_string(num), [num] {
+            auto message = MessageParser::encode_integer(num);
+            do_not_optimize(message);
+        });
+    }
+    runner.run("encode_array_header", [] {
+        auto message = MessageParser::encode_array_header(100);
+        do_not_optimize(message);
+    });
+    for (size_t size : {3, 100}) {
+        std::vector<std::string> words;
+        for (size_t i = 0; i < size; i++) words.push_back(make_key(i));
+        runner.run(
+            "encode_array/" + std::to_string(size),
+            [&] {
+                auto message = MessageParser::encode_array(words);
+                do_not_optimize(message);
+            },
+            size);
+    }
+    const std::string rdb(4096, '\x42');
+    runner.run(
+        "encode_rdb_file/4096",
+        [&] {
+            auto message = MessageParser::encode_rdb_file(rdb);
+            do_not_optimize(message);
+        },
+        1, rdb.size());
+
+    // Direct-to-buffer encoders, appending to a reply buffer the way commands do
+    std::string reply_buffer;
+    auto clear_sometimes = [&reply_buffer] {
+        if (reply_buffer.size() > 64 * 1024) reply_buffer.clear();
+    };
+    runner.run("append_bulk_string/16", [&, value = std::string(16, 'x')] {
+        MessageParser::append_bulk_string(reply_buffer, value);
+        clear_sometimes();
+    });
+    for (long long num : {7LL, 123456789LL}) {
+        runner.run("append_integer/" + std::to_string(num), [&, num] {
+            MessageParser::append_integer(reply_buffer, num);
+            clear_sometimes();
+        });
+    }
+    runner.run("append_array_header", [&] {
+        MessageParser::append_array_header(reply_buffer, 100);
+        clear_sometimes();
+    });
+
+    Stream stream;
+    for (int i = 0; i < 10; i++) stream.emplace_back("field" + std::to_string(i), "value" + std::to_string(i));
+    runner.run("encode_stream/10", [&] {
+        auto message = MessageParser::encode_stream(stream);
+        do_not_optimize(message);
+    });
+}
+
+void bench_storage(Runner &runner) {
+    for (size_t keyspace : {1000, 100000, 1000000}) {
+        Storage storage;
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < keyspace; i++) {
+            keys.push_back(make_key(i));
+            storage.set(keys.back(), StringValue("value", std::nullopt));
+        }
+
+        // Random order so large keyspaces miss the cache the way real traffic does
+        std::vector<uint32_t> order(1 << 16);
+        std::mt19937 rng(42);
+        for (uint32_t &index : order) index = rng() % keyspace;
+
+        const std::string suffix = "/keys:" + std::to_string(keyspace);
+        size_t next = 0;
+        runner.run("storage_get" + suffix, [&] {
+            auto value = storage.get(keys[order[next++ & 0xffff]]);
+            do_not_optimize(value);
+        });
+        runner.run("storage_find" + suffix, [&] {
+            auto value = storage.find(keys[order[next++ & 0xffff]]);
+            do_not_optimize(value);
+        });
+        runner.run("storage_get_missing" + suffix, [&] {
+            try {
+                auto value = storage.get("missing:key");
+                do_not_optimize(value);
+            } catch (const std::out_of_range &) {
+            }
+        });
+        runner.run("storage_set_overwrite" + suffix, [&] {
+            storage.set(keys[order[next++ & 0xffff]], StringValue("value", std::nullopt));
+        });
+    }
+
+    // Inserting fresh keys includes the cost of growing the table
+    Storage storage;
+    size_t next = 0;
+    runner.run("storage_set_insert", [&] { storage.set(make_key(next++), StringValue("value", std::nullopt)); });
+}
+
+// Threads that each call work once per round, so a round can be timed like a single-threaded operation
+class WorkerThreads {
+   public:
+    WorkerThreads(size_t count, std::function<void(size_t)> work) : start(count + 1), done(count + 1) {
+        for (size_t i = 0; i < count; i++) {
+            this->threads.emplace_back([this, i, work] {
+                while (true) {
+                    this->start.arrive_and_wait();
+                    if (this->stopping) return;
+                    work(i);
+                    this->done.arrive_and_wait();
+                }
+            });
+        }
+    }
+
+    ~WorkerThreads() {
+        this->stopping = true;
+        this->start.arrive_and_wait();
+        for (std::thread &thread : this->threads) thread.join();
+    }
+
+    // Returns once every thread finished its call
+    void run_round() {
+        this->start.arrive_and_wait();
+        this->done.arrive_and_wait();
+    }
+
+   private:
+    std::barrier<> start;
+    std::barrier<> done;
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> threads;
+};
+
+// GETs and SETs from several threads on a shared keyspace: ConcurrentStorage, against Storage behind one mutex. A
+// reader-writer lock would not do for Storage, whose reads remove the expired keys they find.
+void bench_concurrent_storage(Runner &runner) {
+    static constexpr size_t KEYSPACE = 100000;
+    static constexpr size_t OPS_PER_ROUND = 1000;  // per thread
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < KEYSPACE; i++) keys.push_back(make_key(i));
+
+    ConcurrentStorage concurrent;
+    Storage locked;
+    std::mutex lock;
+    for (const std::string &key : keys) {
+        concurrent.set(key, StringValue("value", std::nullopt));
+        locked.set(key, StringValue("value", std::nullopt));
+    }
+
+    for (int read_percent : {95, 50}) {
+        for (size_t threads : {1, 2, 4, 8, 16}) {
+            const std::string suffix =
+                "/reads:" + std::to_string(read_percent) + "%/threads:" + std::to_string(threads);
+
+            // Each thread draws its own keys and mix, the same for both
+            std::vector<std::mt19937> rngs;
+            for (size_t i = 0; i < threads; i++) rngs.emplace_back(i);
+
+            WorkerThreads concurrent_workers(threads, [&](size_t thread) {
+                std::mt19937 &rng = rngs[thread];
+                for (size_t op = 0; op < OPS_PER_ROUND; op++) {
+                    const std::string &key = keys[rng() % KEYSPACE];
+                    if (static_cast<int>(rng() % 100) < read_percent) {
+                        concurrent.read(key, [](const StorageValueVariants &value) { do_not_optimize(value); });
+                    } else {
+                        concurrent.set(key, StringValue("value", std::nullopt));
+                    }
+                }
+            });
+            runner.run(
+                "concurrent_storage" + suffix, [&] { concurrent_workers.run_round(); }, threads * OPS_PER_ROUND);
+
+            WorkerThreads locked_workers(threads, [&](size_t thread) {
+                std::mt19937 &rng = rngs[thread];
+                for (size_t op = 0; op < OPS_PER_ROUND; op++) {
+                    const std::string &key = keys[rng() % KEYSPACE];
+                    const bool is_read = static_cast<int>(rng() % 100) < read_percent;
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (is_read) {
+                        do_not_optimize(locked.find(key));
+                    } else {
+                        locked.set(key, StringValue("value", std::nullopt));
+                    }
+                }
+            });
+            runner.run("locked_storage" + suffix, [&] { locked_workers.run_round(); }, threads * OPS_PER_ROUND);
+        }
+    }
+}
+
+void bench_hash(Runner &runner) {
+    // 10 fields stays packed with the default thresholds, 1000 is converted to a hash table
+    for (size_t fields : {10, 1000}) {
+        Hash hash;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < fields; i++) {
+            names.push_back("field" + std::to_string(i));
+            hash.set(names.back(), "value" + std::to_string(i));
+        }
+
+        const std::string suffix = std::string{hash.is_packed() ? "/packed" : "/hashtable"} + "/fields:" +
+                                   std::to_string(fields);
+        size_t next = 0;
+        runner.run("hash_get" + suffix, [&] {
+            auto value = hash.get(names[next++ % fields]);
+            do_not_optimize(value);
+        });
+        runner.run("hash_set_overwrite" + suffix, [&] { hash.set(names[next++ % fields], "value"); });
+    }
+}
+
+/**
+ * Memory held by hashes small enough to stay packed, against the same data stored as one key per field and against
+ * hashes forced into the hash table encoding. Measured as the allocator's in-use bytes before and after filling.
+ */
+void bench_memory(Runner &runner, size_t hashes) {
+    constexpr size_t fields = 10;
+    auto make_hash_key = [](size_t i) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "user:%010zu", i);
+        return std::string{buf};
+    };
+
+    auto measure_hashes = [&](const std::string &name) {
+        const uint64_t before = Stats::used_memory();
+        {
+            Storage storage;
+            for (size_t i = 0; i < hashes; i++) {
+                Hash hash;
+                for (size_t field = 0; field < fields; field++) {
+                    hash.set("field" + std::to_string(field), "value" + std::to_string(field));
+                }
+                storage.set(make_hash_key(i), HashValue(hash, std::nullopt));
+            }
+            runner.record_memory(name, hashes * fields, Stats::used_memory() - before);
+        }
+    };
+
+    measure_hashes("memory/hashes:" + std::to_string(hashes) + "/fields:10/packed");
+
+    const size_t max_listpack_entries = Hash::max_listpack_entries;
+    Hash::max_listpack_entries = 0;
+    measure_hashes("memory/hashes:" + std::to_string(hashes) + "/fields:10/hashtable");
+    Hash::max_listpack_entries = max_listpack_entries;
+
+    const uint64_t before = Stats::used_memory();
+    Storage storage;
+    for (size_t i = 0; i < hashes; i++) {
+        const std::string hash_key = make_hash_key(i);
+        for (size_t field = 0; field < fields; field++) {
+            storage.set(hash_key + ":field" + std::to_string(field),
+                        StringValue("value" + std::to_string(field), std::nullopt));
+        }
+    }
+    runner.record_memory("memory/flat_keys:" + std::to_string(hashes * fields), hashes * fields,
+                         Stats::used_memory() - before);
+}
+
+void bench_sorted_set(Runner &runner) {
+    // 100 members stays packed with the default thresholds
+    for (size_t members : {100, 1000000}) {
+        SortedSet set;
+        std::vector<std::string> names;
+        std::mt19937 rng(42);
+        for (size_t i = 0; i < members; i++) {
+            names.push_back("member:" + std::to_string(i));
+            set.add(names.back(), rng() % 1000000);
+        }
+
+        const std::string suffix = std::string{set.is_packed() ? "/packed" : "/btree"} + "/members:" +
+                                   std::to_string(members);
+        size_t next = 0;
+        runner.run("zset_add_update" + suffix, [&] { set.add(names[rng() % members], rng() % 1000000); });
+        runner.run("zset_remove_add" + suffix, [&] {
+            // Removes a member and adds it back, so the set keeps its size
+            const std::string &name = names[rng() % members];
+            const double score = *set.score(name);
+            set.erase(name);
+            set.add(name, score);
+        });
+        runner.run("zset_score" + suffix, [&] {
+            auto score = set.score(names[next++ % members]);
+            do_not_optimize(score);
+        });
+        runner.run("zset_rank" + suffix, [&] {
+            auto rank = set.rank(names[rng() % members]);
+            do_not_optimize(rank);
+        });
+        runner.run(
+            "zset_range/count:10" + suffix,
+            [&] {
+                const size_t start = rng() % (members - 10);
+                set.for_range(start, start + 10, [](std::string_view member, double score) {
+                    do_not_optimize(member);
+                    do_not_optimize(score);
+                });
+            },
+            10);
+        runner.run("zset_range_by_score" + suffix, [&] {
+            const double min = rng() % 1000000;
+            const size_t start = set.count_below(min, false);
+            set.for_range(start, start + 10, [](std::string_view member, double score) {
+                do_not_optimize(member);
+                do_not_optimize(score);
+            });
+        });
+    }
+}
+
+void bench_pubsub(Runner &runner) {
+    // Subscribers are never sent anything, their output queues are dropped after every publish instead
+    for (size_t subscribers : {10, 10000}) {
+        ServerInfo server_info{};
+        PubSub::attach(server_info);
+        for (size_t i = 0; i < subscribers; i++) {
+            const int client_socket = 1000 + i;
+            server_info.clients[client_socket].id = i + 1;
+            PubSub::subscribe(client_socket, "invalidate");
+        }
+
+        const std::string message(1024, 'm');
+        runner.run(
+            "pubsub_publish/bytes:1024/subscribers:" + std::to_string(subscribers),
+            [&] {
+                const size_t receivers = PubSub::publish("invalidate", message);
+                do_not_optimize(receivers);
+                for (auto &[client_socket, client] : server_info.clients) {
+                    client.output.clear();
+                    client.output_bytes = 0;
+                }
+                server_info.pending_writes.clear();
+            },
+            subscribers);
+
+        for (size_t i = 0; i < subscribers; i++) {
+            PubSub::remove_client(1000 + i);
+        }
+    }
+}
+
+void bench_dispatch(Runner &runner) {
+    const std::vector<std::pair<std::string, DecodedMessage>> commands = {
+        {"ping", {"PING"}},
+        {"echo", {"ECHO", "hello"}},
+        {"get", {"GET", "key:000000000001"}},
+        {"set", {"SET", "key:000000000001", "value"}},
+        {"set_px", {"SET", "key:000000000001", "value", "PX", "1000"}},
+        {"mget", {"MGET", "k1", "k2", "k3", "k4", "k5", "k6", "k7", "k8", "k9", "k10"}},
+        {"xadd", {"XADD", "stream", "1-1", "field", "value"}},
+        {"hset", {"HSET", "hash", "field", "value"}},
+        {"zadd", {"ZADD", "zset", "1.5", "member"}},
+        {"config_get", {"CONFIG", "GET", "dir"}},
+        {"info", {"INFO", "stats"}},
+    };
+    for (const auto &[name, decoded] : commands) {
+        runner.run("command_parse/" + name, [&] {
+            CommandPtr command = Command::parse(decoded);
+            do_not_optimize(command);
+        });
+    }
+}
+
+// Writes an RDB file holding count string keys, half of them with a millisecond expiry far in the future
+std::string write_rdb(size_t count) {
+    std::string data = "REDIS0011";
+    data += "\xfa\x09redis-ver\x05" "7.2.0";
+    data += "\xfe";
+    data.push_back('\0');
+    data += "\xfb";
+    data.push_back(static_cast<char>(count));
+    data.push_back(static_cast<char>(count / 2));
+    for (size_t i = 0; i < count; i++) {
+        if (i % 2 == 0) {
+            data += "\xfc";
+            const uint64_t expiry_ms = 4102444800000ULL;  // 2100-01-01
+            for (int byte = 0; byte < 8; byte++) data.push_back(static_cast<char>(expiry_ms >> (8 * byte)));
+        }
+        data.push_back('\0');
+        const std::string key = make_key(i), value = "value:" + std::to_string(i);
+        data.push_back(static_cast<char>(key.size()));
+        data += key;
+        data.push_back(static_cast<char>(value.size()));
+        data += value;
+    }
+    data += "\xff";
+    data.append(8, '\0');
+
+    const std::string path = "/tmp/sider-bench-" + std::to_string(getpid()) + "-" + std::to_string(count) + ".rdb";
+    std::ofstream(path, std::ios::binary) << data;
+    return path;
+}
+
+void bench_rdb(Runner &runner) {
+    // The format only stores one byte table sizes, so 255 keys is the largest dump it can describe
+    for (size_t count : {10, 255}) {
+        const std::string path = write_rdb(count);
+        runner.run(
+            "parse_rdb/keys:" + std::to_string(count),
+            [&] {
+                StoragePtr storage = RDBParser::parse_rdb(path);
+                do_not_optimize(storage);
+            },
+            count);
+        unlink(path.c_str());
+    }
+}
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument(arg + " requires an argument");
+        }
+        if (arg == "--filter") {
+            options.filter = argv[++i];
+        } else if (arg == "--min-time-ms") {
+            options.min_time_ms = std::stod(argv[++i]);
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--out") {
+            options.out = argv[++i];
+        } else if (arg == "--memory-hashes") {
+            options.memory_hashes = std::stoull(argv[++i]);
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    return options;
+}
+
+}  // namespace
+
+void bench_list(Runner &runner) {
+    // A job queue: producers push on one end and consumers pop from the other, so the list keeps its length
+    for (size_t length : {10, 100000}) {
+        QuickList list;
+        for (size_t i = 0; i < length; i++) {
+            list.push_back("job:" + std::to_string(i));
+        }
+
+        const std::string suffix = "/length:" + std::to_string(length);
+        size_t next = 0;
+        runner.run("list_push_pop" + suffix, [&] {
+            list.push_back("job:" + std::to_string(next++));
+            auto job = list.pop_front();
+            do_not_optimize(job);
+        });
+        runner.run(
+            "list_range/count:10" + suffix,
+            [&] {
+                const size_t start = (length - 10) / 2;
+                list.for_range(start, start + 10, [](std::string_view element) { do_not_optimize(element); });
+            },
+            10);
+    }
+}
+
+int main(int argc, char **argv) {
+    try {
+        const Options options = parse_options(argc, argv);
+        Logger::log_level = Logger::Level::SILENT;
+
+        Runner runner(options);
+        bench_parser(runner);
+        bench_encoders(runner);
+        bench_storage(runner);
+        bench_concurrent_storage(runner);
+        bench_hash(runner);
+        bench_sorted_set(runner);
+        bench_list(runner);
+        bench_pubsub(runner);
+        bench_dispatch(runner);
+        bench_rdb(runner);
+        if (options.memory_hashes > 0) {
+            bench_memory(runner, options.memory_hashes);
+        }
+
+        if (options.out.empty()) {
+            runner.write_json(std::cout);
+        } else {
+            std::ofstream out(options.out);
+            runner.write_json(out);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "bench: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include "concurrent_storage.h"
+
+ConcurrentStorage::Table::~Table() {
+    for (std::atomic<Node *> &bucket : this->buckets) {
+        Node *node = bucket.load(std::memory_order_relaxed);
+        while (node != nullptr) {
+            Node *next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+}
+
+ConcurrentStorage::ConcurrentStorage() {
+    for (Segment &segment : this->segments) {
+        segment.table.store(new Table(INITIAL_BUCKETS), std::memory_order_relaxed);
+    }
+}
+
+ConcurrentStorage::~ConcurrentStorage() {
+    for (Segment &segment : this->segments) {
+        delete segment.table.load(std::memory_order_relaxed);
+    }
+}
+
+bool ConcurrentStorage::is_expired(const StorageValueVariants &value) {
+    return std::visit(
+        [](const auto &v) -> bool {
+            const auto &expiry = v.get_expiry();
+            return expiry.has_value() && std::chrono::system_clock::now() >= expiry.value();
+        },
+        value);
+}
+
+const ConcurrentStorage::Node *ConcurrentStorage::find_node(std::string_view key, size_t hash) {
+    Table *table = segment(hash).table.load(std::memory_order_acquire);
+    for (const Node *node = table->bucket(hash).load(std::memory_order_acquire); node != nullptr;
+         node = node->next.load(std::memory_order_acquire)) {
+        if (node->hash == hash && node->key == key) {
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<StorageValueVariants> ConcurrentStorage::get(std::string_view key) {
+    std::optional<StorageValueVariants> value;
+    read(key, [&value](const StorageValueVariants &found) { value = found; });
+    return value;
+}
+
+void ConcurrentStorage::set(std::string_view key, StorageValueVariants &&value) {
+    const size_t hash = hash_key(key);
+    Segment &segment = this->segment(hash);
+    std::lock_guard<std::mutex> lock(segment.lock);
+
+    Table *table = segment.table.load(std::memory_order_relaxed);
+    std::atomic<Node *> &bucket = table->bucket(hash);
+    auto shared_value = std::make_shared<const StorageValueVariants>(std::move(value));
+    Node *replacement = new Node{std::string{key}, hash, std::move(shared_value)};
+
+    // Readers see either the old node or its replacement, both whole, never one being written
+    Node *prev = nullptr;
+    for (Node *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+         prev = node, node = node->next.load(std::memory_order_relaxed)) {
+        if (node->hash != hash || node->key != key) continue;
+
+        replacement->next.store(node->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        (prev != nullptr ? prev->next : bucket).store(replacement, std::memory_order_release);
+        Epoch::retire(node);
+        return;
+    }
+
+    replacement->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    bucket.store(replacement, std::memory_order_release);
+    const size_t size = segment.size.load(std::memory_order_relaxed) + 1;
+    segment.size.store(size, std::memory_order_relaxed);
+    if (size > table->buckets.size() * MAX_LOAD_FACTOR) {
+        grow(segment);
+    }
+}
+
+bool ConcurrentStorage::erase(std::string_view key) {
+    const size_t hash = hash_key(key);
+    Segment &segment = this->segment(hash);
+    std::lock_guard<std::mutex> lock(segment.lock);
+
+    std::atomic<Node *> &bucket = segment.table.load(std::memory_order_relaxed)->bucket(hash);
+    Node *prev = nullptr;
+    for (Node *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+         prev = node, node = node->next.load(std::memory_order_relaxed)) {
+        if (node->hash != hash || node->key != key) continue;
+
+        const bool expired = is_expired(*node->value);
+        if (expired) {
+            Stats::local().expired_keys.add();
+        }
+        unlink(segment, bucket, prev, node);
+        return !expired;
+    }
+    return false;
+}
+
+void ConcurrentStorage::expire(std::string_view key, size_t hash) {
+    Segment &segment = this->segment(hash);
+    std::lock_guard<std::mutex> lock(segment.lock);
+
+    std::atomic<Node *> &bucket = segment.table.load(std::memory_order_relaxed)->bucket(hash);
+    Node *prev = nullptr;
+    for (Node *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+         prev = node, node = node->next.load(std::memory_order_relaxed)) {
+        if (node->hash != hash || node->key != key) continue;
+
+        // Set again since the reader saw it expire
+        if (is_expired(*node->value)) {
+            Stats::local().expired_keys.add();
+            unlink(segment, bucket, prev, node);
+        }
+        return;
+    }
+}
+
+void ConcurrentStorage::unlink(Segment &segment, std::atomic<Node *> &bucket, Node *prev, Node *node) {
+    // A reader on node still finds the rest of the bucket through its next, which is left as it is
+    Node *next = node->next.load(std::memory_order_relaxed);
+    (prev != nullptr ? prev->next : bucket).store(next, std::memory_order_release);
+    segment.size.store(segment.size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    Epoch::retire(node);
+}
+
+void ConcurrentStorage::grow(Segment &segment) {
+    // Readers may be walking the old table, so its nodes are copied rather than moved. The copies share the values.
+    Table *old_table = segment.table.load(std::memory_order_relaxed);
+    Table *table = new Table(old_table->buckets.size() * 2);
+    for (std::atomic<Node *> &old_bucket : old_table->buckets) {
+        for (Node *node = old_bucket.load(std::memory_order_relaxed); node != nullptr;
+             node = node->next.load(std::memory_order_relaxed)) {
+            std::atomic<Node *> &bucket = table->bucket(node->hash);
+            Node *copy = new Node{node->key, node->hash, node->value};
+            copy->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(copy, std::memory_order_relaxed);
+        }
+    }
+    segment.table.store(table, std::memory_order_release);
+    Epoch::retire(old_table);
+}
+
+size_t ConcurrentStorage::size() const {
+    size_t size = 0;
+    for (const Segment &segment : this->segments) {
+        size += segment.size.load(std::memory_order_relaxed);
+    }
+    return size;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "../src/stats.h"
+#include "../src/storage.h"
+#include "epoch.h"
+
+/*
+    Prototype of a keyspace that several threads can use at once, as an alternative to sharding it by thread. Only
+    the benchmarks use it, to compare it with a Storage behind one mutex.
+
+    Keys are spread over SEGMENTS segments, each a chained hash table with its own lock, so writers only contend with
+    writers of keys in the same segment. Readers take no lock at all: nodes are never changed once they are linked,
+    a write links a new node in place of the old one, and what it unlinks is handed to Epoch, which deletes it once
+    no reader can still be on it. A segment grows by building a new table next to the old one, so readers of the old
+    table are never disturbed either.
+
+    A read that finds an expired key does not remove it itself, it leaves that to expire, which takes the segment's
+    lock and checks again, since a writer may have replaced the key meanwhile.
+
+    Values are shared between a node and the copy of it that a grown table holds, and never modified in place. This
+    is unlike Storage, whose find_mutable lets commands change a value where it is, which is why the server keeps
+    using Storage, one per shard.
+*/
+class ConcurrentStorage {
+   public:
+    ConcurrentStorage();
+    ~ConcurrentStorage();
+
+    ConcurrentStorage(const ConcurrentStorage &) = delete;
+    ConcurrentStorage &operator=(const ConcurrentStorage &) = delete;
+
+    // A copy of the value, nullopt for missing and expired keys
+    std::optional<StorageValueVariants> get(std::string_view key);
+
+    // Calls read with the value, without copying it. Returns false for missing and expired keys. The reference is
+    // only valid during the call.
+    template <typename Fn>
+    bool read(std::string_view key, Fn &&read) {
+        const size_t hash = hash_key(key);
+        bool expired = false;
+        {
+            Epoch::Guard guard;
+            const Node *node = find_node(key, hash);
+            if (node != nullptr && !(expired = is_expired(*node->value))) {
+                Stats::local().keyspace_hits.add();
+                read(*node->value);
+                return true;
+            }
+        }
+        Stats::local().keyspace_misses.add();
+        if (expired) {
+            expire(key, hash);
+        }
+        return false;
+    }
+
+    void set(std::string_view key, StorageValueVariants &&value);
+
+    // Returns true if an unexpired key was removed
+    bool erase(std::string_view key);
+
+    // Number of keys, including expired ones that have not been removed yet
+    size_t size() const;
+
+   private:
+    static constexpr size_t SEGMENTS = 64;  // a power of two
+    static constexpr size_t INITIAL_BUCKETS = 16;
+    static constexpr size_t MAX_LOAD_FACTOR = 1;
+
+    struct Node {
+        std::string key;
+        size_t hash;
+        std::shared_ptr<const StorageValueVariants> value;
+        std::atomic<Node *> next{nullptr};
+    };
+
+    struct Table {
+        explicit Table(size_t bucket_count) : buckets(bucket_count) {}
+
+        // Deletes the nodes still linked into it
+        ~Table();
+
+        std::vector<std::atomic<Node *>> buckets;  // a power of two of them
+
+        std::atomic<Node *> &bucket(size_t hash) {
+            return this->buckets[hash & (this->buckets.size() - 1)];
+        }
+    };
+
+    // On its own cache line, so that writers of different segments never share one
+    struct alignas(64) Segment {
+        std::mutex lock;  // taken by writers only
+        std::atomic<Table *> table{nullptr};
+        std::atomic<size_t> size{0};
+    };
+
+    std::array<Segment, SEGMENTS> segments;
+
+    static size_t hash_key(std::string_view key) {
+        return StoreKeyHash{}(key);
+    }
+
+    // Segments are picked by the high bits of the hash, buckets within them by the low bits
+    Segment &segment(size_t hash) {
+        return this->segments[(hash >> 48) & (SEGMENTS - 1)];
+    }
+
+    static bool is_expired(const StorageValueVariants &value);
+
+    // Caller holds an Epoch::Guard
+    const Node *find_node(std::string_view key, size_t hash);
+
+    // Removes key if it is still expired
+    void expire(std::string_view key, size_t hash);
+
+    // Caller holds segment's lock. Unlinks node, whose predecessor in its bucket is prev (nullptr for the first).
+    void unlink(Segment &segment, std::atomic<Node *> &bucket, Node *prev, Node *node);
+
+    // Caller holds segment's lock
+    void grow(Segment &segment);
+};
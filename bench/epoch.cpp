@@ -0,0 +1,100 @@
+#include "epoch.h"
+
+#include <memory>
+#include <mutex>
+
+std::atomic<uint64_t> Epoch::global_epoch{0};
+
+namespace {
+
+std::mutex registry_mutex;
+
+}  // namespace
+
+// Every thread's state is registered, like the Stats counters, so that the others can see its epoch. It outlives the
+// thread: what it retired but could not delete yet is deleted by the next thread that advances the epoch.
+std::vector<std::shared_ptr<Epoch::ThreadState>> &Epoch::registry() {
+    static std::vector<std::shared_ptr<ThreadState>> states;
+    return states;
+}
+
+Epoch::ThreadState &Epoch::local() {
+    struct Registration {
+        std::shared_ptr<ThreadState> state = std::make_shared<ThreadState>();
+
+        Registration() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            registry().push_back(this->state);
+        }
+
+        ~Registration() {
+            this->state->exited.store(true, std::memory_order_release);
+        }
+    };
+    thread_local Registration registration;
+    return *registration.state;
+}
+
+Epoch::Guard::Guard() {
+    ThreadState &state = Epoch::local();
+    if (state.depth++ > 0) return;
+
+    // Announced before anything is read, and checked again: the epoch loaded may have moved on before the store
+    // became visible to the others
+    uint64_t epoch = Epoch::global_epoch.load(std::memory_order_seq_cst);
+    while (true) {
+        state.epoch.store(epoch, std::memory_order_seq_cst);
+        const uint64_t current = Epoch::global_epoch.load(std::memory_order_seq_cst);
+        if (current == epoch) break;
+        epoch = current;
+    }
+}
+
+Epoch::Guard::~Guard() {
+    ThreadState &state = Epoch::local();
+    if (--state.depth > 0) return;
+    state.epoch.store(IDLE, std::memory_order_release);
+}
+
+void Epoch::retire(void *object, void (*deleter)(void *)) {
+    ThreadState &state = local();
+    state.limbo.push_back({object, deleter, Epoch::global_epoch.load(std::memory_order_seq_cst)});
+    if (state.limbo.size() % RETIRES_PER_COLLECT == 0) {
+        collect();
+    }
+}
+
+void Epoch::collect() {
+    try_advance();
+    free_before(local().limbo, Epoch::global_epoch.load(std::memory_order_acquire));
+}
+
+void Epoch::try_advance() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const uint64_t epoch = Epoch::global_epoch.load(std::memory_order_seq_cst);
+    for (const auto &state : registry()) {
+        const uint64_t seen = state->epoch.load(std::memory_order_seq_cst);
+        if (seen != IDLE && seen != epoch) return;
+    }
+    Epoch::global_epoch.store(epoch + 1, std::memory_order_seq_cst);
+
+    // Threads that exited never collect again
+    for (auto it = registry().begin(); it != registry().end();) {
+        if (!(*it)->exited.load(std::memory_order_acquire)) {
+            ++it;
+            continue;
+        }
+        free_before((*it)->limbo, epoch + 1);
+        it = (*it)->limbo.empty() ? registry().erase(it) : it + 1;
+    }
+}
+
+void Epoch::free_before(std::vector<Retired> &limbo, uint64_t epoch) {
+    // Retired in epoch e, it was unlinked before any reader of epoch e + 1 started
+    size_t freed = 0;
+    while (freed < limbo.size() && limbo[freed].epoch + 2 <= epoch) {
+        limbo[freed].deleter(limbo[freed].object);
+        freed++;
+    }
+    limbo.erase(limbo.begin(), limbo.begin() + freed);
+}
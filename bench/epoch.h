@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+    Epoch-based reclamation, for data structures whose readers take no lock.
+
+    A reader holds an Epoch::Guard while it follows pointers into the structure. A writer that unlinks memory readers
+    may still be looking at hands it to retire instead of deleting it, and it is deleted once every thread that was
+    inside a guard at the time has left it. Readers only ever write their own cache line, on entering and leaving.
+
+    The global epoch only moves on when every thread inside a guard has seen the current one, so memory retired in
+    epoch e is safe to delete once the global epoch reached e + 2. Each thread keeps what it retired in its own list
+    and checks it every RETIRES_PER_COLLECT retires.
+*/
+class Epoch {
+   public:
+    // Marks the calling thread as reading, guards nest
+    class Guard {
+       public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    };
+
+    template <typename T>
+    static void retire(T *object) {
+        retire(object, [](void *p) { delete static_cast<T *>(p); });
+    }
+
+    static void retire(void *object, void (*deleter)(void *));
+
+    // Deletes what the calling thread retired and no reader can see anymore
+    static void collect();
+
+   private:
+    static constexpr uint64_t IDLE = UINT64_MAX;  // the epoch of a thread outside any guard
+    static constexpr size_t RETIRES_PER_COLLECT = 64;
+
+    struct Retired {
+        void *object;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    struct alignas(64) ThreadState {
+        std::atomic<uint64_t> epoch{IDLE};
+        int depth = 0;               // nested guards
+        std::vector<Retired> limbo;  // in the order retired, so by epoch
+        std::atomic<bool> exited{false};
+    };
+
+    static std::atomic<uint64_t> global_epoch;
+
+    static std::vector<std::shared_ptr<ThreadState>> &registry();
+    static ThreadState &local();
+
+    // Moves the global epoch on if every thread inside a guard has seen it
+    static void try_advance();
+
+    // Deletes the entries of limbo no reader can see once the global epoch is epoch
+    static void free_before(std::vector<Retired> &limbo, uint64_t epoch);
+};
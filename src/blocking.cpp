@@ -0,0 +1,146 @@
+#include "blocking.h"
+
+#include <algorithm>
+
+#include "commands.h"
+#include "message_parser.h"
+#include "server.h"
+
+thread_local ServerInfo *Blocking::server_info = nullptr;
+thread_local std::unordered_map<int, Blocking::BlockedClient> Blocking::clients;
+thread_local std::unordered_map<std::string, std::deque<int>, StoreKeyHash, std::equal_to<>> Blocking::waiters;
+thread_local std::vector<std::string> Blocking::ready_keys;
+thread_local std::set<std::pair<std::chrono::steady_clock::time_point, int>> Blocking::deadlines;
+thread_local std::vector<int> Blocking::unblocked;
+
+void Blocking::attach(ServerInfo &server_info) {
+    Blocking::server_info = &server_info;
+}
+
+void Blocking::block(int client_socket, std::vector<std::string> &&keys, Side side, Deadline deadline) {
+    for (const std::string &key : keys) {
+        std::deque<int> &queue = Blocking::waiters[key];
+        // BLPOP k k waits once
+        if (std::find(queue.begin(), queue.end(), client_socket) == queue.end()) {
+            queue.push_back(client_socket);
+        }
+    }
+    if (deadline.has_value()) {
+        Blocking::deadlines.emplace(*deadline, client_socket);
+    }
+    Blocking::clients[client_socket] = {std::move(keys), side, deadline};
+}
+
+bool Blocking::is_blocked(int client_socket) {
+    return !Blocking::clients.empty() && Blocking::clients.contains(client_socket);
+}
+
+void Blocking::signal_key(std::string_view key) {
+    if (Blocking::waiters.find(key) != Blocking::waiters.end()) {
+        Blocking::ready_keys.emplace_back(key);
+    }
+}
+
+void Blocking::serve_ready_keys(Storage &storage) {
+    // Serving never pushes, so no key becomes ready while this runs
+    std::vector<std::string> keys;
+    keys.swap(Blocking::ready_keys);
+
+    for (const std::string &key : keys) {
+        StorageValueVariants *val = storage.find_mutable(key);
+        ListValue *list_value = val != nullptr ? std::get_if<ListValue>(val) : nullptr;
+        if (list_value == nullptr) continue;
+
+        QuickList &list = list_value->get_value_ref();
+        bool popped = false;
+        for (auto it = Blocking::waiters.find(key); it != Blocking::waiters.end() && list.size() > 0;
+             it = Blocking::waiters.find(key)) {
+            const int client_socket = it->second.front();
+            const bool left = Blocking::clients[client_socket].side == Side::Left;
+            const std::string element = left ? *list.pop_front() : *list.pop_back();
+            popped = true;
+
+            reply(client_socket, key, element);
+            propagate_command(MessageParser::encode_array({left ? "LPOP" : "RPOP", key}), *Blocking::server_info);
+            unblock(client_socket);
+        }
+
+        if (!popped) continue;
+        // Empty lists do not exist, like in Redis
+        if (list.size() == 0) {
+            storage.erase(key);
+        } else {
+            storage.modified(key);
+        }
+    }
+}
+
+void Blocking::expire_timeouts() {
+    const auto now = std::chrono::steady_clock::now();
+    while (!Blocking::deadlines.empty() && Blocking::deadlines.begin()->first <= now) {
+        const int client_socket = Blocking::deadlines.begin()->second;
+
+        auto it = Blocking::server_info->clients.find(client_socket);
+        if (it != Blocking::server_info->clients.end()) {
+            it->second.reply_buffer.append(SharedReplies::null_array);
+            Blocking::server_info->pending_writes.insert(client_socket);
+        }
+        unblock(client_socket);
+    }
+}
+
+std::optional<std::chrono::milliseconds> Blocking::until_next_timeout() {
+    if (Blocking::deadlines.empty()) return std::nullopt;
+
+    // Rounded up, so the event loop does not wake up just before the deadline and spin
+    const auto left = Blocking::deadlines.begin()->first - std::chrono::steady_clock::now();
+    return std::max(std::chrono::ceil<std::chrono::milliseconds>(left), std::chrono::milliseconds(0));
+}
+
+std::vector<int> Blocking::take_unblocked() {
+    std::vector<int> res;
+    res.swap(Blocking::unblocked);
+    return res;
+}
+
+void Blocking::remove_client(int client_socket) {
+    unblock(client_socket);
+
+    // Nothing is left to execute for a client that is gone
+    std::erase(Blocking::unblocked, client_socket);
+}
+
+size_t Blocking::get_blocked_count() {
+    return Blocking::clients.size();
+}
+
+void Blocking::unblock(int client_socket) {
+    auto it = Blocking::clients.find(client_socket);
+    if (it == Blocking::clients.end()) return;
+
+    for (const std::string &key : it->second.keys) {
+        auto waiters_it = Blocking::waiters.find(key);
+        if (waiters_it == Blocking::waiters.end()) continue;
+
+        std::erase(waiters_it->second, client_socket);
+        if (waiters_it->second.empty()) {
+            Blocking::waiters.erase(waiters_it);
+        }
+    }
+    if (it->second.deadline.has_value()) {
+        Blocking::deadlines.erase({*it->second.deadline, client_socket});
+    }
+    Blocking::clients.erase(it);
+    Blocking::unblocked.push_back(client_socket);
+}
+
+void Blocking::reply(int client_socket, std::string_view key, std::string_view element) {
+    auto it = Blocking::server_info->clients.find(client_socket);
+    if (it == Blocking::server_info->clients.end()) return;
+
+    std::string &out = it->second.reply_buffer;
+    MessageParser::append_array_header(out, 2);
+    MessageParser::append_bulk_string(out, key);
+    MessageParser::append_bulk_string(out, element);
+    Blocking::server_info->pending_writes.insert(client_socket);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "storage.h"
+
+struct ServerInfo;
+
+/*
+    Clients parked by BLPOP and BRPOP.
+
+    Each key has a queue of the clients waiting on it, oldest first. A push to a key with waiters marks it ready, and
+    right after the pushing command the ready keys' elements are handed to their waiters in queue order, as if each
+    had run LPOP or RPOP itself (which is also what replicas are sent). Nothing polls: a parked client costs nothing
+    until its key is pushed to or its timeout passes.
+
+    A blocked client's input keeps being read but is not executed until it is unblocked, so its commands still run
+    in order. Everything here runs on the event loop thread.
+*/
+class Blocking {
+   public:
+    enum class Side { Left, Right };
+
+    using Deadline = std::optional<std::chrono::steady_clock::time_point>;
+
+    // Where clients and their reply buffers live, set once by the server
+    static void attach(ServerInfo &server_info);
+
+    // Parks the client until one of keys has an element for it, or deadline passes (none for no timeout)
+    static void block(int client_socket, std::vector<std::string> &&keys, Side side, Deadline deadline);
+
+    static bool is_blocked(int client_socket);
+
+    // Called after a push to key. Cheap when nobody waits on it.
+    static void signal_key(std::string_view key);
+
+    static bool has_ready_keys() {
+        return !Blocking::ready_keys.empty();
+    }
+
+    // Hands the elements of the keys signalled since the last call to their waiters
+    static void serve_ready_keys(Storage &storage);
+
+    // Sends a null reply to the clients whose deadline has passed and unblocks them
+    static void expire_timeouts();
+
+    // Time left until the earliest deadline, so the event loop can wake up for it
+    static std::optional<std::chrono::milliseconds> until_next_timeout();
+
+    // Clients unblocked since the last call, whose buffered input can be executed again
+    static std::vector<int> take_unblocked();
+
+    // Called when a client disconnects
+    static void remove_client(int client_socket);
+
+    static size_t get_blocked_count();
+
+   private:
+    struct BlockedClient {
+        std::vector<std::string> keys;
+        Side side;
+        Deadline deadline;
+    };
+
+    // Per thread, each shard of --shards blocks its own clients on its own keys
+    static thread_local ServerInfo *server_info;
+    static thread_local std::unordered_map<int, BlockedClient> clients;
+    static thread_local std::unordered_map<std::string, std::deque<int>, StoreKeyHash, std::equal_to<>> waiters;
+    static thread_local std::vector<std::string> ready_keys;
+    static thread_local std::set<std::pair<std::chrono::steady_clock::time_point, int>> deadlines;
+    static thread_local std::vector<int> unblocked;
+
+    static void unblock(int client_socket);
+
+    // Queues the [key, element] reply of a served client for the event loop to send
+    static void reply(int client_socket, std::string_view key, std::string_view element);
+};
@@ -0,0 +1,384 @@
+#include "cluster.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <sstream>
+
+#include "message_parser.h"
+#include "server.h"
+#include "storage_commands.h"
+
+std::vector<Cluster::Node> Cluster::nodes;
+std::vector<int> Cluster::owners;
+std::vector<int> Cluster::migrating_to;
+std::vector<int> Cluster::importing_from;
+
+namespace {
+
+// CRC16-CCITT (XMODEM), the one Redis Cluster hashes keys with
+constexpr std::array<uint16_t, 256> CRC16_TABLE = [] {
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint16_t crc16(std::string_view data) {
+    uint16_t crc = 0;
+    for (const unsigned char c : data) {
+        crc = (crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ c) & 0xff];
+    }
+    return crc;
+}
+
+// Where the RESP reply starting at pos ends, npos if it has not been received whole yet
+size_t reply_end(std::string_view buffer, size_t pos) {
+    if (pos >= buffer.size()) return std::string_view::npos;
+    const size_t line_end = buffer.find("\r\n", pos);
+    if (line_end == std::string_view::npos) return std::string_view::npos;
+
+    const char type = buffer[pos];
+    if (type != '$' && type != '*') {
+        return line_end + 2;
+    }
+
+    long long size = 0;
+    std::from_chars(buffer.data() + pos + 1, buffer.data() + line_end, size);
+    if (size < 0) {
+        return line_end + 2;  // null
+    }
+    if (type == '$') {
+        const size_t end = line_end + 2 + size + 2;
+        return end <= buffer.size() ? end : std::string_view::npos;
+    }
+
+    size_t end = line_end + 2;
+    for (long long i = 0; i < size && end != std::string_view::npos; i++) {
+        end = reply_end(buffer, end);
+    }
+    return end;
+}
+
+}  // namespace
+
+void Cluster::attach(std::string_view announce_ip, int port) {
+    Cluster::nodes = {{generate_replid(), std::string{announce_ip}, port}};
+    Cluster::owners.assign(SLOTS, NO_NODE);
+    Cluster::migrating_to.assign(SLOTS, NO_NODE);
+    Cluster::importing_from.assign(SLOTS, NO_NODE);
+}
+
+int Cluster::key_hash_slot(std::string_view key) {
+    // Only the hash tag is hashed, if there is a non-empty one
+    const size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        const size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close != open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+    return crc16(key) & (SLOTS - 1);
+}
+
+std::string Cluster::redirect(const Command &cmd, Client &client, Storage &storage) {
+    const bool asking = std::exchange(client.asking, false);
+
+    const StorageCommand *storage_cmd = dynamic_cast<const StorageCommand *>(&cmd);
+    if (storage_cmd == nullptr) {
+        return {};
+    }
+    const std::vector<std::string_view> keys = storage_cmd->get_keys();
+    if (keys.empty()) {
+        return {};
+    }
+
+    const int slot = key_hash_slot(keys[0]);
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (key_hash_slot(keys[i]) != slot) {
+            return "CROSSSLOT Keys in request don't hash to the same slot";
+        }
+    }
+
+    const int owner = Cluster::owners[slot];
+    if (owner == MYSELF) {
+        // Keys that are not here anymore may already have been migrated, or are to be created on the target. MIGRATE
+        // answers NOKEY itself.
+        const int target = Cluster::migrating_to[slot];
+        if (target != NO_NODE && cmd.get_type() != CommandType::Migrate &&
+            std::any_of(keys.begin(), keys.end(), [&](std::string_view key) { return !storage.check_validity(key); })) {
+            return "ASK " + std::to_string(slot) + " " + address(target);
+        }
+        return {};
+    }
+
+    if (asking && Cluster::importing_from[slot] != NO_NODE) {
+        return {};
+    }
+    if (owner == NO_NODE) {
+        return "CLUSTERDOWN Hash slot not served";
+    }
+    return "MOVED " + std::to_string(slot) + " " + address(owner);
+}
+
+const std::vector<Cluster::Node> &Cluster::get_nodes() {
+    return Cluster::nodes;
+}
+
+int Cluster::find_node(std::string_view id) {
+    for (size_t i = 0; i < Cluster::nodes.size(); i++) {
+        if (Cluster::nodes[i].id == id) return i;
+    }
+    return NO_NODE;
+}
+
+std::vector<std::pair<int, int>> Cluster::slot_ranges(int node) {
+    std::vector<std::pair<int, int>> ranges;
+    for (int slot = 0; slot < SLOTS; slot++) {
+        if (Cluster::owners[slot] != node) continue;
+        if (!ranges.empty() && ranges.back().second == slot - 1) {
+            ranges.back().second = slot;
+        } else {
+            ranges.emplace_back(slot, slot);
+        }
+    }
+    return ranges;
+}
+
+// <id> <ip:port@cport> <flags> <master> <ping-sent> <pong-recv> <config-epoch> <link-state> <slot> <slot> ...
+std::string Cluster::describe_nodes() {
+    std::ostringstream out;
+    for (size_t i = 0; i < Cluster::nodes.size(); i++) {
+        const Node &node = Cluster::nodes[i];
+        out << node.id << " " << node.ip << ":" << node.port << "@" << node.port + 10000 << " "
+            << (i == MYSELF ? "myself,master" : "master") << " - 0 0 0 connected";
+        for (const auto &[first, last] : slot_ranges(i)) {
+            out << " " << first;
+            if (last != first) out << "-" << last;
+        }
+        if (i == MYSELF) {
+            for (int slot = 0; slot < SLOTS; slot++) {
+                if (Cluster::migrating_to[slot] != NO_NODE) {
+                    out << " [" << slot << "->-" << Cluster::nodes[Cluster::migrating_to[slot]].id << "]";
+                }
+                if (Cluster::importing_from[slot] != NO_NODE) {
+                    out << " [" << slot << "-<-" << Cluster::nodes[Cluster::importing_from[slot]].id << "]";
+                }
+            }
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+std::string Cluster::describe_info() {
+    const size_t assigned = std::count_if(Cluster::owners.begin(), Cluster::owners.end(),
+                                          [](int owner) { return owner != NO_NODE; });
+    size_t size = 0;  // nodes serving slots
+    for (size_t i = 0; i < Cluster::nodes.size(); i++) {
+        size += std::find(Cluster::owners.begin(), Cluster::owners.end(), i) != Cluster::owners.end();
+    }
+
+    std::ostringstream out;
+    out << "cluster_enabled:1\r\n"
+        << "cluster_state:" << (assigned == SLOTS ? "ok" : "fail") << "\r\n"
+        << "cluster_slots_assigned:" << assigned << "\r\n"
+        << "cluster_slots_ok:" << assigned << "\r\n"
+        << "cluster_slots_pfail:0\r\n"
+        << "cluster_slots_fail:0\r\n"
+        << "cluster_known_nodes:" << Cluster::nodes.size() << "\r\n"
+        << "cluster_size:" << size << "\r\n"
+        << "cluster_current_epoch:0\r\n"
+        << "cluster_my_epoch:0\r\n";
+    return out.str();
+}
+
+std::string Cluster::add_slots(const std::vector<int> &slots) {
+    // All or nothing
+    for (const int slot : slots) {
+        if (Cluster::owners[slot] != NO_NODE) {
+            return "ERR Slot " + std::to_string(slot) + " is already busy";
+        }
+    }
+    for (const int slot : slots) {
+        Cluster::owners[slot] = MYSELF;
+        Cluster::importing_from[slot] = NO_NODE;
+    }
+    return {};
+}
+
+std::string Cluster::del_slots(const std::vector<int> &slots) {
+    for (const int slot : slots) {
+        if (Cluster::owners[slot] == NO_NODE) {
+            return "ERR Slot " + std::to_string(slot) + " is already unassigned";
+        }
+    }
+    for (const int slot : slots) {
+        Cluster::owners[slot] = NO_NODE;
+        Cluster::migrating_to[slot] = NO_NODE;
+        Cluster::importing_from[slot] = NO_NODE;
+    }
+    return {};
+}
+
+std::string Cluster::set_slot(int slot, std::string_view state, std::string_view node_id, const Storage &storage) {
+    if (state == "STABLE") {
+        Cluster::migrating_to[slot] = NO_NODE;
+        Cluster::importing_from[slot] = NO_NODE;
+        return {};
+    }
+
+    const int node = find_node(node_id);
+    if (node == NO_NODE) {
+        return "ERR I don't know about node " + std::string{node_id};
+    }
+
+    if (state == "MIGRATING") {
+        if (Cluster::owners[slot] != MYSELF) {
+            return "ERR I'm not the owner of hash slot " + std::to_string(slot);
+        }
+        if (node == MYSELF) {
+            return "ERR I can't migrate a slot to myself";
+        }
+        Cluster::migrating_to[slot] = node;
+    } else if (state == "IMPORTING") {
+        if (Cluster::owners[slot] == MYSELF) {
+            return "ERR I'm already the owner of hash slot " + std::to_string(slot);
+        }
+        if (node == MYSELF) {
+            return "ERR I can't import a slot from myself";
+        }
+        Cluster::importing_from[slot] = node;
+    } else {
+        if (Cluster::owners[slot] == MYSELF && node != MYSELF && storage.count_keys_in_slot(slot) > 0) {
+            return "ERR Can't assign hashslot " + std::to_string(slot) +
+                   " to a different node while I still hold keys for this hash slot.";
+        }
+        Cluster::owners[slot] = node;
+        if (node != MYSELF) Cluster::migrating_to[slot] = NO_NODE;
+        if (node == MYSELF) Cluster::importing_from[slot] = NO_NODE;
+    }
+    return {};
+}
+
+std::string Cluster::meet(const std::string &ip, int port) {
+    std::vector<std::string> replies;
+    const std::string error =
+        exchange(ip, port, MEET_TIMEOUT, MessageParser::encode_array({"CLUSTER", "NODES"}), 1, replies);
+    if (!error.empty()) {
+        return error;
+    }
+    if (!replies[0].starts_with('$')) {
+        return "ERR " + ip + ":" + std::to_string(port) + " is not a cluster node";
+    }
+
+    // The line of the node itself is the one flagged myself
+    std::istringstream lines(replies[0].substr(replies[0].find("\r\n") + 2));
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::vector<std::string> words;
+        for (std::string word; fields >> word;) words.push_back(word);
+        if (words.size() < 8 || words[2].find("myself") == std::string::npos) continue;
+
+        if (find_node(words[0]) == MYSELF) {
+            return "ERR Can't meet myself";
+        }
+        int node = find_node(words[0]);
+        if (node == NO_NODE) {
+            node = Cluster::nodes.size();
+            Cluster::nodes.push_back({words[0], ip, port});
+        } else {
+            Cluster::nodes[node].ip = ip;
+            Cluster::nodes[node].port = port;
+        }
+
+        // It knows best which slots it serves, except for those this node serves
+        for (size_t i = 8; i < words.size(); i++) {
+            if (words[i].starts_with('[')) continue;  // migrating or importing
+            int first = 0, last = 0;
+            const size_t dash = words[i].find('-');
+            std::from_chars(words[i].data(), words[i].data() + words[i].size(), first);
+            last = first;
+            if (dash != std::string::npos) {
+                std::from_chars(words[i].data() + dash + 1, words[i].data() + words[i].size(), last);
+            }
+            for (int slot = std::max(first, 0); slot <= std::min(last, SLOTS - 1); slot++) {
+                if (Cluster::owners[slot] != MYSELF) Cluster::owners[slot] = node;
+            }
+        }
+        return {};
+    }
+    return "ERR " + ip + ":" + std::to_string(port) + " did not describe itself";
+}
+
+std::string Cluster::exchange(const std::string &ip, int port, std::chrono::milliseconds timeout,
+                              std::string_view pipeline, size_t reply_count, std::vector<std::string> &replies) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) {
+        return "ERR Invalid node address specified: " + ip + ":" + std::to_string(port);
+    }
+
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return "IOERR error creating socket";
+    }
+
+    // Also bounds connect
+    const timeval tv{static_cast<time_t>(timeout.count() / 1000),
+                     static_cast<suseconds_t>(timeout.count() % 1000 * 1000)};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string error;
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        error = "IOERR error or timeout connecting to the client";
+    }
+
+    for (size_t sent = 0; error.empty() && sent < pipeline.size();) {
+        const ssize_t n = send(fd, pipeline.data() + sent, pipeline.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            error = "IOERR error or timeout writing to target instance";
+            break;
+        }
+        sent += n;
+    }
+
+    std::string buffer;
+    size_t pos = 0;
+    char chunk[16384];
+    while (error.empty() && replies.size() < reply_count) {
+        const size_t end = reply_end(buffer, pos);
+        if (end != std::string::npos) {
+            replies.push_back(buffer.substr(pos, end - pos));
+            pos = end;
+            continue;
+        }
+
+        const ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            error = "IOERR error or timeout reading from target node";
+            break;
+        }
+        buffer.append(chunk, n);
+    }
+
+    close(fd);
+    return error;
+}
+
+std::string Cluster::address(int node) {
+    return Cluster::nodes[node].ip + ":" + std::to_string(Cluster::nodes[node].port);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Command;
+class Storage;
+struct Client;
+
+/*
+    Redis Cluster style partitioning of the keyspace over several servers, --cluster-enabled yes.
+
+    Every key maps to one of SLOTS hash slots: the CRC16 of the key modulo SLOTS, or of its hash tag, the part between
+    the first { and the next }, when that is not empty, so that keys sharing a tag can be used together. Each node
+    serves the slots assigned to it and answers commands for keys of other slots with a MOVED redirection to their
+    owner. Clients learn the whole slot map from CLUSTER SLOTS or CLUSTER SHARDS and send each command to the right
+    node straight away.
+
+    There is no cluster bus: nodes neither gossip nor fail over. CLUSTER MEET asks a node for its id and slots over a
+    regular client connection, and the slot map is changed with CLUSTER ADDSLOTS and SETSLOT on every node, the way
+    redis-cli --cluster drives a cluster. None of it is persisted, a restarted node has to be set up again.
+
+    A slot moves between nodes online: the target is set IMPORTING it and the source MIGRATING it, MIGRATE moves its
+    keys over, then SETSLOT NODE hands the slot to the target. Meanwhile the source keeps serving the keys it still
+    holds and redirects commands for the others to the target with ASK, which the target only serves right after
+    ASKING.
+
+    Cluster mode runs a single shard, --shards is refused with it, so nothing here is thread local.
+*/
+class Cluster {
+   public:
+    static constexpr int SLOTS = 16384;
+    static constexpr int NO_NODE = -1;
+
+    struct Node {
+        std::string id;  // 40 characters, random
+        std::string ip;
+        int port;
+    };
+
+    static bool enabled() {
+        return !Cluster::nodes.empty();
+    }
+
+    // Enables cluster mode with this server as node 0, announced at ip:port and serving no slots yet
+    static void attach(std::string_view announce_ip, int port);
+
+    static int key_hash_slot(std::string_view key);
+
+    /**
+     * Error to answer cmd with when its keys are served by another node, CROSSSLOT when they span slots, empty if it
+     * runs here. Takes back the client's ASKING, which only holds for the command right after it.
+     */
+    static std::string redirect(const Command &cmd, Client &client, Storage &storage);
+
+    static const std::vector<Node> &get_nodes();
+
+    // Index of the node with id in get_nodes(), NO_NODE if unknown
+    static int find_node(std::string_view id);
+
+    // Slots of node as [first, last] ranges, in order
+    static std::vector<std::pair<int, int>> slot_ranges(int node);
+
+    // CLUSTER NODES and CLUSTER INFO
+    static std::string describe_nodes();
+    static std::string describe_info();
+
+    // CLUSTER ADDSLOTS, DELSLOTS and SETSLOT, each returns an error or nothing
+    static std::string add_slots(const std::vector<int> &slots);
+    static std::string del_slots(const std::vector<int> &slots);
+    static std::string set_slot(int slot, std::string_view state, std::string_view node_id, const Storage &storage);
+
+    // Asks the node at ip:port for its id and slots and adds it, or updates it. Returns an error or nothing.
+    static std::string meet(const std::string &ip, int port);
+
+    /**
+     * Sends pipeline to the node at ip:port over a new connection and reads reply_count replies into replies, each
+     * as received. Blocks the event loop until then, like replication's handshake, giving up after timeout.
+     * Returns an error or nothing.
+     */
+    static std::string exchange(const std::string &ip, int port, std::chrono::milliseconds timeout,
+                                std::string_view pipeline, size_t reply_count, std::vector<std::string> &replies);
+
+   private:
+    static constexpr int MYSELF = 0;
+    static constexpr std::chrono::milliseconds MEET_TIMEOUT{1000};
+
+    static std::vector<Node> nodes;  // this server first
+    // By slot, indexes into nodes
+    static std::vector<int> owners;
+    static std::vector<int> migrating_to;
+    static std::vector<int> importing_from;
+
+    static std::string address(int node);
+};
@@ -4,9 +4,18 @@
 #include <sys/socket.h>
 
 #include <algorithm>
+#include <array>
+#include <cstdio>
 #include <numeric>
 
+#include "cluster.h"
+#include "handler.h"
+#include "latency.h"
+#include "lazy_free.h"
 #include "logger.h"
+#include "pubsub.h"
+#include "replication.h"
+#include "stats.h"
 #include "storage_commands.h"
 
 CommandParseError::CommandParseError(std::string_view error_msg) : std::runtime_error(error_msg.data()) {}
@@ -21,6 +30,30 @@ void Command::set_client_socket(int client_socket) {
     this->client_socket = client_socket;
 }
 
+void Command::set_reply_buffer(std::string *reply_buffer) {
+    this->reply_buffer = reply_buffer;
+}
+
+void Command::respond(std::string_view message) {
+    this->reply_buffer->append(message);
+}
+
+void Command::respond_simple_string(std::string_view message) {
+    this->respond_with([message](std::string &out) { MessageParser::append_simple_string(out, message); });
+}
+
+void Command::respond_bulk_string(std::string_view message) {
+    this->respond_with([message](std::string &out) { MessageParser::append_bulk_string(out, message); });
+}
+
+void Command::respond_integer(long long num) {
+    this->respond_with([num](std::string &out) { MessageParser::append_integer(out, num); });
+}
+
+void Command::respond_error(std::string_view message) {
+    this->respond_with([message](std::string &out) { MessageParser::append_simple_error(out, message); });
+}
+
 CommandPtr Command::parse(const DecodedMessage &decoded_msg) {
     if (decoded_msg.size() < 1) {
         throw CommandParseError("Invalid command received");
@@ -74,12 +107,221 @@ CommandPtr Command::parse(const DecodedMessage &decoded_msg) {
     } else if (command == "XADD") {
         LOG("Handling case 12 master receives XADD");
         return XAddCommand::parse(decoded_msg);
+    } else if (command == "MGET") {
+        LOG("Handling case 13 master receives MGET");
+        return MGetCommand::parse(decoded_msg);
+    } else if (command == "MSET") {
+        LOG("Handling case 14 master receives MSET");
+        return MSetCommand::parse(decoded_msg);
+    } else if (command == "DEL" || command == "UNLINK") {
+        LOG("Handling case 15 master receives DEL/UNLINK");
+        return DelCommand::parse(decoded_msg);
+    } else if (command == "EXISTS") {
+        LOG("Handling case 16 master receives EXISTS");
+        return ExistsCommand::parse(decoded_msg);
+    } else if (command == "SLOWLOG") {
+        LOG("Handling case 17 master receives SLOWLOG");
+        return SlowlogCommand::parse(decoded_msg);
+    } else if (command == "LATENCY") {
+        LOG("Handling case 18 master receives LATENCY");
+        return LatencyCommand::parse(decoded_msg);
+    } else if (command == "CLIENT") {
+        LOG("Handling case 19 master receives CLIENT");
+        return ClientCommand::parse(decoded_msg);
+    } else if (command == "HSET") {
+        LOG("Handling case 20 master receives HSET");
+        return HSetCommand::parse(decoded_msg);
+    } else if (command == "HGET") {
+        LOG("Handling case 21 master receives HGET");
+        return HGetCommand::parse(decoded_msg);
+    } else if (command == "HMGET") {
+        LOG("Handling case 22 master receives HMGET");
+        return HMGetCommand::parse(decoded_msg);
+    } else if (command == "HDEL") {
+        LOG("Handling case 23 master receives HDEL");
+        return HDelCommand::parse(decoded_msg);
+    } else if (command == "HGETALL") {
+        LOG("Handling case 24 master receives HGETALL");
+        return HGetAllCommand::parse(decoded_msg);
+    } else if (command == "HINCRBY") {
+        LOG("Handling case 25 master receives HINCRBY");
+        return HIncrByCommand::parse(decoded_msg);
+    } else if (command == "ZADD") {
+        LOG("Handling case 26 master receives ZADD");
+        return ZAddCommand::parse(decoded_msg);
+    } else if (command == "ZSCORE") {
+        LOG("Handling case 27 master receives ZSCORE");
+        return ZScoreCommand::parse(decoded_msg);
+    } else if (command == "ZRANGE") {
+        LOG("Handling case 28 master receives ZRANGE");
+        return ZRangeCommand::parse(decoded_msg);
+    } else if (command == "ZRANGEBYSCORE") {
+        LOG("Handling case 29 master receives ZRANGEBYSCORE");
+        return ZRangeByScoreCommand::parse(decoded_msg);
+    } else if (command == "ZRANK") {
+        LOG("Handling case 30 master receives ZRANK");
+        return ZRankCommand::parse(decoded_msg);
+    } else if (command == "ZPOPMIN") {
+        LOG("Handling case 31 master receives ZPOPMIN");
+        return ZPopMinCommand::parse(decoded_msg);
+    } else if (command == "LPUSH" || command == "RPUSH") {
+        LOG("Handling case 32 master receives LPUSH/RPUSH");
+        return ListPushCommand::parse(decoded_msg);
+    } else if (command == "LPOP" || command == "RPOP") {
+        LOG("Handling case 33 master receives LPOP/RPOP");
+        return ListPopCommand::parse(decoded_msg);
+    } else if (command == "BLPOP" || command == "BRPOP") {
+        LOG("Handling case 34 master receives BLPOP/BRPOP");
+        return BlockingListPopCommand::parse(decoded_msg);
+    } else if (command == "LRANGE") {
+        LOG("Handling case 35 master receives LRANGE");
+        return LRangeCommand::parse(decoded_msg);
+    } else if (command == "LLEN") {
+        LOG("Handling case 36 master receives LLEN");
+        return LLenCommand::parse(decoded_msg);
+    } else if (command == "SUBSCRIBE" || command == "PSUBSCRIBE") {
+        LOG("Handling case 37 master receives SUBSCRIBE/PSUBSCRIBE");
+        return SubscribeCommand::parse(decoded_msg);
+    } else if (command == "UNSUBSCRIBE" || command == "PUNSUBSCRIBE") {
+        LOG("Handling case 38 master receives UNSUBSCRIBE/PUNSUBSCRIBE");
+        return UnsubscribeCommand::parse(decoded_msg);
+    } else if (command == "PUBLISH") {
+        LOG("Handling case 39 master receives PUBLISH");
+        return PublishCommand::parse(decoded_msg);
+    } else if (command == "PUBSUB") {
+        LOG("Handling case 40 master receives PUBSUB");
+        return PubSubCommand::parse(decoded_msg);
+    } else if (command == "FLUSHALL" || command == "FLUSHDB") {
+        LOG("Handling case 41 master receives FLUSHALL/FLUSHDB");
+        return FlushCommand::parse(decoded_msg);
+    } else if (command == "CLUSTER") {
+        LOG("Handling case 42 master receives CLUSTER");
+        return ClusterCommand::parse(decoded_msg);
+    } else if (command == "ASKING") {
+        LOG("Handling case 43 master receives ASKING");
+        return AskingCommand::parse(decoded_msg);
+    } else if (command == "MIGRATE") {
+        LOG("Handling case 44 master receives MIGRATE");
+        return MigrateCommand::parse(decoded_msg);
+    } else if (command == "SAVE") {
+        LOG("Handling case 45 master receives SAVE");
+        return SaveCommand::parse(decoded_msg);
     }
 
     LOG("Handling else case: Unknown command");
     throw CommandParseError("Unknown command");
 }
 
+std::string_view command_name(CommandType type) {
+    switch (type) {
+        case CommandType::Ping:
+            return "ping";
+        case CommandType::Echo:
+            return "echo";
+        case CommandType::Set:
+            return "set";
+        case CommandType::Get:
+            return "get";
+        case CommandType::Info:
+            return "info";
+        case CommandType::Replconf:
+            return "replconf";
+        case CommandType::Psync:
+            return "psync";
+        case CommandType::Wait:
+            return "wait";
+        case CommandType::ConfigGet:
+            return "config|get";
+        case CommandType::Keys:
+            return "keys";
+        case CommandType::Type:
+            return "type";
+        case CommandType::XAdd:
+            return "xadd";
+        case CommandType::MGet:
+            return "mget";
+        case CommandType::MSet:
+            return "mset";
+        case CommandType::Del:
+            return "del";
+        case CommandType::Unlink:
+            return "unlink";
+        case CommandType::FlushAll:
+            return "flushall";
+        case CommandType::FlushDb:
+            return "flushdb";
+        case CommandType::Cluster:
+            return "cluster";
+        case CommandType::Asking:
+            return "asking";
+        case CommandType::Migrate:
+            return "migrate";
+        case CommandType::Save:
+            return "save";
+        case CommandType::Exists:
+            return "exists";
+        case CommandType::Slowlog:
+            return "slowlog";
+        case CommandType::Latency:
+            return "latency";
+        case CommandType::Client:
+            return "client";
+        case CommandType::HSet:
+            return "hset";
+        case CommandType::HGet:
+            return "hget";
+        case CommandType::HMGet:
+            return "hmget";
+        case CommandType::HDel:
+            return "hdel";
+        case CommandType::HGetAll:
+            return "hgetall";
+        case CommandType::HIncrBy:
+            return "hincrby";
+        case CommandType::ZAdd:
+            return "zadd";
+        case CommandType::ZScore:
+            return "zscore";
+        case CommandType::ZRange:
+            return "zrange";
+        case CommandType::ZRangeByScore:
+            return "zrangebyscore";
+        case CommandType::ZRank:
+            return "zrank";
+        case CommandType::ZPopMin:
+            return "zpopmin";
+        case CommandType::LPush:
+            return "lpush";
+        case CommandType::RPush:
+            return "rpush";
+        case CommandType::LPop:
+            return "lpop";
+        case CommandType::RPop:
+            return "rpop";
+        case CommandType::BLPop:
+            return "blpop";
+        case CommandType::BRPop:
+            return "brpop";
+        case CommandType::LRange:
+            return "lrange";
+        case CommandType::LLen:
+            return "llen";
+        case CommandType::Subscribe:
+            return "subscribe";
+        case CommandType::Unsubscribe:
+            return "unsubscribe";
+        case CommandType::PSubscribe:
+            return "psubscribe";
+        case CommandType::PUnsubscribe:
+            return "punsubscribe";
+        case CommandType::Publish:
+            return "publish";
+        case CommandType::PubSub:
+            return "pubsub";
+    }
+    return "unknown";
+}
+
 PingCommand::PingCommand() : Command(CommandType::Ping) {}
 
 // Example: PING
@@ -88,9 +330,17 @@ CommandPtr PingCommand::parse(const DecodedMessage &decoded_msg) {
 }
 
 void PingCommand::execute(ServerInfo &server_info) {
-    if (server_info.replication_info.master_fd != this->client_socket) {
-        const RESPMessage message = MessageParser::encode_simple_string("PONG");
-        send(this->client_socket, message.c_str(), message.size(), 0);
+    if (server_info.replication_info.master_fd == this->client_socket) return;
+
+    // A subscribed RESP2 connection only expects arrays
+    if (PubSub::is_subscribed(this->client_socket)) {
+        this->respond_with([](std::string &out) {
+            MessageParser::append_array_header(out, 2);
+            MessageParser::append_bulk_string(out, "pong");
+            MessageParser::append_bulk_string(out, "");
+        });
+    } else {
+        this->respond(SharedReplies::pong);
     }
 }
 
@@ -103,24 +353,7 @@ CommandPtr EchoCommand::parse(const DecodedMessage &decoded_msg) {
 }
 
 void EchoCommand::execute(ServerInfo &server_info) {
-    std::string encoded_echo_msg = MessageParser::encode_bulk_string(this->echo_msg);
-    send(this->client_socket, encoded_echo_msg.data(), encoded_echo_msg.size(), 0);
-}
-
-InfoCommand::InfoCommand() : Command(CommandType::Info) {}
-
-// Example: INFO replication
-CommandPtr InfoCommand::parse(const DecodedMessage &decoded_msg) {
-    return std::make_unique<InfoCommand>();
-}
-
-void InfoCommand::execute(ServerInfo &server_info) {
-    const std::string role = server_info.replication_info.master_port == -1 ? "role:master" : "role:slave";
-    const std::string replid = "master_replid:" + std::to_string(server_info.replication_info.master_repl_offset);
-    const std::string offset = "master_repl_offset:" + std::to_string(server_info.replication_info.master_repl_offset);
-    const std::string temp_message = role + "\n" + replid + "\n" + offset + "\n";
-    const RESPMessage message = MessageParser::encode_bulk_string(temp_message);
-    send(this->client_socket, message.c_str(), message.size(), 0);
+    this->respond_bulk_string(this->echo_msg);
 }
 
 ReplconfCommand::ReplconfCommand() : Command(CommandType::Replconf) {}
@@ -137,50 +370,35 @@ CommandPtr ReplconfCommand::parse(const DecodedMessage &decoded_msg) {
 }
 
 void ReplconfCommand::execute(ServerInfo &server_info) {
-    RESPMessage message;
     if (!server_info.is_replica()) {
-        message = MessageParser::encode_simple_string("OK");
+        this->respond(SharedReplies::ok);
     } else {
-        message = MessageParser::encode_array(
-            {"REPLCONF", "ACK", std::to_string(server_info.replication_info.master_repl_offset)});
+        this->respond(MessageParser::encode_array(
+            {"REPLCONF", "ACK", std::to_string(server_info.replication_info.master_repl_offset)}));
     }
-    send(this->client_socket, message.c_str(), message.size(), 0);
 }
 
-std::string PsyncCommand::empty_rdb_in_bytes = "";
-
-bool PsyncCommand::empty_rdb_initialised = false;
-
-void PsyncCommand::initialiseEmptyRdb() {
-    if (PsyncCommand::empty_rdb_initialised) return;
-
-    try {
-        empty_rdb_in_bytes = hexToBytes(empty_rdb_hardcoded);
-        PsyncCommand::empty_rdb_initialised = true;
-    } catch (const std::runtime_error &e) {
-        ERROR("Error initializing empty_rdb_in_bytes: " << e.what());
-    }
-}
-
-PsyncCommand::PsyncCommand() : Command(CommandType::Psync) {
-    initialiseEmptyRdb();
-}
+PsyncCommand::PsyncCommand() : Command(CommandType::Psync) {}
 
 // Example: PSYNC ? -1
 CommandPtr PsyncCommand::parse(const DecodedMessage &decoded_msg) {
     return std::make_unique<PsyncCommand>();
 }
 
+// Answered with FULLRESYNC and a snapshot of the keyspace, possibly later when the snapshot is shared with other
+// replicas
 void PsyncCommand::execute(ServerInfo &server_info) {
-    const std::string temp_message = "FULLRESYNC " + server_info.replication_info.master_replid + " " +
-                                     std::to_string(server_info.replication_info.master_repl_offset);
-    RESPMessage message = MessageParser::encode_simple_string(temp_message);
-    send(this->client_socket, message.c_str(), message.size(), 0);
-    server_info.replication_info.replica_connections.insert(this->client_socket);
+    Replication::full_resync(this->client_socket);
+}
+
+// Queued after anything still on its way to the replica, eg. the RDB file of its full resync, and sent by the event
+// loop as far as its socket takes it, so a replica that stops reading never blocks the master
+static void send_to_replica(int replica, std::string_view data, ServerInfo &server_info) {
+    auto it = server_info.clients.find(replica);
+    if (it == server_info.clients.end()) return;
 
-    // Send over a copy of store to replica
-    message = MessageParser::encode_rdb_file(PsyncCommand::empty_rdb_in_bytes);
-    send(this->client_socket, message.c_str(), message.size(), 0);
+    it->second.reply_buffer.append(data);
+    server_info.pending_writes.insert(replica);
 }
 
 WaitCommand::WaitCommand(int timeout_milliseconds, int responses_needed, std::chrono::steady_clock::time_point &&start)
@@ -207,15 +425,19 @@ CommandPtr WaitCommand::parse(const DecodedMessage &decoded_msg) {
 
 void WaitCommand::execute(ServerInfo &server_info) {
     if (server_info.bytes_propagated == 0) {
-        const RESPMessage message =
-            MessageParser::encode_integer(server_info.replication_info.replica_connections.size());
-        send(this->client_socket, message.c_str(), message.size(), 0);
+        this->respond_integer(server_info.replication_info.replica_connections.size());
         return;
     }
 
+    // The acks are polled for below, before the event loop would send the queued GETACKs, so they go out now as far
+    // as the replicas' sockets take them
     RESPMessage message = MessageParser::encode_array({"REPLCONF", "GETACK", "*"});
     for (const int fd : server_info.replication_info.replica_connections) {
-        send(fd, message.c_str(), message.size(), 0);
+        send_to_replica(fd, message, server_info);
+        auto it = server_info.clients.find(fd);
+        if (it != server_info.clients.end() && Handler::flush_replies(fd, it->second) != 0) {
+            server_info.pending_closes.insert(fd);
+        }
     }
 
     std::vector<char> buf(1024);
@@ -241,8 +463,7 @@ void WaitCommand::execute(ServerInfo &server_info) {
         }
     }
 
-    message = MessageParser::encode_integer(responses_received);
-    send(client_socket, message.c_str(), message.size(), 0);
+    this->respond_integer(responses_received);
 }
 
 ConfigGetCommand::ConfigGetCommand(std::vector<std::string> &&params)
@@ -274,18 +495,621 @@ void ConfigGetCommand::execute(ServerInfo &server_info) {
             message_array.push_back(server_info.dir);
         } else if (param == "dbfilename") {
             message_array.push_back(server_info.dbfilename);
+        } else if (param == "slowlog-log-slower-than") {
+            message_array.push_back(std::to_string(LatencyMonitor::slowlog_log_slower_than));
+        } else if (param == "slowlog-max-len") {
+            message_array.push_back(std::to_string(LatencyMonitor::slowlog_max_len));
+        } else if (param == "latency-monitor-threshold") {
+            message_array.push_back(std::to_string(LatencyMonitor::latency_monitor_threshold));
+        } else if (param == "tracking-table-max-keys") {
+            message_array.push_back(std::to_string(Tracking::tracking_table_max_keys));
+        } else if (param == "hash-max-listpack-entries") {
+            message_array.push_back(std::to_string(Hash::max_listpack_entries));
+        } else if (param == "hash-max-listpack-value") {
+            message_array.push_back(std::to_string(Hash::max_listpack_value));
+        } else if (param == "zset-max-listpack-entries") {
+            message_array.push_back(std::to_string(SortedSet::max_listpack_entries));
+        } else if (param == "zset-max-listpack-value") {
+            message_array.push_back(std::to_string(SortedSet::max_listpack_value));
+        } else if (param == "list-max-listpack-size") {
+            message_array.push_back(std::to_string(QuickList::max_listpack_size));
+        } else if (param == "tcp-backlog") {
+            message_array.push_back(std::to_string(server_info.tcp_backlog));
+        } else if (param == "unixsocket") {
+            message_array.push_back(server_info.unixsocket);
+        } else if (param == "unixsocketperm") {
+            std::array<char, 8> perm;
+            const int len = snprintf(perm.data(), perm.size(), "%o", server_info.unixsocketperm);
+            message_array.emplace_back(perm.data(), len);
+        } else if (param == "io-threads") {
+            message_array.push_back(std::to_string(server_info.io_threads));
+        } else if (param == "shards") {
+            message_array.push_back(std::to_string(server_info.shards));
+        } else if (param == "cluster-enabled") {
+            message_array.push_back(server_info.cluster_enabled ? "yes" : "no");
+        } else if (param == "cluster-announce-ip") {
+            message_array.push_back(server_info.cluster_announce_ip);
+        } else if (param == "mmap-snapshot") {
+            message_array.push_back(server_info.mmap_snapshot);
+        } else if (param == "repl-diskless-sync") {
+            message_array.push_back(Replication::diskless_sync ? "yes" : "no");
+        } else if (param == "repl-diskless-sync-delay") {
+            message_array.push_back(std::to_string(Replication::diskless_sync_delay.count()));
+        } else if (param == "repl-diskless-sync-max-replicas") {
+            message_array.push_back(std::to_string(Replication::diskless_sync_max_replicas));
+        } else if (param == "lazyfree-lazy-user-del") {
+            message_array.push_back(LazyFree::lazy_user_del ? "yes" : "no");
+        } else if (param == "lazyfree-lazy-server-del") {
+            message_array.push_back(LazyFree::lazy_server_del ? "yes" : "no");
+        } else if (param == "lazyfree-lazy-expire") {
+            message_array.push_back(LazyFree::lazy_expire ? "yes" : "no");
+        } else if (param == "lazyfree-lazy-user-flush") {
+            message_array.push_back(LazyFree::lazy_user_flush ? "yes" : "no");
+        } else if (param == "io-backend") {
+            message_array.push_back(std::string{Reactor::backend_name(server_info.io_backend)});
+        } else if (param == "client-output-buffer-limit") {
+            message_array.push_back("pubsub " + std::to_string(PubSub::output_buffer_hard_limit) + " " +
+                                    std::to_string(PubSub::output_buffer_soft_limit) + " " +
+                                    std::to_string(PubSub::output_buffer_soft_seconds));
         } else {
             throw CommandParseError("Unknown configuration parameter for CONFIG GET");
         }
     }
 
-    const RESPMessage encoded_message = MessageParser::encode_array(message_array);
-    send(client_socket, encoded_message.c_str(), encoded_message.size(), 0);
+    this->respond_with([&message_array](std::string &out) { MessageParser::append_array(out, message_array); });
+}
+
+SlowlogCommand::SlowlogCommand(Subcommand subcommand, int count)
+    : Command(CommandType::Slowlog), subcommand(subcommand), count(count) {}
+
+/**
+ * Examples:
+ * SLOWLOG GET [count]
+ * SLOWLOG LEN
+ * SLOWLOG RESET
+ */
+CommandPtr SlowlogCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for SLOWLOG command");
+    }
+
+    std::string subcommand = decoded_msg[1];
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+
+    if (subcommand == "GET") {
+        // Default of 10 entries, -1 for all of them
+        int count = 10;
+        if (decoded_msg.size() > 2) {
+            try {
+                count = std::stoi(decoded_msg[2]);
+            } catch (const std::logic_error &e) {
+                throw CommandParseError("Invalid count for SLOWLOG GET");
+            }
+        }
+        return std::make_unique<SlowlogCommand>(Subcommand::Get, count);
+    } else if (subcommand == "LEN") {
+        return std::make_unique<SlowlogCommand>(Subcommand::Len, 0);
+    } else if (subcommand == "RESET") {
+        return std::make_unique<SlowlogCommand>(Subcommand::Reset, 0);
+    }
+    throw CommandParseError("Unknown SLOWLOG subcommand");
+}
+
+void SlowlogCommand::execute(ServerInfo &server_info) {
+    const auto &slowlog = LatencyMonitor::get_slowlog();
+
+    if (this->subcommand == Subcommand::Len) {
+        this->respond_integer(slowlog.size());
+        return;
+    } else if (this->subcommand == Subcommand::Reset) {
+        LatencyMonitor::reset_slowlog();
+        this->respond(SharedReplies::ok);
+        return;
+    }
+
+    const size_t count = this->count < 0 ? slowlog.size() : std::min<size_t>(this->count, slowlog.size());
+
+    // Each entry: id, unix timestamp, duration in microseconds, arguments, client address, client name
+    this->respond_with([&](std::string &out) {
+        MessageParser::append_array_header(out, count);
+        for (size_t i = 0; i < count; i++) {
+            const LatencyMonitor::SlowlogEntry &entry = slowlog[i];
+            MessageParser::append_array_header(out, 6);
+            MessageParser::append_integer(out, entry.id);
+            MessageParser::append_integer(out, entry.timestamp);
+            MessageParser::append_integer(out, entry.duration_us);
+            MessageParser::append_array(out, entry.args);
+            out.append(SharedReplies::empty_bulk_string);
+            out.append(SharedReplies::empty_bulk_string);
+        }
+    });
+}
+
+LatencyCommand::LatencyCommand(Subcommand subcommand, std::vector<std::string> &&args)
+    : Command(CommandType::Latency), subcommand(subcommand), args(std::move(args)) {}
+
+/**
+ * Examples:
+ * LATENCY LATEST
+ * LATENCY HISTORY <event>
+ * LATENCY RESET [event ...]
+ * LATENCY HISTOGRAM [command ...]
+ */
+CommandPtr LatencyCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for LATENCY command");
+    }
+
+    std::string subcommand = decoded_msg[1];
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+    std::vector<std::string> args(decoded_msg.begin() + 2, decoded_msg.end());
+
+    if (subcommand == "LATEST") {
+        return std::make_unique<LatencyCommand>(Subcommand::Latest, std::move(args));
+    } else if (subcommand == "HISTORY") {
+        if (args.size() != 1) {
+            throw CommandParseError("LATENCY HISTORY requires an event name");
+        }
+        return std::make_unique<LatencyCommand>(Subcommand::History, std::move(args));
+    } else if (subcommand == "RESET") {
+        return std::make_unique<LatencyCommand>(Subcommand::Reset, std::move(args));
+    } else if (subcommand == "HISTOGRAM") {
+        for (std::string &arg : args) {
+            std::transform(arg.begin(), arg.end(), arg.begin(), tolower);
+        }
+        return std::make_unique<LatencyCommand>(Subcommand::Histogram, std::move(args));
+    }
+    throw CommandParseError("Unknown LATENCY subcommand");
+}
+
+// Microseconds with 3 decimals, from nanoseconds
+static std::string format_usec(uint64_t nanoseconds) {
+    char buf[32];
+    const int len = snprintf(buf, sizeof(buf), "%.3f", nanoseconds / 1000.0);
+    return std::string(buf, len);
+}
+
+void LatencyCommand::execute(ServerInfo &server_info) {
+    RESPMessage message;
+
+    switch (this->subcommand) {
+        case Subcommand::Latest: {
+            // Each event: name, unix timestamp of the latest spike, latest latency, all time max latency
+            const auto &events = LatencyMonitor::get_events();
+            MessageParser::append_array_header(message, events.size());
+            for (const auto &[name, event] : events) {
+                MessageParser::append_array_header(message, 4);
+                MessageParser::append_bulk_string(message, name);
+                MessageParser::append_integer(message, event.samples.back().timestamp);
+                MessageParser::append_integer(message, event.samples.back().latency_ms);
+                MessageParser::append_integer(message, event.max_latency_ms);
+            }
+            break;
+        }
+        case Subcommand::History: {
+            const auto &events = LatencyMonitor::get_events();
+            auto it = events.find(this->args[0]);
+            if (it == events.end()) {
+                MessageParser::append_array_header(message, 0);
+                break;
+            }
+
+            MessageParser::append_array_header(message, it->second.samples.size());
+            for (const LatencyMonitor::LatencySample &sample : it->second.samples) {
+                MessageParser::append_array_header(message, 2);
+                MessageParser::append_integer(message, sample.timestamp);
+                MessageParser::append_integer(message, sample.latency_ms);
+            }
+            break;
+        }
+        case Subcommand::Reset: {
+            int reset = 0;
+            if (this->args.empty()) {
+                reset = LatencyMonitor::get_events().size();
+                LatencyMonitor::reset_events();
+            } else {
+                for (const std::string &event : this->args) {
+                    reset += LatencyMonitor::reset_event(event);
+                }
+            }
+            MessageParser::append_integer(message, reset);
+            break;
+        }
+        case Subcommand::Histogram: {
+            /**
+             * For each command: name, then
+             * ["calls", <n>, "p50_usec", <p50>, "p99_usec", <p99>, "p99.9_usec", <p999>, "histogram_usec", [...]]
+             * where the histogram lists <bucket upper bound> <commands at or below it> for power-of-two buckets.
+             */
+            const auto &command_stats = LatencyMonitor::get_command_stats();
+            std::vector<size_t> selected;
+            for (size_t i = 0; i < command_stats.size(); i++) {
+                if (command_stats[i].calls == 0) continue;
+
+                const std::string_view name = command_name(static_cast<CommandType>(i));
+                if (this->args.empty() || std::find(this->args.begin(), this->args.end(), name) != this->args.end()) {
+                    selected.push_back(i);
+                }
+            }
+
+            MessageParser::append_array_header(message, selected.size() * 2);
+            for (const size_t i : selected) {
+                const Histogram &histogram = command_stats[i].histogram;
+                MessageParser::append_bulk_string(message, command_name(static_cast<CommandType>(i)));
+                MessageParser::append_array_header(message, 10);
+                MessageParser::append_bulk_string(message, "calls");
+                MessageParser::append_integer(message, command_stats[i].calls);
+                MessageParser::append_bulk_string(message, "p50_usec");
+                MessageParser::append_bulk_string(message, format_usec(histogram.percentile(50)));
+                MessageParser::append_bulk_string(message, "p99_usec");
+                MessageParser::append_bulk_string(message, format_usec(histogram.percentile(99)));
+                MessageParser::append_bulk_string(message, "p99.9_usec");
+                MessageParser::append_bulk_string(message, format_usec(histogram.percentile(99.9)));
+                MessageParser::append_bulk_string(message, "histogram_usec");
+
+                RESPMessage buckets;
+                int num_buckets = 0;
+                uint64_t cumulative = 0;
+                for (uint64_t bucket_us = 1; cumulative < histogram.get_count(); bucket_us *= 2) {
+                    const uint64_t from_ns = bucket_us == 1 ? 0 : bucket_us / 2 * 1000;
+                    const uint64_t in_bucket = histogram.count_between(from_ns, bucket_us * 1000);
+                    if (in_bucket == 0) continue;
+
+                    cumulative += in_bucket;
+                    MessageParser::append_integer(buckets, bucket_us);
+                    MessageParser::append_integer(buckets, cumulative);
+                    num_buckets++;
+                }
+                MessageParser::append_array_header(message, num_buckets * 2);
+                message += buckets;
+            }
+            break;
+        }
+    }
+
+    this->respond(message);
+}
+
+ClientCommand::ClientCommand(Subcommand subcommand, bool tracking_on, Tracking::Options &&tracking_options)
+    : Command(CommandType::Client),
+      subcommand(subcommand),
+      tracking_on(tracking_on),
+      tracking_options(std::move(tracking_options)) {}
+
+/**
+ * Examples:
+ * CLIENT ID
+ * CLIENT TRACKING ON|OFF [REDIRECT <client-id>] [BCAST] [PREFIX <prefix> ...] [NOLOOP]
+ *
+ * Invalidations are sent as RESP3 push messages, or as Pub/Sub messages on __redis__:invalidate to the REDIRECT
+ * client, which RESP2 clients can read.
+ */
+CommandPtr ClientCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for CLIENT command");
+    }
+
+    std::string subcommand = decoded_msg[1];
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+
+    if (subcommand == "ID") {
+        return std::make_unique<ClientCommand>(Subcommand::Id, false, Tracking::Options{});
+    } else if (subcommand != "TRACKING") {
+        throw CommandParseError("Unknown CLIENT subcommand");
+    }
+
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("CLIENT TRACKING requires ON or OFF");
+    }
+    std::string state = decoded_msg[2];
+    std::transform(state.begin(), state.end(), state.begin(), toupper);
+    if (state != "ON" && state != "OFF") {
+        throw CommandParseError("CLIENT TRACKING requires ON or OFF");
+    }
+
+    Tracking::Options options;
+    for (size_t i = 3; i < decoded_msg.size(); i++) {
+        std::string option = decoded_msg[i];
+        std::transform(option.begin(), option.end(), option.begin(), toupper);
+
+        if (option == "BCAST") {
+            options.bcast = true;
+        } else if (option == "NOLOOP") {
+            options.noloop = true;
+        } else if (option == "REDIRECT" && i + 1 < decoded_msg.size()) {
+            try {
+                options.redirect = std::stoull(decoded_msg[++i]);
+            } catch (const std::logic_error &e) {
+                throw CommandParseError("Invalid client ID for REDIRECT");
+            }
+        } else if (option == "PREFIX" && i + 1 < decoded_msg.size()) {
+            options.prefixes.push_back(decoded_msg[++i]);
+        } else {
+            throw CommandParseError("Syntax error in CLIENT TRACKING");
+        }
+    }
+    if (!options.prefixes.empty() && !options.bcast) {
+        throw CommandParseError("PREFIX option requires BCAST mode to be enabled");
+    }
+
+    return std::make_unique<ClientCommand>(Subcommand::Tracking, state == "ON", std::move(options));
+}
+
+void ClientCommand::execute(ServerInfo &server_info) {
+    const uint64_t client_id = server_info.clients[this->client_socket].id;
+
+    if (this->subcommand == Subcommand::Id) {
+        this->respond_integer(client_id);
+        return;
+    }
+
+    if (!this->tracking_on) {
+        Tracking::disable(client_id);
+        this->respond(SharedReplies::ok);
+        return;
+    }
+
+    if (this->tracking_options.redirect != 0) {
+        auto it = std::find_if(server_info.clients.begin(), server_info.clients.end(), [this](const auto &entry) {
+            return entry.second.id == this->tracking_options.redirect;
+        });
+        if (it == server_info.clients.end()) {
+            this->respond_error("ERR The client ID you want redirect to does not exist");
+            return;
+        }
+        this->tracking_options.redirect_socket = it->first;
+    }
+
+    Tracking::enable(client_id, this->client_socket, std::move(this->tracking_options));
+    this->respond(SharedReplies::ok);
+}
+
+SubscribeCommand::SubscribeCommand(CommandType type, std::vector<std::string> &&names)
+    : Command(type), names(std::move(names)) {}
+
+/**
+ * Examples:
+ * SUBSCRIBE <channel> [<channel> ...]
+ * PSUBSCRIBE <pattern> [<pattern> ...]
+ */
+CommandPtr SubscribeCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for SUBSCRIBE command");
+    }
+
+    std::string command = decoded_msg[0];
+    std::transform(command.begin(), command.end(), command.begin(), toupper);
+    const CommandType type = command == "SUBSCRIBE" ? CommandType::Subscribe : CommandType::PSubscribe;
+    return std::make_unique<SubscribeCommand>(type,
+                                              std::vector<std::string>(decoded_msg.begin() + 1, decoded_msg.end()));
+}
+
+// Replies with one [subscribe, name, subscription count] array per name
+void SubscribeCommand::execute(ServerInfo &server_info) {
+    if (this->client_socket == server_info.replication_info.master_fd) return;
+
+    const bool patterns = this->type == CommandType::PSubscribe;
+    for (const std::string &name : this->names) {
+        const size_t count = patterns ? PubSub::psubscribe(this->client_socket, name)
+                                      : PubSub::subscribe(this->client_socket, name);
+        this->respond_with([&](std::string &out) {
+            MessageParser::append_array_header(out, 3);
+            MessageParser::append_bulk_string(out, patterns ? "psubscribe" : "subscribe");
+            MessageParser::append_bulk_string(out, name);
+            MessageParser::append_integer(out, count);
+        });
+    }
+}
+
+UnsubscribeCommand::UnsubscribeCommand(CommandType type, std::vector<std::string> &&names)
+    : Command(type), names(std::move(names)) {}
+
+/**
+ * Examples:
+ * UNSUBSCRIBE [<channel> ...]
+ * PUNSUBSCRIBE [<pattern> ...]
+ */
+CommandPtr UnsubscribeCommand::parse(const DecodedMessage &decoded_msg) {
+    std::string command = decoded_msg[0];
+    std::transform(command.begin(), command.end(), command.begin(), toupper);
+    const CommandType type = command == "UNSUBSCRIBE" ? CommandType::Unsubscribe : CommandType::PUnsubscribe;
+    return std::make_unique<UnsubscribeCommand>(type,
+                                                std::vector<std::string>(decoded_msg.begin() + 1, decoded_msg.end()));
+}
+
+// Replies with one [unsubscribe, name, subscription count] array per name, or a single one with a null name when
+// there was nothing to unsubscribe from
+void UnsubscribeCommand::execute(ServerInfo &server_info) {
+    if (this->client_socket == server_info.replication_info.master_fd) return;
+
+    const bool patterns = this->type == CommandType::PUnsubscribe;
+    if (this->names.empty()) {
+        this->names = patterns ? PubSub::get_client_patterns(this->client_socket)
+                               : PubSub::get_client_channels(this->client_socket);
+    }
+
+    const std::string_view kind = patterns ? "punsubscribe" : "unsubscribe";
+    if (this->names.empty()) {
+        this->respond_with([&](std::string &out) {
+            MessageParser::append_array_header(out, 3);
+            MessageParser::append_bulk_string(out, kind);
+            out.append(SharedReplies::null_bulk_string);
+            MessageParser::append_integer(out, PubSub::get_subscription_count(this->client_socket));
+        });
+        return;
+    }
+
+    for (const std::string &name : this->names) {
+        const size_t count = patterns ? PubSub::punsubscribe(this->client_socket, name)
+                                      : PubSub::unsubscribe(this->client_socket, name);
+        this->respond_with([&](std::string &out) {
+            MessageParser::append_array_header(out, 3);
+            MessageParser::append_bulk_string(out, kind);
+            MessageParser::append_bulk_string(out, name);
+            MessageParser::append_integer(out, count);
+        });
+    }
+}
+
+PublishCommand::PublishCommand(std::string &&channel, std::string &&message)
+    : Command(CommandType::Publish), channel(std::move(channel)), message(std::move(message)) {}
+
+// Example: PUBLISH <channel> <message>
+CommandPtr PublishCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() != 3) {
+        throw CommandParseError("PUBLISH requires a channel and a message");
+    }
+    return std::make_unique<PublishCommand>(std::string{decoded_msg[1]}, std::string{decoded_msg[2]});
+}
+
+// Replicas deliver what their master propagates to their own subscribers too
+void PublishCommand::execute(ServerInfo &server_info) {
+    const size_t receivers = PubSub::publish(this->channel, this->message);
+    if (this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_integer(receivers);
+    }
+}
+
+PubSubCommand::PubSubCommand(Subcommand subcommand, std::vector<std::string> &&args)
+    : Command(CommandType::PubSub), subcommand(subcommand), args(std::move(args)) {}
+
+/**
+ * Examples:
+ * PUBSUB CHANNELS [<pattern>]
+ * PUBSUB NUMSUB [<channel> ...]
+ * PUBSUB NUMPAT
+ */
+CommandPtr PubSubCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for PUBSUB command");
+    }
+
+    std::string subcommand = decoded_msg[1];
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+    std::vector<std::string> args(decoded_msg.begin() + 2, decoded_msg.end());
+
+    if (subcommand == "CHANNELS" && args.size() <= 1) {
+        return std::make_unique<PubSubCommand>(Subcommand::Channels, std::move(args));
+    } else if (subcommand == "NUMSUB") {
+        return std::make_unique<PubSubCommand>(Subcommand::NumSub, std::move(args));
+    } else if (subcommand == "NUMPAT" && args.empty()) {
+        return std::make_unique<PubSubCommand>(Subcommand::NumPat, std::move(args));
+    }
+    throw CommandParseError("Unknown PUBSUB subcommand");
+}
+
+void PubSubCommand::execute(ServerInfo &server_info) {
+    switch (this->subcommand) {
+        case Subcommand::Channels: {
+            const std::vector<std::string> channels = PubSub::get_channels(this->args.empty() ? "" : this->args[0]);
+            this->respond_with([&channels](std::string &out) { MessageParser::append_array(out, channels); });
+            break;
+        }
+        case Subcommand::NumSub: {
+            // channel, subscriber count, ...
+            this->respond_with([this](std::string &out) {
+                MessageParser::append_array_header(out, this->args.size() * 2);
+                for (const std::string &channel : this->args) {
+                    MessageParser::append_bulk_string(out, channel);
+                    MessageParser::append_integer(out, PubSub::get_subscriber_count(channel));
+                }
+            });
+            break;
+        }
+        case Subcommand::NumPat:
+            this->respond_integer(PubSub::get_pattern_count());
+            break;
+    }
+}
+
+AskingCommand::AskingCommand() : Command(CommandType::Asking) {}
+
+// Example: ASKING
+CommandPtr AskingCommand::parse(const DecodedMessage &decoded_msg) {
+    return std::make_unique<AskingCommand>();
+}
+
+void AskingCommand::execute(ServerInfo &server_info) {
+    if (!Cluster::enabled()) {
+        this->respond_error("ERR This instance has cluster support disabled");
+        return;
+    }
+
+    // Taken back by Cluster::redirect before the next command runs
+    auto it = server_info.clients.find(this->client_socket);
+    if (it != server_info.clients.end()) {
+        it->second.asking = true;
+    }
+    this->respond(SharedReplies::ok);
+}
+
+bool is_allowed_when_subscribed(CommandType type) {
+    switch (type) {
+        case CommandType::Subscribe:
+        case CommandType::Unsubscribe:
+        case CommandType::PSubscribe:
+        case CommandType::PUnsubscribe:
+        case CommandType::Ping:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_write_command(CommandType type) {
+    switch (type) {
+        case CommandType::Set:
+        case CommandType::MSet:
+        case CommandType::Del:
+        case CommandType::Unlink:
+        case CommandType::FlushAll:
+        case CommandType::FlushDb:
+        case CommandType::HSet:
+        case CommandType::HDel:
+        case CommandType::HIncrBy:
+        case CommandType::ZAdd:
+        case CommandType::ZPopMin:
+        case CommandType::LPush:
+        case CommandType::RPush:
+        case CommandType::LPop:
+        case CommandType::RPop:
+        case CommandType::Publish:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_read_only_command(CommandType type) {
+    switch (type) {
+        case CommandType::Ping:
+        case CommandType::Echo:
+        case CommandType::Get:
+        case CommandType::Info:
+        case CommandType::ConfigGet:
+        case CommandType::Keys:
+        case CommandType::Type:
+        case CommandType::MGet:
+        case CommandType::Exists:
+        case CommandType::HGet:
+        case CommandType::HMGet:
+        case CommandType::HGetAll:
+        case CommandType::ZScore:
+        case CommandType::ZRange:
+        case CommandType::ZRangeByScore:
+        case CommandType::ZRank:
+        case CommandType::LRange:
+        case CommandType::LLen:
+            return true;
+        default:
+            return false;
+    }
 }
 
 void propagate_command(const std::string_view &command, ServerInfo &server_info) {
     for (const int replica : server_info.replication_info.replica_connections) {
-        send(replica, command.data(), command.size(), 0);
+        send_to_replica(replica, command, server_info);
+        Stats::local().net_repl_output_bytes.add(command.size());
     }
     server_info.bytes_propagated += command.size();
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 #include "message_parser.h"
 #include "server.h"
+#include "tracking.h"
 #include "utils.h"
 
 class CommandParseError : public std::runtime_error {
@@ -15,7 +16,63 @@ class CommandParseError : public std::runtime_error {
     CommandParseError(std::string_view error_msg);
 };
 
-enum class CommandType { Ping, Echo, Set, Get, Info, Replconf, Psync, Wait, ConfigGet, Keys, Type, XAdd };
+enum class CommandType {
+    Ping,
+    Echo,
+    Set,
+    Get,
+    Info,
+    Replconf,
+    Psync,
+    Wait,
+    ConfigGet,
+    Keys,
+    Type,
+    XAdd,
+    MGet,
+    MSet,
+    Del,
+    Exists,
+    Slowlog,
+    Latency,
+    Client,
+    HSet,
+    HGet,
+    HMGet,
+    HDel,
+    HGetAll,
+    HIncrBy,
+    ZAdd,
+    ZScore,
+    ZRange,
+    ZRangeByScore,
+    ZRank,
+    ZPopMin,
+    LPush,
+    RPush,
+    LPop,
+    RPop,
+    BLPop,
+    BRPop,
+    LRange,
+    LLen,
+    Subscribe,
+    Unsubscribe,
+    PSubscribe,
+    PUnsubscribe,
+    Publish,
+    PubSub,
+    Unlink,
+    FlushAll,
+    FlushDb,
+    Cluster,
+    Asking,
+    Migrate,
+    Save
+};
+
+// Lowercase command name as shown by SLOWLOG, LATENCY HISTOGRAM and INFO commandstats
+std::string_view command_name(CommandType type);
 
 class Command;
 using CommandPtr = std::unique_ptr<Command>;
@@ -34,13 +91,31 @@ class Command {
 
     void set_client_socket(int client_socket);
 
+    // Where replies go, set before every execute
+    void set_reply_buffer(std::string *reply_buffer);
+
     virtual void execute(ServerInfo &server_info) = 0;
 
    protected:
     CommandType type;
     int client_socket = 0;
+    std::string *reply_buffer = nullptr;
 
     Command(CommandType type);
+
+    // Queues a reply in the client's reply buffer, which the event loop sends
+    void respond(std::string_view message);
+
+    // Encodes a reply piece by piece straight into the reply buffer, encode is called with the std::string to append to
+    template <typename Encoder>
+    void respond_with(Encoder &&encode) {
+        encode(*this->reply_buffer);
+    }
+
+    void respond_simple_string(std::string_view message);
+    void respond_bulk_string(std::string_view message);
+    void respond_integer(long long num);
+    void respond_error(std::string_view message);
 };
 
 class PingCommand : public Command {
@@ -64,20 +139,6 @@ class EchoCommand : public Command {
     std::string echo_msg;
 };
 
-class InfoCommand : public Command {
-   public:
-    InfoCommand();
-
-    static CommandPtr parse(const DecodedMessage &decoded_msg);
-
-    void execute(ServerInfo &server_info) override;
-
-   private:
-    std::string role;
-    std::string replid;
-    std::string offset;
-};
-
 class ReplconfCommand : public Command {
    public:
     ReplconfCommand();
@@ -94,15 +155,6 @@ class PsyncCommand : public Command {
     static CommandPtr parse(const DecodedMessage &decoded_msg);
 
     void execute(ServerInfo &server_info) override;
-
-    static void initialiseEmptyRdb();
-
-   private:
-    static constexpr const std::string_view empty_rdb_hardcoded =
-        "524544495330303131fa0972656469732d76657205372e322e30fa0a72656469732d62697473c040fa056374696d65c26d08bc65fa0875"
-        "7365642d6d656dc2b0c41000fa08616f662d62617365c000fff06e3bfec0ff5aa2";
-    static std::string empty_rdb_in_bytes;
-    static bool empty_rdb_initialised;
 };
 
 class WaitCommand : public Command {
@@ -131,4 +183,125 @@ class ConfigGetCommand : public Command {
     std::vector<std::string> params;
 };
 
+class SlowlogCommand : public Command {
+   public:
+    enum class Subcommand { Get, Len, Reset };
+
+    SlowlogCommand(Subcommand subcommand, int count);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    Subcommand subcommand;
+    int count;
+};
+
+class LatencyCommand : public Command {
+   public:
+    enum class Subcommand { Latest, History, Reset, Histogram };
+
+    LatencyCommand(Subcommand subcommand, std::vector<std::string> &&args);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    Subcommand subcommand;
+    std::vector<std::string> args;
+};
+
+class ClientCommand : public Command {
+   public:
+    enum class Subcommand { Id, Tracking };
+
+    ClientCommand(Subcommand subcommand, bool tracking_on, Tracking::Options &&tracking_options);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    Subcommand subcommand;
+    bool tracking_on;
+    Tracking::Options tracking_options;
+};
+
+// SUBSCRIBE and PSUBSCRIBE
+class SubscribeCommand : public Command {
+   public:
+    SubscribeCommand(CommandType type, std::vector<std::string> &&names);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    std::vector<std::string> names;  // channels or patterns
+};
+
+// UNSUBSCRIBE and PUNSUBSCRIBE, from everything when no names are given
+class UnsubscribeCommand : public Command {
+   public:
+    UnsubscribeCommand(CommandType type, std::vector<std::string> &&names);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    std::vector<std::string> names;  // channels or patterns
+};
+
+class PublishCommand : public Command {
+   public:
+    PublishCommand(std::string &&channel, std::string &&message);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    std::string channel;
+    std::string message;
+};
+
+class PubSubCommand : public Command {
+   public:
+    enum class Subcommand { Channels, NumSub, NumPat };
+
+    PubSubCommand(Subcommand subcommand, std::vector<std::string> &&args);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    Subcommand subcommand;
+    std::vector<std::string> args;
+};
+
+// Lets the next command use a slot this cluster node is importing
+class AskingCommand : public Command {
+   public:
+    AskingCommand();
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+};
+
+// Commands a client may still send while it is subscribed to channels or patterns
+bool is_allowed_when_subscribed(CommandType type);
+
+// Commands that are propagated to replicas as received: those that modify the store, and PUBLISH so that
+// subscribers of replicas get the messages too. BLPOP and BRPOP are not among them: they propagate the pops they
+// perform instead.
+bool is_write_command(CommandType type);
+
+// Commands that never modify the store, so consecutive ones can be executed as one batch
+bool is_read_only_command(CommandType type);
+
 void propagate_command(const std::string_view &command, ServerInfo &server_info);
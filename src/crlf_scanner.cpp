@@ -0,0 +1,73 @@
+#include "crlf_scanner.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Bit i is set if p[i] == '\r', for n <= 64 bytes
+static uint64_t cr_mask_scalar(const char *p, size_t n) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < n; i++) {
+        mask |= static_cast<uint64_t>(p[i] == '\r') << i;
+    }
+    return mask;
+}
+
+#if defined(__x86_64__)
+static uint64_t cr_mask_sse2(const char *p) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, cr)))) << (16 * i);
+    }
+    return mask;
+}
+
+[[gnu::target("avx2")]] static uint64_t cr_mask_avx2(const char *p) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+    const uint32_t low_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, cr));
+    const uint32_t high_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, cr));
+    return static_cast<uint64_t>(high_mask) << 32 | low_mask;
+}
+
+static const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+// Mask of a full block
+static uint64_t cr_mask(const char *p) {
+#if defined(__x86_64__)
+    return has_avx2 ? cr_mask_avx2(p) : cr_mask_sse2(p);
+#else
+    return cr_mask_scalar(p, CrlfScanner::BLOCK_SIZE);
+#endif
+}
+
+CrlfScanner::CrlfScanner(std::string_view data) : data(data) {}
+
+size_t CrlfScanner::find_cr(size_t pos) {
+    while (pos < this->data.size()) {
+        if (this->block_start == std::string_view::npos || pos < this->block_start ||
+            pos >= this->block_start + BLOCK_SIZE) {
+            load_block(pos);
+        }
+
+        const uint64_t mask = this->block_mask >> (pos - this->block_start);
+        if (mask != 0) {
+            return pos + __builtin_ctzll(mask);
+        }
+        pos = this->block_start + BLOCK_SIZE;
+    }
+    return std::string_view::npos;
+}
+
+void CrlfScanner::load_block(size_t pos) {
+    this->block_start = pos;
+    const size_t remaining = this->data.size() - pos;
+
+    // The last partial block is scanned byte by byte so nothing past the end is ever read
+    this->block_mask = remaining >= BLOCK_SIZE ? cr_mask(this->data.data() + pos)
+                                               : cr_mask_scalar(this->data.data() + pos, remaining);
+}
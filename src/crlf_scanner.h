@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Finds the '\r' of RESP header lines in a buffer, 64 bytes at a time.
+ *
+ * Each block is compared against '\r' with SIMD (AVX2 when the CPU has it, SSE2 otherwise, scalar elsewhere) into a
+ * bitmask. Headers of small commands are packed closely, so one block usually answers several lookups, while bulk
+ * payloads that the parser skips by their declared length are never loaded at all.
+ */
+class CrlfScanner {
+   public:
+    static constexpr size_t BLOCK_SIZE = 64;
+
+    CrlfScanner(std::string_view data);
+
+    // Position of the first '\r' at or after pos, or std::string_view::npos
+    size_t find_cr(size_t pos);
+
+   private:
+    std::string_view data;
+    size_t block_start = std::string_view::npos;
+    uint64_t block_mask = 0;
+
+    void load_block(size_t pos);
+};
@@ -0,0 +1,239 @@
+#include "glob_pattern.h"
+
+#include <algorithm>
+#include <cstring>
+
+GlobPattern::GlobPattern(std::string_view pattern) {
+    Segment current;
+
+    size_t i = 0;
+    while (i < pattern.size()) {
+        const char c = pattern[i];
+        if (c == '*') {
+            if (!this->has_star && current.elements.empty()) this->leading_star = true;
+            this->has_star = true;
+            if (!current.elements.empty()) {
+                this->segments.push_back(std::move(current));
+                current = Segment{};
+            }
+            i++;
+            continue;
+        }
+
+        if (c == '?') {
+            current.elements.push_back({Element::Kind::AnyChar, 0, 0});
+            i++;
+        } else if (c == '[') {
+            i = parse_set(pattern, i + 1, current);
+        } else if (c == '\\' && i + 1 < pattern.size()) {
+            current.elements.push_back({Element::Kind::Literal, pattern[i + 1], 0});
+            i += 2;
+        } else {
+            // A lone trailing backslash matches itself, like Redis
+            current.elements.push_back({Element::Kind::Literal, c, 0});
+            i++;
+        }
+    }
+
+    this->trailing_star = this->has_star && current.elements.empty();
+    if (!current.elements.empty() || !this->has_star) {
+        this->segments.push_back(std::move(current));
+    }
+
+    for (Segment &segment : this->segments) {
+        compute_anchor(segment);
+    }
+
+    if (!this->leading_star && !this->segments.empty()) {
+        for (const Element &element : this->segments[0].elements) {
+            if (element.kind != Element::Kind::Literal) break;
+            this->literal_prefix.push_back(element.ch);
+        }
+    }
+
+    // "*" or "<literal>*"
+    this->prefix_only =
+        this->trailing_star &&
+        (this->segments.empty() || (!this->leading_star && this->segments.size() == 1 &&
+                                    this->literal_prefix.size() == this->segments[0].elements.size()));
+}
+
+// Parses the body of [...] starting right after '[', returns the index just past the closing ']'
+size_t GlobPattern::parse_set(std::string_view pattern, size_t i, Segment &segment) {
+    std::bitset<256> set;
+
+    bool negate = false;
+    if (i < pattern.size() && pattern[i] == '^') {
+        negate = true;
+        i++;
+    }
+
+    // An unterminated set runs until the end of the pattern
+    while (i < pattern.size() && pattern[i] != ']') {
+        if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+            set.set(static_cast<unsigned char>(pattern[i + 1]));
+            i += 2;
+        } else if (i + 2 < pattern.size() && pattern[i + 1] == '-') {
+            unsigned char start = pattern[i];
+            unsigned char end = pattern[i + 2];
+            if (start > end) std::swap(start, end);
+            for (int ch = start; ch <= end; ch++) {
+                set.set(ch);
+            }
+            i += 3;
+        } else {
+            set.set(static_cast<unsigned char>(pattern[i]));
+            i++;
+        }
+    }
+
+    if (negate) set.flip();
+
+    segment.elements.push_back({Element::Kind::Set, 0, static_cast<uint16_t>(this->sets.size())});
+    this->sets.push_back(set);
+
+    return i < pattern.size() ? i + 1 : i;
+}
+
+void GlobPattern::compute_anchor(Segment &segment) {
+    size_t run_start = 0;
+    for (size_t i = 0; i <= segment.elements.size(); i++) {
+        if (i < segment.elements.size() && segment.elements[i].kind == Element::Kind::Literal) continue;
+
+        if (i - run_start > segment.anchor.size()) {
+            segment.anchor.clear();
+            for (size_t j = run_start; j < i; j++) {
+                segment.anchor.push_back(segment.elements[j].ch);
+            }
+            segment.anchor_offset = run_start;
+        }
+        run_start = i + 1;
+    }
+}
+
+bool GlobPattern::match_at(const Segment &segment, std::string_view target, size_t pos) const {
+    for (const Element &element : segment.elements) {
+        const char ch = target[pos++];
+        switch (element.kind) {
+            case Element::Kind::Literal:
+                if (ch != element.ch) return false;
+                break;
+            case Element::Kind::AnyChar:
+                break;
+            case Element::Kind::Set:
+                if (!this->sets[element.set_index].test(static_cast<unsigned char>(ch))) return false;
+                break;
+        }
+    }
+    return true;
+}
+
+// Leftmost position in [from, limit) where segment matches entirely, or npos
+size_t GlobPattern::find(const Segment &segment, std::string_view target, size_t from, size_t limit) const {
+    const size_t len = segment.elements.size();
+    if (limit < from || limit - from < len) return std::string_view::npos;
+    const size_t last_start = limit - len;
+
+    if (segment.anchor.empty()) {
+        for (size_t pos = from; pos <= last_start; pos++) {
+            if (match_at(segment, target, pos)) return pos;
+        }
+        return std::string_view::npos;
+    }
+
+    // Jump between occurrences of the anchor's first byte with memchr (vectorised in libc)
+    const char *data = target.data();
+    const char first = segment.anchor[0];
+    size_t anchor_pos = from + segment.anchor_offset;
+    const size_t last_anchor_pos = last_start + segment.anchor_offset;
+    while (anchor_pos <= last_anchor_pos) {
+        const void *hit = std::memchr(data + anchor_pos, first, last_anchor_pos - anchor_pos + 1);
+        if (hit == nullptr) break;
+
+        anchor_pos = static_cast<const char *>(hit) - data;
+        const size_t pos = anchor_pos - segment.anchor_offset;
+        if (std::memcmp(data + anchor_pos, segment.anchor.data(), segment.anchor.size()) == 0 &&
+            match_at(segment, target, pos)) {
+            return pos;
+        }
+        anchor_pos++;
+    }
+    return std::string_view::npos;
+}
+
+bool GlobPattern::match(std::string_view target) const {
+    if (!this->has_star) {
+        const Segment &segment = this->segments[0];
+        return target.size() == segment.elements.size() && match_at(segment, target, 0);
+    }
+
+    size_t pos = 0;
+    size_t end = target.size();
+    size_t first = 0;
+    size_t last = this->segments.size();
+
+    if (!this->leading_star) {
+        const Segment &segment = this->segments[first++];
+        if (target.size() < segment.elements.size() || !match_at(segment, target, 0)) return false;
+        pos = segment.elements.size();
+    }
+
+    if (!this->trailing_star) {
+        const Segment &segment = this->segments[--last];
+        if (end - pos < segment.elements.size()) return false;
+        end -= segment.elements.size();
+        if (!match_at(segment, target, end)) return false;
+    }
+
+    for (size_t i = first; i < last; i++) {
+        const size_t found = find(this->segments[i], target, pos, end);
+        if (found == std::string_view::npos) return false;
+        pos = found + this->segments[i].elements.size();
+    }
+    return true;
+}
+
+const std::string &GlobPattern::get_literal_prefix() const {
+    return this->literal_prefix;
+}
+
+bool GlobPattern::is_prefix_only() const {
+    return this->prefix_only;
+}
+
+bool GlobPatternSet::insert(std::string_view pattern) {
+    GlobPattern compiled(pattern);
+    std::vector<Entry> &bucket = this->buckets[compiled.get_literal_prefix()];
+    for (const Entry &entry : bucket) {
+        if (entry.pattern == pattern) return false;
+    }
+
+    this->prefix_lengths[compiled.get_literal_prefix().size()]++;
+    bucket.push_back({std::string{pattern}, std::move(compiled)});
+    this->patterns++;
+    return true;
+}
+
+bool GlobPatternSet::erase(std::string_view pattern) {
+    const std::string prefix = GlobPattern(pattern).get_literal_prefix();
+    auto it = this->buckets.find(prefix);
+    if (it == this->buckets.end()) return false;
+
+    std::vector<Entry> &bucket = it->second;
+    auto entry_it = std::find_if(bucket.begin(), bucket.end(), [&](const Entry &e) { return e.pattern == pattern; });
+    if (entry_it == bucket.end()) return false;
+
+    bucket.erase(entry_it);
+    if (bucket.empty()) {
+        this->buckets.erase(it);
+    }
+    if (--this->prefix_lengths[prefix.size()] == 0) {
+        this->prefix_lengths.erase(prefix.size());
+    }
+    this->patterns--;
+    return true;
+}
+
+size_t GlobPatternSet::size() const {
+    return this->patterns;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Redis-compatible glob pattern, compiled once and matched against many keys.
+ *
+ * Supported syntax: * (any run), ? (any char), [abc], [^abc], [a-z] and \x escapes.
+ *
+ * The pattern is split on '*' into fixed-width segments. Since every segment matches exactly as many
+ * characters as it has elements, placing each segment at its leftmost match is always optimal, so matching
+ * never backtracks. Segments are located with memchr on their longest literal run.
+ */
+class GlobPattern {
+   public:
+    GlobPattern(std::string_view pattern);
+
+    bool match(std::string_view target) const;
+
+    // Literal characters every match must start with, eg. "tenant:42:" for "tenant:42:*"
+    const std::string &get_literal_prefix() const;
+
+    // True if the pattern is exactly "<literal-prefix>*", so a prefix check is a full match
+    bool is_prefix_only() const;
+
+   private:
+    struct Element {
+        enum class Kind : uint8_t { Literal, AnyChar, Set };
+        Kind kind;
+        char ch;
+        uint16_t set_index;
+    };
+
+    struct Segment {
+        std::vector<Element> elements;
+        std::string anchor;  // longest literal run, used to locate candidates
+        size_t anchor_offset = 0;
+    };
+
+    std::vector<Segment> segments;
+    std::vector<std::bitset<256>> sets;
+    bool has_star = false;
+    bool leading_star = false;
+    bool trailing_star = false;
+    bool prefix_only = false;
+    std::string literal_prefix;
+
+    bool match_at(const Segment &segment, std::string_view target, size_t pos) const;
+    size_t find(const Segment &segment, std::string_view target, size_t from, size_t limit) const;
+    size_t parse_set(std::string_view pattern, size_t i, Segment &segment);
+    static void compute_anchor(Segment &segment);
+};
+
+/**
+ * Many patterns matched against one target at a time, eg. the channel patterns of PSUBSCRIBE.
+ *
+ * Patterns are bucketed by their literal prefix, and a target only probes the buckets of its own prefixes, of the
+ * lengths in use. Patterns that cannot match it are never tried, and "<literal-prefix>*" patterns match without
+ * running the matcher at all.
+ */
+class GlobPatternSet {
+   public:
+    // False if the pattern was already in the set
+    bool insert(std::string_view pattern);
+
+    // False if the pattern was not in the set
+    bool erase(std::string_view pattern);
+
+    size_t size() const;
+
+    // Calls fn(pattern) for every pattern in the set that matches target
+    template <typename Fn>
+    void for_each_match(std::string_view target, Fn &&fn) const {
+        for (const auto &[length, count] : this->prefix_lengths) {
+            if (length > target.size()) break;
+
+            auto it = this->buckets.find(target.substr(0, length));
+            if (it == this->buckets.end()) continue;
+            for (const Entry &entry : it->second) {
+                if (entry.compiled.is_prefix_only() || entry.compiled.match(target)) {
+                    fn(std::string_view{entry.pattern});
+                }
+            }
+        }
+    }
+
+   private:
+    struct Entry {
+        std::string pattern;
+        GlobPattern compiled;
+    };
+
+    std::map<std::string, std::vector<Entry>, std::less<>> buckets;  // keyed by literal prefix
+    std::map<size_t, size_t> prefix_lengths;                         // literal prefix length, patterns with it
+    size_t patterns = 0;
+};
@@ -1,25 +1,126 @@
 #include "handler.h"
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
+#include <array>
+#include <cerrno>
+
+#include "blocking.h"
+#include "cluster.h"
 #include "commands.h"
+#include "latency.h"
 #include "logger.h"
 #include "message_parser.h"
+#include "pubsub.h"
+#include "shards.h"
+#include "stats.h"
 #include "storage.h"
 #include "storage_commands.h"
+#include "tracking.h"
 #include "utils.h"
 
-void respond_failure(int client_socket, std::string_view error) {
-    send(client_socket, error.data(), error.size(), 0);
+static constexpr int RECV_CHUNK_SIZE = 16 * 1024;
+static constexpr size_t MAX_QUERY_BUFFER_SIZE = 1024 * 1024 * 1024;
+static constexpr size_t MAX_IOVECS = 64;
+
+// Sends what the socket takes of the file at the front of the output. Client sockets are blocking and sendfile has
+// no MSG_DONTWAIT, so the socket is non-blocking for the duration of the call.
+static ssize_t send_file(int client_socket, const OutputChunk &chunk) {
+    const int flags = fcntl(client_socket, F_GETFL);
+    fcntl(client_socket, F_SETFL, flags | O_NONBLOCK);
+    off_t offset = chunk.sent;
+    const ssize_t n = sendfile(client_socket, chunk.file->fd, &offset, chunk.size() - chunk.sent);
+    const int send_errno = errno;
+    fcntl(client_socket, F_SETFL, flags);
+    errno = send_errno;
+    return n;
 }
 
-int Handler::handle_client(int client_socket, Server &server) {
-    ServerInfo &server_info = server.get_server_info();
-    StoragePtr storage_ptr = server.get_storage_ptr();
+// Writes as much of the client's output as the socket takes without blocking. The rest stays queued, and the event
+// loop sends it once the socket is writable again, so a client that reads slowly never stalls the others.
+int Handler::flush_replies(int client_socket, Client &client) {
+    size_t written = 0;
+    while (client.has_pending_output()) {
+        size_t requested = 0;
+        ssize_t n;
+        bool includes_reply_buffer = false;
+        const bool sending_file = !client.output.empty() && client.output.front().file;
+        if (sending_file) {
+            requested = client.output.front().size() - client.output.front().sent;
+            n = send_file(client_socket, client.output.front());
+        } else {
+            // Up to the next file, which goes out with sendfile
+            std::array<iovec, MAX_IOVECS> iov;
+            size_t iov_count = 0;
+            auto it = client.output.begin();
+            for (; it != client.output.end() && iov_count < MAX_IOVECS && !it->file; ++it) {
+                iov[iov_count++] = {const_cast<char *>(it->data->data()) + it->sent, it->data->size() - it->sent};
+                requested += it->data->size() - it->sent;
+            }
+            includes_reply_buffer =
+                it == client.output.end() && iov_count < MAX_IOVECS && !client.reply_buffer.empty();
+            if (includes_reply_buffer) {
+                iov[iov_count++] = {client.reply_buffer.data(), client.reply_buffer.size()};
+                requested += client.reply_buffer.size();
+            }
+
+            msghdr msg{};
+            msg.msg_iov = iov.data();
+            msg.msg_iovlen = iov_count;
+            n = sendmsg(client_socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        // A file that sends nothing is shorter than it was when it was queued
+        if (n < 0 || (n == 0 && sending_file)) {
+            ERROR("Error sending replies to client " << client_socket);
+            client.output.clear();
+            client.output_bytes = 0;
+            client.reply_buffer.clear();
+            return 1;
+        }
+        written += n;
+
+        const size_t left = n - client.consume_output(n);
+        if (includes_reply_buffer && left == client.reply_buffer.size()) {
+            client.reply_buffer.clear();
+        } else if (includes_reply_buffer && left > 0) {
+            client.queue_reply_buffer(left);
+        }
+
+        // The socket buffer is full
+        if (static_cast<size_t>(n) < requested) break;
+    }
+
+    // Replies of later commands must go after what is still queued
+    if (!client.reply_buffer.empty()) {
+        client.queue_reply_buffer();
+    }
+    if (client.output.empty()) {
+        client.soft_limit_since.reset();
+    }
+    Stats::local().net_output_bytes.add(written);
+    return 0;
+}
+
+// The client is closed right after, so the error is sent now unless earlier output is still on its way
+int respond_failure(int client_socket, Client &client, std::string_view error) {
+    MessageParser::append_simple_error(client.reply_buffer, error);
+    if (client.output.empty()) {
+        Handler::flush_replies(client_socket, client);
+    }
+    return 1;
+}
 
-    std::vector<char> buf(1024);
-    const int recv_bytes = recv(client_socket, buf.data(), 1024, 0);
+// Appends what the client sent to its query buffer, returns non-zero once it should be disconnected
+static int receive_query(int client_socket, Client &client) {
+    std::array<char, RECV_CHUNK_SIZE> buf;
+    const int recv_bytes = recv(client_socket, buf.data(), RECV_CHUNK_SIZE, 0);
 
     if (recv_bytes < 0) {
         ERROR("Error receiving bytes while handling client");
@@ -29,49 +130,237 @@ int Handler::handle_client(int client_socket, Server &server) {
         return 1;
     }
 
-    std::string_view msg(buf.data());
-    LOG("Port " << server_info.tcp_port << ", message received from " << client_socket << ": " << msg.data());
+    Stats::local().net_input_bytes.add(recv_bytes);
+    client.query_buffer.append(buf.data(), recv_bytes);
+    if (client.query_buffer.size() > MAX_QUERY_BUFFER_SIZE) {
+        ERROR("Query buffer of client " << client_socket << " exceeded its limit");
+        return 1;
+    }
+    return 0;
+}
+
+int Handler::handle_client(int client_socket, Server &server) {
+    ServerInfo &server_info = server.get_server_info();
+    if (receive_query(client_socket, server_info.clients[client_socket]) != 0) {
+        return 1;
+    }
 
-    if (msg == null_bulk_string) return 0;
+    // The commands of a blocked client, or of one whose command runs on another shard, wait in the query buffer
+    if (is_waiting(client_socket, server_info.clients[client_socket])) {
+        return 0;
+    }
+    return process_query_buffer(client_socket, server);
+}
+
+int Handler::read_query(int client_socket, Client &client, ParsedQuery &parsed) {
+    if (receive_query(client_socket, client) != 0) {
+        return 1;
+    }
+    if (!is_waiting(client_socket, client)) {
+        parse_query(client, parsed);
+    }
+    return 0;
+}
+
+void Handler::parse_query(Client &client, ParsedQuery &parsed) {
+    std::string_view msg(client.query_buffer);
+    if (msg == SharedReplies::null_bulk_string) {
+        parsed.bytes_consumed = msg.size();
+        return;
+    }
 
-    std::vector<std::pair<DecodedMessage, int>> commands;
     try {
-        commands = MessageParser::parse_message(msg);
+        parsed.commands = MessageParser::parse_message(msg, parsed.bytes_consumed, &client.multibulk_progress);
     } catch (CommandParseError const &e) {
         ERROR("Error parsing command" << e.what());
-        respond_failure(client_socket, MessageParser::encode_simple_error("Error parsing message"));
+        parsed.malformed = true;
+        return;
+    }
+
+    // Parse everything up front so that runs of read-only commands can be recognised. A parse error still only
+    // surfaces after every command before it has been executed.
+    parsed.cmd_ptrs.reserve(parsed.commands.size());
+    for (const auto &[command, num_bytes] : parsed.commands) {
+        try {
+            parsed.cmd_ptrs.push_back(Command::parse(command));
+        } catch (CommandParseError const &e) {
+            parsed.parse_error = e.what();
+            break;
+        }
+    }
+}
+
+int Handler::handle_input(int client_socket, Server &server, std::string_view data) {
+    ServerInfo &server_info = server.get_server_info();
+    Client &client = server_info.clients[client_socket];
+
+    Stats::local().net_input_bytes.add(data.size());
+    client.query_buffer.append(data);
+    if (client.query_buffer.size() > MAX_QUERY_BUFFER_SIZE) {
+        ERROR("Query buffer of client " << client_socket << " exceeded its limit");
         return 1;
     }
 
-    for (auto [command, num_bytes] : commands) {
-        CommandPtr cmd_ptr;
-        CommandType type;
+    // The commands of a blocked client, or of one whose command runs on another shard, wait in the query buffer
+    if (is_waiting(client_socket, client)) {
+        return 0;
+    }
+    return process_query_buffer(client_socket, server);
+}
+
+bool Handler::is_waiting(int client_socket, const Client &client) {
+    return !client.shard_requests.empty() || Blocking::is_blocked(client_socket);
+}
+
+int Handler::process_query_buffer(int client_socket, Server &server, ParsedQuery *parsed) {
+    ServerInfo &server_info = server.get_server_info();
+    StoragePtr storage_ptr = server.get_storage_ptr();
+    Client &client = server_info.clients[client_socket];
+
+    std::string_view msg(client.query_buffer);
+    LOG_RATE_LIMITED(100,
+                     "Port " << server_info.tcp_port << ", message received from " << client_socket << ": " << msg);
+
+    ParsedQuery parsed_here;
+    if (parsed == nullptr) {
+        parse_query(client, parsed_here);
+        parsed = &parsed_here;
+    }
+    if (parsed->malformed) {
+        return respond_failure(client_socket, client, "Error parsing message");
+    }
+    const std::vector<std::pair<DecodedMessage, int>> &commands = parsed->commands;
+    const std::vector<CommandPtr> &cmd_ptrs = parsed->cmd_ptrs;
+    const std::string &parse_error = parsed->parse_error;
+    const size_t bytes_consumed = parsed->bytes_consumed;
+
+    for (size_t i = 0; i < cmd_ptrs.size(); i++) {
+        // Read-only commands cannot affect each other, so the keys of a whole run of them are prefetched before any
+        // of them executes. Their replies all land in the same reply buffer and go out in a single send.
+        if (i == 0 || !is_read_only_command(cmd_ptrs[i - 1]->get_type())) {
+            std::vector<std::string_view> run_keys;
+            for (size_t j = i; j < cmd_ptrs.size() && is_read_only_command(cmd_ptrs[j]->get_type()); j++) {
+                if (StorageCommand *storage_cmd = dynamic_cast<StorageCommand *>(cmd_ptrs[j].get())) {
+                    const std::vector<std::string_view> keys = storage_cmd->get_keys();
+                    run_keys.insert(run_keys.end(), keys.begin(), keys.end());
+                }
+            }
+            storage_ptr->prefetch(run_keys);
+        }
+
+        const CommandPtr &cmd_ptr = cmd_ptrs[i];
+        const auto &[command, num_bytes] = commands[i];
+        const CommandType type = cmd_ptr->get_type();
+
+        // At some point we must distinguish these anyway, unless we blindly pass all information
+        StorageCommand *storage_cmd = dynamic_cast<StorageCommand *>(cmd_ptr.get());
+
+        // A subscribed connection reads Pub/Sub messages, replies to anything else would be mixed up with them
+        if (PubSub::is_subscribed(client_socket) && !is_allowed_when_subscribed(type)) {
+            MessageParser::append_simple_error(client.reply_buffer,
+                                               "ERR Can't execute '" + std::string{command_name(type)} +
+                                                   "': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this "
+                                                   "context");
+            continue;
+        }
+
+        // Keys of other shards are theirs to execute on. The rest of the pipeline is forwarded right behind, unless
+        // it has to run here, then it waits for the replies still due.
+        if (Shards::enabled()) {
+            Shards::Plan plan = Shards::plan(*cmd_ptr, command, !client.shard_requests.empty());
+            if (plan.wait) {
+                size_t executed_bytes = 0;
+                for (size_t j = 0; j < i; j++) executed_bytes += commands[j].second;
+                client.consume_query(executed_bytes);
+                server_info.pending_writes.insert(client_socket);
+                return 0;
+            }
+            if (!plan.error.empty()) {
+                MessageParser::append_simple_error(client.reply_buffer, plan.error);
+                continue;
+            }
+            if (!plan.parts.empty()) {
+                Shards::dispatch(client_socket, client, type, std::move(plan.parts));
+                continue;
+            }
+        }
+
+        // Keys of slots other cluster nodes serve are answered with where to send them instead
+        if (Cluster::enabled() && client_socket != server_info.replication_info.master_fd) {
+            const std::string redirect = Cluster::redirect(*cmd_ptr, client, *storage_ptr);
+            if (!redirect.empty()) {
+                MessageParser::append_simple_error(client.reply_buffer, redirect);
+                continue;
+            }
+        }
 
         try {
-            cmd_ptr = Command::parse(command);
             cmd_ptr->set_client_socket(client_socket);
-            type = cmd_ptr->get_type();
-
-            // At some point we must distinguish these anyway, unless we blindly pass all information
-            if (StorageCommand *storage_cmd = dynamic_cast<StorageCommand *>(cmd_ptr.get())) {
+            cmd_ptr->set_reply_buffer(&client.reply_buffer);
+            if (storage_cmd != nullptr) {
                 storage_cmd->set_store_ref(storage_ptr);
             }
 
+            // WAIT blocks on the replicas, earlier replies should not be held back by it
+            if (type == CommandType::Wait && client.output.empty() &&
+                Handler::flush_replies(client_socket, client) != 0) {
+                return 1;
+            }
+
+            Tracking::set_current_client(client.id);
+            const uint64_t start_ticks = CycleClock::now();
             cmd_ptr->execute(server_info);
+            LatencyMonitor::record_command(type, command, CycleClock::now() - start_ticks);
+            Stats::local().total_commands_processed.add();
         } catch (CommandParseError const &e) {
             ERROR("Error while handling command. Command: " << msg << ". Error: " << e.what());
-            respond_failure(client_socket, MessageParser::encode_simple_error(e.what()));
-            return 1;
+            return respond_failure(client_socket, client, e.what());
         }
 
-        if (type == CommandType::Set) {
-            propagate_command(msg, server_info);
+        if (is_write_command(type)) {
+            propagate_command(MessageParser::encode_array(command), server_info);
+        } else if (Tracking::active() && storage_cmd != nullptr && is_read_only_command(type)) {
+            Tracking::remember_keys(client.id, storage_cmd->get_keys());
+        }
+
+        // Elements pushed to keys with blocked clients go straight to them, before the next command can see them
+        if (Blocking::has_ready_keys()) {
+            Blocking::serve_ready_keys(*storage_ptr);
         }
 
         if (client_socket == server_info.replication_info.master_fd) {
             server_info.replication_info.master_repl_offset += num_bytes;
         }
+
+        // The rest of the pipeline runs once the client is unblocked
+        if (Blocking::is_blocked(client_socket)) {
+            size_t executed_bytes = 0;
+            for (size_t j = 0; j <= i; j++) executed_bytes += commands[j].second;
+            client.consume_query(executed_bytes);
+            server_info.pending_writes.insert(client_socket);
+            return 0;
+        }
+    }
+
+    client.consume_query(bytes_consumed);
+
+    if (!parse_error.empty()) {
+        ERROR("Error while handling command. Error: " << parse_error);
+        return respond_failure(client_socket, client, parse_error);
     }
 
+    // Sent by the reactor with the replies of every other client handled in this event loop iteration
+    server_info.pending_writes.insert(client_socket);
     return 0;
-}
\ No newline at end of file
+}
+
+void Handler::flush_pending_writes(ServerInfo &server_info) {
+    for (const int client_socket : server_info.pending_writes) {
+        // The client may have disconnected since its reply was queued
+        auto it = server_info.clients.find(client_socket);
+        if (it != server_info.clients.end() && Handler::flush_replies(client_socket, it->second) != 0) {
+            server_info.pending_closes.insert(client_socket);
+        }
+    }
+    server_info.pending_writes.clear();
+}
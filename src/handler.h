@@ -1,8 +1,46 @@
 #pragma once
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "commands.h"
 #include "server.h"
 
 class Handler {
    public:
+    // Commands decoded from a client's query buffer, ready to execute
+    struct ParsedQuery {
+        std::vector<std::pair<DecodedMessage, int>> commands;
+        std::vector<CommandPtr> cmd_ptrs;  // may stop short of commands at parse_error
+        std::string parse_error;
+        size_t bytes_consumed = 0;
+        bool malformed = false;  // not valid RESP
+    };
+
+    // Reads what the client sent and executes every complete command in its query buffer
     static int handle_client(int client_socket, Server &server);
+
+    // Same with input the reactor already received
+    static int handle_input(int client_socket, Server &server, std::string_view data);
+
+    // Reads what the client sent and decodes its commands into parsed, unless it is blocked. Only touches the client,
+    // so I/O threads can read several clients at once while the event loop thread waits.
+    static int read_query(int client_socket, Client &client, ParsedQuery &parsed);
+
+    static void parse_query(Client &client, ParsedQuery &parsed);
+
+    // Whether the client's buffered commands have to wait, because it is blocked or its current command runs on
+    // other shards
+    static bool is_waiting(int client_socket, const Client &client);
+
+    // Executes the commands already buffered for the client, eg. once it is no longer blocked. They are decoded here
+    // unless parsed holds them already.
+    static int process_query_buffer(int client_socket, Server &server, ParsedQuery *parsed = nullptr);
+
+    // Sends what the socket takes of the client's queued output without blocking, returns non-zero on error
+    static int flush_replies(int client_socket, Client &client);
+
+    // Sends the replies queued for the clients in pending_writes, for the readiness based reactors
+    static void flush_pending_writes(ServerInfo &server_info);
 };
\ No newline at end of file
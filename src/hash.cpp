@@ -0,0 +1,117 @@
+#include "hash.h"
+
+size_t Hash::max_listpack_entries = 128;
+size_t Hash::max_listpack_value = 64;
+
+Hash::Hash(const Hash &other)
+    : packed(other.packed),
+      packed_entries(other.packed_entries),
+      table(other.table ? std::make_unique<Table>(*other.table) : nullptr) {}
+
+Hash &Hash::operator=(const Hash &other) {
+    if (this != &other) {
+        this->packed = other.packed;
+        this->packed_entries = other.packed_entries;
+        this->table = other.table ? std::make_unique<Table>(*other.table) : nullptr;
+    }
+    return *this;
+}
+
+bool Hash::set(std::string_view field, std::string_view value) {
+    if (!this->table) {
+        // Replacing a value keeps the entry count, so a full hash only converts when a field is added
+        const bool oversized = field.size() > max_listpack_value || value.size() > max_listpack_value;
+        if (oversized || (this->packed_entries >= max_listpack_entries && find_packed(field) == std::string::npos)) {
+            convert();
+        }
+    }
+
+    if (this->table) {
+        auto [it, inserted] = this->table->try_emplace(std::string{field}, value);
+        if (!inserted) {
+            it->second.assign(value);
+        }
+        return inserted;
+    }
+
+    const size_t entry = find_packed(field);
+    if (entry == std::string::npos) {
+        Listpack::append_string(this->packed, field);
+        Listpack::append_string(this->packed, value);
+        this->packed_entries++;
+        return true;
+    }
+
+    // Splice the new value over the old one, length prefix included
+    size_t value_start = entry;
+    Listpack::read_string(this->packed, value_start);
+    size_t value_end = value_start;
+    Listpack::read_string(this->packed, value_end);
+
+    std::string encoded;
+    Listpack::append_string(encoded, value);
+    this->packed.replace(value_start, value_end - value_start, encoded);
+    return false;
+}
+
+std::optional<std::string_view> Hash::get(std::string_view field) const {
+    if (this->table) {
+        auto it = this->table->find(field);
+        if (it == this->table->end()) return std::nullopt;
+        return it->second;
+    }
+
+    size_t pos = find_packed(field);
+    if (pos == std::string::npos) return std::nullopt;
+    Listpack::read_string(this->packed, pos);
+    return Listpack::read_string(this->packed, pos);
+}
+
+bool Hash::erase(std::string_view field) {
+    if (this->table) {
+        auto it = this->table->find(field);
+        if (it == this->table->end()) return false;
+        this->table->erase(it);
+        return true;
+    }
+
+    const size_t entry = find_packed(field);
+    if (entry == std::string::npos) return false;
+
+    size_t entry_end = entry;
+    Listpack::read_string(this->packed, entry_end);
+    Listpack::read_string(this->packed, entry_end);
+    this->packed.erase(entry, entry_end - entry);
+    this->packed_entries--;
+    return true;
+}
+
+size_t Hash::size() const {
+    return this->table ? this->table->size() : this->packed_entries;
+}
+
+bool Hash::is_packed() const {
+    return !this->table;
+}
+
+size_t Hash::find_packed(std::string_view field) const {
+    size_t pos = 0;
+    while (pos < this->packed.size()) {
+        const size_t entry = pos;
+        const bool match = Listpack::read_string(this->packed, pos) == field;
+        if (match) return entry;
+        Listpack::read_string(this->packed, pos);
+    }
+    return std::string::npos;
+}
+
+void Hash::convert() {
+    auto table = std::make_unique<Table>();
+    table->reserve(this->packed_entries + 1);
+    for_each(
+        [&table](std::string_view field, std::string_view value) { table->try_emplace(std::string{field}, value); });
+
+    this->table = std::move(table);
+    std::string{}.swap(this->packed);
+    this->packed_entries = 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "listpack.h"
+
+/**
+ * Field-value map behind the hash type.
+ *
+ * Small hashes are packed into one contiguous buffer of [varint length][field][varint length][value] entries, like
+ * Redis' listpack: a single allocation, no per-field nodes, and a linear scan that stays within a few cache lines.
+ * Once a hash grows past max_listpack_entries fields, or stores a field or value longer than max_listpack_value
+ * bytes, it is converted to a hash table for good.
+ */
+class Hash {
+   public:
+    static size_t max_listpack_entries;  // hash-max-listpack-entries
+    static size_t max_listpack_value;    // hash-max-listpack-value, in bytes
+
+    Hash() = default;
+    Hash(const Hash &other);
+    Hash &operator=(const Hash &other);
+    Hash(Hash &&) noexcept = default;
+    Hash &operator=(Hash &&) noexcept = default;
+
+    // Returns true if field was added, false if an existing value was replaced
+    bool set(std::string_view field, std::string_view value);
+
+    // The view is valid until the hash is next modified
+    std::optional<std::string_view> get(std::string_view field) const;
+
+    // Returns true if field existed
+    bool erase(std::string_view field);
+
+    size_t size() const;
+
+    bool is_packed() const;
+
+    // Calls fn(field, value) for every entry, in insertion order while packed
+    template <typename Fn>
+    void for_each(Fn &&fn) const {
+        if (this->table) {
+            for (const auto &[field, value] : *this->table) {
+                fn(std::string_view{field}, std::string_view{value});
+            }
+            return;
+        }
+
+        size_t pos = 0;
+        while (pos < this->packed.size()) {
+            const std::string_view field = Listpack::read_string(this->packed, pos);
+            const std::string_view value = Listpack::read_string(this->packed, pos);
+            fn(field, value);
+        }
+    }
+
+   private:
+    struct FieldHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view field) const {
+            return std::hash<std::string_view>{}(field);
+        }
+    };
+    using Table = std::unordered_map<std::string, std::string, FieldHash, std::equal_to<>>;
+
+    std::string packed;
+    uint32_t packed_entries = 0;
+    std::unique_ptr<Table> table;  // set once converted, packed is empty from then on
+
+    // Offset of the entry holding field in packed, or std::string::npos
+    size_t find_packed(std::string_view field) const;
+
+    void convert();
+};
@@ -0,0 +1,82 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+Histogram::Histogram() : counts(index_of((uint64_t(1) << MAX_VALUE_BITS) - 1) + 1, 0) {}
+
+size_t Histogram::index_of(uint64_t value) {
+    if (value < 2 * SUB_BUCKETS) return value;
+
+    // Values in [2^k, 2^(k+1)) share one shift, which keeps their top SUB_BUCKET_BITS + 1 bits
+    const int shift = (63 - __builtin_clzll(value)) - SUB_BUCKET_BITS;
+    return SUB_BUCKETS * shift + (value >> shift);
+}
+
+uint64_t Histogram::highest_value_of(size_t index) {
+    if (index < 2 * SUB_BUCKETS) return index;
+
+    const int shift = index / SUB_BUCKETS - 1;
+    return ((index - SUB_BUCKETS * shift) << shift) + (uint64_t(1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    value = std::min(value, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+    this->counts[index_of(value)]++;
+    this->count++;
+    this->min = std::min(this->min, value);
+    this->max = std::max(this->max, value);
+}
+
+void Histogram::reset() {
+    std::fill(this->counts.begin(), this->counts.end(), 0);
+    this->count = 0;
+    this->min = UINT64_MAX;
+    this->max = 0;
+}
+
+uint64_t Histogram::get_count() const {
+    return this->count;
+}
+
+uint64_t Histogram::get_max() const {
+    return this->max;
+}
+
+uint64_t Histogram::get_min() const {
+    return this->count == 0 ? 0 : this->min;
+}
+
+uint64_t Histogram::percentile(double percentile) const {
+    if (this->count == 0) return 0;
+
+    const uint64_t target =
+        std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(this->count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < this->counts.size(); i++) {
+        seen += this->counts[i];
+        if (seen >= target) {
+            return std::min(highest_value_of(i), this->max);
+        }
+    }
+    return this->max;
+}
+
+uint64_t Histogram::count_between(uint64_t from, uint64_t to) const {
+    const size_t last = std::min(this->counts.size(), to >= (uint64_t(1) << MAX_VALUE_BITS) ? this->counts.size()
+                                                                                           : index_of(to));
+    uint64_t res = 0;
+    for (size_t i = index_of(std::min(from, (uint64_t(1) << MAX_VALUE_BITS) - 1)); i < last; i++) {
+        res += this->counts[i];
+    }
+    return res;
+}
+
+void Histogram::merge(const Histogram &other) {
+    for (size_t i = 0; i < this->counts.size(); i++) {
+        this->counts[i] += other.counts[i];
+    }
+    this->count += other.count;
+    this->min = std::min(this->min, other.min);
+    this->max = std::max(this->max, other.max);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * HDR-style log-linear histogram of non-negative integers, eg. latencies in nanoseconds.
+ *
+ * Every power-of-two range is split into SUB_BUCKETS linear buckets, so any recorded value is reported with a
+ * relative error below 1 / SUB_BUCKETS (~1.6%) no matter its magnitude. Recording is a couple of shifts and
+ * one increment, with no allocation.
+ */
+class Histogram {
+   public:
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 40;  // ~18 minutes in nanoseconds, larger values are clamped
+
+    Histogram();
+
+    void record(uint64_t value);
+    void reset();
+
+    uint64_t get_count() const;
+    uint64_t get_max() const;
+    uint64_t get_min() const;
+
+    // Smallest recorded value such that at least percentile % of all values are <= it, eg. percentile(99.9)
+    uint64_t percentile(double percentile) const;
+
+    // Number of recorded values in [from, to)
+    uint64_t count_between(uint64_t from, uint64_t to) const;
+
+    void merge(const Histogram &other);
+
+   private:
+    std::vector<uint64_t> counts;
+    uint64_t count = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+
+    static size_t index_of(uint64_t value);
+    static uint64_t highest_value_of(size_t index);
+};
@@ -0,0 +1,39 @@
+#include "io_threads.h"
+
+#include <latch>
+
+IoThreads::IoThreads(size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->thread = std::thread([context = &worker->context] { context->run(); });
+        this->workers.push_back(std::move(worker));
+    }
+}
+
+IoThreads::~IoThreads() {
+    for (const auto &worker : this->workers) {
+        worker->work_guard.reset();
+    }
+    for (const auto &worker : this->workers) {
+        worker->thread.join();
+    }
+}
+
+void IoThreads::run(size_t count, const std::function<void(size_t)> &work) {
+    const size_t num_threads = size();
+    if (count < num_threads * MIN_ITEMS_PER_THREAD) {
+        for (size_t i = 0; i < count; i++) work(i);
+        return;
+    }
+
+    // Round robin, so clients accepted around the same time, which tend to be equally busy, are spread out
+    std::latch done(this->workers.size());
+    for (size_t t = 1; t < num_threads; t++) {
+        asio::post(this->workers[t - 1]->context, [&work, &done, count, num_threads, t] {
+            for (size_t i = t; i < count; i += num_threads) work(i);
+            done.count_down();
+        });
+    }
+    for (size_t i = 0; i < count; i += num_threads) work(i);
+    done.wait();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+    Pool that reads and writes client sockets in parallel for the event loop, like Redis' threaded I/O.
+
+    The event loop thread hands out a batch of clients and works on a share of it itself, then waits until every
+    thread is done before it goes on. Commands still only execute on the event loop thread, between the read and the
+    write batches, so nothing but the clients' own buffers is ever touched from two threads.
+
+    Every I/O thread runs its own asio io_context, the batches are posted to them.
+*/
+class IoThreads {
+   public:
+    // count includes the event loop thread, so count - 1 threads are started
+    IoThreads(size_t count);
+    ~IoThreads();
+
+    IoThreads(const IoThreads &) = delete;
+    IoThreads &operator=(const IoThreads &) = delete;
+
+    size_t size() const {
+        return this->workers.size() + 1;
+    }
+
+    // Calls work(i) for every i below count spread over all threads, returns once each call returned
+    void run(size_t count, const std::function<void(size_t)> &work);
+
+   private:
+    // Below this many items per thread the batch runs on the event loop thread alone, waking the others would cost
+    // more than it saves
+    static constexpr size_t MIN_ITEMS_PER_THREAD = 2;
+
+    struct Worker {
+        asio::io_context context;
+        asio::executor_work_guard<asio::io_context::executor_type> work_guard{context.get_executor()};
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+using IoThreadsPtr = std::unique_ptr<IoThreads>;
@@ -0,0 +1,374 @@
+#include "io_uring_reactor.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+
+#include "logger.h"
+#include "server.h"
+#include "stats.h"
+
+static int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+                          size_t arg_size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+static int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+IoUringReactor::IoUringReactor(ServerInfo &server_info) : Reactor(Backend::IoUring, server_info) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    this->ring_fd = io_uring_setup(RING_ENTRIES, &params);
+    if (this->ring_fd < 0) {
+        throw std::runtime_error(std::string{"io_uring_setup failed: "} + strerror(errno));
+    }
+
+    // The destructor does not run when the constructor throws, so the ring has to be released by hand
+    auto fail = [this](const std::string &reason) {
+        release();
+        throw std::runtime_error(reason);
+    };
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        fail("kernel lacks single mmap or extended wait arguments");
+    }
+
+    this->sq_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                  params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    this->sq_ring = mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         this->ring_fd, IORING_OFF_SQ_RING);
+    if (this->sq_ring == MAP_FAILED) {
+        this->sq_ring = nullptr;
+        fail("mmap of the rings failed");
+    }
+    this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    this->sqes = static_cast<io_uring_sqe *>(mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES));
+    if (this->sqes == MAP_FAILED) {
+        this->sqes = nullptr;
+        fail("mmap of the submission entries failed");
+    }
+
+    char *ring = static_cast<char *>(this->sq_ring);
+    this->sq_head = reinterpret_cast<unsigned *>(ring + params.sq_off.head);
+    this->sq_tail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    this->sq_mask = *reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    this->sq_entries = params.sq_entries;
+    this->sq_array = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+    this->cq_head = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    this->cq_tail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    this->cq_mask = *reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    this->cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+    this->sqe_tail = this->submitted_tail = *this->sq_tail;
+
+    this->buf_ring_size = BUFFER_COUNT * sizeof(io_uring_buf);
+    void *buf_ring = mmap(nullptr, this->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        fail("mmap of the buffer ring failed");
+    }
+    this->buf_ring = static_cast<io_uring_buf_ring *>(buf_ring);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(this->buf_ring);
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (io_uring_register(this->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        fail(std::string{"registering the buffer ring failed: "} + strerror(errno));
+    }
+
+    this->buffers = std::make_unique<char[]>(static_cast<size_t>(BUFFER_COUNT) * BUFFER_SIZE);
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) {
+        recycle_buffer(i);
+    }
+}
+
+IoUringReactor::~IoUringReactor() {
+    release();
+}
+
+void IoUringReactor::release() {
+    if (this->buf_ring != nullptr) munmap(this->buf_ring, this->buf_ring_size);
+    if (this->sqes != nullptr) munmap(this->sqes, this->sqes_size);
+    if (this->sq_ring != nullptr) munmap(this->sq_ring, this->sq_ring_size);
+    if (this->ring_fd >= 0) close(this->ring_fd);
+    this->buf_ring = nullptr;
+    this->sqes = nullptr;
+    this->sq_ring = nullptr;
+    this->ring_fd = -1;
+}
+
+void IoUringReactor::add_listener(int fd) {
+    auto socket = std::make_unique<Socket>();
+    socket->fd = fd;
+    socket->listener = true;
+    arm_accept(*socket);
+    this->sockets[fd] = std::move(socket);
+}
+
+void IoUringReactor::add_connection(int fd) {
+    auto socket = std::make_unique<Socket>();
+    socket->fd = fd;
+    arm_recv(*socket);
+    this->sockets[fd] = std::move(socket);
+}
+
+void IoUringReactor::add_notifier(int fd) {
+    auto socket = std::make_unique<Socket>();
+    socket->fd = fd;
+    arm_poll(*socket);
+    this->sockets[fd] = std::move(socket);
+}
+
+void IoUringReactor::remove_connection(int fd) {
+    auto it = this->sockets.find(fd);
+    if (it == this->sockets.end()) return;
+
+    // The armed recv and any send in flight hold on to the socket past close, shutting it down ends them. Their
+    // completions still refer to the Socket, which is kept until the last of them arrives.
+    std::unique_ptr<Socket> socket = std::move(it->second);
+    this->sockets.erase(it);
+    socket->closing = true;
+    shutdown(fd, SHUT_RDWR);
+    if (socket->pending_operations > 0) {
+        Socket *key = socket.get();
+        this->closing[key] = std::move(socket);
+    }
+}
+
+void IoUringReactor::wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) {
+    submit(1, timeout);
+
+    unsigned head = *this->cq_head;
+    const unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        const io_uring_cqe cqe = this->cqes[head & this->cq_mask];
+        __atomic_store_n(this->cq_head, ++head, __ATOMIC_RELEASE);
+        complete(cqe, handle);
+    }
+}
+
+void IoUringReactor::flush() {
+    for (const int fd : this->server_info.pending_writes) {
+        auto socket_it = this->sockets.find(fd);
+        auto client_it = this->server_info.clients.find(fd);
+        if (socket_it == this->sockets.end() || client_it == this->server_info.clients.end()) continue;
+
+        // Replies queued meanwhile go out when the send in flight completes
+        if (!socket_it->second->sending && client_it->second.has_pending_output()) {
+            send(*socket_it->second, client_it->second);
+        }
+    }
+    this->server_info.pending_writes.clear();
+}
+
+io_uring_sqe *IoUringReactor::get_sqe() {
+    if (this->sqe_tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries) {
+        // Full, hand what is queued to the kernel without waiting for anything
+        submit(0, std::chrono::milliseconds(0));
+    }
+
+    const unsigned index = this->sqe_tail & this->sq_mask;
+    this->sq_array[index] = index;
+    this->sqe_tail++;
+
+    io_uring_sqe *sqe = &this->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUringReactor::submit(unsigned wait_nr, std::chrono::milliseconds timeout) {
+    const unsigned to_submit = this->sqe_tail - this->submitted_tail;
+    __atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+    this->submitted_tail = this->sqe_tail;
+
+    __kernel_timespec ts{};
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+
+    // Completions are only reaped with GETEVENTS, as deferred task running does the work on that call
+    const unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    const int res = io_uring_enter(this->ring_fd, to_submit, timeout.count() > 0 ? wait_nr : 0, flags, &arg,
+                                   sizeof(arg));
+    if (res < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+        throw std::runtime_error(std::string{"io_uring_enter failed: "} + strerror(errno));
+    }
+}
+
+void IoUringReactor::arm_accept(Socket &socket) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = socket.fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket) | Operation::Accept;
+    socket.pending_operations++;
+}
+
+void IoUringReactor::arm_recv(Socket &socket) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket) | Operation::Recv;
+    socket.pending_operations++;
+}
+
+void IoUringReactor::arm_poll(Socket &socket) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = socket.fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket) | Operation::Poll;
+    socket.pending_operations++;
+}
+
+void IoUringReactor::send(Socket &socket, Client &client) {
+    // The kernel reads the reply buffer asynchronously, so later replies must not be appended to it meanwhile
+    if (!client.reply_buffer.empty()) {
+        client.queue_reply_buffer();
+    }
+
+    socket.iov.clear();
+    socket.chunks.clear();
+    auto it = client.output.begin();
+    for (; it != client.output.end() && socket.iov.size() < MAX_IOVECS && !it->file; ++it) {
+        socket.iov.push_back({const_cast<char *>(it->data->data()) + it->sent, it->data->size() - it->sent});
+        socket.chunks.push_back(it->data);
+    }
+    if (it == client.output.begin() && it != client.output.end()) {
+        // A file, io_uring has no sendfile: its next part is read into a buffer of the socket and sent from there
+        const size_t size = std::min(FILE_READ_SIZE, it->size() - it->sent);
+        socket.file_buffer.resize(size);
+        const ssize_t n = pread(it->file->fd, socket.file_buffer.data(), size, it->sent);
+        if (n <= 0) {
+            ERROR("Failed to read the file queued for client " << socket.fd);
+            // Ends its recv, whose completion closes the client
+            shutdown(socket.fd, SHUT_RDWR);
+            return;
+        }
+        socket.iov.push_back({socket.file_buffer.data(), static_cast<size_t>(n)});
+    }
+    socket.msg = {};
+    socket.msg.msg_iov = socket.iov.data();
+    socket.msg.msg_iovlen = socket.iov.size();
+
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&socket.msg);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(&socket) | Operation::Send;
+    socket.sending = true;
+    socket.pending_operations++;
+}
+
+void IoUringReactor::recycle_buffer(uint16_t buffer_id) {
+    // Not through bufs, which C++ places past the start of the ring: the header's flexible array member is declared
+    // next to an empty struct, and those take a byte in C++. The tail overlaps the first entry, as the kernel expects.
+    io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(this->buf_ring)[this->buf_tail & (BUFFER_COUNT - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(this->buffers.get() + static_cast<size_t>(buffer_id) * BUFFER_SIZE);
+    buf.len = BUFFER_SIZE;
+    buf.bid = buffer_id;
+    __atomic_store_n(&this->buf_ring->tail, ++this->buf_tail, __ATOMIC_RELEASE);
+}
+
+void IoUringReactor::complete(const io_uring_cqe &cqe, const IoEventHandler &handle) {
+    Socket &socket = *reinterpret_cast<Socket *>(cqe.user_data & ~OPERATION_MASK);
+    const uint64_t operation = cqe.user_data & OPERATION_MASK;
+    const bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    switch (operation) {
+        case Operation::Accept: {
+            if (cqe.res >= 0) {
+                handle({IoEvent::Type::Accepted, cqe.res, {}, socket.fd});
+            } else {
+                ERROR("Failed to accept new connection: " << strerror(-cqe.res));
+            }
+            if (!more) {
+                socket.pending_operations--;
+                arm_accept(socket);
+            }
+            break;
+        }
+        case Operation::Recv: {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                const uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                if (cqe.res > 0 && !socket.closing) {
+                    const char *data = this->buffers.get() + static_cast<size_t>(buffer_id) * BUFFER_SIZE;
+                    handle({IoEvent::Type::Data, socket.fd, std::string_view(data, cqe.res)});
+                }
+                recycle_buffer(buffer_id);
+            }
+
+            if (!more) {
+                // Out of provided buffers ends the multishot recv without anything being wrong with the socket
+                const bool rearm = cqe.res > 0 || cqe.res == -ENOBUFS;
+                if (!socket.closing && !rearm) {
+                    handle({IoEvent::Type::Closed, socket.fd, {}});
+                }
+                if (!socket.closing && rearm) {
+                    arm_recv(socket);
+                }
+                operation_done(socket);
+            }
+            break;
+        }
+        case Operation::Send: {
+            socket.sending = false;
+            socket.chunks.clear();
+            if (!socket.closing) {
+                auto it = this->server_info.clients.find(socket.fd);
+                if (cqe.res < 0) {
+                    ERROR("Error sending replies to client " << socket.fd << ": " << strerror(-cqe.res));
+                    handle({IoEvent::Type::Closed, socket.fd, {}});
+                } else if (it != this->server_info.clients.end()) {
+                    Client &client = it->second;
+                    client.consume_output(cqe.res);
+                    Stats::local().net_output_bytes.add(cqe.res);
+                    if (client.has_pending_output()) {
+                        send(socket, client);
+                    } else {
+                        client.soft_limit_since.reset();
+                    }
+                }
+            }
+            operation_done(socket);
+            break;
+        }
+        case Operation::Poll: {
+            if (cqe.res >= 0) {
+                handle({IoEvent::Type::Notified, socket.fd, {}});
+            }
+            if (!more) {
+                socket.pending_operations--;
+                arm_poll(socket);
+            }
+            break;
+        }
+    }
+}
+
+// Frees a removed socket once the kernel is done with it
+void IoUringReactor::operation_done(Socket &socket) {
+    socket.pending_operations--;
+    if (socket.closing && socket.pending_operations == 0) {
+        this->closing.erase(&socket);
+    }
+}
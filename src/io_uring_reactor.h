@@ -0,0 +1,116 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "reactor.h"
+
+struct Client;
+
+/*
+    io_uring backend, talking to the kernel through the raw syscalls.
+
+    Every listener has one multishot accept and every connection one multishot recv armed at all times, so accepting
+    and reading cost no syscalls of their own. Received data lands in a ring of provided buffers, which goes back to
+    the kernel as soon as the event loop has appended it to the query buffer.
+
+    flush only queues a sendmsg per client with output, pointing straight at its output chunks. All of them are
+    submitted together by the io_uring_enter that waits for the next events, so an event loop iteration makes one
+    syscall however many clients it reads from and replies to. A client has at most one send in flight, replies
+    produced meanwhile are sent when it completes. A queued file is read FILE_READ_SIZE bytes at a time and sent the
+    same way.
+
+    Requires Linux 6.1 (single issuer, deferred task running), the constructor throws otherwise.
+*/
+class IoUringReactor : public Reactor {
+   public:
+    IoUringReactor(ServerInfo &server_info);
+    ~IoUringReactor() override;
+
+    void add_listener(int fd) override;
+    void add_connection(int fd) override;
+    void add_notifier(int fd) override;
+    void remove_connection(int fd) override;
+    void wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) override;
+    void flush() override;
+
+   private:
+    static constexpr unsigned RING_ENTRIES = 4096;
+    static constexpr unsigned BUFFER_COUNT = 1024;  // a power of two
+    static constexpr unsigned BUFFER_SIZE = 16 * 1024;
+    static constexpr uint16_t BUFFER_GROUP = 0;
+    static constexpr size_t MAX_IOVECS = 64;
+    static constexpr size_t FILE_READ_SIZE = 256 * 1024;  // of a queued file, per send
+
+    // Stored in the low bits of user_data, next to the Socket it is about
+    enum Operation : uint64_t { Accept = 0, Recv = 1, Send = 2, Poll = 3 };
+    static constexpr uint64_t OPERATION_MASK = 3;
+
+    struct Socket {
+        int fd;
+        bool listener = false;
+        bool closing = false;     // removed, only waiting for its operations to complete
+        int pending_operations = 0;
+
+        // The send in flight, kept alive until it completes
+        bool sending = false;
+        msghdr msg{};
+        std::vector<iovec> iov;
+        std::vector<std::shared_ptr<const std::string>> chunks;
+        std::string file_buffer;  // the part of a queued file being sent
+    };
+
+    int ring_fd = -1;
+
+    // Submission queue
+    void *sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned *sq_array = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned sqe_tail = 0;       // next sqe to hand out
+    unsigned submitted_tail = 0;  // sqes up to here were passed to the kernel
+
+    // Completion queue, shares the mapping of the submission queue
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    // Provided buffers for the multishot recvs
+    io_uring_buf_ring *buf_ring = nullptr;
+    size_t buf_ring_size = 0;
+    std::unique_ptr<char[]> buffers;
+    uint16_t buf_tail = 0;
+
+    std::unordered_map<int, std::unique_ptr<Socket>> sockets;  // listeners and connections by fd
+    std::unordered_map<Socket *, std::unique_ptr<Socket>> closing;
+
+    // Unmaps the rings and closes the ring fd
+    void release();
+
+    io_uring_sqe *get_sqe();
+
+    // Passes the queued sqes to the kernel and waits for up to wait_nr completions, or until timeout
+    void submit(unsigned wait_nr, std::chrono::milliseconds timeout);
+
+    void arm_accept(Socket &socket);
+    void arm_recv(Socket &socket);
+    void arm_poll(Socket &socket);
+    void send(Socket &socket, Client &client);
+    void recycle_buffer(uint16_t buffer_id);
+
+    void complete(const io_uring_cqe &cqe, const IoEventHandler &handle);
+    void operation_done(Socket &socket);
+};
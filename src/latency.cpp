@@ -0,0 +1,132 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+double CycleClock::nanoseconds_per_tick = 1.0;
+
+uint64_t CycleClock::now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+void CycleClock::calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t start_ticks = now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const uint64_t ticks = now() - start_ticks;
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (ticks > 0) {
+        nanoseconds_per_tick =
+            static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / ticks;
+    }
+#endif
+}
+
+uint64_t CycleClock::to_nanoseconds(uint64_t ticks) {
+    return static_cast<uint64_t>(ticks * nanoseconds_per_tick);
+}
+
+int64_t LatencyMonitor::slowlog_log_slower_than = 10000;
+size_t LatencyMonitor::slowlog_max_len = 128;
+uint64_t LatencyMonitor::latency_monitor_threshold = 0;
+
+thread_local std::deque<LatencyMonitor::SlowlogEntry> LatencyMonitor::slowlog;
+thread_local uint64_t LatencyMonitor::next_slowlog_id = 0;
+thread_local std::map<std::string, LatencyMonitor::LatencyEvent> LatencyMonitor::events;
+thread_local std::vector<LatencyMonitor::CommandStats> LatencyMonitor::command_stats;
+
+static int64_t unix_time() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+void LatencyMonitor::record_command(CommandType type, const std::vector<std::string> &args, uint64_t ticks) {
+    const uint64_t duration_ns = CycleClock::to_nanoseconds(ticks);
+
+    const size_t index = static_cast<size_t>(type);
+    if (index >= command_stats.size()) command_stats.resize(index + 1);
+    CommandStats &stats = command_stats[index];
+    stats.histogram.record(duration_ns);
+    stats.calls++;
+    stats.total_ns += duration_ns;
+
+    const uint64_t duration_us = duration_ns / 1000;
+    if (slowlog_log_slower_than >= 0 && duration_us >= static_cast<uint64_t>(slowlog_log_slower_than)) {
+        // Like Redis, long argument lists and values are shortened so the log stays small
+        SlowlogEntry entry{next_slowlog_id++, unix_time(), duration_us, {}};
+        for (size_t i = 0; i < args.size() && i < SLOWLOG_MAX_ARGS; i++) {
+            if (i == SLOWLOG_MAX_ARGS - 1 && args.size() > SLOWLOG_MAX_ARGS) {
+                entry.args.push_back("... (" + std::to_string(args.size() - i) + " more arguments)");
+            } else if (args[i].size() > SLOWLOG_MAX_ARG_LEN) {
+                entry.args.push_back(args[i].substr(0, SLOWLOG_MAX_ARG_LEN) + "... (" +
+                                     std::to_string(args[i].size() - SLOWLOG_MAX_ARG_LEN) + " more bytes)");
+            } else {
+                entry.args.push_back(args[i]);
+            }
+        }
+
+        slowlog.push_front(std::move(entry));
+        while (slowlog.size() > slowlog_max_len) slowlog.pop_back();
+    }
+
+    if (latency_monitor_threshold > 0) {
+        add_sample("command", duration_ns / 1000000);
+    }
+}
+
+void LatencyMonitor::add_sample(const std::string &event, uint64_t latency_ms) {
+    if (latency_monitor_threshold == 0 || latency_ms < latency_monitor_threshold) return;
+
+    LatencyEvent &latency_event = events[event];
+    const int64_t now = unix_time();
+
+    // One sample per second, keeping the worst one
+    if (!latency_event.samples.empty() && latency_event.samples.back().timestamp == now) {
+        latency_event.samples.back().latency_ms = std::max(latency_event.samples.back().latency_ms, latency_ms);
+    } else {
+        latency_event.samples.push_back({now, latency_ms});
+        if (latency_event.samples.size() > MAX_EVENT_SAMPLES) latency_event.samples.pop_front();
+    }
+    latency_event.max_latency_ms = std::max(latency_event.max_latency_ms, latency_ms);
+}
+
+const std::deque<LatencyMonitor::SlowlogEntry> &LatencyMonitor::get_slowlog() {
+    return slowlog;
+}
+
+void LatencyMonitor::reset_slowlog() {
+    slowlog.clear();
+}
+
+const std::map<std::string, LatencyMonitor::LatencyEvent> &LatencyMonitor::get_events() {
+    return events;
+}
+
+void LatencyMonitor::reset_events() {
+    events.clear();
+}
+
+bool LatencyMonitor::reset_event(const std::string &event) {
+    return events.erase(event) > 0;
+}
+
+const std::vector<LatencyMonitor::CommandStats> &LatencyMonitor::get_command_stats() {
+    return command_stats;
+}
+
+void LatencyMonitor::reset_command_stats() {
+    command_stats.clear();
+}
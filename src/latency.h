@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+enum class CommandType;
+
+// Cheap timestamps for timing every command: the TSC on x86, steady_clock elsewhere
+class CycleClock {
+   public:
+    static uint64_t now();
+
+    // Measures the tick rate against steady_clock, takes ~10ms
+    static void calibrate();
+
+    static uint64_t to_nanoseconds(uint64_t ticks);
+
+   private:
+    static double nanoseconds_per_tick;
+};
+
+/*
+    Per-command latency histograms, the slow log and the latency event monitor.
+
+    Everything here runs on the thread executing commands, so recording is plain, unsynchronised bookkeeping.
+*/
+class LatencyMonitor {
+   public:
+    struct SlowlogEntry {
+        uint64_t id;
+        int64_t timestamp;  // unix time, seconds
+        uint64_t duration_us;
+        std::vector<std::string> args;
+    };
+
+    struct LatencySample {
+        int64_t timestamp;  // unix time, seconds
+        uint64_t latency_ms;
+    };
+
+    struct LatencyEvent {
+        std::deque<LatencySample> samples;
+        uint64_t max_latency_ms = 0;
+    };
+
+    struct CommandStats {
+        Histogram histogram;  // nanoseconds
+        uint64_t calls = 0;
+        uint64_t total_ns = 0;
+    };
+
+    static int64_t slowlog_log_slower_than;  // microseconds, negative disables the slow log
+    static size_t slowlog_max_len;
+    static uint64_t latency_monitor_threshold;  // milliseconds, 0 disables the latency monitor
+
+    static void record_command(CommandType type, const std::vector<std::string> &args, uint64_t ticks);
+
+    // Records a latency spike of event if it crosses latency_monitor_threshold
+    static void add_sample(const std::string &event, uint64_t latency_ms);
+
+    static const std::deque<SlowlogEntry> &get_slowlog();
+    static void reset_slowlog();
+
+    static const std::map<std::string, LatencyEvent> &get_events();
+    static void reset_events();
+    static bool reset_event(const std::string &event);
+
+    // Indexed by CommandType, commands never called may be missing from the end
+    static const std::vector<CommandStats> &get_command_stats();
+    static void reset_command_stats();
+
+   private:
+    static constexpr size_t MAX_EVENT_SAMPLES = 160;
+    static constexpr size_t SLOWLOG_MAX_ARGS = 32;
+    static constexpr size_t SLOWLOG_MAX_ARG_LEN = 128;
+
+    // Kept per shard thread, like the keys they are about
+    static thread_local std::deque<SlowlogEntry> slowlog;
+    static thread_local uint64_t next_slowlog_id;
+    static thread_local std::map<std::string, LatencyEvent> events;
+    static thread_local std::vector<CommandStats> command_stats;
+};
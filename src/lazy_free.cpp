@@ -0,0 +1,116 @@
+#include "lazy_free.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+bool LazyFree::lazy_user_del = false;
+bool LazyFree::lazy_server_del = false;
+bool LazyFree::lazy_expire = false;
+bool LazyFree::lazy_user_flush = false;
+
+namespace {
+
+struct Job {
+    std::shared_ptr<void> object;  // the last reference, dropping it destroys the object
+    size_t objects;
+};
+
+// Started on the first job, drains the queue and stops at exit
+struct FreeThread {
+    std::mutex mutex;  // guards jobs, thread and stopping
+    std::condition_variable ready;
+    std::deque<Job> jobs;
+    std::thread thread;
+    bool stopping = false;
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> freed{0};
+
+    ~FreeThread() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->ready.notify_one();
+        if (this->thread.joinable()) {
+            this->thread.join();
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while (true) {
+            this->ready.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+            if (this->jobs.empty()) return;
+
+            Job job = std::move(this->jobs.front());
+            this->jobs.pop_front();
+            lock.unlock();
+            job.object.reset();
+            this->pending.fetch_sub(job.objects, std::memory_order_relaxed);
+            this->freed.fetch_add(job.objects, std::memory_order_relaxed);
+            lock.lock();
+        }
+    }
+};
+
+FreeThread &free_thread() {
+    static FreeThread free_thread;
+    return free_thread;
+}
+
+}  // namespace
+
+bool LazyFree::is_large(const StorageValueVariants &value) {
+    return std::visit(
+        [](const auto &v) -> bool {
+            using T = std::decay_t<decltype(v.get_value_ref())>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                return v.get_value_ref().size() > MAX_INLINE_STRING;
+            } else {
+                return v.get_value_ref().size() > MAX_INLINE_ELEMENTS;
+            }
+        },
+        value);
+}
+
+void LazyFree::free(StorageValueVariants &&value) {
+    if (!is_large(value)) return;  // destroyed by the caller
+    enqueue(std::make_shared<StorageValueVariants>(std::move(value)), 1);
+}
+
+void LazyFree::free(Storage::Store &&store) {
+    const bool small = store.size() <= MAX_INLINE_ELEMENTS &&
+                       std::none_of(store.begin(), store.end(), [](const auto &kv) { return is_large(kv.second); });
+    if (small) {
+        store.clear();
+        return;
+    }
+    const size_t objects = store.size();
+    enqueue(std::make_shared<Storage::Store>(std::move(store)), objects);
+}
+
+void LazyFree::enqueue(std::shared_ptr<void> &&object, size_t objects) {
+    FreeThread &t = free_thread();
+    {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        if (t.stopping) return;  // past exit, object is freed here
+        if (!t.thread.joinable()) {
+            t.thread = std::thread([&t] { t.run(); });
+        }
+        t.pending.fetch_add(objects, std::memory_order_relaxed);
+        t.jobs.push_back({std::move(object), objects});
+    }
+    t.ready.notify_one();
+}
+
+size_t LazyFree::pending_objects() {
+    return free_thread().pending.load(std::memory_order_relaxed);
+}
+
+size_t LazyFree::freed_objects() {
+    return free_thread().freed.load(std::memory_order_relaxed);
+}
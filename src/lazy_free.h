@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "storage.h"
+
+/*
+    Lazy freeing: values that are expensive to free are handed to a background thread instead of being destroyed on
+    the event loop. Destroying a hash, sorted set, list or stream frees each of its elements one by one, a large one
+    stalls every client for milliseconds. Once unlinked from the store the value is unreachable, so nothing else is
+    needed to free it on another thread.
+
+    Only values past the thresholds below are sent there, freeing a small one inline costs less than the hand-off.
+    UNLINK and FLUSHALL ASYNC always free lazily, DEL, overwrites, expiry and FLUSHALL only when enabled by their
+    --lazyfree-lazy-* option. The thread is shared by all shards.
+*/
+class LazyFree {
+   public:
+    static constexpr size_t MAX_INLINE_ELEMENTS = 64;         // hashes, sorted sets, lists and streams above are lazy
+    static constexpr size_t MAX_INLINE_STRING = 1024 * 1024;  // past malloc's mmap threshold, freeing unmaps pages
+
+    // Set once from the command line, before any thread starts
+    static bool lazy_user_del;    // DEL behaves like UNLINK
+    static bool lazy_server_del;  // values replaced by a write
+    static bool lazy_expire;      // expired keys
+    static bool lazy_user_flush;  // FLUSHALL and FLUSHDB without ASYNC or SYNC
+
+    // Frees value here if it is cheap to, on the background thread otherwise
+    static void free(StorageValueVariants &&value);
+
+    // Frees a whole keyspace on the background thread, unless it is small
+    static void free(Storage::Store &&store);
+
+    // Objects queued and not freed yet, a keyspace counts as many objects as it has keys
+    static size_t pending_objects();
+
+    // Objects freed on the background thread since the start
+    static size_t freed_objects();
+
+    // Whether destroying value costs more than queueing it
+    static bool is_large(const StorageValueVariants &value);
+
+   private:
+    // Queues object to be destroyed on the background thread, counted as objects
+    static void enqueue(std::shared_ptr<void> &&object, size_t objects);
+};
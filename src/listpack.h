@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Helpers for the packed encodings of small hashes, sorted sets and list nodes: strings are stored back to back in one
+ * buffer, each prefixed by its length as a LEB128 varint (7 bits per byte, high bit set on all but the last byte).
+ *
+ * List nodes are popped from both ends, so their entries are also followed by a back length: the size of the string
+ * and its prefix, written so it can be decoded from its last byte backwards.
+ */
+class Listpack {
+   public:
+    // Bytes taken by the length prefix or back length of a string of the given length
+    static size_t varint_size(size_t length) {
+        size_t size = 1;
+        while (length >= 0x80) {
+            length >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    // Bytes taken by an entry written by append_entry for a string of the given length
+    static size_t entry_size(size_t length) {
+        const size_t string_size = varint_size(length) + length;
+        return string_size + varint_size(string_size);
+    }
+
+    static void append_string(std::string &out, std::string_view s) {
+        size_t length = s.size();
+        while (length >= 0x80) {
+            out.push_back(static_cast<char>((length & 0x7f) | 0x80));
+            length >>= 7;
+        }
+        out.push_back(static_cast<char>(length));
+        out.append(s);
+    }
+
+    // Reads the string at pos and moves pos past it
+    static std::string_view read_string(std::string_view buf, size_t &pos) {
+        size_t length = 0;
+        for (int shift = 0;; shift += 7) {
+            const uint8_t byte = buf[pos++];
+            length |= static_cast<size_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) break;
+        }
+
+        const std::string_view s = buf.substr(pos, length);
+        pos += length;
+        return s;
+    }
+
+    static void append_entry(std::string &out, std::string_view s) {
+        const size_t start = out.size();
+        append_string(out, s);
+
+        // Same 7 bit groups as the prefix, stored in reverse so the lowest group is the last byte
+        size_t length = out.size() - start;
+        uint8_t groups[10];
+        int count = 0;
+        do {
+            groups[count] = length & 0x7f;
+            length >>= 7;
+            if (count > 0) groups[count - 1] |= 0x80;
+            count++;
+        } while (length > 0);
+        while (count > 0) out.push_back(static_cast<char>(groups[--count]));
+    }
+
+    // Reads the entry at pos and moves pos past it
+    static std::string_view read_entry(std::string_view buf, size_t &pos) {
+        const size_t start = pos;
+        const std::string_view s = read_string(buf, pos);
+        pos += varint_size(pos - start);
+        return s;
+    }
+
+    // Reads the entry ending at end and moves end back to its start
+    static std::string_view read_entry_backwards(std::string_view buf, size_t &end) {
+        size_t length = 0;
+        for (int shift = 0;; shift += 7) {
+            const uint8_t byte = buf[--end];
+            length |= static_cast<size_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) break;
+        }
+
+        end -= length;
+        size_t pos = end;
+        return read_string(buf, pos);
+    }
+};
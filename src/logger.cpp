@@ -1,6 +1,15 @@
 #include "logger.h"
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 Logger::Level Logger::log_level = Logger::Level::SILENT;
 
@@ -61,10 +70,264 @@ std::string stringify(std::string_view message) {
     return res;
 }
 
+namespace {
+
+// Single-producer single-consumer byte ring owned by one logging thread and drained by the writer thread.
+// Each record is a RecordHeader followed by the raw message bytes.
+class LogRing {
+   public:
+    static constexpr size_t CAPACITY = 1 << 20;
+    static constexpr size_t MAX_MESSAGE_SIZE = CAPACITY / 4;
+
+    // Returns true when the ring had been drained up to this record, so the writer may be waiting for it
+    bool push(Logger::Level level, std::string_view message) {
+        message = message.substr(0, MAX_MESSAGE_SIZE);
+        const RecordHeader header{static_cast<uint32_t>(message.size()), static_cast<uint32_t>(level)};
+        const size_t record_size = sizeof(header) + message.size();
+
+        const size_t head = this->head.load(std::memory_order_relaxed);
+        const size_t tail = this->tail.load(std::memory_order_acquire);
+        if (CAPACITY - (head - tail) < record_size) {
+            this->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        write(head, &header, sizeof(header));
+        write(head + sizeof(header), message.data(), message.size());
+        // Sequentially consistent with the writer's store of tail, so that either it sees this record or this sees
+        // that it is idle
+        this->head.store(head + record_size, std::memory_order_seq_cst);
+        return this->tail.load(std::memory_order_seq_cst) == head;
+    }
+
+    template <typename Sink>
+    void drain(Sink &&sink) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        const size_t head = this->head.load(std::memory_order_seq_cst);
+
+        while (tail < head) {
+            RecordHeader header;
+            read(tail, &header, sizeof(header));
+            this->scratch.resize(header.size);
+            read(tail + sizeof(header), this->scratch.data(), header.size);
+            sink(static_cast<Logger::Level>(header.level), this->scratch);
+            tail += sizeof(header) + header.size;
+        }
+        this->tail.store(tail, std::memory_order_seq_cst);
+    }
+
+    size_t take_dropped() {
+        return this->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+   private:
+    struct RecordHeader {
+        uint32_t size;
+        uint32_t level;
+    };
+
+    std::unique_ptr<char[]> data = std::make_unique<char[]>(CAPACITY);
+    alignas(64) std::atomic<size_t> head{0};  // written by the producer only
+    alignas(64) std::atomic<size_t> tail{0};  // written by the consumer only
+    std::atomic<size_t> dropped{0};
+    std::string scratch;  // consumer side
+
+    void write(size_t pos, const void *src, size_t n) {
+        const size_t offset = pos % CAPACITY;
+        const size_t first = std::min(n, CAPACITY - offset);
+        std::memcpy(this->data.get() + offset, src, first);
+        std::memcpy(this->data.get(), static_cast<const char *>(src) + first, n - first);
+    }
+
+    void read(size_t pos, void *dst, size_t n) const {
+        const size_t offset = pos % CAPACITY;
+        const size_t first = std::min(n, CAPACITY - offset);
+        std::memcpy(dst, this->data.get() + offset, first);
+        std::memcpy(static_cast<char *>(dst) + first, this->data.get(), n - first);
+    }
+};
+
+struct LogWriter {
+    std::mutex mutex;  // guards rings and output, only taken on registration and by the writer thread
+    std::vector<std::shared_ptr<LogRing>> rings;
+    FILE *output = stdout;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopped{false};
+
+    // The writer thread sleeps on ready until a ring it drained empty gets a record, or until it is stopped
+    std::mutex wake_mutex;
+    std::condition_variable ready;
+    uint64_t wakeups = 0;  // guarded by wake_mutex
+
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(this->wake_mutex);
+            this->wakeups++;
+        }
+        this->ready.notify_one();
+    }
+
+    void write_line(Logger::Level level, std::string_view message) {
+        const std::string escaped = stringify(message);
+        std::fputs(level == Logger::Level::ERROR ? "[ERROR]: " : "[DEBUG]", this->output);
+        std::fwrite(escaped.data(), 1, escaped.size(), this->output);
+        std::fputc('\n', this->output);
+    }
+
+    // Caller holds mutex
+    bool drain_all() {
+        bool wrote = false;
+        for (const auto &ring : this->rings) {
+            ring->drain([&](Logger::Level level, std::string_view message) {
+                write_line(level, message);
+                wrote = true;
+            });
+
+            if (const size_t dropped = ring->take_dropped()) {
+                const std::string notice = "Logger dropped " + std::to_string(dropped) + " lines, ring was full";
+                write_line(Logger::Level::ERROR, notice);
+                wrote = true;
+            }
+        }
+        if (wrote) std::fflush(this->output);
+        return wrote;
+    }
+
+    void run() {
+        while (this->running.load(std::memory_order_acquire)) {
+            uint64_t seen;
+            {
+                std::lock_guard<std::mutex> lock(this->wake_mutex);
+                seen = this->wakeups;
+            }
+            bool wrote;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                wrote = drain_all();
+            }
+            if (wrote) continue;
+
+            // Nothing was left in any ring, a record pushed since then has bumped wakeups
+            std::unique_lock<std::mutex> lock(this->wake_mutex);
+            this->ready.wait(lock, [&] { return this->wakeups != seen || !this->running.load(); });
+        }
+    }
+};
+
+LogWriter &writer() {
+    static LogWriter writer;
+    return writer;
+}
+
+LogRing *thread_ring() {
+    thread_local std::shared_ptr<LogRing> ring = [] {
+        LogWriter &w = writer();
+        auto ring = std::make_shared<LogRing>();
+
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.rings.push_back(ring);
+        if (!w.running && !w.stopped) {
+            w.running = true;
+            w.thread = std::thread([&w] { w.run(); });
+            std::atexit(Logger::flush);
+        }
+        return ring;
+    }();
+    return ring.get();
+}
+
+void enqueue(Logger::Level level, std::string_view message) {
+    LogWriter &w = writer();
+    if (w.stopped) {
+        // Past shutdown there is no writer thread left, fall back to writing synchronously
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.write_line(level, message);
+        return;
+    }
+    if (thread_ring()->push(level, message)) w.wake();
+}
+
+}  // namespace
+
 void Logger::log(std::string_view message) {
-    std::cout << "[DEBUG]" << stringify(message) << '\n';
+    enqueue(Logger::Level::DEBUG, message);
 }
 
 void Logger::log_error(std::string_view message) {
-    std::cout << "[ERROR]: " << stringify(message) << '\n';
+    enqueue(Logger::Level::ERROR, message);
+}
+
+void Logger::set_log_file(std::string_view file_path) {
+    FILE *file = std::fopen(std::string{file_path}.c_str(), "a");
+    if (file == nullptr) {
+        throw std::runtime_error("Unable to open log file " + std::string{file_path});
+    }
+
+    LogWriter &w = writer();
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.drain_all();
+    if (w.output != stdout) std::fclose(w.output);
+    w.output = file;
+}
+
+void Logger::flush() {
+    LogWriter &w = writer();
+    if (w.running.exchange(false)) {
+        w.wake();
+        w.thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(w.mutex);
+    w.stopped = true;
+    w.drain_all();
+}
+
+Logger::LineStream::LineStream() : std::ostream(&buffer) {}
+
+std::string_view Logger::LineStream::view() const {
+    return this->buffer.line;
+}
+
+void Logger::LineStream::reset() {
+    this->buffer.line.clear();
+    this->clear();
+}
+
+Logger::LineStream::Buffer::int_type Logger::LineStream::Buffer::overflow(int_type ch) {
+    if (ch != traits_type::eof()) this->line.push_back(static_cast<char>(ch));
+    return ch;
+}
+
+std::streamsize Logger::LineStream::Buffer::xsputn(const char *s, std::streamsize n) {
+    this->line.append(s, n);
+    return n;
+}
+
+Logger::LineStream &Logger::begin_line() {
+    thread_local LineStream stream;
+    stream.reset();
+    return stream;
+}
+
+Logger::RateLimiter::RateLimiter(int per_second)
+    : tokens(per_second), per_second(per_second), last_refill(std::chrono::steady_clock::now()) {}
+
+bool Logger::RateLimiter::allow() {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - this->last_refill).count();
+    this->tokens = std::min(this->per_second, this->tokens + elapsed * this->per_second);
+    this->last_refill = now;
+
+    if (this->tokens < 1) {
+        this->suppressed++;
+        return false;
+    }
+
+    this->tokens -= 1;
+    if (this->suppressed > 0) {
+        Logger::log("Rate limited log statement suppressed " + std::to_string(this->suppressed) + " lines");
+        this->suppressed = 0;
+    }
+    return true;
 }
@@ -1,26 +1,108 @@
 #pragma once
 
-#include <sstream>
+#include <chrono>
+#include <ostream>
+#include <streambuf>
 #include <string>
 
+// Levels below this threshold are compiled out entirely: 0 keeps everything, 1 keeps only ERROR, 2 keeps nothing
+#ifndef SIDER_MIN_LOG_LEVEL
+#define SIDER_MIN_LOG_LEVEL 0
+#endif
+
+/*
+    Log lines are formatted into a reusable thread-local buffer and pushed into a per-thread lock-free ring.
+    A background thread drains the rings, escapes the messages and writes them out, so logging never blocks
+    the event loop on I/O. Lines that do not fit in a full ring are dropped and counted instead.
+*/
 class Logger {
    public:
-    enum class Level { SILENT, DEBUG, ERROR };
+    enum class Level { SILENT, ERROR, DEBUG };  // each level also shows everything before it
     static Level log_level;
     static void log(std::string_view message);
     static void log_error(std::string_view message);
+
+    static bool debug_enabled() {
+        return SIDER_MIN_LOG_LEVEL <= 0 && log_level >= Level::DEBUG;
+    }
+
+    // Writes to file_path instead of stdout
+    static void set_log_file(std::string_view file_path);
+
+    // Drains everything that is still queued and stops the background thread
+    static void flush();
+
+    // Reusable per-thread stream the LOG macros format into, so formatting does not allocate once warmed up
+    class LineStream : public std::ostream {
+       public:
+        LineStream();
+        std::string_view view() const;
+        void reset();
+
+       private:
+        class Buffer : public std::streambuf {
+           public:
+            std::string line;
+
+           protected:
+            int_type overflow(int_type ch) override;
+            std::streamsize xsputn(const char *s, std::streamsize n) override;
+        } buffer;
+    };
+    static LineStream &begin_line();
+
+    // Token bucket for log statements on hot paths, one per call site
+    class RateLimiter {
+       public:
+        RateLimiter(int per_second);
+        bool allow();
+
+       private:
+        double tokens;
+        const double per_second;
+        std::chrono::steady_clock::time_point last_refill;
+        long suppressed = 0;
+    };
 };
 
-#define LOG(Message_)                                                                                       \
-    do {                                                                                                    \
-        if (Logger::log_level >= Logger::Level::DEBUG) {                                                    \
-            Logger::log(static_cast<std::ostringstream &>(std::ostringstream().flush() << Message_).str()); \
-        }                                                                                                   \
+#define LOGGER_FORMAT_(Message_) (static_cast<Logger::LineStream &>(Logger::begin_line() << Message_).view())
+
+#if SIDER_MIN_LOG_LEVEL <= 0
+#define LOG(Message_)                                       \
+    do {                                                    \
+        if (Logger::log_level >= Logger::Level::DEBUG) {    \
+            Logger::log(LOGGER_FORMAT_(Message_));          \
+        }                                                   \
     } while (0)
 
-#define ERROR(Message_)                                                                                           \
-    do {                                                                                                          \
-        if (Logger::log_level >= Logger::Level::ERROR) {                                                          \
-            Logger::log_error(static_cast<std::ostringstream &>(std::ostringstream().flush() << Message_).str()); \
-        }                                                                                                         \
+// Like LOG, but emits at most PerSecond_ lines per second from this call site
+#define LOG_RATE_LIMITED(PerSecond_, Message_)                         \
+    do {                                                               \
+        if (Logger::log_level >= Logger::Level::DEBUG) {               \
+            static thread_local Logger::RateLimiter limiter_(PerSecond_); \
+            if (limiter_.allow()) {                                    \
+                Logger::log(LOGGER_FORMAT_(Message_));                 \
+            }                                                          \
+        }                                                              \
+    } while (0)
+#else
+#define LOG(Message_) \
+    do {              \
+    } while (0)
+#define LOG_RATE_LIMITED(PerSecond_, Message_) \
+    do {                                       \
+    } while (0)
+#endif
+
+#if SIDER_MIN_LOG_LEVEL <= 1
+#define ERROR(Message_)                                       \
+    do {                                                      \
+        if (Logger::log_level >= Logger::Level::ERROR) {      \
+            Logger::log_error(LOGGER_FORMAT_(Message_));      \
+        }                                                     \
+    } while (0)
+#else
+#define ERROR(Message_) \
+    do {                \
     } while (0)
+#endif
@@ -1,14 +1,24 @@
 #include <netdb.h>
 
 #include <algorithm>
+#include <csignal>
 
 #include "logger.h"
 #include "server.h"
+#include "shards.h"
 
 int main(int argc, char **argv) {
+    // A peer that resets its connection makes a write fail with EPIPE instead of killing the server
+    std::signal(SIGPIPE, SIG_IGN);
+
     try {
-        ServerPtr server_ptr = std::make_unique<Server>(ServerInfo::parse(argc, argv));
-        server_ptr->listen();
+        ServerInfo server_info = ServerInfo::parse(argc, argv);
+        if (server_info.shards > 1) {
+            Shards::serve(std::move(server_info));
+        } else {
+            ServerPtr server_ptr = std::make_unique<Server>(std::move(server_info));
+            server_ptr->listen();
+        }
     } catch (const std::out_of_range &e) {
         ERROR(e.what());
     } catch (const std::runtime_error &e) {
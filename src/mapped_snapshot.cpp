@@ -0,0 +1,268 @@
+#include "mapped_snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "logger.h"
+#include "rdb_writer.h"
+
+namespace {
+
+// Appends to a file through a buffer, keeping track of the offset reached
+struct FileWriter {
+    static constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    int fd;
+    std::string buffer;
+    uint64_t offset = 0;
+
+    explicit FileWriter(int fd) : fd(fd) {}
+
+    void append(const void *bytes, size_t n) {
+        this->buffer.append(static_cast<const char *>(bytes), n);
+        this->offset += n;
+        if (this->buffer.size() >= FLUSH_THRESHOLD) flush();
+    }
+
+    void pad() {
+        static constexpr char zeros[8] = {};
+        append(zeros, (8 - this->offset % 8) % 8);
+    }
+
+    void flush() {
+        size_t sent = 0;
+        while (sent < this->buffer.size()) {
+            const ssize_t n = write(this->fd, this->buffer.data() + sent, this->buffer.size() - sent);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::strerror(errno));
+            }
+            sent += n;
+        }
+        this->buffer.clear();
+    }
+};
+
+}  // namespace
+
+MappedSnapshot::MappedSnapshot(const char *data, size_t size_bytes, const Header &header)
+    : data(data),
+      size_bytes(size_bytes),
+      slot_count(header.slot_count),
+      slot_offset(header.slot_offset),
+      removed(header.slot_count),
+      live_keys(header.key_count),
+      live_expires(header.expires_count) {}
+
+MappedSnapshot::~MappedSnapshot() {
+    munmap(const_cast<char *>(this->data), this->size_bytes);
+}
+
+std::unique_ptr<MappedSnapshot> MappedSnapshot::open(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) return nullptr;
+        throw std::runtime_error("Unable to open snapshot " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        close(fd);
+        throw std::runtime_error("Snapshot " + path + " is truncated");
+    }
+    const size_t size_bytes = st.st_size;
+    void *mapped = mmap(nullptr, size_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file open
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Unable to map snapshot " + path + ": " + std::strerror(errno));
+    }
+    // Lookups jump all over the file, reading ahead would only fault in pages nobody asked for
+    madvise(mapped, size_bytes, MADV_RANDOM);
+
+    Header header;
+    std::memcpy(&header, mapped, sizeof(header));
+    const bool valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION &&
+                       header.file_size == size_bytes && std::has_single_bit(header.slot_count) &&
+                       header.slot_offset % 8 == 0 && header.slot_offset >= sizeof(Header) &&
+                       header.slot_offset + header.slot_count * sizeof(Slot) == size_bytes;
+    if (!valid) {
+        munmap(mapped, size_bytes);
+        throw std::runtime_error("Snapshot " + path + " is not a valid snapshot of this version");
+    }
+
+    LOG("mapped snapshot " << path << " with " << header.key_count << " keys");
+    return std::unique_ptr<MappedSnapshot>(new MappedSnapshot(static_cast<const char *>(mapped), size_bytes, header));
+}
+
+long long MappedSnapshot::save(const Storage &storage, const std::string &path) {
+    const auto now = std::chrono::system_clock::now();
+    auto is_live = [&](const TimeStamp &expiry) { return !expiry.has_value() || expiry.value() > now; };
+    auto expiry_of = [](const StorageValueVariants &value) {
+        return std::visit([](const auto &v) { return v.get_expiry(); }, value);
+    };
+    const MappedSnapshot *snapshot = storage.get_snapshot();
+
+    // Streams and expired keys are left out, so the table is sized on what is actually written
+    size_t keys = 0;
+    for (const auto &[key, value] : storage.get_view()) {
+        keys += !std::holds_alternative<StreamValue>(value) && is_live(expiry_of(value));
+    }
+    if (snapshot != nullptr) {
+        snapshot->for_each([&](const Entry &entry) { keys += is_live(entry.expiry); });
+    }
+
+    const std::string temp_path = path + ".tmp-" + std::to_string(getpid());
+    const int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ERROR("Failed to open " << temp_path << " for writing: " << std::strerror(errno));
+        return -1;
+    }
+
+    // At most half full, so that probing for a missing key stops early
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.slot_count = std::bit_ceil(std::max<size_t>(keys * 2, 16));
+    std::vector<Slot> slots(header.slot_count);
+
+    FileWriter out(fd);
+    auto add = [&](std::string_view key, RDBParser::ValueType type, const TimeStamp &expiry, std::string_view value) {
+        out.pad();
+        const uint64_t h = hash(key);
+        size_t slot = h & (slots.size() - 1);
+        while (slots[slot].offset != 0) slot = (slot + 1) & (slots.size() - 1);
+        slots[slot] = {h, out.offset};
+
+        EntryHeader entry{};
+        entry.key_size = key.size();
+        entry.type = static_cast<uint8_t>(type);
+        entry.expiry_ms =
+            expiry.has_value()
+                ? std::chrono::duration_cast<std::chrono::milliseconds>(expiry->time_since_epoch()).count()
+                : -1;
+        entry.value_size = value.size();
+        out.append(&entry, sizeof(entry));
+        out.append(key.data(), key.size());
+        out.append(value.data(), value.size());
+
+        header.key_count++;
+        header.expires_count += expiry.has_value();
+    };
+
+    try {
+        out.append(&header, sizeof(header));
+
+        std::string payload;
+        for (const auto &[key, value] : storage.get_view()) {
+            const TimeStamp expiry = expiry_of(value);
+            if (!is_live(expiry)) continue;
+
+            if (const StringValue *string_value = std::get_if<StringValue>(&value)) {
+                add(key, RDBParser::ValueType::STRING, expiry, string_value->get_value_ref());
+                continue;
+            }
+            payload.clear();
+            if (const auto type = RDBWriter::encode_value(value, payload)) {
+                add(key, *type, expiry, payload);
+            }
+        }
+        if (snapshot != nullptr) {
+            snapshot->for_each([&](const Entry &entry) {
+                if (is_live(entry.expiry)) add(entry.key, entry.type, entry.expiry, entry.value);
+            });
+        }
+
+        out.pad();
+        header.slot_offset = out.offset;
+        out.append(slots.data(), slots.size() * sizeof(Slot));
+        out.flush();
+        header.file_size = out.offset;
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            throw std::runtime_error(std::strerror(errno));
+        }
+    } catch (const std::runtime_error &e) {
+        ERROR("Failed to write " << temp_path << ": " << e.what());
+        close(fd);
+        unlink(temp_path.c_str());
+        return -1;
+    }
+
+    // A mapping of the file being replaced keeps reading the old one
+    return RDBWriter::commit_file(fd, temp_path, path) ? static_cast<long long>(header.key_count) : -1;
+}
+
+size_t MappedSnapshot::find(std::string_view key) const {
+    const uint64_t h = hash(key);
+    const size_t mask = this->slot_count - 1;
+    for (size_t slot = h & mask, probes = 0; probes < this->slot_count; slot = (slot + 1) & mask, probes++) {
+        const Slot s = read_slot(slot);
+        if (s.offset == 0) break;
+        // Removed entries stay in place, later keys of their chain are found past them
+        if (s.hash == h && entry(slot).key == key) {
+            return this->removed[slot] ? NOT_FOUND : slot;
+        }
+    }
+    return NOT_FOUND;
+}
+
+MappedSnapshot::Entry MappedSnapshot::entry(size_t slot) const {
+    const Slot s = read_slot(slot);
+    if (s.offset < sizeof(Header) || s.offset > this->slot_offset - sizeof(EntryHeader)) {
+        throw std::runtime_error("Snapshot entry out of bounds");
+    }
+    EntryHeader header;
+    std::memcpy(&header, this->data + s.offset, sizeof(header));
+    const size_t key_start = s.offset + sizeof(header);
+    if (header.key_size > this->slot_offset - key_start ||
+        header.value_size > this->slot_offset - key_start - header.key_size) {
+        throw std::runtime_error("Snapshot entry out of bounds");
+    }
+
+    Entry entry;
+    entry.key = std::string_view(this->data + key_start, header.key_size);
+    entry.type = static_cast<RDBParser::ValueType>(header.type);
+    entry.value = std::string_view(this->data + key_start + header.key_size, header.value_size);
+    if (header.expiry_ms >= 0) {
+        entry.expiry = TimeStamp(std::chrono::milliseconds(header.expiry_ms));
+    }
+    return entry;
+}
+
+StorageValueVariants MappedSnapshot::load(size_t slot) const {
+    const Entry e = entry(slot);
+    if (e.type == RDBParser::ValueType::STRING) {
+        return StringValue(std::string{e.value}, e.expiry);
+    }
+    return RDBParser::load_value(e.value, e.type, e.expiry);
+}
+
+void MappedSnapshot::remove(size_t slot) {
+    if (this->removed[slot]) return;
+
+    this->removed[slot] = true;
+    this->live_keys--;
+    this->live_expires -= entry(slot).expiry.has_value();
+}
+
+uint64_t MappedSnapshot::hash(std::string_view key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const char c : key) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+MappedSnapshot::Slot MappedSnapshot::read_slot(size_t slot) const {
+    Slot s;
+    std::memcpy(&s, this->data + this->slot_offset + slot * sizeof(Slot), sizeof(s));
+    return s;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rdb_parser.h"
+#include "storage.h"
+
+/*
+    Native snapshot that the server maps into memory at start instead of loading it, --mmap-snapshot <filename>.
+
+    Loading an RDB file builds every key and value before the first command is served, which for a large dataset
+    takes minutes. This file is laid out as the index that reads it: a header, the entries, then an open addressing
+    hash table of (hash, entry offset) slots. Opening it is an mmap and a check of the header, the pages are faulted
+    in by the lookups that touch them. Each entry holds its key, type, expiry and value blob: the bytes of a string,
+    which GET and MGET answer straight from the mapping, and the RDB payload of the other types, decoded only when
+    the key is first used.
+
+    Storage keeps the snapshot below its store. A key used by any other command, or written, is promoted: decoded
+    into the store and removed from the snapshot, which is then done with it. Removals are kept in a bitmap by slot,
+    the file itself is never written to, so SAVE can replace it while it is mapped.
+
+    Integers are stored in the byte order of the machine that wrote the file, and the hash is FNV-1a so that it does
+    not depend on the standard library. Streams are not saved, as in RDB files.
+*/
+class MappedSnapshot {
+   public:
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    struct Entry {
+        std::string_view key;
+        RDBParser::ValueType type;
+        TimeStamp expiry;
+        std::string_view value;  // the string itself, or the RDB payload of the other types
+    };
+
+    ~MappedSnapshot();
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    // Maps the snapshot at path, nullptr if there is none. Throws if the file is not a valid snapshot.
+    static std::unique_ptr<MappedSnapshot> open(const std::string &path);
+
+    // Writes storage, including the keys of the snapshot it still has, to path through a temporary file renamed over
+    // it. Returns the number of keys written or -1 on failure.
+    static long long save(const Storage &storage, const std::string &path);
+
+    // Slot of key, NOT_FOUND if it is not in the snapshot or was removed
+    size_t find(std::string_view key) const;
+
+    Entry entry(size_t slot) const;
+
+    // Decodes the value of the entry in slot
+    StorageValueVariants load(size_t slot) const;
+
+    void remove(size_t slot);
+
+    // Calls fn(entry) for every entry that has not been removed, including expired ones
+    template <typename Fn>
+    void for_each(Fn &&fn) const {
+        for (size_t slot = 0; slot < this->slot_count; slot++) {
+            if (read_slot(slot).offset != 0 && !this->removed[slot]) {
+                fn(entry(slot));
+            }
+        }
+    }
+
+    // Entries not removed yet, and how many of them have an expiry
+    size_t size() const {
+        return this->live_keys;
+    }
+    size_t expires_count() const {
+        return this->live_expires;
+    }
+
+    // Size of the file, whose pages only take memory once read
+    size_t mapped_bytes() const {
+        return this->size_bytes;
+    }
+
+   private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t key_count;
+        uint64_t expires_count;
+        uint64_t slot_count;   // a power of two
+        uint64_t slot_offset;  // where the hash table starts
+        uint64_t file_size;
+    };
+
+    struct Slot {
+        uint64_t hash;
+        uint64_t offset;  // of the entry, 0 for an empty slot
+    };
+
+    // Followed by the key and the value, then padding to 8 bytes
+    struct EntryHeader {
+        uint32_t key_size;
+        uint8_t type;
+        uint8_t reserved[3];
+        int64_t expiry_ms;  // -1 for none
+        uint64_t value_size;
+    };
+
+    static constexpr char MAGIC[8] = {'S', 'I', 'D', 'E', 'R', 'M', 'A', 'P'};
+    static constexpr uint32_t VERSION = 1;
+
+    MappedSnapshot(const char *data, size_t size_bytes, const Header &header);
+
+    const char *data;
+    size_t size_bytes;
+    size_t slot_count;
+    size_t slot_offset;
+    std::vector<bool> removed;  // by slot
+    size_t live_keys;
+    size_t live_expires;
+
+    static uint64_t hash(std::string_view key);
+
+    Slot read_slot(size_t slot) const;
+};
@@ -1,9 +1,12 @@
 #include "message_parser.h"
 
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <sstream>
 
 #include "commands.h"
+#include "crlf_scanner.h"
 #include "logger.h"
 
 std::string hexToBytes(std::string_view s) {
@@ -48,52 +51,157 @@ int numDigits(int num) {
 static constexpr const std::string_view DELIM = "\r\n";
 static constexpr const int DELIM_SIZE = 2;
 
-std::vector<std::pair<DecodedMessage, int>> MessageParser::parse_message(std::string_view raw_message) {
+// Requests larger than this are rejected as protocol errors, like Redis does
+static constexpr long long MAX_MULTIBULK_LENGTH = 1024 * 1024;
+static constexpr long long MAX_BULK_LENGTH = 512LL * 1024 * 1024;
+
+// Parses a decimal integer such as "3" or "-1" in place, returns false if it is not one
+static bool parse_integer(std::string_view digits, long long &num) {
+    const bool negative = !digits.empty() && digits[0] == '-';
+    if (negative) digits.remove_prefix(1);
+    if (digits.empty() || digits.size() > 18) return false;
+
+    long long value = 0;
+    for (const char ch : digits) {
+        const unsigned digit = ch - '0';
+        if (digit > 9) return false;
+        value = value * 10 + digit;
+    }
+    num = negative ? -value : value;
+    return true;
+}
+
+/**
+ * Reads the header line starting at pos, eg. "*3\r\n" or "$5\r\n", into num and sets end past its "\r\n".
+ * Returns false if the line has not been received completely yet.
+ */
+static bool read_header(std::string_view raw_message, CrlfScanner &scanner, size_t pos, long long &num, size_t &end) {
+    const size_t cr = scanner.find_cr(pos + 1);
+    if (cr == std::string_view::npos || cr + 1 >= raw_message.size()) return false;
+
+    if (raw_message[cr + 1] != '\n' || !parse_integer(raw_message.substr(pos + 1, cr - pos - 1), num)) {
+        throw CommandParseError("Protocol error: invalid header line");
+    }
+    end = cr + DELIM_SIZE;
+    return true;
+}
+
+std::vector<std::pair<DecodedMessage, int>> MessageParser::parse_message(std::string_view raw_message,
+                                                                        size_t &bytes_consumed,
+                                                                        MultibulkProgress *progress) {
     std::vector<std::pair<DecodedMessage, int>> commands;
+    CrlfScanner scanner(raw_message);
     size_t i = 0;
-    while (i < raw_message.size()) {
+
+    // A frame cut off by the end of raw_message is left unconsumed, to be completed by the next read
+    bool incomplete = false;
+
+    // Each command's byte count also covers anything skipped since the previous one, so a prefix of the counts always
+    // adds up to the offset where that command ends
+    size_t command_start = 0;
+    while (i < raw_message.size() && !incomplete) {
         switch (raw_message[i]) {
             case '+': {
-                // Simple strings: Start with +, terminated with \r\n
-                size_t end = raw_message.find(DELIM, i);
-                if (end == std::string_view::npos) throw CommandParseError("Error parsing message");
+                // Simple strings: Start with +, terminated with \r\n, a lone '\r' is part of the string
+                size_t end = scanner.find_cr(i);
+                while (end != std::string_view::npos && end + 1 < raw_message.size() && raw_message[end + 1] != '\n') {
+                    end = scanner.find_cr(end + 1);
+                }
+                if (end == std::string_view::npos || end + 1 >= raw_message.size()) {
+                    incomplete = true;
+                    break;
+                }
 
-                commands.emplace_back(parse_simple_string(raw_message.substr(i, end - i + 2)), end - i + 2);
-                i = end + 2;
+                commands.emplace_back(parse_simple_string(raw_message.substr(i, end - i + 2)), end + 2 - command_start);
+                i = command_start = end + 2;
                 break;
             }
             case '$': {
-                // Bulk strings: $<length>\r\n<data>\r\n
-                size_t length_end = raw_message.find(DELIM, i);
-                if (length_end == std::string_view::npos) throw CommandParseError("Error parsing message");
+                // Bulk strings: $<length>\r\n<data>\r\n, or $-1\r\n for null
+                long long length;
+                size_t data_start;
+                if (!read_header(raw_message, scanner, i, length, data_start)) {
+                    incomplete = true;
+                    break;
+                }
 
-                size_t data_end = raw_message.find(DELIM, length_end + 2);
-                if (data_end == std::string_view::npos) throw CommandParseError("Error parsing message");
+                const size_t frame_end = length < 0 ? data_start : data_start + length + DELIM_SIZE;
+                if (frame_end > raw_message.size()) {
+                    incomplete = true;
+                    break;
+                }
 
-                commands.emplace_back(parse_bulk_string(raw_message.substr(i, data_end - i + 2)), data_end - i + 2);
-                i = data_end + 2;
+                commands.emplace_back(parse_bulk_string(raw_message.substr(i, frame_end - i)),
+                                      frame_end - command_start);
+                i = command_start = frame_end;
                 break;
             }
             case '*': {
                 // Arrays: *<number-of-elements>\r\n<element-1>...<element-n>
                 // eg. Array of "hello world": *2\r\n$5\r\nhello\r\n$5\r\nworld\r\n
-                size_t end = raw_message.find(DELIM, i);
-                if (end == std::string_view::npos) throw CommandParseError("Error parsing message");
+                long long num_elements;
+                size_t elements_start;
+                if (!read_header(raw_message, scanner, i, num_elements, elements_start)) {
+                    incomplete = true;
+                    break;
+                }
+                if (num_elements > MAX_MULTIBULK_LENGTH) {
+                    throw CommandParseError("Protocol error: invalid multibulk length");
+                }
 
-                // Multiply by 2 because every element has $size and $data
-                int num_elements = std::stoi(std::string{raw_message.substr(i + 1, end - i)}) * 2;
+                // Nothing is allocated or copied until the whole frame has arrived. A frame that takes many reads
+                // resumes the check where the previous read left it, so each of its elements is walked only once.
+                size_t pos = elements_start;
+                long long checked = 0;
+                if (progress != nullptr && progress->checked_until != 0 && progress->frame_start == i) {
+                    pos = progress->checked_until;
+                    checked = progress->elements_checked;
+                }
+                for (; checked < num_elements; checked++) {
+                    long long length;
+                    size_t data_start;
+                    if (pos < raw_message.size() && raw_message[pos] != '$') {
+                        throw CommandParseError("Protocol error: expected '$'");
+                    }
+                    if (pos >= raw_message.size() || !read_header(raw_message, scanner, pos, length, data_start)) {
+                        break;
+                    }
+                    if (length < 0 || length > MAX_BULK_LENGTH) {
+                        throw CommandParseError("Protocol error: invalid bulk length");
+                    }
 
-                for (int j = 0; j < num_elements; j++) {
-                    size_t next_end = raw_message.find(DELIM, end + 2);
-                    if (next_end == std::string_view::npos) {
-                        next_end = raw_message.size();
+                    // Payloads are skipped by their declared length, never scanned, so they may contain anything
+                    if (raw_message.size() - data_start < static_cast<size_t>(length) + DELIM_SIZE) {
                         break;
                     }
-                    end = next_end;
+                    if (raw_message[data_start + length] != '\r' || raw_message[data_start + length + 1] != '\n') {
+                        throw CommandParseError("Protocol error: bulk string longer than its declared length");
+                    }
+                    pos = data_start + length + DELIM_SIZE;
+                }
+                if (checked < num_elements) {
+                    if (progress != nullptr) *progress = {i, pos, checked};
+                    incomplete = true;
+                    break;
+                }
+                if (progress != nullptr && progress->frame_start == i) *progress = {};
+
+                DecodedMessage decoded;
+                decoded.reserve(std::max(num_elements, 0LL));
+                pos = elements_start;
+                for (long long j = 0; j < num_elements; j++) {
+                    long long length;
+                    read_header(raw_message, scanner, pos, length, pos);
+                    decoded.emplace_back(raw_message.substr(pos, length));
+                    pos += length + DELIM_SIZE;
                 }
 
-                commands.emplace_back(parse_array(raw_message.substr(i, end - i + 2)), end - i + 2);
-                i = end + 2;
+                // Empty arrays are ignored, like Redis does
+                if (!decoded.empty()) {
+                    commands.emplace_back(std::move(decoded), pos - command_start);
+                    command_start = pos;
+                }
+                i = pos;
                 break;
             }
             default: {
@@ -102,8 +210,11 @@ std::vector<std::pair<DecodedMessage, int>> MessageParser::parse_message(std::st
             }
         }
     }
+    bytes_consumed = i;
 
-    if (Logger::log_level >= Logger::Level::DEBUG) {
+    // Dumping every parsed command is expensive on pipelines, so it is rate limited
+    static thread_local Logger::RateLimiter limiter(100);
+    if (Logger::debug_enabled() && limiter.allow()) {
         ERROR("Parsed " << std::to_string(commands.size()) << " commands");
         for (int i = 0; i < commands.size(); i++) {
             std::stringstream ss;
@@ -140,26 +251,50 @@ DecodedMessage MessageParser::parse_array(std::string_view raw_message) {
     return res;
 }
 
+// Appends <prefix><num>\r\n with a single append, eg. the length line of a bulk string
+template <typename Integer>
+static void append_number(std::string &out, char prefix, Integer num) {
+    char buf[1 + 20 + DELIM_SIZE];
+    buf[0] = prefix;
+    char *end = std::to_chars(buf + 1, buf + sizeof(buf) - DELIM_SIZE, num).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    out.append(buf, end - buf);
+}
+
+std::string_view SharedReplies::integer(long long num) {
+    // Fixed-size slots, the longest entry is ":9999\r\n"
+    static constexpr int SLOT_SIZE = 8;
+    struct Table {
+        char data[SHARED_INTEGERS][SLOT_SIZE];
+        uint8_t sizes[SHARED_INTEGERS];
+
+        Table() {
+            for (int i = 0; i < SHARED_INTEGERS; i++) {
+                std::string encoded;
+                append_number(encoded, ':', i);
+                encoded.copy(this->data[i], SLOT_SIZE);
+                this->sizes[i] = encoded.size();
+            }
+        }
+    };
+    static const Table table;
+
+    if (num < 0 || num >= SHARED_INTEGERS) return {};
+    return {table.data[num], table.sizes[num]};
+}
+
 RESPMessage MessageParser::encode_simple_string(std::string_view message) {
-    std::string res;
+    RESPMessage res;
     res.reserve(1 + message.size() + DELIM_SIZE);
-    res.push_back('+');
-    res.append(message);
-    res.append(DELIM);
+    append_simple_string(res, message);
     return res;
 }
 
 RESPMessage MessageParser::encode_bulk_string(std::string_view message) {
-    std::string res;
-
-    const int digits = numDigits(message.size());
-    res.reserve(1 + digits + 2 + message.size() + DELIM_SIZE);
-
-    res.push_back('$');
-    res.append(std::to_string(message.size()));
-    res.append(DELIM);
-    res.append(std::string{message});
-    res.append(DELIM);
+    RESPMessage res;
+    res.reserve(1 + numDigits(message.size()) + DELIM_SIZE + message.size() + DELIM_SIZE);
+    append_bulk_string(res, message);
     return res;
 }
 
@@ -172,45 +307,34 @@ RESPMessage MessageParser::encode_array(const std::vector<std::string> &words) {
     }
     res.reserve(size);
 
-    res.push_back('*');
-    res.append(std::to_string(words.size()));
-    res.append(DELIM);
-
-    for (const auto &word : words) {
-        res.push_back('$');
-        res.append(std::to_string(word.size()));
-        res.append(DELIM);
-        res.append(word);
-        res.append(DELIM);
-    }
+    append_array(res, words);
     return res;
 }
 
 RESPMessage MessageParser::encode_rdb_file(std::string_view message) {
     RESPMessage res;
     res.reserve(1 + numDigits(message.size()) + DELIM_SIZE + message.size());
-    res.push_back('$');
-    res.append(std::to_string(message.size()));
-    res.append(DELIM);
+    append_number(res, '$', message.size());
     res.append(message);
     return res;
 }
 
-RESPMessage MessageParser::encode_integer(int num) {
+RESPMessage MessageParser::encode_integer(long long num) {
+    RESPMessage res;
+    append_integer(res, num);
+    return res;
+}
+
+RESPMessage MessageParser::encode_array_header(size_t size) {
     RESPMessage res;
-    res.reserve(1 + numDigits(num) + DELIM_SIZE);
-    res.push_back(':');
-    res.append(std::to_string(num));
-    res.append(DELIM);
+    append_array_header(res, size);
     return res;
 }
 
 RESPMessage MessageParser::encode_simple_error(std::string_view message) {
     RESPMessage res;
     res.reserve(1 + message.size() + DELIM_SIZE);
-    res.push_back('-');
-    res.append(message);
-    res.append(DELIM);
+    append_simple_error(res, message);
     return res;
 }
 
@@ -218,3 +342,45 @@ RESPMessage MessageParser::encode_stream(const Stream &stream) {
     // TODO
     return "stream";
 }
+
+void MessageParser::append_simple_string(std::string &out, std::string_view message) {
+    out.push_back('+');
+    out.append(message);
+    out.append(DELIM);
+}
+
+void MessageParser::append_bulk_string(std::string &out, std::string_view message) {
+    append_number(out, '$', message.size());
+    out.append(message);
+    out.append(DELIM);
+}
+
+void MessageParser::append_array(std::string &out, const std::vector<std::string> &words) {
+    append_number(out, '*', words.size());
+    for (const auto &word : words) {
+        append_bulk_string(out, word);
+    }
+}
+
+void MessageParser::append_integer(std::string &out, long long num) {
+    const std::string_view shared = SharedReplies::integer(num);
+    if (!shared.empty()) {
+        out.append(shared);
+    } else {
+        append_number(out, ':', num);
+    }
+}
+
+void MessageParser::append_array_header(std::string &out, size_t size) {
+    append_number(out, '*', size);
+}
+
+void MessageParser::append_push_header(std::string &out, size_t size) {
+    append_number(out, '>', size);
+}
+
+void MessageParser::append_simple_error(std::string &out, std::string_view message) {
+    out.push_back('-');
+    out.append(message);
+    out.append(DELIM);
+}
@@ -10,9 +10,26 @@ std::string hexToBytes(std::string_view s);
 using RESPMessage = std::string;
 using DecodedMessage = std::vector<std::string>;
 
+/**
+ * How far the check of an incomplete array frame got, kept between reads of the same query buffer.
+ * checked_until is 0 when there is nothing to resume.
+ */
+struct MultibulkProgress {
+    size_t frame_start = 0;          // offset of the frame's '*'
+    size_t checked_until = 0;        // offset of its first element not known to be complete
+    long long elements_checked = 0;  // its elements before checked_until
+};
+
 class MessageParser {
    public:
-    static std::vector<std::pair<DecodedMessage, int>> parse_message(std::string_view raw_message);
+    /**
+     * Parses every complete frame in raw_message, bytes_consumed is set to where the first incomplete frame starts.
+     * Each command comes with its size in bytes, including anything skipped right before it.
+     * With progress, an array frame that is still incomplete is not walked again from its start by the next call.
+     */
+    static std::vector<std::pair<DecodedMessage, int>> parse_message(std::string_view raw_message,
+                                                                     size_t &bytes_consumed,
+                                                                     MultibulkProgress *progress = nullptr);
     static DecodedMessage parse_simple_string(std::string_view raw_message);
     static DecodedMessage parse_bulk_string(std::string_view raw_message);
     static DecodedMessage parse_array(std::string_view raw_message);
@@ -21,9 +38,35 @@ class MessageParser {
     static RESPMessage encode_bulk_string(std::string_view message);
     static RESPMessage encode_array(const std::vector<std::string> &words);
     static RESPMessage encode_rdb_file(std::string_view message);
-    static RESPMessage encode_integer(int num);
+    static RESPMessage encode_integer(long long num);
+    // Header of an array whose <size> elements are encoded separately and appended after it
+    static RESPMessage encode_array_header(size_t size);
     static RESPMessage encode_simple_error(std::string_view message);
     static RESPMessage encode_stream(const Stream &stream);
+
+    // Like the encode_* functions, but write straight into out (usually a reply buffer) without temporaries
+    static void append_simple_string(std::string &out, std::string_view message);
+    static void append_bulk_string(std::string &out, std::string_view message);
+    static void append_array(std::string &out, const std::vector<std::string> &words);
+    static void append_integer(std::string &out, long long num);
+    static void append_array_header(std::string &out, size_t size);
+    // RESP3 out-of-band push message, >size followed by its elements
+    static void append_push_header(std::string &out, size_t size);
+    static void append_simple_error(std::string &out, std::string_view message);
 };
 
-const RESPMessage null_bulk_string = "$-1\r\n";
\ No newline at end of file
+// Replies that never change, shared instead of being encoded again for every command
+struct SharedReplies {
+    static constexpr std::string_view ok = "+OK\r\n";
+    static constexpr std::string_view pong = "+PONG\r\n";
+    static constexpr std::string_view null_bulk_string = "$-1\r\n";
+    static constexpr std::string_view empty_array = "*0\r\n";
+    static constexpr std::string_view null_array = "*-1\r\n";
+    static constexpr std::string_view empty_bulk_string = "$0\r\n\r\n";
+    static constexpr std::string_view wrong_type =
+        "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+
+    // Integer replies in [0, SHARED_INTEGERS) are encoded once at startup
+    static constexpr int SHARED_INTEGERS = 10000;
+    static std::string_view integer(long long num);
+};
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "pubsub.h"
+
+#include "logger.h"
+#include "message_parser.h"
+#include "server.h"
+#include "stats.h"
+
+size_t PubSub::output_buffer_hard_limit = 32 * 1024 * 1024;
+size_t PubSub::output_buffer_soft_limit = 8 * 1024 * 1024;
+long long PubSub::output_buffer_soft_seconds = 60;
+thread_local ServerInfo *PubSub::server_info = nullptr;
+thread_local std::unordered_map<int, PubSub::Subscriptions> PubSub::clients;
+thread_local PubSub::Subscribers PubSub::channels;
+thread_local PubSub::Subscribers PubSub::patterns;
+thread_local GlobPatternSet PubSub::pattern_set;
+
+void PubSub::attach(ServerInfo &server_info) {
+    PubSub::server_info = &server_info;
+}
+
+size_t PubSub::subscribe(int client_socket, std::string_view channel) {
+    if (PubSub::clients[client_socket].channels.emplace(channel).second) {
+        PubSub::channels[std::string{channel}].insert(client_socket);
+    }
+    return get_subscription_count(client_socket);
+}
+
+size_t PubSub::unsubscribe(int client_socket, std::string_view channel) {
+    auto client_it = PubSub::clients.find(client_socket);
+    if (client_it == PubSub::clients.end()) return 0;
+
+    if (client_it->second.channels.erase(std::string{channel}) > 0) {
+        auto it = PubSub::channels.find(channel);
+        it->second.erase(client_socket);
+        if (it->second.empty()) {
+            PubSub::channels.erase(it);
+        }
+    }
+    return release_if_unsubscribed(client_socket);
+}
+
+size_t PubSub::psubscribe(int client_socket, std::string_view pattern) {
+    if (PubSub::clients[client_socket].patterns.emplace(pattern).second) {
+        std::unordered_set<int> &subscribers = PubSub::patterns[std::string{pattern}];
+        if (subscribers.empty()) {
+            PubSub::pattern_set.insert(pattern);
+        }
+        subscribers.insert(client_socket);
+    }
+    return get_subscription_count(client_socket);
+}
+
+size_t PubSub::punsubscribe(int client_socket, std::string_view pattern) {
+    auto client_it = PubSub::clients.find(client_socket);
+    if (client_it == PubSub::clients.end()) return 0;
+
+    if (client_it->second.patterns.erase(std::string{pattern}) > 0) {
+        auto it = PubSub::patterns.find(pattern);
+        it->second.erase(client_socket);
+        if (it->second.empty()) {
+            PubSub::pattern_set.erase(pattern);
+            PubSub::patterns.erase(it);
+        }
+    }
+    return release_if_unsubscribed(client_socket);
+}
+
+size_t PubSub::get_subscription_count(int client_socket) {
+    auto it = PubSub::clients.find(client_socket);
+    return it != PubSub::clients.end() ? it->second.channels.size() + it->second.patterns.size() : 0;
+}
+
+std::vector<std::string> PubSub::get_client_channels(int client_socket) {
+    auto it = PubSub::clients.find(client_socket);
+    if (it == PubSub::clients.end()) return {};
+    return {it->second.channels.begin(), it->second.channels.end()};
+}
+
+std::vector<std::string> PubSub::get_client_patterns(int client_socket) {
+    auto it = PubSub::clients.find(client_socket);
+    if (it == PubSub::clients.end()) return {};
+    return {it->second.patterns.begin(), it->second.patterns.end()};
+}
+
+size_t PubSub::publish(std::string_view channel, std::string_view message) {
+    size_t receivers = 0;
+
+    auto it = PubSub::channels.find(channel);
+    if (it != PubSub::channels.end()) {
+        // message channel payload, encoded once for every subscriber
+        auto encoded = std::make_shared<std::string>();
+        MessageParser::append_array_header(*encoded, 3);
+        MessageParser::append_bulk_string(*encoded, "message");
+        MessageParser::append_bulk_string(*encoded, channel);
+        MessageParser::append_bulk_string(*encoded, message);
+
+        const std::shared_ptr<const std::string> shared = std::move(encoded);
+        for (const int client_socket : it->second) {
+            receivers += deliver(client_socket, shared);
+        }
+    }
+
+    PubSub::pattern_set.for_each_match(channel, [&](std::string_view pattern) {
+        // pmessage pattern channel payload, encoded once for every subscriber of the pattern
+        auto encoded = std::make_shared<std::string>();
+        MessageParser::append_array_header(*encoded, 4);
+        MessageParser::append_bulk_string(*encoded, "pmessage");
+        MessageParser::append_bulk_string(*encoded, pattern);
+        MessageParser::append_bulk_string(*encoded, channel);
+        MessageParser::append_bulk_string(*encoded, message);
+
+        const std::shared_ptr<const std::string> shared = std::move(encoded);
+        for (const int client_socket : PubSub::patterns.find(pattern)->second) {
+            receivers += deliver(client_socket, shared);
+        }
+    });
+
+    return receivers;
+}
+
+void PubSub::remove_client(int client_socket) {
+    for (const std::string &channel : get_client_channels(client_socket)) {
+        unsubscribe(client_socket, channel);
+    }
+    for (const std::string &pattern : get_client_patterns(client_socket)) {
+        punsubscribe(client_socket, pattern);
+    }
+    PubSub::clients.erase(client_socket);
+}
+
+std::vector<std::string> PubSub::get_channels(std::string_view pattern) {
+    std::vector<std::string> res;
+    if (pattern.empty()) {
+        for (const auto &[channel, subscribers] : PubSub::channels) {
+            res.push_back(channel);
+        }
+        return res;
+    }
+
+    const GlobPattern glob(pattern);
+    for (const auto &[channel, subscribers] : PubSub::channels) {
+        if (glob.match(channel)) res.push_back(channel);
+    }
+    return res;
+}
+
+size_t PubSub::get_subscriber_count(std::string_view channel) {
+    auto it = PubSub::channels.find(channel);
+    return it != PubSub::channels.end() ? it->second.size() : 0;
+}
+
+size_t PubSub::get_channel_count() {
+    return PubSub::channels.size();
+}
+
+size_t PubSub::get_pattern_count() {
+    return PubSub::pattern_set.size();
+}
+
+size_t PubSub::get_client_count() {
+    return PubSub::clients.size();
+}
+
+size_t PubSub::release_if_unsubscribed(int client_socket) {
+    auto it = PubSub::clients.find(client_socket);
+    if (it == PubSub::clients.end()) return 0;
+
+    const size_t count = it->second.channels.size() + it->second.patterns.size();
+    if (count == 0) {
+        PubSub::clients.erase(it);
+    }
+    return count;
+}
+
+bool PubSub::deliver(int client_socket, const std::shared_ptr<const std::string> &message) {
+    if (PubSub::server_info == nullptr) return false;
+
+    auto it = PubSub::server_info->clients.find(client_socket);
+    if (it == PubSub::server_info->clients.end() || PubSub::server_info->pending_closes.contains(client_socket)) {
+        return false;
+    }
+    Client &client = it->second;
+    client.queue_shared(message);
+    PubSub::server_info->pending_writes.insert(client_socket);
+
+    const size_t pending = client.output_bytes + client.reply_buffer.size();
+    bool over_limit = PubSub::output_buffer_hard_limit > 0 && pending > PubSub::output_buffer_hard_limit;
+    if (PubSub::output_buffer_soft_limit > 0 && pending > PubSub::output_buffer_soft_limit) {
+        const auto now = std::chrono::steady_clock::now();
+        if (!client.soft_limit_since.has_value()) {
+            client.soft_limit_since = now;
+        }
+        over_limit |= now - *client.soft_limit_since >= std::chrono::seconds(PubSub::output_buffer_soft_seconds);
+    } else {
+        client.soft_limit_since.reset();
+    }
+
+    if (over_limit) {
+        ERROR("Disconnecting subscriber " << client_socket << " with " << pending
+                                          << " bytes of output over the pubsub output buffer limit");
+        Stats::local().client_output_buffer_limit_disconnections.add();
+        PubSub::server_info->pending_closes.insert(client_socket);
+    }
+    return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "glob_pattern.h"
+#include "storage.h"
+
+struct ServerInfo;
+
+/*
+    Channels and patterns subscribed to with SUBSCRIBE and PSUBSCRIBE.
+
+    PUBLISH encodes a message once for the channel and once for each matching pattern, into a refcounted buffer. Every
+    receiver's output queue points at that buffer, which is written to each socket with sendmsg straight from there,
+    so fanning out to many subscribers costs a pointer each instead of a copy. The buffer is freed once the last
+    receiver has sent it.
+
+    A subscriber that does not keep up only grows its own output queue. Past output_buffer_hard_limit, or over
+    output_buffer_soft_limit for output_buffer_soft_seconds in a row, it is disconnected by the event loop rather than
+    buffered without bounds. Everything here runs on the event loop thread.
+*/
+class PubSub {
+   public:
+    // Limits on the unsent output of a subscribed client, 0 for no limit
+    static size_t output_buffer_hard_limit;
+    static size_t output_buffer_soft_limit;
+    static long long output_buffer_soft_seconds;
+
+    // Where clients and their output queues live, set once by the server
+    static void attach(ServerInfo &server_info);
+
+    // Each returns the client's number of channels and patterns after the change
+    static size_t subscribe(int client_socket, std::string_view channel);
+    static size_t unsubscribe(int client_socket, std::string_view channel);
+    static size_t psubscribe(int client_socket, std::string_view pattern);
+    static size_t punsubscribe(int client_socket, std::string_view pattern);
+
+    // Only subscribed clients are limited to the Pub/Sub commands
+    static bool is_subscribed(int client_socket) {
+        return !PubSub::clients.empty() && PubSub::clients.contains(client_socket);
+    }
+
+    static size_t get_subscription_count(int client_socket);
+    static std::vector<std::string> get_client_channels(int client_socket);
+    static std::vector<std::string> get_client_patterns(int client_socket);
+
+    // Queues message for every subscriber of channel and of the patterns matching it, returns how many received it
+    static size_t publish(std::string_view channel, std::string_view message);
+
+    // Called when a client disconnects
+    static void remove_client(int client_socket);
+
+    // Channels with at least one subscriber, all of them if pattern is empty
+    static std::vector<std::string> get_channels(std::string_view pattern);
+    static size_t get_subscriber_count(std::string_view channel);
+    static size_t get_channel_count();
+    static size_t get_pattern_count();
+    static size_t get_client_count();
+
+   private:
+    struct Subscriptions {
+        std::unordered_set<std::string> channels;
+        std::unordered_set<std::string> patterns;
+    };
+
+    using Subscribers = std::unordered_map<std::string, std::unordered_set<int>, StoreKeyHash, std::equal_to<>>;
+
+    // Subscriptions of the calling shard's clients, PUBLISH is broadcast to every shard
+    static thread_local ServerInfo *server_info;
+    static thread_local std::unordered_map<int, Subscriptions> clients;
+    static thread_local Subscribers channels;
+    static thread_local Subscribers patterns;
+    static thread_local GlobPatternSet pattern_set;
+
+    // Forgets the client once it has no subscriptions left, so it leaves the subscribed state
+    static size_t release_if_unsubscribed(int client_socket);
+
+    // Queues message for the client, or marks it for disconnection if its output is over the limits
+    static bool deliver(int client_socket, const std::shared_ptr<const std::string> &message);
+};
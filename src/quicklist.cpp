@@ -0,0 +1,73 @@
+#include "quicklist.h"
+
+#include <algorithm>
+
+long QuickList::max_listpack_size = -2;
+
+void QuickList::push_front(std::string_view element) {
+    if (this->nodes.empty() || is_full(this->nodes.front(), Listpack::entry_size(element.size()))) {
+        this->nodes.emplace_front();
+    }
+
+    // Encoded separately since the node's existing entries have to move up to make room
+    std::string entry;
+    Listpack::append_entry(entry, element);
+    Node &node = this->nodes.front();
+    node.data.insert(0, entry);
+    node.count++;
+    this->count++;
+}
+
+void QuickList::push_back(std::string_view element) {
+    if (this->nodes.empty() || is_full(this->nodes.back(), Listpack::entry_size(element.size()))) {
+        this->nodes.emplace_back();
+    }
+
+    Node &node = this->nodes.back();
+    Listpack::append_entry(node.data, element);
+    node.count++;
+    this->count++;
+}
+
+std::optional<std::string> QuickList::pop_front() {
+    if (this->nodes.empty()) return std::nullopt;
+
+    Node &node = this->nodes.front();
+    size_t pos = 0;
+    std::string element{Listpack::read_entry(node.data, pos)};
+    if (--node.count == 0) {
+        this->nodes.pop_front();
+    } else {
+        node.data.erase(0, pos);
+    }
+    this->count--;
+    return element;
+}
+
+std::optional<std::string> QuickList::pop_back() {
+    if (this->nodes.empty()) return std::nullopt;
+
+    Node &node = this->nodes.back();
+    size_t end = node.data.size();
+    std::string element{Listpack::read_entry_backwards(node.data, end)};
+    if (--node.count == 0) {
+        this->nodes.pop_back();
+    } else {
+        node.data.resize(end);
+    }
+    this->count--;
+    return element;
+}
+
+size_t QuickList::size() const {
+    return this->count;
+}
+
+bool QuickList::is_full(const Node &node, size_t entry_size) {
+    if (max_listpack_size > 0) {
+        return node.count >= static_cast<size_t>(max_listpack_size);
+    }
+
+    const size_t max_bytes = size_t{4096} << (std::clamp(-max_listpack_size, 1L, 5L) - 1);
+    return node.count > 0 && node.data.size() + entry_size > max_bytes;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "listpack.h"
+
+/**
+ * Elements of the list type, stored like Redis' quicklist: a doubly linked list of nodes that each pack a run of
+ * elements into one buffer. Pushes and pops only touch the first or last node, and the per-element overhead is a
+ * couple of length bytes instead of a heap node and two pointers.
+ */
+class QuickList {
+   public:
+    /**
+     * list-max-listpack-size: a positive value caps the elements per node, a negative one caps the node size at
+     * 4 KB (-1), 8 KB (-2), 16 KB (-3), 32 KB (-4) or 64 KB (-5). An element larger than the cap gets its own node.
+     */
+    static long max_listpack_size;
+
+    void push_front(std::string_view element);
+    void push_back(std::string_view element);
+
+    std::optional<std::string> pop_front();
+    std::optional<std::string> pop_back();
+
+    size_t size() const;
+
+    // Calls fn(element) for the elements at indexes [start, stop), in order
+    template <typename Fn>
+    void for_range(size_t start, size_t stop, Fn &&fn) const {
+        size_t index = 0;
+        for (const Node &node : this->nodes) {
+            if (index >= stop) return;
+            if (index + node.count <= start) {
+                index += node.count;
+                continue;
+            }
+
+            size_t pos = 0;
+            for (uint32_t i = 0; i < node.count && index < stop; i++, index++) {
+                const std::string_view element = Listpack::read_entry(node.data, pos);
+                if (index >= start) fn(element);
+            }
+        }
+    }
+
+   private:
+    struct Node {
+        std::string data;  // Listpack entries
+        uint32_t count = 0;
+    };
+
+    std::list<Node> nodes;
+    size_t count = 0;
+
+    // Whether node has no room for an element taking entry_size bytes
+    static bool is_full(const Node &node, size_t entry_size);
+};
@@ -2,12 +2,11 @@
 
 #include <sys/stat.h>
 
-#include <algorithm>
-#include <bitset>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
-#include <vector>
+#include <iterator>
 
 #include "logger.h"
 
@@ -49,180 +48,228 @@ void print_file(std::string_view file_path) {
 StoragePtr RDBParser::parse_rdb(std::string_view file_path) {
     LOG("parsing rdb at: " << file_path.data());
 
-    StoragePtr storage_ptr = std::make_shared<Storage>();
-
     // Assume rdb is empty if file does not exist
     struct stat buffer;
     if (stat(file_path.data(), &buffer) != 0) return {};
 
-    std::ifstream fin(file_path.data());
+    std::ifstream fin(file_path.data(), std::ios::binary);
     if (!fin.is_open()) {
         throw std::runtime_error("Unable to open file");
     }
+    const std::string data{std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>()};
+    fin.close();
 
-    uint8_t c;
-
-    // Header section
-    while (fin >> std::hex >> std::noskipws >> c) {
-        if (c == static_cast<uint8_t>(RDBParser::Delimiters::METADATA)) break;
+    StoragePtr storage_ptr = std::make_shared<Storage>();
+    try {
+        load(data, *storage_ptr);
+    } catch (const std::runtime_error &e) {
+        ERROR("Error while parsing rdb: " << e.what());
+        return {};
     }
+    return storage_ptr;
+}
 
-    // Metadata section
-    while (fin >> std::hex >> std::noskipws >> c) {
-        if (c == static_cast<uint8_t>(RDBParser::Delimiters::DATABASE)) break;
-    }
+void RDBParser::load(std::string_view data, Storage &storage) {
+    Reader in{data};
 
-    // Database section
-    uint8_t db_index;
-    fin >> std::hex >> std::noskipws >> db_index;
+    // Header section, REDIS and a 4 digit version
+    if (in.bytes(9).substr(0, 5) != "REDIS") {
+        throw std::runtime_error("Not an RDB file");
+    }
 
-    uint8_t key_value_table_size = 0;
-    uint8_t expiry_table_size = 0;
-    while (fin >> std::hex >> std::noskipws >> c) {
+    while (true) {
+        const uint8_t c = in.byte();
         if (c == static_cast<uint8_t>(RDBParser::Delimiters::END_OF_FILE)) break;
 
-        if (c == static_cast<uint8_t>(RDBParser::Delimiters::HASH_TABLE_SIZE)) {
-            fin >> std::hex >> std::noskipws >> key_value_table_size;
-            fin >> std::hex >> std::noskipws >> expiry_table_size;
+        switch (static_cast<RDBParser::Delimiters>(c)) {
+            case RDBParser::Delimiters::METADATA:
+                // Auxiliary field, eg. redis-ver, none of them matter here
+                parse_string(in);
+                parse_string(in);
+                continue;
+            case RDBParser::Delimiters::DATABASE:
+                // Every database is loaded into the only one there is
+                parse_size_encoding(in);
+                continue;
+            case RDBParser::Delimiters::HASH_TABLE_SIZE:
+                parse_size_encoding(in);  // key value table size
+                parse_size_encoding(in);  // expiry table size
+                continue;
+            default:
+                break;
         }
 
-        for (int i = 0; i < key_value_table_size; i++) {
-            fin >> std::hex >> std::noskipws >> c;
-
-            if (c == static_cast<uint8_t>(RDBParser::Delimiters::EXPIRY_MILLISECONDS) ||
-                c == static_cast<uint8_t>(RDBParser::Delimiters::EXPIRY_SECONDS)) {
-                TimeStamp ts;
-                try {
-                    ts = parse_expiry(fin, static_cast<RDBParser::Delimiters>(c));
-                } catch (const std::runtime_error &e) {
-                    ERROR("Error while parsing expiry: " << e.what());
-                    return {};
-                }
-
-                // Consume 1-byte type indicator
-                fin >> std::hex >> std::noskipws >> c;
-
-                // Get kv pair associated with this expiry
-                if (c == static_cast<uint8_t>(RDBParser::Delimiters::START_OF_STRING)) {
-                    std::pair<std::string, std::string> kv = RDBParser::parse_string(fin);
-                    storage_ptr->set(kv.first, StringValue(kv.second, ts));
-                }
-            } else if (c == static_cast<uint8_t>(RDBParser::Delimiters::START_OF_STRING)) {
-                // This key-value pair does not have an expiry
-                std::pair<std::string, std::string> kv = RDBParser::parse_string(fin);
-                storage_ptr->set(kv.first, StringValue(kv.second, std::nullopt));
-            }
+        TimeStamp ts = std::nullopt;
+        uint8_t type = c;
+        if (c == static_cast<uint8_t>(RDBParser::Delimiters::EXPIRY_MILLISECONDS) ||
+            c == static_cast<uint8_t>(RDBParser::Delimiters::EXPIRY_SECONDS)) {
+            ts = parse_expiry(in, static_cast<RDBParser::Delimiters>(c));
+            // Consume 1-byte type indicator
+            type = in.byte();
         }
-    }
 
-    // EOF section, 8-byte checksum
-    std::string checksum;
-    checksum.reserve(8);
-    while (fin >> std::hex >> std::noskipws >> c) {
-        checksum.push_back(c);
+        std::string key = parse_string(in);
+        storage.set(key, parse_value(in, static_cast<RDBParser::ValueType>(type), ts));
     }
-    // assume checksum is correct for now
 
-    fin.close();
+    // EOF section, 8-byte checksum, assume it is correct for now
+}
 
-    return storage_ptr;
+StorageValueVariants RDBParser::load_value(std::string_view payload, RDBParser::ValueType type,
+                                           const TimeStamp &expiry) {
+    Reader in{payload};
+    return parse_value(in, type, expiry);
+}
+
+StorageValueVariants RDBParser::parse_value(Reader &in, RDBParser::ValueType type, const TimeStamp &expiry) {
+    switch (type) {
+        case RDBParser::ValueType::STRING:
+            return StringValue(parse_string(in), expiry);
+        case RDBParser::ValueType::LIST: {
+            QuickList list;
+            for (uint64_t n = parse_size_encoding(in); n > 0; n--) {
+                list.push_back(parse_string(in));
+            }
+            return ListValue(std::move(list), expiry);
+        }
+        case RDBParser::ValueType::HASH: {
+            Hash hash;
+            for (uint64_t n = parse_size_encoding(in); n > 0; n--) {
+                const std::string field = parse_string(in);
+                hash.set(field, parse_string(in));
+            }
+            return HashValue(std::move(hash), expiry);
+        }
+        case RDBParser::ValueType::SORTED_SET: {
+            SortedSet set;
+            for (uint64_t n = parse_size_encoding(in); n > 0; n--) {
+                const std::string member = parse_string(in);
+                const uint64_t bits = in.fixed(8);
+                double score;
+                std::memcpy(&score, &bits, sizeof(score));
+                set.add(member, score);
+            }
+            return SortedSetValue(std::move(set), expiry);
+        }
+    }
+    // Eg. the listpack encodings Redis uses for small values
+    throw std::runtime_error("Unsupported value type " + std::to_string(static_cast<int>(type)));
 }
 
-std::pair<std::string, std::string> RDBParser::parse_string(std::ifstream &fin) {
-    std::string key, value;
-    uint8_t c;
+uint8_t RDBParser::Reader::byte() {
+    return static_cast<uint8_t>(bytes(1)[0]);
+}
 
-    uint8_t key_size;
-    fin >> std::hex >> std::noskipws >> key_size;
-    key.reserve(key_size);
-    for (int i = 0; i < key_size; i++) {
-        fin >> std::hex >> std::noskipws >> c;
-        key.push_back(c);
+std::string_view RDBParser::Reader::bytes(size_t n) {
+    if (n > this->data.size() - this->pos) {
+        throw std::runtime_error("Unexpected end of rdb");
     }
+    const std::string_view res = this->data.substr(this->pos, n);
+    this->pos += n;
+    return res;
+}
 
-    uint8_t value_size;
-    fin >> std::hex >> std::noskipws >> value_size;
-    value.reserve(value_size);
-    for (int i = 0; i < value_size; i++) {
-        fin >> std::hex >> std::noskipws >> c;
-        value.push_back(c);
+uint64_t RDBParser::Reader::fixed(size_t n) {
+    const std::string_view raw = bytes(n);
+    uint64_t value = 0;
+    for (size_t i = n; i > 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(raw[i - 1]);
     }
+    return value;
+}
 
-    return {key, value};
+TimeStamp RDBParser::parse_expiry(Reader &in, RDBParser::Delimiters delim) {
+    if (delim == RDBParser::Delimiters::EXPIRY_MILLISECONDS) {
+        std::chrono::milliseconds duration(in.fixed(8));
+        return TimeStamp(duration);
+    } else if (delim == RDBParser::Delimiters::EXPIRY_SECONDS) {
+        std::chrono::seconds duration(in.fixed(4));
+        return TimeStamp(duration);
+    }
+
+    throw std::runtime_error("Unknown expiry time unit");
 }
 
-TimeStamp RDBParser::parse_expiry(std::ifstream &fin, RDBParser::Delimiters delim) {
-    std::stringstream raw_timestamp;
+uint64_t RDBParser::parse_size_encoding(Reader &in, bool &encoded) {
+    const uint8_t c = in.byte();
+    encoded = false;
+    switch (static_cast<RDBParser::SizeEncoding>(c >> 6)) {
+        case RDBParser::SizeEncoding::SIX_BITS:
+            return c & 0x3f;
+        case RDBParser::SizeEncoding::FOURTEEN_BITS:
+            return (static_cast<uint64_t>(c & 0x3f) << 8) | in.byte();
+        case RDBParser::SizeEncoding::LONG: {
+            // Big endian, unlike everything else
+            const size_t num_bytes_to_read = c == 0x80 ? 4 : 8;
+            uint64_t val = 0;
+            for (size_t i = 0; i < num_bytes_to_read; i++) {
+                val = (val << 8) | in.byte();
+            }
+            return val;
+        }
+        case RDBParser::SizeEncoding::STRING_ENCODING:
+            encoded = true;
+            return c & 0x3f;
+    }
+    return 0;
+}
 
-    uint8_t c;
-    for (int i = 0; i < 8; i++) {
-        fin >> std::hex >> std::noskipws >> c;
-        raw_timestamp << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned short>(c);
+uint64_t RDBParser::parse_size_encoding(Reader &in) {
+    bool encoded;
+    const uint64_t size = parse_size_encoding(in, encoded);
+    if (encoded) {
+        throw std::runtime_error("Expected a length, got a string encoding");
     }
-    std::string expiry_timestamp = raw_timestamp.str();
-    reverse(expiry_timestamp.begin(), expiry_timestamp.end());
+    return size;
+}
 
-    if (expiry_timestamp.size() & 1) {
-        throw std::runtime_error("Hex string cannot have an odd length");
+// LZF as Redis compresses long strings: runs of literal bytes and back references into what was decoded so far
+static std::string lzf_decompress(std::string_view compressed, size_t length) {
+    std::string out;
+    out.reserve(length);
+    size_t i = 0;
+    auto next = [&]() -> uint8_t {
+        if (i >= compressed.size()) throw std::runtime_error("Truncated LZF string");
+        return static_cast<uint8_t>(compressed[i++]);
+    };
+    while (i < compressed.size()) {
+        const uint8_t ctrl = next();
+        if (ctrl < 32) {
+            for (int n = ctrl + 1; n > 0; n--) out.push_back(static_cast<char>(next()));
+            continue;
+        }
+        size_t len = ctrl >> 5;
+        if (len == 7) len += next();
+        const size_t back = ((static_cast<size_t>(ctrl & 0x1f) << 8) | next()) + 1;
+        if (back > out.size()) throw std::runtime_error("Invalid LZF back reference");
+        // Byte by byte, a reference may overlap what it produces
+        for (size_t from = out.size() - back, n = len + 2; n > 0; n--, from++) out.push_back(out[from]);
+    }
+    if (out.size() != length) {
+        throw std::runtime_error("LZF string has the wrong length");
     }
+    return out;
+}
 
-    // Reverse will reverse all our hex numbers, so we need to reverse each block of 2 again
-    for (int i = 0; i < expiry_timestamp.size(); i += 2) {
-        const char tmp = expiry_timestamp[i];
-        expiry_timestamp[i] = expiry_timestamp[i + 1];
-        expiry_timestamp[i + 1] = tmp;
+std::string RDBParser::parse_string(Reader &in) {
+    bool encoded;
+    const uint64_t size = parse_size_encoding(in, encoded);
+    if (!encoded) {
+        return std::string{in.bytes(size)};
     }
 
-    try {
-        const unsigned long expiry_value = std::stoul(expiry_timestamp, nullptr, 16);
-
-        if (delim == RDBParser::Delimiters::EXPIRY_MILLISECONDS) {
-            std::chrono::milliseconds duration(expiry_value);
-            return TimeStamp(duration);
-        } else if (delim == RDBParser::Delimiters::EXPIRY_SECONDS) {
-            std::chrono::seconds duration(expiry_value);
-            return TimeStamp(duration);
+    switch (static_cast<RDBParser::StringEncoding>(size)) {
+        case RDBParser::StringEncoding::INT8:
+            return std::to_string(static_cast<int8_t>(in.fixed(1)));
+        case RDBParser::StringEncoding::INT16:
+            return std::to_string(static_cast<int16_t>(in.fixed(2)));
+        case RDBParser::StringEncoding::INT32:
+            return std::to_string(static_cast<int32_t>(in.fixed(4)));
+        case RDBParser::StringEncoding::LZF: {
+            const uint64_t compressed_size = parse_size_encoding(in);
+            const uint64_t length = parse_size_encoding(in);
+            return lzf_decompress(in.bytes(compressed_size), length);
         }
-    } catch (const std::invalid_argument &e) {
-        std::cerr << "Out of range when parsing rdb timestamp: " << e.what() << std::endl;
-        return std::nullopt;
     }
-
-    throw std::runtime_error("Unknown expiry time unit");
+    throw std::runtime_error("Unknown string encoding " + std::to_string(size));
 }
-
-// Not used in the challenge
-uint64_t RDBParser::parse_size_encoding(std::ifstream &fin) {
-    uint8_t c;
-    fin >> c;
-    std::bitset<4> bs(c);
-    const int last_bit = bs[3], second_last_bit = bs[2];
-
-    // Supposed to check "first two" bits aka leftmost, but this is flipped
-    // 0x8 gives 0 0 0 1
-    RDBParser::SizeEncoding encoded_size;
-    if (last_bit == 0 && second_last_bit == 0) {
-        encoded_size = RDBParser::SizeEncoding::TWO_BYTES;
-    } else if (last_bit == 0 && second_last_bit == 1) {
-        encoded_size = RDBParser::SizeEncoding::FOUR_BYTES;
-    } else if (last_bit == 1 && second_last_bit == 0) {
-        encoded_size = RDBParser::SizeEncoding::TEN_BYTES;
-    } else {
-        encoded_size = RDBParser::SizeEncoding::STRING_ENCODING;
-    }
-
-    const int num_bytes_to_read = static_cast<int>(encoded_size);
-
-    std::string raw_size;
-    raw_size.push_back(c);
-    for (int i = 1; i < num_bytes_to_read; i++) {
-        fin >> c;
-        raw_size.push_back(c);
-    }
-
-    uint64_t bitmask = (uint64_t(1) << (num_bytes_to_read * 4 - 2)) - 1;
-    uint64_t val;
-    std::istringstream iss(raw_size);
-    iss >> std::hex >> val;
-    return val & bitmask;
-}
\ No newline at end of file
@@ -1,13 +1,14 @@
 #pragma once
 
+#include <cstdint>
+#include <string>
+#include <string_view>
+
 #include "storage.h"
 #include "utils.h"
 
 class RDBParser {
    public:
-    static StoragePtr parse_rdb(std::string_view file_path);
-
-   private:
     enum class Delimiters {
         METADATA = 0xfa,
         DATABASE = 0xfe,
@@ -18,11 +19,42 @@ class RDBParser {
         END_OF_FILE = 0xff
     };
 
-    static std::pair<std::string, std::string> parse_string(std::ifstream &fin);
+    // Value types that follow a key's expiry, or stand in its place
+    enum class ValueType { STRING = 0, LIST = 1, HASH = 4, SORTED_SET = 5 };
+
+    // Top two bits of the first byte of a length
+    enum class SizeEncoding { SIX_BITS = 0, FOURTEEN_BITS = 1, LONG = 2, STRING_ENCODING = 3 };
+
+    // Lower six bits of a length in STRING_ENCODING, for strings stored as integers or compressed
+    enum class StringEncoding { INT8 = 0, INT16 = 1, INT32 = 2, LZF = 3 };
+
+    static StoragePtr parse_rdb(std::string_view file_path);
+
+    // Adds the keys of an RDB file already in memory to storage, like the snapshot a replica gets from its master
+    static void load(std::string_view data, Storage &storage);
+
+    // Decodes a value stored as payload, the bytes following its key in an RDB file
+    static StorageValueVariants load_value(std::string_view payload, ValueType type, const TimeStamp &expiry);
+
+   private:
+    // Where load has got to in the data, every read throws once past its end
+    struct Reader {
+        std::string_view data;
+        size_t pos = 0;
+
+        uint8_t byte();
+        std::string_view bytes(size_t n);
+        // Little endian, as expiries and scores are stored
+        uint64_t fixed(size_t n);
+    };
+
+    // A length, or the encoding of a string when encoded is set
+    static uint64_t parse_size_encoding(Reader &in, bool &encoded);
+    static uint64_t parse_size_encoding(Reader &in);
 
-    static TimeStamp parse_expiry(std::ifstream &fin, RDBParser::Delimiters delim);
+    static std::string parse_string(Reader &in);
 
-    enum class SizeEncoding { TWO_BYTES = 2, FOUR_BYTES = 4, TEN_BYTES = 10, STRING_ENCODING = 2 };
+    static TimeStamp parse_expiry(Reader &in, RDBParser::Delimiters delim);
 
-    static uint64_t parse_size_encoding(std::ifstream &fin);
-};
\ No newline at end of file
+    static StorageValueVariants parse_value(Reader &in, ValueType type, const TimeStamp &expiry);
+};
@@ -0,0 +1,245 @@
+#include "rdb_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "logger.h"
+#include "mapped_snapshot.h"
+
+std::string RDBWriter::serialize(const Storage &storage) {
+    RDBWriter writer(-1);
+    writer.write_storage(storage);
+    return std::move(writer.out);
+}
+
+long long RDBWriter::save(const Storage &storage, const std::string &path) {
+    const std::string temp_path = path + ".tmp-" + std::to_string(getpid());
+    const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ERROR("Failed to open " << temp_path << " for writing: " << std::strerror(errno));
+        return -1;
+    }
+
+    RDBWriter writer(fd);
+    try {
+        writer.write_storage(storage);
+        writer.flush(true);
+    } catch (const std::runtime_error &e) {
+        ERROR("Failed to write " << temp_path << ": " << e.what());
+        close(fd);
+        unlink(temp_path.c_str());
+        return -1;
+    }
+    return commit_file(fd, temp_path, path) ? writer.written : -1;
+}
+
+bool RDBWriter::commit_file(int fd, const std::string &temp_path, const std::string &path) {
+    // On disk before it replaces path, or a crash right after the rename could leave a truncated file there
+    if (fsync(fd) != 0) {
+        ERROR("Failed to sync " << temp_path << ": " << std::strerror(errno));
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    close(fd);
+
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        ERROR("Failed to rename " << temp_path << " to " << path << ": " << std::strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    // The rename is an entry of the directory, which has to reach the disk too
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    const int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0 || fsync(dir_fd) != 0) {
+        ERROR("Failed to sync directory " << dir << ": " << std::strerror(errno));
+    }
+    if (dir_fd >= 0) close(dir_fd);
+    return true;
+}
+
+void RDBWriter::write_storage(const Storage &storage) {
+    const auto now = std::chrono::system_clock::now();
+    auto is_live = [&](const TimeStamp &expiry) { return !expiry.has_value() || expiry.value() > now; };
+    auto expiry_of = [](const StorageValueVariants &value) {
+        return std::visit([](const auto &v) { return v.get_expiry(); }, value);
+    };
+
+    size_t keys = 0, expires = 0;
+    for (const auto &[key, value] : storage.get_view()) {
+        const TimeStamp expiry = expiry_of(value);
+        if (!value_type(value).has_value() || !is_live(expiry)) continue;
+        keys++;
+        expires += expiry.has_value();
+    }
+    const MappedSnapshot *snapshot = storage.get_snapshot();
+    if (snapshot != nullptr) {
+        snapshot->for_each([&](const MappedSnapshot::Entry &entry) {
+            if (!is_live(entry.expiry)) return;
+            keys++;
+            expires += entry.expiry.has_value();
+        });
+    }
+
+    this->out.append("REDIS0011");
+    this->out.push_back(static_cast<char>(RDBParser::Delimiters::METADATA));
+    write_string("redis-ver");
+    write_string("7.2.0");
+    this->out.push_back(static_cast<char>(RDBParser::Delimiters::METADATA));
+    write_string("redis-bits");
+    write_string("64");
+
+    this->out.push_back(static_cast<char>(RDBParser::Delimiters::DATABASE));
+    write_length(0);
+    this->out.push_back(static_cast<char>(RDBParser::Delimiters::HASH_TABLE_SIZE));
+    write_length(keys);
+    write_length(expires);
+
+    for (const auto &[key, value] : storage.get_view()) {
+        const std::optional<RDBParser::ValueType> type = value_type(value);
+        const TimeStamp expiry = expiry_of(value);
+        if (!type.has_value() || !is_live(expiry)) continue;
+        write_entry(key, *type, expiry);
+        write_payload(value);
+        flush();
+    }
+
+    // Keys not read or written since the server started from a mapped snapshot, whose values are still RDB payloads
+    if (snapshot != nullptr) {
+        snapshot->for_each([&](const MappedSnapshot::Entry &entry) {
+            if (!is_live(entry.expiry)) return;
+            write_entry(entry.key, entry.type, entry.expiry);
+            if (entry.type == RDBParser::ValueType::STRING) {
+                write_string(entry.value);
+            } else {
+                this->out.append(entry.value);
+            }
+            flush();
+        });
+    }
+
+    this->out.push_back(static_cast<char>(RDBParser::Delimiters::END_OF_FILE));
+    write_fixed(0, 8);  // no checksum
+}
+
+std::optional<RDBParser::ValueType> RDBWriter::value_type(const StorageValueVariants &value) {
+    return std::visit(
+        [](const auto &v) -> std::optional<RDBParser::ValueType> {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, StringValue>) {
+                return RDBParser::ValueType::STRING;
+            } else if constexpr (std::is_same_v<T, HashValue>) {
+                return RDBParser::ValueType::HASH;
+            } else if constexpr (std::is_same_v<T, SortedSetValue>) {
+                return RDBParser::ValueType::SORTED_SET;
+            } else if constexpr (std::is_same_v<T, ListValue>) {
+                return RDBParser::ValueType::LIST;
+            } else {
+                return std::nullopt;
+            }
+        },
+        value);
+}
+
+std::optional<RDBParser::ValueType> RDBWriter::encode_value(const StorageValueVariants &value, std::string &payload) {
+    const std::optional<RDBParser::ValueType> type = value_type(value);
+    if (!type.has_value()) return std::nullopt;
+
+    RDBWriter writer(-1);
+    writer.out.swap(payload);
+    writer.write_payload(value);
+    writer.out.swap(payload);
+    return type;
+}
+
+void RDBWriter::write_entry(std::string_view key, RDBParser::ValueType type, const TimeStamp &expiry) {
+    if (expiry.has_value()) {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(expiry->time_since_epoch()).count();
+        this->out.push_back(static_cast<char>(RDBParser::Delimiters::EXPIRY_MILLISECONDS));
+        write_fixed(ms, 8);
+    }
+    this->out.push_back(static_cast<char>(type));
+    write_string(key);
+}
+
+void RDBWriter::write_payload(const StorageValueVariants &value) {
+    std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, StringValue>) {
+                write_string(v.get_value_ref());
+            } else if constexpr (std::is_same_v<T, HashValue>) {
+                write_length(v.get_value_ref().size());
+                v.get_value_ref().for_each([&](std::string_view field, std::string_view val) {
+                    write_string(field);
+                    write_string(val);
+                });
+            } else if constexpr (std::is_same_v<T, SortedSetValue>) {
+                const SortedSet &set = v.get_value_ref();
+                write_length(set.size());
+                set.for_range(0, set.size(), [&](std::string_view member, double score) {
+                    write_string(member);
+                    uint64_t bits;
+                    std::memcpy(&bits, &score, sizeof(bits));
+                    write_fixed(bits, 8);
+                });
+            } else if constexpr (std::is_same_v<T, ListValue>) {
+                const QuickList &list = v.get_value_ref();
+                write_length(list.size());
+                list.for_range(0, list.size(), [&](std::string_view element) { write_string(element); });
+            }
+        },
+        value);
+}
+
+void RDBWriter::write_length(uint64_t length) {
+    if (length < (1 << 6)) {
+        this->out.push_back(static_cast<char>(length));
+    } else if (length < (1 << 14)) {
+        this->out.push_back(static_cast<char>(0x40 | (length >> 8)));
+        this->out.push_back(static_cast<char>(length & 0xff));
+    } else {
+        // Big endian, unlike everything else
+        const size_t n = length <= UINT32_MAX ? 4 : 8;
+        this->out.push_back(static_cast<char>(n == 4 ? 0x80 : 0x81));
+        for (size_t i = n; i > 0; i--) {
+            this->out.push_back(static_cast<char>((length >> ((i - 1) * 8)) & 0xff));
+        }
+    }
+}
+
+void RDBWriter::write_string(std::string_view s) {
+    write_length(s.size());
+    this->out.append(s);
+}
+
+void RDBWriter::write_fixed(uint64_t value, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        this->out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+void RDBWriter::flush(bool force) {
+    if (this->fd < 0 || (!force && this->out.size() < FLUSH_THRESHOLD)) return;
+
+    size_t sent = 0;
+    while (sent < this->out.size()) {
+        const ssize_t n = write(this->fd, this->out.data() + sent, this->out.size() - sent);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::strerror(errno));
+        }
+        sent += n;
+    }
+    this->written += sent;
+    this->out.clear();
+}
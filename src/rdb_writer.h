@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "rdb_parser.h"
+#include "storage.h"
+
+/*
+    Snapshots of the keyspace in the RDB format that RDBParser loads, for SAVE and the full resynchronization of
+    replicas.
+
+    Strings, lists, hashes and sorted sets are written in the plain encodings every RDB loader understands: a length
+    and then each element, no listpacks and no compression. Streams are left out, a stream here only keeps the fields
+    of its last entry and not its ids, which is nothing an RDB stream can hold. So are keys past their expiry. The
+    checksum is written as zero, which loaders take as not computed. Keys still in a mapped snapshot are copied
+    from it, their payloads already are in this format.
+
+    The writer fills a buffer, which either is the snapshot (serialize) or is written out to a file whenever it gets
+    large (save), so that saving a large keyspace does not hold all of it in memory twice.
+*/
+class RDBWriter {
+   public:
+    // The whole snapshot, to be sent as it is
+    static std::string serialize(const Storage &storage);
+
+    // Writes the snapshot to path through a temporary file renamed over it, returns its size or -1 on failure
+    static long long save(const Storage &storage, const std::string &path);
+
+    // Appends value as RDB stores it after its key to payload and returns its type, nullopt for streams
+    static std::optional<RDBParser::ValueType> encode_value(const StorageValueVariants &value, std::string &payload);
+
+    // Syncs and closes fd, written as temp_path, then renames it over path and syncs the directory. Removes temp_path
+    // and returns false on failure.
+    static bool commit_file(int fd, const std::string &temp_path, const std::string &path);
+
+   private:
+    static constexpr size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    explicit RDBWriter(int fd) : fd(fd) {}
+
+    std::string out;
+    int fd;  // where out goes once it gets large, -1 to keep everything in it
+    long long written = 0;
+
+    static std::optional<RDBParser::ValueType> value_type(const StorageValueVariants &value);
+
+    void write_storage(const Storage &storage);
+    // A key's expiry, type and name, which its payload follows
+    void write_entry(std::string_view key, RDBParser::ValueType type, const TimeStamp &expiry);
+    void write_payload(const StorageValueVariants &value);
+    void write_length(uint64_t length);
+    void write_string(std::string_view s);
+    void write_fixed(uint64_t value, size_t n);
+
+    // Writes out to fd when it has grown past FLUSH_THRESHOLD, or at all with force. Throws when the write fails.
+    void flush(bool force = false);
+};
@@ -0,0 +1,245 @@
+#include "reactor.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "handler.h"
+#include "io_uring_reactor.h"
+#include "logger.h"
+#include "server.h"
+
+Reactor::Reactor(Backend backend, ServerInfo &server_info) : backend(backend), server_info(server_info) {}
+
+ReactorPtr Reactor::create(Backend backend, ServerInfo &server_info) {
+    if (backend == Backend::IoUring) {
+        try {
+            return std::make_unique<IoUringReactor>(server_info);
+        } catch (const std::runtime_error &e) {
+            ERROR("io_uring is not available, falling back to epoll: " << e.what());
+            backend = Backend::Epoll;
+        }
+    }
+    if (backend == Backend::Epoll) {
+        try {
+            return std::make_unique<EpollReactor>(server_info);
+        } catch (const std::runtime_error &e) {
+            ERROR("epoll is not available, falling back to poll: " << e.what());
+        }
+    }
+    return std::make_unique<PollReactor>(server_info);
+}
+
+std::string_view Reactor::backend_name(Backend backend) {
+    switch (backend) {
+        case Backend::Poll:
+            return "poll";
+        case Backend::Epoll:
+            return "epoll";
+        case Backend::IoUring:
+            return "io_uring";
+    }
+    return "unknown";
+}
+
+// A listener is readable when a connection is waiting, accepted one at a time like the sockets are blocking
+static void accept_connection(int listener, const IoEventHandler &handle) {
+    const int client_socket = accept(listener, nullptr, nullptr);
+    if (client_socket < 0) {
+        throw std::runtime_error("Failed to accept new connection");
+    }
+    handle({IoEvent::Type::Accepted, client_socket, {}, listener});
+}
+
+PollReactor::PollReactor(ServerInfo &server_info) : Reactor(Backend::Poll, server_info) {}
+
+void PollReactor::add_listener(int fd) {
+    this->listeners.push_back(fd);
+}
+
+void PollReactor::add_connection(int fd) {
+    this->removed.erase(fd);
+    this->connections.push_back(fd);
+}
+
+void PollReactor::add_notifier(int fd) {
+    this->notifiers.push_back(fd);
+}
+
+void PollReactor::remove_connection(int fd) {
+    std::erase(this->connections, fd);
+    // The events being dispatched may still include it
+    this->removed.insert(fd);
+}
+
+void PollReactor::wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) {
+    std::vector<pollfd> fds;
+    fds.reserve(this->connections.size() + this->notifiers.size() + this->listeners.size());
+    for (const int fd : this->connections) {
+        // Output the socket did not take yet is sent as soon as it is writable again
+        const bool has_pending_output = this->server_info.clients[fd].has_pending_output();
+        fds.push_back({fd, static_cast<short>(POLLIN | (has_pending_output ? POLLOUT : 0)), 0});
+    }
+    for (const int fd : this->notifiers) {
+        fds.push_back({fd, POLLIN, 0});
+    }
+    for (const int fd : this->listeners) {
+        fds.push_back({fd, POLLIN, 0});
+    }
+
+    if (poll(fds.data(), fds.size(), std::max<long>(0, timeout.count())) < 0) {
+        throw std::runtime_error("Error while polling");
+    }
+
+    const size_t num_connections = fds.size() - this->notifiers.size() - this->listeners.size();
+    for (size_t i = 0; i < num_connections; i++) {
+        const pollfd &pfd = fds[i];
+        if ((pfd.revents & POLLOUT) && !this->removed.contains(pfd.fd)) {
+            handle({IoEvent::Type::Writable, pfd.fd, {}});
+        }
+        if ((pfd.revents & (POLLIN | POLLHUP | POLLERR)) && !this->removed.contains(pfd.fd)) {
+            handle({IoEvent::Type::Readable, pfd.fd, {}});
+        }
+    }
+
+    const size_t num_notifiers = this->notifiers.size();
+    for (size_t i = num_connections; i < num_connections + num_notifiers; i++) {
+        if (fds[i].revents & POLLIN) {
+            handle({IoEvent::Type::Notified, fds[i].fd, {}});
+        }
+    }
+
+    // Accepting last, so a new connection never gets the events of a closed one that had the same fd
+    for (size_t i = num_connections + num_notifiers; i < fds.size(); i++) {
+        if (fds[i].revents & POLLIN) {
+            accept_connection(fds[i].fd, handle);
+        }
+    }
+    this->removed.clear();
+}
+
+void PollReactor::flush() {
+    Handler::flush_pending_writes(this->server_info);
+}
+
+EpollReactor::EpollReactor(ServerInfo &server_info)
+    : Reactor(Backend::Epoll, server_info), epoll_fd(epoll_create1(EPOLL_CLOEXEC)), events(MAX_EVENTS) {
+    if (this->epoll_fd < 0) {
+        throw std::runtime_error("epoll_create1 failed");
+    }
+}
+
+EpollReactor::~EpollReactor() {
+    close(this->epoll_fd);
+}
+
+void EpollReactor::add_listener(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error("Failed to watch listener");
+    }
+    this->listeners.insert(fd);
+}
+
+void EpollReactor::add_connection(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        ERROR("Failed to watch connection " << fd);
+    }
+    this->connections.insert(fd);
+}
+
+void EpollReactor::add_notifier(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        throw std::runtime_error("Failed to watch notifier");
+    }
+    this->notifiers.insert(fd);
+}
+
+void EpollReactor::remove_connection(int fd) {
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    this->connections.erase(fd);
+    this->writers.erase(fd);
+}
+
+void EpollReactor::wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) {
+    // Connections whose output drained since they were watched for writes
+    for (auto it = this->writers.begin(); it != this->writers.end();) {
+        const int fd = *it++;
+        if (!this->server_info.clients[fd].has_pending_output()) {
+            watch_writes(fd, false);
+        }
+    }
+
+    const int num_events =
+        epoll_wait(this->epoll_fd, this->events.data(), MAX_EVENTS, std::max<long>(0, timeout.count()));
+    if (num_events < 0) {
+        if (errno == EINTR) return;
+        throw std::runtime_error("Error while waiting for epoll events");
+    }
+
+    std::vector<int> ready_listeners;
+    for (int i = 0; i < num_events; i++) {
+        const int fd = this->events[i].data.fd;
+        const uint32_t flags = this->events[i].events;
+        if (this->listeners.contains(fd)) {
+            ready_listeners.push_back(fd);
+            continue;
+        }
+        if (this->notifiers.contains(fd)) {
+            handle({IoEvent::Type::Notified, fd, {}});
+            continue;
+        }
+
+        // A connection closed by an earlier event of this batch is no longer registered
+        if ((flags & EPOLLOUT) && this->connections.contains(fd)) {
+            handle({IoEvent::Type::Writable, fd, {}});
+        }
+        if ((flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) && this->connections.contains(fd)) {
+            handle({IoEvent::Type::Readable, fd, {}});
+        }
+    }
+
+    // Accepting last, so a new connection never gets the events of a closed one that had the same fd
+    for (const int fd : ready_listeners) {
+        accept_connection(fd, handle);
+    }
+}
+
+void EpollReactor::flush() {
+    for (const int fd : this->server_info.pending_writes) {
+        auto it = this->server_info.clients.find(fd);
+        if (it == this->server_info.clients.end()) continue;
+
+        if (Handler::flush_replies(fd, it->second) != 0) {
+            this->server_info.pending_closes.insert(fd);
+        } else if (it->second.has_pending_output() && this->connections.contains(fd)) {
+            watch_writes(fd, true);
+        }
+    }
+    this->server_info.pending_writes.clear();
+}
+
+void EpollReactor::watch_writes(int fd, bool enable) {
+    if (enable == this->writers.contains(fd)) return;
+
+    epoll_event event{};
+    event.events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    if (enable) {
+        this->writers.insert(fd);
+    } else {
+        this->writers.erase(fd);
+    }
+}
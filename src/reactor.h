@@ -0,0 +1,127 @@
+#pragma once
+
+#include <sys/epoll.h>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct ServerInfo;
+
+// Something that happened on one of the reactor's sockets
+struct IoEvent {
+    enum class Type {
+        Accepted,  // fd is a new connection
+        Readable,  // fd has input to recv
+        Data,      // input of fd was already received into data
+        Writable,  // fd can take more of its pending output
+        Closed,    // fd was closed by the peer or failed
+        Notified,  // fd is a notifier, eg. an eventfd, that was signalled. The handler has to drain it.
+    };
+
+    Type type;
+    int fd;
+    std::string_view data;  // Data only, valid during the callback
+    int listener = -1;      // Accepted only, the listener fd accepted on
+};
+
+using IoEventHandler = std::function<void(const IoEvent &)>;
+
+class Reactor;
+using ReactorPtr = std::unique_ptr<Reactor>;
+
+/*
+    Waits for socket events and sends replies, for the event loop in Server::listen.
+
+    Readiness based backends (poll, epoll) report Readable and Writable, and the event loop does the recv and send
+    itself. Completion based ones (io_uring) do the I/O and report Data. Either way replies are queued in the clients'
+    output, and only written by flush once per event loop iteration, so a backend can batch the sends.
+*/
+class Reactor {
+   public:
+    enum class Backend { Poll, Epoll, IoUring };
+
+    // Creates the requested backend, or the next simplest one available if the kernel does not support it
+    static ReactorPtr create(Backend backend, ServerInfo &server_info);
+
+    static std::string_view backend_name(Backend backend);
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+    virtual ~Reactor() = default;
+
+    Backend get_backend() const {
+        return this->backend;
+    }
+
+    virtual void add_listener(int fd) = 0;
+    virtual void add_connection(int fd) = 0;
+
+    // For an fd that is signalled by other threads, like an eventfd
+    virtual void add_notifier(int fd) = 0;
+
+    // Called right before the connection is closed
+    virtual void remove_connection(int fd) = 0;
+
+    // Waits at most timeout for events and calls handle with each of them
+    virtual void wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) = 0;
+
+    // Sends the pending output of server_info.pending_writes, without blocking
+    virtual void flush() = 0;
+
+   protected:
+    Backend backend;
+    ServerInfo &server_info;
+
+    Reactor(Backend backend, ServerInfo &server_info);
+};
+
+// poll(2) on every socket for every wait
+class PollReactor : public Reactor {
+   public:
+    PollReactor(ServerInfo &server_info);
+
+    void add_listener(int fd) override;
+    void add_connection(int fd) override;
+    void add_notifier(int fd) override;
+    void remove_connection(int fd) override;
+    void wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) override;
+    void flush() override;
+
+   private:
+    std::vector<int> listeners;
+    std::vector<int> notifiers;
+    std::vector<int> connections;  // in the order they were added
+    std::unordered_set<int> removed;  // during the current wait
+};
+
+// Level triggered epoll(7), interested in writes only while a connection has output the socket did not take
+class EpollReactor : public Reactor {
+   public:
+    // Throws if epoll is not available
+    EpollReactor(ServerInfo &server_info);
+    ~EpollReactor() override;
+
+    void add_listener(int fd) override;
+    void add_connection(int fd) override;
+    void add_notifier(int fd) override;
+    void remove_connection(int fd) override;
+    void wait(std::chrono::milliseconds timeout, const IoEventHandler &handle) override;
+    void flush() override;
+
+   private:
+    static constexpr int MAX_EVENTS = 256;
+
+    int epoll_fd;
+    std::unordered_set<int> listeners;
+    std::unordered_set<int> notifiers;
+    std::unordered_set<int> connections;
+    std::unordered_set<int> writers;  // connections watched for EPOLLOUT
+    std::vector<epoll_event> events;
+
+    void watch_writes(int fd, bool enable);
+};
@@ -0,0 +1,135 @@
+#include "replication.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+
+#include "handler.h"
+#include "logger.h"
+#include "message_parser.h"
+#include "rdb_writer.h"
+#include "server.h"
+#include "stats.h"
+
+bool Replication::diskless_sync = false;
+std::chrono::seconds Replication::diskless_sync_delay{5};
+size_t Replication::diskless_sync_max_replicas = 0;
+
+thread_local ServerInfo *Replication::server_info = nullptr;
+thread_local StoragePtr Replication::storage_ptr;
+thread_local std::vector<int> Replication::waiting;
+thread_local std::optional<std::chrono::steady_clock::time_point> Replication::sync_deadline;
+thread_local uint64_t Replication::snapshot_count = 0;
+thread_local uint64_t Replication::full_sync_count = 0;
+
+void Replication::attach(ServerInfo &server_info, StoragePtr storage_ptr) {
+    Replication::server_info = &server_info;
+    Replication::storage_ptr = std::move(storage_ptr);
+}
+
+std::string Replication::fullresync_reply() {
+    const ServerInfo::ReplicationInfo &info = Replication::server_info->replication_info;
+    return MessageParser::encode_simple_string("FULLRESYNC " + info.master_replid + " " +
+                                               std::to_string(info.master_repl_offset));
+}
+
+void Replication::full_resync(int replica) {
+    auto it = Replication::server_info->clients.find(replica);
+    if (it == Replication::server_info->clients.end()) return;
+
+    if (!Replication::diskless_sync) {
+        if (queue_rdb_file(replica, it->second)) {
+            Replication::server_info->replication_info.replica_connections.insert(replica);
+            Replication::full_sync_count++;
+        } else {
+            Replication::server_info->pending_closes.insert(replica);
+        }
+        return;
+    }
+
+    if (std::find(Replication::waiting.begin(), Replication::waiting.end(), replica) == Replication::waiting.end()) {
+        Replication::waiting.push_back(replica);
+    }
+    if (!Replication::sync_deadline.has_value()) {
+        Replication::sync_deadline = std::chrono::steady_clock::now() + Replication::diskless_sync_delay;
+    }
+    const bool enough_replicas = Replication::diskless_sync_max_replicas > 0 &&
+                                 Replication::waiting.size() >= Replication::diskless_sync_max_replicas;
+    if (enough_replicas || Replication::diskless_sync_delay.count() == 0) {
+        sync_waiting_replicas();
+    }
+}
+
+void Replication::cron() {
+    if (Replication::sync_deadline.has_value() && std::chrono::steady_clock::now() >= *Replication::sync_deadline) {
+        sync_waiting_replicas();
+    }
+}
+
+void Replication::sync_waiting_replicas() {
+    Replication::sync_deadline.reset();
+    if (Replication::waiting.empty()) return;
+
+    const auto start = std::chrono::steady_clock::now();
+    auto rdb = std::make_shared<const std::string>(RDBWriter::serialize(*Replication::storage_ptr));
+    auto header = std::make_shared<const std::string>(fullresync_reply() + "$" + std::to_string(rdb->size()) + "\r\n");
+    Replication::snapshot_count++;
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    LOG("serialized " << rdb->size() << " bytes for " << Replication::waiting.size() << " replicas in "
+                      << elapsed.count() << "ms");
+
+    for (const int replica : Replication::waiting) {
+        auto it = Replication::server_info->clients.find(replica);
+        if (it == Replication::server_info->clients.end()) continue;
+
+        it->second.queue_shared(header);
+        it->second.queue_shared(rdb);
+        Replication::server_info->pending_writes.insert(replica);
+        Replication::server_info->replication_info.replica_connections.insert(replica);
+        Replication::full_sync_count++;
+        Stats::local().net_repl_output_bytes.add(header->size() + rdb->size());
+    }
+    Replication::waiting.clear();
+}
+
+bool Replication::queue_rdb_file(int replica, Client &client) {
+    const std::string path = Replication::server_info->data_path(Replication::server_info->rdb_filename());
+
+    const long long size = RDBWriter::save(*Replication::storage_ptr, path);
+    if (size < 0) return false;
+    Replication::snapshot_count++;
+
+    // Opened right away, a later save renamed over the path does not change the file this replica gets
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ERROR("Failed to open " << path << " to send it to replica " << replica);
+        return false;
+    }
+
+    // The file goes after the FULLRESYNC reply and anything else still queued for the replica
+    const std::string header = fullresync_reply() + "$" + std::to_string(size) + "\r\n";
+    client.reply_buffer.append(header);
+    client.queue_file(std::make_shared<const OutputFile>(fd, size));
+    Replication::server_info->pending_writes.insert(replica);
+    Stats::local().net_repl_output_bytes.add(header.size() + size);
+    return true;
+}
+
+size_t Replication::waiting_replicas() {
+    return Replication::waiting.size();
+}
+
+uint64_t Replication::snapshots() {
+    return Replication::snapshot_count;
+}
+
+uint64_t Replication::full_syncs() {
+    return Replication::full_sync_count;
+}
+
+void Replication::remove_client(int client_socket) {
+    std::erase(Replication::waiting, client_socket);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "storage.h"
+
+struct ServerInfo;
+struct Client;
+
+/*
+    Full resynchronization: the snapshot a replica gets after PSYNC, before the write commands that follow it.
+
+    By default the snapshot is saved to the RDB file, --dir and --dbfilename, and the file is queued as the replica's
+    output. The event loop hands it to the socket with sendfile whenever the socket can take more, so its bytes go
+    from the page cache to the socket without being copied through the server, and other clients are served
+    meanwhile however slowly the replica reads.
+
+    With --repl-diskless-sync yes nothing touches the disk. A replica's PSYNC is not answered straight away, it
+    waits --repl-diskless-sync-delay seconds for others to attach too (or until --repl-diskless-sync-max-replicas
+    are waiting), then the keyspace is serialized once into a buffer that all of them share, queued as their output
+    like a Pub/Sub message is. The event loop goes on serving clients while the replicas take it, and the buffer is
+    freed once the slowest one has. Writes are only propagated to a replica once its snapshot is queued, so it sees
+    each of them exactly once, in the snapshot or after it.
+
+    Both ways the snapshot itself is taken synchronously on the event loop: without a fork or copy-on-write values
+    there is no other consistent view of the keyspace to stream from. Other clients wait for it, seconds on a
+    keyspace of millions of keys, and a diskless pass holds the whole serialized keyspace in memory on top of it.
+*/
+class Replication {
+   public:
+    // Set once from the command line
+    static bool diskless_sync;
+    static std::chrono::seconds diskless_sync_delay;
+    static size_t diskless_sync_max_replicas;  // 0 for no limit
+
+    // The clients and the keyspace snapshots are taken of, set once by the server
+    static void attach(ServerInfo &server_info, StoragePtr storage_ptr);
+
+    // Sends replica, which just sent PSYNC, the snapshot to start from, now or with the next diskless pass
+    static void full_resync(int replica);
+
+    // Starts the diskless pass once the replicas waiting for it have waited long enough, from the server cron
+    static void cron();
+
+    // Replicas waiting for the next diskless pass
+    static size_t waiting_replicas();
+
+    // Snapshots taken and replicas sent one since the start, a diskless pass counts once for all its replicas
+    static uint64_t snapshots();
+    static uint64_t full_syncs();
+
+    // Called when a client disconnects
+    static void remove_client(int client_socket);
+
+   private:
+    static thread_local ServerInfo *server_info;
+    static thread_local StoragePtr storage_ptr;
+    static thread_local std::vector<int> waiting;
+    static thread_local std::optional<std::chrono::steady_clock::time_point> sync_deadline;
+    static thread_local uint64_t snapshot_count;
+    static thread_local uint64_t full_sync_count;
+
+    static std::string fullresync_reply();
+
+    // Serializes the keyspace and queues it to every waiting replica
+    static void sync_waiting_replicas();
+
+    // Saves the RDB file and queues it to replica, returns false if the replica has to be disconnected
+    static bool queue_rdb_file(int replica, Client &client);
+};
@@ -0,0 +1,308 @@
+#include "score_index.h"
+
+#include <algorithm>
+
+namespace {
+constexpr uint32_t LEAF_CAPACITY = 64;
+constexpr uint32_t INNER_CAPACITY = 64;
+
+// Nodes emptier than this are merged into a neighbour when the two fit in one node
+constexpr uint32_t MERGE_THRESHOLD = 16;
+}  // namespace
+
+struct ScoreIndex::Node {
+    bool leaf;
+    uint32_t size = 0;
+
+    explicit Node(bool leaf) : leaf(leaf) {}
+};
+
+struct ScoreIndex::Leaf : Node {
+    Entry entries[LEAF_CAPACITY];
+    Leaf *prev = nullptr;
+    Leaf *next = nullptr;
+
+    Leaf() : Node(true) {}
+};
+
+struct ScoreIndex::Inner : Node {
+    Node *children[INNER_CAPACITY];
+    size_t counts[INNER_CAPACITY];  // entries under each child
+    Entry max[INNER_CAPACITY];      // last entry under each child
+
+    Inner() : Node(false) {}
+};
+
+const ScoreIndex::Entry &ScoreIndex::Iterator::operator*() const {
+    return this->leaf->entries[this->pos];
+}
+
+ScoreIndex::Iterator &ScoreIndex::Iterator::operator++() {
+    if (++this->pos == this->leaf->size) {
+        this->leaf = this->leaf->next;
+        this->pos = 0;
+    }
+    return *this;
+}
+
+ScoreIndex::ScoreIndex() : root(new Leaf()) {}
+
+ScoreIndex::~ScoreIndex() {
+    destroy(this->root);
+}
+
+const ScoreIndex::Entry &ScoreIndex::max_entry(const Node *node) {
+    return node->leaf ? static_cast<const Leaf *>(node)->entries[node->size - 1]
+                      : static_cast<const Inner *>(node)->max[node->size - 1];
+}
+
+size_t ScoreIndex::subtree_count(const Node *node) {
+    if (node->leaf) return node->size;
+
+    const Inner *inner = static_cast<const Inner *>(node);
+    size_t count = 0;
+    for (uint32_t i = 0; i < inner->size; i++) count += inner->counts[i];
+    return count;
+}
+
+bool ScoreIndex::less(const Entry &a, const Entry &b) {
+    return a.score < b.score || (a.score == b.score && a.member < b.member);
+}
+
+void ScoreIndex::insert(const Entry &entry) {
+    Node *sibling = insert(this->root, entry);
+    this->count++;
+    if (sibling == nullptr) return;
+
+    // The root was split, so the tree grows by one level
+    Inner *root = new Inner();
+    root->size = 2;
+    root->children[0] = this->root;
+    root->children[1] = sibling;
+    root->counts[1] = subtree_count(sibling);
+    root->counts[0] = this->count - root->counts[1];
+    root->max[0] = max_entry(this->root);
+    root->max[1] = max_entry(sibling);
+    this->root = root;
+}
+
+bool ScoreIndex::erase(const Entry &entry) {
+    if (!erase(this->root, entry)) return false;
+    this->count--;
+
+    // Shrink the tree while the root has a single child
+    while (!this->root->leaf && this->root->size == 1) {
+        Inner *root = static_cast<Inner *>(this->root);
+        this->root = root->children[0];
+        delete root;
+    }
+    return true;
+}
+
+size_t ScoreIndex::size() const {
+    return this->count;
+}
+
+template <typename Before>
+size_t ScoreIndex::count_while(Before &&before) const {
+    // before must hold for a prefix of the entries, so whole children are skipped using their counts
+    size_t counted = 0;
+    const Node *node = this->root;
+    while (!node->leaf) {
+        const Inner *inner = static_cast<const Inner *>(node);
+        const uint32_t i = std::partition_point(inner->max, inner->max + inner->size, before) - inner->max;
+        for (uint32_t j = 0; j < i; j++) {
+            counted += inner->counts[j];
+        }
+        if (i == inner->size) return counted;
+        node = inner->children[i];
+    }
+
+    const Leaf *leaf = static_cast<const Leaf *>(node);
+    return counted + (std::partition_point(leaf->entries, leaf->entries + leaf->size, before) - leaf->entries);
+}
+
+size_t ScoreIndex::rank(const Entry &entry) const {
+    return count_while([&entry](const Entry &other) { return less(other, entry); });
+}
+
+size_t ScoreIndex::count_below(double score, bool inclusive) const {
+    if (inclusive) {
+        return count_while([score](const Entry &other) { return other.score <= score; });
+    }
+    return count_while([score](const Entry &other) { return other.score < score; });
+}
+
+ScoreIndex::Iterator ScoreIndex::at(size_t rank) const {
+    Iterator it;
+    if (rank >= this->count) return it;
+
+    const Node *node = this->root;
+    while (!node->leaf) {
+        const Inner *inner = static_cast<const Inner *>(node);
+        uint32_t i = 0;
+        while (rank >= inner->counts[i]) {
+            rank -= inner->counts[i++];
+        }
+        node = inner->children[i];
+    }
+
+    it.leaf = static_cast<const Leaf *>(node);
+    it.pos = rank;
+    return it;
+}
+
+ScoreIndex::Node *ScoreIndex::insert(Node *node, const Entry &entry) {
+    if (node->leaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        uint32_t pos = std::lower_bound(leaf->entries, leaf->entries + leaf->size, entry, less) - leaf->entries;
+
+        Leaf *right = nullptr;
+        if (leaf->size == LEAF_CAPACITY) {
+            // Split in half, keeping the leaf chain intact
+            right = new Leaf();
+            right->size = LEAF_CAPACITY / 2;
+            std::copy(leaf->entries + LEAF_CAPACITY / 2, leaf->entries + LEAF_CAPACITY, right->entries);
+            leaf->size = LEAF_CAPACITY / 2;
+            right->next = leaf->next;
+            right->prev = leaf;
+            if (leaf->next != nullptr) leaf->next->prev = right;
+            leaf->next = right;
+
+            if (pos > leaf->size) {
+                pos -= leaf->size;
+                leaf = right;
+            }
+        }
+
+        std::copy_backward(leaf->entries + pos, leaf->entries + leaf->size, leaf->entries + leaf->size + 1);
+        leaf->entries[pos] = entry;
+        leaf->size++;
+        return right;
+    }
+
+    // First child whose last entry is not below entry, or the last child if entry goes at the very end
+    Inner *inner = static_cast<Inner *>(node);
+    const uint32_t i = std::min<uint32_t>(
+        std::lower_bound(inner->max, inner->max + inner->size, entry, less) - inner->max, inner->size - 1);
+
+    Node *child = inner->children[i];
+    Node *child_sibling = insert(child, entry);
+    inner->counts[i]++;
+    inner->max[i] = max_entry(child);
+    if (child_sibling == nullptr) return nullptr;
+
+    // Move the entries that went to the new sibling over to its slot
+    const size_t sibling_count = subtree_count(child_sibling);
+    inner->counts[i] -= sibling_count;
+
+    Inner *right = nullptr;
+    uint32_t pos = i + 1;
+    if (inner->size == INNER_CAPACITY) {
+        right = new Inner();
+        right->size = INNER_CAPACITY / 2;
+        std::copy(inner->children + INNER_CAPACITY / 2, inner->children + INNER_CAPACITY, right->children);
+        std::copy(inner->counts + INNER_CAPACITY / 2, inner->counts + INNER_CAPACITY, right->counts);
+        std::copy(inner->max + INNER_CAPACITY / 2, inner->max + INNER_CAPACITY, right->max);
+        inner->size = INNER_CAPACITY / 2;
+
+        if (pos > inner->size) {
+            pos -= inner->size;
+            inner = right;
+        }
+    }
+
+    std::copy_backward(inner->children + pos, inner->children + inner->size, inner->children + inner->size + 1);
+    std::copy_backward(inner->counts + pos, inner->counts + inner->size, inner->counts + inner->size + 1);
+    std::copy_backward(inner->max + pos, inner->max + inner->size, inner->max + inner->size + 1);
+    inner->children[pos] = child_sibling;
+    inner->counts[pos] = sibling_count;
+    inner->max[pos] = max_entry(child_sibling);
+    inner->size++;
+    return right;
+}
+
+bool ScoreIndex::erase(Node *node, const Entry &entry) {
+    if (node->leaf) {
+        Leaf *leaf = static_cast<Leaf *>(node);
+        const uint32_t pos = std::lower_bound(leaf->entries, leaf->entries + leaf->size, entry, less) - leaf->entries;
+        if (pos == leaf->size || less(entry, leaf->entries[pos])) return false;
+
+        std::copy(leaf->entries + pos + 1, leaf->entries + leaf->size, leaf->entries + pos);
+        leaf->size--;
+        return true;
+    }
+
+    Inner *inner = static_cast<Inner *>(node);
+    const uint32_t i = std::lower_bound(inner->max, inner->max + inner->size, entry, less) - inner->max;
+    if (i == inner->size) return false;
+
+    Node *child = inner->children[i];
+    if (!erase(child, entry)) return false;
+    inner->counts[i]--;
+
+    auto remove_child = [inner](uint32_t j) {
+        std::copy(inner->children + j + 1, inner->children + inner->size, inner->children + j);
+        std::copy(inner->counts + j + 1, inner->counts + inner->size, inner->counts + j);
+        std::copy(inner->max + j + 1, inner->max + inner->size, inner->max + j);
+        inner->size--;
+    };
+
+    if (child->size == 0) {
+        // An inner node empties along with its last leaf, which was unlinked one level down
+        if (child->leaf) {
+            Leaf *leaf = static_cast<Leaf *>(child);
+            if (leaf->prev != nullptr) leaf->prev->next = leaf->next;
+            if (leaf->next != nullptr) leaf->next->prev = leaf->prev;
+        }
+        destroy(child);
+        remove_child(i);
+        return true;
+    }
+    inner->max[i] = max_entry(child);
+
+    // Merge a sparse child into a neighbour so deletes cannot leave a tree of near-empty nodes
+    if (child->size >= MERGE_THRESHOLD || inner->size == 1) return true;
+
+    const uint32_t left_index = i + 1 < inner->size ? i : i - 1;
+    Node *left = inner->children[left_index];
+    Node *right = inner->children[left_index + 1];
+    const uint32_t capacity = left->leaf ? LEAF_CAPACITY : INNER_CAPACITY;
+    if (left->size + right->size > capacity) return true;
+
+    if (left->leaf) {
+        Leaf *left_leaf = static_cast<Leaf *>(left);
+        Leaf *right_leaf = static_cast<Leaf *>(right);
+        std::copy(right_leaf->entries, right_leaf->entries + right_leaf->size, left_leaf->entries + left_leaf->size);
+        left_leaf->next = right_leaf->next;
+        if (right_leaf->next != nullptr) right_leaf->next->prev = left_leaf;
+    } else {
+        Inner *left_inner = static_cast<Inner *>(left);
+        Inner *right_inner = static_cast<Inner *>(right);
+        std::copy(right_inner->children, right_inner->children + right_inner->size,
+                  left_inner->children + left_inner->size);
+        std::copy(right_inner->counts, right_inner->counts + right_inner->size, left_inner->counts + left_inner->size);
+        std::copy(right_inner->max, right_inner->max + right_inner->size, left_inner->max + left_inner->size);
+    }
+    left->size += right->size;
+    right->size = 0;
+    destroy(right);
+
+    inner->counts[left_index] += inner->counts[left_index + 1];
+    inner->max[left_index] = inner->max[left_index + 1];
+    remove_child(left_index + 1);
+    return true;
+}
+
+void ScoreIndex::destroy(Node *node) {
+    if (node->leaf) {
+        delete static_cast<Leaf *>(node);
+        return;
+    }
+
+    Inner *inner = static_cast<Inner *>(node);
+    for (uint32_t i = 0; i < inner->size; i++) {
+        destroy(inner->children[i]);
+    }
+    delete inner;
+}
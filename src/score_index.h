@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Ordered index of a sorted set: a B+tree over (score, member) pairs.
+ *
+ * Nodes are wide (64 entries) so a lookup touches a handful of cache lines instead of one per level like a skiplist.
+ * Every inner node keeps the entry count of each child, which makes rank lookups and seeking to a rank O(log n).
+ * Members are views: the strings are owned by the sorted set's member-to-score table.
+ */
+class ScoreIndex {
+    struct Node;
+    struct Leaf;
+    struct Inner;
+
+   public:
+    struct Entry {
+        double score;
+        std::string_view member;
+    };
+
+    // Position in the index, walking leaves left to right
+    class Iterator {
+       public:
+        bool valid() const {
+            return this->leaf != nullptr;
+        }
+
+        const Entry &operator*() const;
+
+        Iterator &operator++();
+
+       private:
+        friend class ScoreIndex;
+
+        const Leaf *leaf = nullptr;
+        uint32_t pos = 0;
+    };
+
+    ScoreIndex();
+    ~ScoreIndex();
+    ScoreIndex(const ScoreIndex &) = delete;
+    ScoreIndex &operator=(const ScoreIndex &) = delete;
+
+    // entry must not be in the index yet
+    void insert(const Entry &entry);
+
+    // Returns true if entry was in the index
+    bool erase(const Entry &entry);
+
+    size_t size() const;
+
+    // Number of entries ordered before entry
+    size_t rank(const Entry &entry) const;
+
+    // Number of entries with a score below score, or not above it if inclusive
+    size_t count_below(double score, bool inclusive) const;
+
+    // Iterator to the entry with the given rank, invalid if rank >= size()
+    Iterator at(size_t rank) const;
+
+   private:
+    Node *root;
+    size_t count = 0;
+
+    static bool less(const Entry &a, const Entry &b);
+    static const Entry &max_entry(const Node *node);
+    static size_t subtree_count(const Node *node);
+
+    template <typename Before>
+    size_t count_while(Before &&before) const;
+
+    // Returns the new right sibling if node was split, or nullptr
+    static Node *insert(Node *node, const Entry &entry);
+    static bool erase(Node *node, const Entry &entry);
+    static void destroy(Node *node);
+};
@@ -1,17 +1,41 @@
 #include "server.h"
 
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <iostream>
 #include <random>
+#include <sstream>
 
+#include "blocking.h"
+#include "cluster.h"
 #include "handler.h"
+#include "hash.h"
+#include "latency.h"
+#include "lazy_free.h"
 #include "logger.h"
+#include "mapped_snapshot.h"
 #include "message_parser.h"
+#include "pubsub.h"
+#include "quicklist.h"
 #include "rdb_parser.h"
+#include "replication.h"
+#include "shards.h"
+#include "sorted_set.h"
+#include "stats.h"
+#include "tracking.h"
+
+// Value of an option that takes "yes" or "no", anything else is rejected rather than read as "no"
+static bool parse_yes_no(std::string_view option, std::string_view value) {
+    if (value == "yes") return true;
+    if (value == "no") return false;
+    throw std::invalid_argument(std::string(option) + " requires \"yes\" or \"no\"");
+}
 
 ServerInfo ServerInfo::parse(int argc, char **argv) {
     ServerInfo server_info;
@@ -61,26 +85,229 @@ ServerInfo ServerInfo::parse(int argc, char **argv) {
                 throw std::invalid_argument("--dbfilename requires an argument");
             }
             server_info.dbfilename = argv[++i];
+        } else if (arg == "--loglevel") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--loglevel requires \"silent\", \"debug\" or \"error\"");
+            }
+
+            std::string_view level = argv[++i];
+            if (level == "silent") {
+                Logger::log_level = Logger::Level::SILENT;
+            } else if (level == "debug") {
+                Logger::log_level = Logger::Level::DEBUG;
+            } else if (level == "error") {
+                Logger::log_level = Logger::Level::ERROR;
+            } else {
+                throw std::invalid_argument("--loglevel requires \"silent\", \"debug\" or \"error\"");
+            }
+        } else if (arg == "--logfile") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--logfile requires an argument");
+            }
+            Logger::set_log_file(argv[++i]);
+        } else if (arg == "--hz") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--hz requires an argument");
+            }
+            server_info.hz = std::clamp(std::stoi(argv[++i]), 1, 500);
+        } else if (arg == "--slowlog-log-slower-than") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--slowlog-log-slower-than requires an argument");
+            }
+            LatencyMonitor::slowlog_log_slower_than = std::stoll(argv[++i]);
+        } else if (arg == "--slowlog-max-len") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--slowlog-max-len requires an argument");
+            }
+            LatencyMonitor::slowlog_max_len = std::stoull(argv[++i]);
+        } else if (arg == "--latency-monitor-threshold") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--latency-monitor-threshold requires an argument");
+            }
+            LatencyMonitor::latency_monitor_threshold = std::stoull(argv[++i]);
+        } else if (arg == "--tracking-table-max-keys") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--tracking-table-max-keys requires an argument");
+            }
+            Tracking::tracking_table_max_keys = std::stoull(argv[++i]);
+        } else if (arg == "--hash-max-listpack-entries") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--hash-max-listpack-entries requires an argument");
+            }
+            Hash::max_listpack_entries = std::stoull(argv[++i]);
+        } else if (arg == "--hash-max-listpack-value") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--hash-max-listpack-value requires an argument");
+            }
+            Hash::max_listpack_value = std::stoull(argv[++i]);
+        } else if (arg == "--zset-max-listpack-entries") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--zset-max-listpack-entries requires an argument");
+            }
+            SortedSet::max_listpack_entries = std::stoull(argv[++i]);
+        } else if (arg == "--zset-max-listpack-value") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--zset-max-listpack-value requires an argument");
+            }
+            SortedSet::max_listpack_value = std::stoull(argv[++i]);
+        } else if (arg == "--client-output-buffer-limit") {
+            const std::string usage =
+                "--client-output-buffer-limit requires \"pubsub <HARD_BYTES> <SOFT_BYTES> <SOFT_SECONDS>\"";
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(usage);
+            }
+
+            std::istringstream limits(argv[++i]);
+            std::string client_class;
+            size_t hard = 0, soft = 0;
+            long long soft_seconds = 0;
+            if (!(limits >> client_class >> hard >> soft >> soft_seconds) || client_class != "pubsub") {
+                throw std::invalid_argument(usage);
+            }
+            PubSub::output_buffer_hard_limit = hard;
+            PubSub::output_buffer_soft_limit = soft;
+            PubSub::output_buffer_soft_seconds = soft_seconds;
+        } else if (arg == "--io-backend") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--io-backend requires \"poll\", \"epoll\" or \"io_uring\"");
+            }
+
+            std::string_view backend = argv[++i];
+            if (backend == "poll") {
+                server_info.io_backend = Reactor::Backend::Poll;
+            } else if (backend == "epoll") {
+                server_info.io_backend = Reactor::Backend::Epoll;
+            } else if (backend == "io_uring") {
+                server_info.io_backend = Reactor::Backend::IoUring;
+            } else {
+                throw std::invalid_argument("--io-backend requires \"poll\", \"epoll\" or \"io_uring\"");
+            }
+        } else if (arg == "--io-threads") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--io-threads requires an argument");
+            }
+            server_info.io_threads = std::clamp(std::stoi(argv[++i]), 1, 128);
+        } else if (arg == "--shards") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--shards requires an argument");
+            }
+            server_info.shards = std::clamp(std::stoi(argv[++i]), 1, 256);
+        } else if (arg == "--tcp-backlog") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--tcp-backlog requires an argument");
+            }
+            server_info.tcp_backlog = std::stoi(argv[++i]);
+        } else if (arg == "--unixsocket") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--unixsocket requires a path");
+            }
+            server_info.unixsocket = argv[++i];
+        } else if (arg == "--unixsocketperm") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--unixsocketperm requires an octal mode, eg. 700");
+            }
+            server_info.unixsocketperm = std::stoi(argv[++i], nullptr, 8);
+        } else if (arg == "--list-max-listpack-size") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--list-max-listpack-size requires an argument");
+            }
+            QuickList::max_listpack_size = std::stol(argv[++i]);
+        } else if (arg == "--prefix-index") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--prefix-index requires \"yes\" or \"no\"");
+            }
+            server_info.prefix_index = parse_yes_no(arg, argv[++i]);
+        } else if (arg == "--cluster-enabled") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--cluster-enabled requires \"yes\" or \"no\"");
+            }
+            server_info.cluster_enabled = parse_yes_no(arg, argv[++i]);
+        } else if (arg == "--cluster-announce-ip") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--cluster-announce-ip requires an address");
+            }
+            server_info.cluster_announce_ip = argv[++i];
+        } else if (arg == "--mmap-snapshot") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--mmap-snapshot requires a file name");
+            }
+            server_info.mmap_snapshot = argv[++i];
+        } else if (arg == "--repl-diskless-sync") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--repl-diskless-sync requires \"yes\" or \"no\"");
+            }
+            Replication::diskless_sync = parse_yes_no(arg, argv[++i]);
+        } else if (arg == "--repl-diskless-sync-delay") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--repl-diskless-sync-delay requires an argument");
+            }
+            Replication::diskless_sync_delay = std::chrono::seconds(std::max(std::stoi(argv[++i]), 0));
+        } else if (arg == "--repl-diskless-sync-max-replicas") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("--repl-diskless-sync-max-replicas requires an argument");
+            }
+            Replication::diskless_sync_max_replicas = std::max(std::stoi(argv[++i]), 0);
+        } else if (arg == "--lazyfree-lazy-user-del" || arg == "--lazyfree-lazy-server-del" ||
+                   arg == "--lazyfree-lazy-expire" || arg == "--lazyfree-lazy-user-flush") {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(std::string(arg) + " requires \"yes\" or \"no\"");
+            }
+
+            const bool lazy = parse_yes_no(arg, argv[++i]);
+            if (arg == "--lazyfree-lazy-user-del") {
+                LazyFree::lazy_user_del = lazy;
+            } else if (arg == "--lazyfree-lazy-server-del") {
+                LazyFree::lazy_server_del = lazy;
+            } else if (arg == "--lazyfree-lazy-expire") {
+                LazyFree::lazy_expire = lazy;
+            } else {
+                LazyFree::lazy_user_flush = lazy;
+            }
         } else {
             throw std::invalid_argument("Unknown option '" + std::string(arg) + "'.\n");
         }
     }
 
+    if (server_info.shards > 1 && server_info.replication_info.master_port != -1) {
+        throw std::invalid_argument("--replicaof cannot be combined with --shards");
+    }
+    if (server_info.shards > 1 && server_info.cluster_enabled) {
+        throw std::invalid_argument("--cluster-enabled cannot be combined with --shards");
+    }
+    // Neither the foreign keys of a shard nor the slot index cover keys that are still in the snapshot
+    if (!server_info.mmap_snapshot.empty() && (server_info.shards > 1 || server_info.cluster_enabled)) {
+        throw std::invalid_argument("--mmap-snapshot cannot be combined with --shards or --cluster-enabled");
+    }
+
     return server_info;
 }
 
+OutputFile::~OutputFile() {
+    close(this->fd);
+}
+
 bool ServerInfo::is_replica() const {
     return this->replication_info._is_replica;
 }
 
+std::string ServerInfo::data_path(const std::string &filename) const {
+    return this->dir.empty() ? filename : this->dir + '/' + filename;
+}
+
+std::string ServerInfo::rdb_filename() const {
+    return this->dbfilename.empty() ? "dump.rdb" : this->dbfilename;
+}
+
 Server::Server(ServerInfo &&server_info) : server_info(std::move(server_info)) {
     this->start();
 }
 
-Server::Server(Server &&other) noexcept : server_info(std::move(other.server_info)), server_fd(other.server_fd) {
+Server::Server(Server &&other) noexcept
+    : server_info(std::move(other.server_info)), server_fd(other.server_fd), unix_fd(other.unix_fd) {
     other.server_info.client_sockets.clear();
     other.server_info.replication_info.replica_connections.clear();
     other.server_fd = -1;
+    other.unix_fd = -1;
 }
 
 Server &Server::operator=(Server &&other) noexcept {
@@ -88,10 +315,12 @@ Server &Server::operator=(Server &&other) noexcept {
 
     this->server_info = std::move(other.server_info);
     this->server_fd = other.server_fd;
+    this->unix_fd = other.unix_fd;
 
     other.server_info.client_sockets.clear();
     other.server_info.replication_info.replica_connections.clear();
     other.server_fd = -1;
+    other.unix_fd = -1;
 
     return *this;
 }
@@ -116,6 +345,81 @@ void Server::close_all_connections() {
     for (int client_fd : this->server_info.client_sockets) close(client_fd);
 
     if (this->server_fd != -1) close(this->server_fd);
+    if (this->unix_fd != -1) {
+        close(this->unix_fd);
+        unlink(this->server_info.unixsocket.c_str());
+    }
+}
+
+void Server::close_client(int client_socket) {
+    if (this->reactor) {
+        this->reactor->remove_connection(client_socket);
+    }
+    close(client_socket);
+    std::erase(this->server_info.client_sockets, client_socket);
+    if (client_socket == this->server_info.replication_info.master_fd) {
+        this->server_info.replication_info.master_fd = -1;
+    }
+
+    Blocking::remove_client(client_socket);
+    PubSub::remove_client(client_socket);
+    Replication::remove_client(client_socket);
+    this->server_info.replication_info.replica_connections.erase(client_socket);
+    this->server_info.pending_writes.erase(client_socket);
+    auto it = this->server_info.clients.find(client_socket);
+    if (it != this->server_info.clients.end()) {
+        Tracking::disable(it->second.id);
+        this->server_info.clients.erase(it);
+    }
+}
+
+// Reads and decodes the input of every readable client on the I/O threads, then executes it in the order the clients
+// became readable
+void Server::read_clients() {
+    const std::vector<int> &fds = this->readable_clients;
+    std::vector<Client *> clients(fds.size());
+    for (size_t i = 0; i < fds.size(); i++) {
+        clients[i] = &this->server_info.clients[fds[i]];
+    }
+
+    std::vector<Handler::ParsedQuery> parsed(fds.size());
+    std::vector<int> results(fds.size());
+    this->io_threads->run(fds.size(),
+                          [&](size_t i) { results[i] = Handler::read_query(fds[i], *clients[i], parsed[i]); });
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        const int client_socket = fds[i];
+        if (results[i] != 0) {
+            close_client(client_socket);
+        } else if (!Handler::is_waiting(client_socket, *clients[i]) &&
+                   Handler::process_query_buffer(client_socket, *this, &parsed[i]) != 0) {
+            close_client(client_socket);
+        }
+    }
+    this->readable_clients.clear();
+}
+
+// Sends the replies of the event loop iteration on the I/O threads. What a socket does not take is left for the
+// reactor, which watches it for writes.
+void Server::write_clients() {
+    std::vector<int> fds;
+    std::vector<Client *> clients;
+    for (const int client_socket : this->server_info.pending_writes) {
+        auto it = this->server_info.clients.find(client_socket);
+        if (it != this->server_info.clients.end() && it->second.has_pending_output()) {
+            fds.push_back(client_socket);
+            clients.push_back(&it->second);
+        }
+    }
+
+    std::vector<int> results(fds.size());
+    this->io_threads->run(fds.size(), [&](size_t i) { results[i] = Handler::flush_replies(fds[i], *clients[i]); });
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (results[i] != 0) {
+            this->server_info.pending_closes.insert(fds[i]);
+        }
+    }
 }
 
 // Handshake steps:
@@ -175,11 +479,14 @@ int Server::handshake_master(ServerInfo &server_info) {
         recv(master_fd, buf.data(), 1, 0);
     }
 
-    // Receive empty RDB
+    // Receive the snapshot, which replaces whatever was loaded from our own RDB file
     bool size_found = false;
-    int size = 0;
+    size_t size = 0;
     while (!size_found) {
-        recv(master_fd, buf.data(), 1, 0);
+        if (recv(master_fd, buf.data(), 1, 0) != 1) {
+            ERROR("Master closed the connection before its snapshot");
+            return 1;
+        }
         if (buf[0] == '$' || buf[0] == '\r')
             continue;
         else if (buf[0] == '\n')
@@ -188,25 +495,84 @@ int Server::handshake_master(ServerInfo &server_info) {
             size = size * 10 + (buf[0] - '0');
     }
 
-    int recv_bytes = 0;
+    std::string snapshot(size, '\0');
+    size_t recv_bytes = 0;
     while (recv_bytes < size) {
-        recv(master_fd, buf.data(), 1, 0);
-        recv_bytes++;
+        const ssize_t n = recv(master_fd, snapshot.data() + recv_bytes, size - recv_bytes, 0);
+        if (n <= 0) {
+            ERROR("Master closed the connection during its snapshot");
+            return 1;
+        }
+        recv_bytes += n;
+    }
+
+    this->storage_ptr->flush(false);
+    try {
+        RDBParser::load(snapshot, *this->storage_ptr);
+    } catch (const std::runtime_error &e) {
+        ERROR("Error while loading the snapshot of master: " << e.what());
+        return 1;
     }
+    LOG("loaded " << this->storage_ptr->size() << " keys from master");
 
-    // Important to receive the above bit by bit, to not skip over incoming commands
+    // Important to receive no more than the snapshot, to not skip over incoming commands
     return 0;
 }
 
 void Server::start() {
     LOG("starting server...");
+    CycleClock::calibrate();
+
+    // A native snapshot is mapped rather than loaded, and takes the place of the RDB file
+    std::unique_ptr<MappedSnapshot> snapshot;
+    if (!this->server_info.mmap_snapshot.empty()) {
+        const auto map_start = std::chrono::steady_clock::now();
+        snapshot = MappedSnapshot::open(this->server_info.data_path(this->server_info.mmap_snapshot));
+        LatencyMonitor::add_sample("snapshot-map", std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                       std::chrono::steady_clock::now() - map_start)
+                                                       .count());
+    }
 
-    if (this->server_info.dbfilename != "") {
+    if (snapshot) {
+        this->storage_ptr = std::make_shared<Storage>();
+        this->storage_ptr->attach_snapshot(std::move(snapshot));
+    } else if (this->server_info.dbfilename != "") {
+        const auto load_start = std::chrono::steady_clock::now();
         this->storage_ptr = RDBParser::parse_rdb(this->server_info.dir + '/' + this->server_info.dbfilename);
+        LatencyMonitor::add_sample("rdb-load", std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                   std::chrono::steady_clock::now() - load_start)
+                                                   .count());
     } else {
         this->storage_ptr = std::make_shared<Storage>();
     }
 
+    // parse_rdb returns nothing when the file does not exist yet
+    if (!this->storage_ptr) {
+        this->storage_ptr = std::make_shared<Storage>();
+    }
+
+    // Every shard loads the whole file and keeps the keys it owns
+    if (this->server_info.shards > 1) {
+        std::vector<std::string> foreign_keys;
+        for (const auto &[key, value] : this->storage_ptr->get_view()) {
+            if (Shards::shard_of(key) != static_cast<size_t>(this->server_info.shard_index)) {
+                foreign_keys.push_back(key);
+            }
+        }
+        for (const std::string &key : foreign_keys) {
+            this->storage_ptr->erase(key);
+        }
+    }
+
+    if (this->server_info.prefix_index) {
+        this->storage_ptr->enable_prefix_index();
+    }
+
+    if (this->server_info.cluster_enabled) {
+        Cluster::attach(this->server_info.cluster_announce_ip, this->server_info.tcp_port);
+        this->storage_ptr->enable_slot_index();
+    }
+
     const int server_fd = socket(AF_INET, SOCK_STREAM, 0);
     this->server_fd = server_fd;
     if (server_fd < 0) {
@@ -217,6 +583,10 @@ void Server::start() {
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
         throw std::runtime_error("setsockopt failed\n");
     }
+    // Every shard listens on the port, the kernel spreads the connections over them
+    if (this->server_info.shards > 1 && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        throw std::runtime_error("setsockopt SO_REUSEPORT failed");
+    }
 
     struct sockaddr_in server_addr;
     server_addr.sin_family = AF_INET;
@@ -227,11 +597,15 @@ void Server::start() {
         throw std::runtime_error("Failed to bind to port " + std::to_string(this->server_info.tcp_port));
     }
 
-    const int connection_backlog = 5;
-    if (::listen(server_fd, connection_backlog) != 0) {
+    if (::listen(server_fd, this->server_info.tcp_backlog) != 0) {
         throw std::runtime_error("listen failed");
     }
 
+    // A path can only be bound once, the first shard takes the unix socket clients
+    if (!this->server_info.unixsocket.empty() && this->server_info.shard_index == 0) {
+        listen_unix_socket();
+    }
+
     // Connect to master if we are slave
     if (this->server_info.replication_info.master_port != -1) {
         if (handshake_master(this->server_info) != 0) {
@@ -243,61 +617,186 @@ void Server::start() {
     LOG("server started.");
 }
 
+// For clients on the same host, which skip the TCP stack entirely
+void Server::listen_unix_socket() {
+    const std::string &path = this->server_info.unixsocket;
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Unix socket path is too long: " + path);
+    }
+    path.copy(addr.sun_path, path.size());
+
+    this->unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->unix_fd < 0) {
+        throw std::runtime_error("Failed to create unix socket");
+    }
+
+    // Left behind by a previous run that did not shut down cleanly
+    unlink(path.c_str());
+    if (bind(this->unix_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        throw std::runtime_error("Failed to bind to unix socket " + path);
+    }
+    if (this->server_info.unixsocketperm != 0 && chmod(path.c_str(), this->server_info.unixsocketperm) != 0) {
+        throw std::runtime_error("Failed to set the permissions of unix socket " + path);
+    }
+    if (::listen(this->unix_fd, this->server_info.tcp_backlog) != 0) {
+        throw std::runtime_error("listen failed on unix socket " + path);
+    }
+}
+
+// Periodic housekeeping, runs server_info.hz times per second
+void Server::cron() {
+    // Samples the totals of every shard
+    if (this->server_info.shard_index == 0) {
+        Stats::sample_ops();
+    }
+
+    // Reclaims expired keys nobody accesses anymore, which also tells tracking clients about them
+    static constexpr size_t ACTIVE_EXPIRE_KEYS_PER_CYCLE = 1000;
+    this->storage_ptr->expire_cycle(ACTIVE_EXPIRE_KEYS_PER_CYCLE);
+
+    Replication::cron();
+}
+
 void Server::listen() {
     // Event Loop to handle clients
     LOG("Waiting for a client to connect...");
+    Tracking::attach(this->server_info);
+    Blocking::attach(this->server_info);
+    PubSub::attach(this->server_info);
+    Replication::attach(this->server_info, this->storage_ptr);
+    const auto cron_interval = std::chrono::milliseconds(1000 / this->server_info.hz);
+    this->next_cron = std::chrono::steady_clock::now() + cron_interval;
+
+    this->reactor = Reactor::create(this->server_info.io_backend, this->server_info);
+    this->server_info.io_backend = this->reactor->get_backend();
+    this->reactor->add_listener(this->server_fd);
+    if (this->unix_fd != -1) {
+        this->reactor->add_listener(this->unix_fd);
+    }
+    if (this->server_info.is_replica()) {
+        this->reactor->add_connection(this->server_info.replication_info.master_fd);
+    }
+    if (Shards::enabled()) {
+        Shards::attach(*this, *this->reactor);
+    }
+    if (this->server_info.io_threads > 1 && this->server_info.shards > 1) {
+        ERROR("io-threads are ignored with shards, every shard already does its own I/O");
+        this->server_info.io_threads = 1;
+    } else if (this->server_info.io_threads > 1 && this->server_info.io_backend == Reactor::Backend::IoUring) {
+        ERROR("io-threads only apply to the poll and epoll backends, io_uring already does the I/O in the kernel");
+        this->server_info.io_threads = 1;
+    } else if (this->server_info.io_threads > 1) {
+        this->io_threads = std::make_unique<IoThreads>(this->server_info.io_threads);
+    }
+
+    const auto handle_event = [this](const IoEvent &event) { this->handle_event(event); };
     while (true) {
         ServerInfo &server_info = this->server_info;
-        std::vector<int> &client_sockets = server_info.client_sockets;
 
-        // 0 for server_fd, 1 to n - 1 for clients, n for master (if any)
-        std::vector<pollfd> fds;
-        fds.push_back({this->server_fd, POLLIN, 0});
-        for (int client_socket : client_sockets) {
-            fds.push_back({client_socket, POLLIN, 0});
+        // Wake up in time for the next cron run or blocked client timeout, even when no client is active
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(this->next_cron -
+                                                                              std::chrono::steady_clock::now());
+        if (const auto until_blocked_timeout = Blocking::until_next_timeout(); until_blocked_timeout.has_value()) {
+            timeout = std::min(timeout, *until_blocked_timeout);
         }
-
-        if (this->server_info.is_replica()) {
-            fds.push_back({this->server_info.replication_info.master_fd, POLLIN, 0});
+        // Messages for a shard whose queue was full are retried soon, it does not signal when it has room again
+        if (Shards::has_backlog()) {
+            timeout = std::min(timeout, std::chrono::milliseconds(1));
         }
-
-        const int num_ready = poll(fds.data(), fds.size(), -1);
-        if (num_ready < 0) {
-            throw std::runtime_error("Error while polling");
+        this->reactor->wait(timeout, handle_event);
+        if (!this->readable_clients.empty()) {
+            read_clients();
         }
 
-        if (fds[0].revents & POLLIN) {
-            struct sockaddr_in client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-            int client_socket = accept(this->server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
-            if (client_socket < 0) {
-                throw std::runtime_error("Failed to accept new connection");
-            }
-            LOG("New connection accepted from " << std::to_string(client_socket));
-            server_info.client_sockets.push_back(client_socket);
+        if (std::chrono::steady_clock::now() >= this->next_cron) {
+            cron();
+            this->next_cron = std::chrono::steady_clock::now() + cron_interval;
         }
 
-        for (size_t i = 1; i < fds.size(); i++) {
-            if (fds[i].revents & POLLIN) {
-                if (i == fds.size() - 1 && this->server_info.is_replica()) {
-                    if (Handler::handle_client(server_info.replication_info.master_fd, *this) != 0) {
-                        close(server_info.replication_info.master_fd);
-                        server_info.replication_info.master_fd = -1;
-                    }
+        // Clients that were served or timed out can run the commands they sent while blocked, which may in turn block
+        // or unblock others
+        Blocking::expire_timeouts();
+        for (std::vector<int> unblocked = Blocking::take_unblocked(); !unblocked.empty();
+             unblocked = Blocking::take_unblocked()) {
+            for (const int client_socket : unblocked) {
+                if (!server_info.clients.contains(client_socket) ||
+                    server_info.clients[client_socket].query_buffer.empty() ||
+                    Handler::is_waiting(client_socket, server_info.clients[client_socket])) {
+                    continue;
                 }
-                // i - 1 since i here includes server_fd, which is not in client_sockets[]
-                else if (Handler::handle_client(client_sockets[i - 1], *this) != 0) {
-                    close(client_sockets[i - 1]);
-                    if (server_info.replication_info.replica_connections.find(client_sockets[i - 1]) !=
-                        server_info.replication_info.replica_connections.end()) {
-                        server_info.replication_info.replica_connections.erase(client_sockets[i - 1]);
-                    }
-                    client_sockets[i - 1] = -1;
+                if (Handler::process_query_buffer(client_socket, *this) != 0) {
+                    close_client(client_socket);
                 }
             }
         }
 
-        client_sockets.erase(std::remove(client_sockets.begin(), client_sockets.end(), -1), client_sockets.end());
+        // Replies of every client handled in this iteration, and those queued for others, eg. invalidations
+        Tracking::flush_broadcasts();
+        if (Shards::enabled()) {
+            Shards::flush();
+        }
+        if (this->io_threads) {
+            write_clients();
+        }
+        this->reactor->flush();
+
+        // Eg. subscribers past their output buffer limit
+        for (const int client_socket : server_info.pending_closes) {
+            if (server_info.clients.contains(client_socket)) {
+                close_client(client_socket);
+            }
+        }
+        server_info.pending_closes.clear();
+    }
+}
+
+void Server::handle_event(const IoEvent &event) {
+    const int client_socket = event.fd;
+    if (event.type == IoEvent::Type::Accepted) {
+        LOG("New connection accepted from " << std::to_string(client_socket));
+        Stats::local().total_connections_received.add();
+        if (event.listener == this->server_fd) {
+            // Replies are written whole, Nagle would only hold back the tail of large ones
+            const int nodelay = 1;
+            setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        }
+        this->server_info.client_sockets.push_back(client_socket);
+        // Ids of different shards never collide, each one hands out those congruent to its index
+        this->server_info.clients[client_socket].id = this->server_info.next_client_id;
+        this->server_info.next_client_id += this->server_info.shards;
+        this->reactor->add_connection(client_socket);
+        return;
+    }
+
+    int res = 0;
+    switch (event.type) {
+        case IoEvent::Type::Readable:
+            if (this->io_threads) {
+                this->readable_clients.push_back(client_socket);
+            } else {
+                res = Handler::handle_client(client_socket, *this);
+            }
+            break;
+        case IoEvent::Type::Data:
+            res = Handler::handle_input(client_socket, *this, event.data);
+            break;
+        case IoEvent::Type::Writable:
+            res = Handler::flush_replies(client_socket, this->server_info.clients[client_socket]);
+            break;
+        case IoEvent::Type::Closed:
+            ERROR("Client disconnected while handling");
+            res = 1;
+            break;
+        case IoEvent::Type::Notified:
+            Shards::drain();
+            return;
+        case IoEvent::Type::Accepted:
+            break;
+    }
+    if (res != 0) {
+        close_client(client_socket);
     }
 }
 
@@ -1,19 +1,139 @@
 #pragma once
 
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "io_threads.h"
+#include "message_parser.h"
+#include "reactor.h"
 #include "storage.h"
 #include "utils.h"
 
+// A file queued as a client's output, like the RDB file of a replica's full resynchronization. It is closed once
+// no output refers to it anymore.
+struct OutputFile {
+    int fd;
+    size_t size;
+
+    OutputFile(int fd, size_t size) : fd(fd), size(size) {}
+    ~OutputFile();
+
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+};
+
+// Part of a client's output the socket did not take yet. Pub/Sub messages share one buffer between all receivers.
+struct OutputChunk {
+    std::shared_ptr<const std::string> data;
+    size_t sent = 0;                          // bytes of data, or of file, already written to the socket
+    std::shared_ptr<const OutputFile> file;  // sent with sendfile instead of data when set
+
+    size_t size() const {
+        return this->file ? this->file->size : this->data->size();
+    }
+};
+
+// Per-connection state that has to outlive a single read
+struct Client {
+    uint64_t id = 0;           // unique for the lifetime of the server, unlike the socket fd
+    std::string query_buffer;  // received bytes not yet parsed into complete commands
+    MultibulkProgress multibulk_progress;  // how far its incomplete last frame was checked
+    std::string reply_buffer;  // replies queued while handling one read, sent together
+    std::deque<OutputChunk> output;  // written before reply_buffer, when the socket can take more
+    size_t output_bytes = 0;         // unsent bytes in output
+    std::optional<std::chrono::steady_clock::time_point> soft_limit_since;  // when output went over the soft limit
+    std::deque<uint64_t> shard_requests;  // its commands running on shards of --shards, in the order of their replies
+    bool asking = false;                  // sent ASKING, its next command may use a slot being imported
+
+    // Drops the first n bytes of the query buffer once their commands ran, the incomplete frame behind them moves along
+    void consume_query(size_t n) {
+        this->query_buffer.erase(0, n);
+        if (this->multibulk_progress.frame_start >= n) {
+            this->multibulk_progress.frame_start -= n;
+            this->multibulk_progress.checked_until -= n;
+        } else {
+            this->multibulk_progress = {};
+        }
+    }
+
+    // Moves the reply buffer to the end of the queued output, its first sent bytes already written
+    void queue_reply_buffer(size_t sent = 0) {
+        this->output_bytes += this->reply_buffer.size() - sent;
+        this->output.push_back({std::make_shared<const std::string>(std::move(this->reply_buffer)), sent, nullptr});
+        this->reply_buffer.clear();
+    }
+
+    // Queues a buffer that may be shared with other clients, after everything already queued
+    void queue_shared(std::shared_ptr<const std::string> data) {
+        if (!this->reply_buffer.empty()) {
+            this->queue_reply_buffer();
+        }
+        this->output_bytes += data->size();
+        this->output.push_back({std::move(data), 0, nullptr});
+    }
+
+    // Queues a file, after everything already queued
+    void queue_file(std::shared_ptr<const OutputFile> file) {
+        if (!this->reply_buffer.empty()) {
+            this->queue_reply_buffer();
+        }
+        this->output_bytes += file->size;
+        this->output.push_back({nullptr, 0, std::move(file)});
+    }
+
+    // Drops the first n bytes of output once the socket took them, returns how many of them were in output
+    size_t consume_output(size_t n) {
+        size_t consumed = 0;
+        while (consumed < n && !this->output.empty()) {
+            OutputChunk &chunk = this->output.front();
+            const size_t taken = std::min(n - consumed, chunk.size() - chunk.sent);
+            chunk.sent += taken;
+            consumed += taken;
+            if (chunk.sent == chunk.size()) {
+                this->output.pop_front();
+            }
+        }
+        this->output_bytes -= consumed;
+        return consumed;
+    }
+
+    bool has_pending_output() const {
+        return !this->output.empty() || !this->reply_buffer.empty();
+    }
+};
+
 struct ServerInfo {
     int tcp_port;
+    int tcp_backlog = 511;        // capped by net.core.somaxconn
+    std::string unixsocket = "";  // no unix socket listener when empty
+    mode_t unixsocketperm = 0;    // 0 keeps what the umask gives
+    int hz = 10;                  // how often per second the server cron runs
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
     std::vector<int> client_sockets;
+    std::unordered_map<int, Client> clients;  // keyed by socket fd
+    uint64_t next_client_id = 1;
+    std::unordered_set<int> pending_writes;  // clients with replies to send at the end of the event loop iteration
+    std::unordered_set<int> pending_closes;  // clients to disconnect once the current event is handled
     int bytes_propagated = 0;
     std::string dir = "";
     std::string dbfilename = "";
+    std::string mmap_snapshot = "";  // native snapshot in dir, mapped at start and written by SAVE
+    bool prefix_index = false;  // ordered key index for KEYS <prefix>*
+    Reactor::Backend io_backend = Reactor::Backend::Poll;  // the one actually in use once the server listens
+    int io_threads = 1;  // threads reading and writing sockets, including the event loop thread
+    int shards = 1;       // threads each owning a part of the keyspace
+    int shard_index = 0;  // the one this server is
+    bool cluster_enabled = false;
+    std::string cluster_announce_ip = "127.0.0.1";  // the address other cluster nodes and clients are given
 
     struct ReplicationInfo {
         std::string master_host = "";
@@ -27,6 +147,11 @@ struct ServerInfo {
 
     static ServerInfo parse(int argc, char **argv);
     bool is_replica() const;
+
+    // filename in dir
+    std::string data_path(const std::string &filename) const;
+    // dbfilename, or dump.rdb when none is set, for files written by the server
+    std::string rdb_filename() const;
 };
 
 class Server;
@@ -53,10 +178,22 @@ class Server {
    private:
     ServerInfo server_info;
     int server_fd;
+    int unix_fd = -1;
     StoragePtr storage_ptr;
+    ReactorPtr reactor;
+    IoThreadsPtr io_threads;
+    std::vector<int> readable_clients;  // left for the I/O threads by the current reactor wait
+
+    std::chrono::steady_clock::time_point next_cron;
 
     void start();
+    void listen_unix_socket();
+    void cron();
+    void handle_event(const IoEvent &event);
+    void read_clients();
+    void write_clients();
     void close_all_connections();
+    void close_client(int client_socket);
     int handshake_master(ServerInfo &server_info);
 };
 
@@ -0,0 +1,387 @@
+#include "shards.h"
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+#include "blocking.h"
+#include "handler.h"
+#include "latency.h"
+#include "logger.h"
+#include "message_parser.h"
+#include "server.h"
+#include "stats.h"
+#include "storage_commands.h"
+
+size_t Shards::count = 1;
+std::vector<std::unique_ptr<SpscQueue<Shards::Message>>> Shards::queues;
+std::vector<int> Shards::eventfds;
+
+thread_local size_t Shards::index = 0;
+thread_local Server *Shards::server = nullptr;
+thread_local std::unordered_map<uint64_t, Shards::Gather> Shards::gathers;
+thread_local uint64_t Shards::next_gather_id = 0;
+thread_local std::vector<std::deque<Shards::Message>> Shards::backlog;
+thread_local std::vector<bool> Shards::woken;
+
+namespace {
+
+// Keeps the shard on one core, so its keys and queues stay in that core's caches
+void pin_to_core(size_t shard) {
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(shard % cores, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        ERROR("Failed to pin shard " << shard << " to a core");
+    }
+}
+
+// The count of an integer reply, or the size of an array reply
+long long parse_count(std::string_view reply) {
+    return std::stoll(std::string{reply.substr(1, reply.find("\r\n") - 1)});
+}
+
+}  // namespace
+
+void Shards::serve(ServerInfo &&server_info) {
+    Shards::count = server_info.shards;
+    for (size_t i = 0; i < Shards::count * Shards::count; i++) {
+        Shards::queues.push_back(std::make_unique<SpscQueue<Message>>(QUEUE_CAPACITY));
+    }
+    for (size_t i = 0; i < Shards::count; i++) {
+        const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create the eventfd of shard " + std::to_string(i));
+        }
+        Shards::eventfds.push_back(fd);
+    }
+
+    // Started one after the other, so loading the RDB file and binding the port never race
+    std::vector<ServerPtr> servers;
+    for (size_t i = 0; i < Shards::count; i++) {
+        ServerInfo shard_info = server_info;
+        shard_info.shard_index = i;
+        shard_info.next_client_id = i + 1;
+        servers.push_back(std::make_unique<Server>(std::move(shard_info)));
+    }
+
+    for (size_t i = 1; i < Shards::count; i++) {
+        std::thread([server = servers[i].get(), i] {
+            pin_to_core(i);
+            try {
+                server->listen();
+            } catch (const std::exception &e) {
+                ERROR("Shard " << i << " failed: " << e.what());
+                Logger::flush();
+                std::exit(EXIT_FAILURE);
+            }
+        }).detach();
+    }
+    pin_to_core(0);
+    servers[0]->listen();
+}
+
+size_t Shards::shard_of(std::string_view key) {
+    // The store's buckets are picked by the low bits of the same hash, the shard by the high bits of its mix
+    const uint64_t hash = StoreKeyHash{}(key) * 0x9E3779B97F4A7C15ULL;
+    return (hash >> 32) % Shards::count;
+}
+
+void Shards::attach(Server &server, Reactor &reactor) {
+    Shards::index = server.get_server_info().shard_index;
+    Shards::server = &server;
+    Shards::backlog.resize(Shards::count);
+    Shards::woken.assign(Shards::count, false);
+    reactor.add_notifier(Shards::eventfds[Shards::index]);
+}
+
+Shards::Plan Shards::plan(const Command &cmd, const DecodedMessage &command, bool behind) {
+    Plan plan = plan_command(cmd, command);
+    if (!behind || !plan.parts.empty()) {
+        return plan;
+    }
+
+    const StorageCommand *storage_cmd = dynamic_cast<const StorageCommand *>(&cmd);
+    const bool blocking = cmd.get_type() == CommandType::BLPop || cmd.get_type() == CommandType::BRPop;
+    if (plan.error.empty() && storage_cmd != nullptr && !storage_cmd->get_keys().empty() && !blocking) {
+        plan.parts.push_back({Shards::index, command});
+    } else {
+        plan.wait = true;
+    }
+    return plan;
+}
+
+Shards::Plan Shards::plan_command(const Command &cmd, const DecodedMessage &command) {
+    Plan plan;
+    const CommandType type = cmd.get_type();
+    switch (type) {
+        case CommandType::Replconf:
+        case CommandType::Psync:
+        case CommandType::Wait:
+            plan.error = "ERR replication is not supported with --shards";
+            return plan;
+        case CommandType::Client: {
+            std::string subcommand = command[1];
+            std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+            if (subcommand == "TRACKING") {
+                plan.error = "ERR CLIENT TRACKING is not supported with --shards";
+            }
+            return plan;
+        }
+        case CommandType::Keys:
+        case CommandType::Publish:
+        case CommandType::FlushAll:
+        case CommandType::FlushDb:
+            for (size_t shard = 0; shard < Shards::count; shard++) {
+                plan.parts.push_back({shard, command});
+            }
+            return plan;
+        default:
+            break;
+    }
+
+    const StorageCommand *storage_cmd = dynamic_cast<const StorageCommand *>(&cmd);
+    if (storage_cmd == nullptr) {
+        return plan;
+    }
+    const std::vector<std::string_view> keys = storage_cmd->get_keys();
+    if (keys.empty()) {
+        return plan;
+    }
+
+    std::vector<size_t> owners;
+    owners.reserve(keys.size());
+    for (std::string_view key : keys) {
+        owners.push_back(shard_of(key));
+    }
+    const bool single_shard = std::all_of(owners.begin(), owners.end(), [&](size_t s) { return s == owners[0]; });
+    if (single_shard && owners[0] == Shards::index) {
+        return plan;
+    }
+
+    // A blocked client is parked on the shard it is connected to, pushes to keys of other shards could not wake it
+    if (type == CommandType::BLPop || type == CommandType::BRPop) {
+        plan.error = "ERR BLPOP and BRPOP only take keys of the shard the client is connected to";
+        return plan;
+    }
+    if (single_shard) {
+        plan.parts.push_back({owners[0], command});
+        return plan;
+    }
+
+    switch (type) {
+        case CommandType::MGet:
+            // One part per key, so the replies can be put back together in the order of the keys
+            for (size_t i = 0; i < keys.size(); i++) {
+                plan.parts.push_back({owners[i], {command[0], std::string{keys[i]}}});
+            }
+            break;
+        case CommandType::MSet:
+        case CommandType::Del:
+        case CommandType::Unlink:
+        case CommandType::Exists: {
+            // One part per shard, holding its keys in the order they were given
+            std::vector<DecodedMessage> by_shard(Shards::count);
+            const size_t args_per_key = type == CommandType::MSet ? 2 : 1;
+            for (size_t i = 0; i < keys.size(); i++) {
+                DecodedMessage &part = by_shard[owners[i]];
+                if (part.empty()) part.push_back(command[0]);
+                for (size_t j = 0; j < args_per_key; j++) {
+                    part.push_back(command[1 + i * args_per_key + j]);
+                }
+            }
+            for (size_t shard = 0; shard < Shards::count; shard++) {
+                if (!by_shard[shard].empty()) plan.parts.push_back({shard, std::move(by_shard[shard])});
+            }
+            break;
+        }
+        default:
+            plan.error = "CROSSSLOT Keys in request don't hash to the same shard";
+            break;
+    }
+    return plan;
+}
+
+void Shards::dispatch(int client_socket, Client &client, CommandType type, std::vector<Part> &&parts) {
+    const uint64_t gather_id = Shards::next_gather_id++;
+    Shards::gathers[gather_id] = {client_socket, client.id, type, std::vector<std::string>(parts.size()), parts.size()};
+    client.shard_requests.push_back(gather_id);
+
+    for (size_t i = 0; i < parts.size(); i++) {
+        Message request;
+        request.kind = Message::Kind::Request;
+        request.origin = Shards::index;
+        request.gather_id = gather_id;
+        request.part = i;
+        request.command = std::move(parts[i].command);
+        send(parts[i].shard, std::move(request));
+    }
+}
+
+void Shards::send(size_t to, Message &&message) {
+    // Behind what is already waiting, so that a shard's messages keep their order
+    std::deque<Message> &waiting = Shards::backlog[to];
+    if (!waiting.empty() || !queue(Shards::index, to).try_push(std::move(message))) {
+        waiting.push_back(std::move(message));
+    }
+    Shards::woken[to] = true;
+}
+
+void Shards::drain() {
+    uint64_t signals;
+    while (read(Shards::eventfds[Shards::index], &signals, sizeof(signals)) > 0) {
+    }
+
+    // Only after the eventfd was reset, a message pushed meanwhile signals it again
+    Message message;
+    for (size_t from = 0; from < Shards::count; from++) {
+        SpscQueue<Message> &inbox = queue(from, Shards::index);
+        while (inbox.try_pop(message)) {
+            if (message.kind == Message::Kind::Request) {
+                execute(message);
+            } else {
+                complete(message);
+            }
+        }
+    }
+}
+
+// Runs a part on the shard owning its keys, as if a client of its own had sent it
+void Shards::execute(Message &request) {
+    ServerInfo &server_info = Shards::server->get_server_info();
+    StoragePtr storage_ptr = Shards::server->get_storage_ptr();
+
+    Message response;
+    response.kind = Message::Kind::Response;
+    response.origin = request.origin;
+    response.gather_id = request.gather_id;
+    response.part = request.part;
+    try {
+        CommandPtr cmd_ptr = Command::parse(request.command);
+        cmd_ptr->set_client_socket(REMOTE_CLIENT);
+        cmd_ptr->set_reply_buffer(&response.reply);
+        if (StorageCommand *storage_cmd = dynamic_cast<StorageCommand *>(cmd_ptr.get())) {
+            storage_cmd->set_store_ref(storage_ptr);
+        }
+
+        const uint64_t start_ticks = CycleClock::now();
+        cmd_ptr->execute(server_info);
+        LatencyMonitor::record_command(cmd_ptr->get_type(), request.command, CycleClock::now() - start_ticks);
+        Stats::local().total_commands_processed.add();
+    } catch (CommandParseError const &e) {
+        response.reply.clear();
+        MessageParser::append_simple_error(response.reply, e.what());
+    }
+
+    if (Blocking::has_ready_keys()) {
+        Blocking::serve_ready_keys(*storage_ptr);
+    }
+    send(request.origin, std::move(response));
+}
+
+void Shards::complete(Message &response) {
+    auto it = Shards::gathers.find(response.gather_id);
+    if (it == Shards::gathers.end()) return;
+    Gather &gather = it->second;
+    gather.replies[response.part] = std::move(response.reply);
+    if (--gather.remaining > 0) return;
+    gather.replies[0] = merge(gather.type, gather.replies);
+
+    ServerInfo &server_info = Shards::server->get_server_info();
+    const int client_socket = gather.client_socket;
+    auto client_it = server_info.clients.find(client_socket);
+    if (client_it == server_info.clients.end() || client_it->second.id != gather.client_id) {
+        Shards::gathers.erase(it);  // disconnected meanwhile
+        return;
+    }
+
+    // Replies go out in the order of the commands, one that came back early waits for those before it
+    Client &client = client_it->second;
+    while (!client.shard_requests.empty()) {
+        auto due = Shards::gathers.find(client.shard_requests.front());
+        if (due->second.remaining > 0) break;
+        client.reply_buffer += due->second.replies[0];
+        Shards::gathers.erase(due);
+        client.shard_requests.pop_front();
+    }
+    server_info.pending_writes.insert(client_socket);
+
+    // The commands that had to wait, or arrived meanwhile
+    if (!client.query_buffer.empty() && !Handler::is_waiting(client_socket, client) &&
+        Handler::process_query_buffer(client_socket, *Shards::server) != 0) {
+        server_info.pending_closes.insert(client_socket);
+    }
+}
+
+std::string Shards::merge(CommandType type, std::vector<std::string> &replies) {
+    if (replies.size() == 1) {
+        return std::move(replies[0]);
+    }
+    for (std::string &reply : replies) {
+        if (reply.starts_with('-')) return std::move(reply);
+    }
+
+    std::string merged;
+    switch (type) {
+        case CommandType::MGet:
+            // Each part is a one element array, only its element is kept
+            MessageParser::append_array_header(merged, replies.size());
+            for (const std::string &reply : replies) {
+                merged.append(reply, reply.find("\r\n") + 2);
+            }
+            break;
+        case CommandType::Keys: {
+            long long size = 0;
+            for (const std::string &reply : replies) size += parse_count(reply);
+            MessageParser::append_array_header(merged, size);
+            for (const std::string &reply : replies) {
+                merged.append(reply, reply.find("\r\n") + 2);
+            }
+            break;
+        }
+        case CommandType::MSet:
+        case CommandType::FlushAll:
+        case CommandType::FlushDb:
+            merged = SharedReplies::ok;
+            break;
+        default: {
+            // DEL, UNLINK, EXISTS and PUBLISH count
+            long long sum = 0;
+            for (const std::string &reply : replies) sum += parse_count(reply);
+            MessageParser::append_integer(merged, sum);
+            break;
+        }
+    }
+    return merged;
+}
+
+void Shards::flush() {
+    for (size_t to = 0; to < Shards::count; to++) {
+        std::deque<Message> &waiting = Shards::backlog[to];
+        while (!waiting.empty() && queue(Shards::index, to).try_push(std::move(waiting.front()))) {
+            waiting.pop_front();
+            Shards::woken[to] = true;
+        }
+    }
+
+    for (size_t to = 0; to < Shards::count; to++) {
+        if (!Shards::woken[to]) continue;
+        Shards::woken[to] = false;
+        const uint64_t signal = 1;
+        if (write(Shards::eventfds[to], &signal, sizeof(signal)) < 0 && errno != EAGAIN) {
+            ERROR("Failed to wake shard " << to);
+        }
+    }
+}
+
+bool Shards::has_backlog() {
+    return std::any_of(Shards::backlog.begin(), Shards::backlog.end(),
+                       [](const std::deque<Message> &waiting) { return !waiting.empty(); });
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "commands.h"
+#include "spsc_queue.h"
+
+class Server;
+struct Client;
+struct ServerInfo;
+
+/*
+    Shared-nothing keyspace sharding, --shards N.
+
+    Each shard is a whole Server on its own thread pinned to a core: its own listening socket, bound with SO_REUSEPORT
+    so that the kernel spreads connections over the shards, its own reactor, Storage and Blocking, Tracking and
+    Pub/Sub state. Every key is owned by exactly one shard, picked by its hash, and only that shard's thread ever
+    touches it, so nothing is locked.
+
+    A command for keys of another shard is forwarded to it over a single-producer single-consumer queue, one for
+    every pair of shards, and its reply comes back the same way. Meanwhile the client waits like a blocked one: its
+    later commands stay in the query buffer, so its replies keep their order. A shard is woken through its eventfd
+    once per event loop iteration, however many messages it was sent.
+
+    MGET, MSET, DEL, UNLINK and EXISTS over keys of several shards are split into one part per shard and their replies
+    merged, KEYS, PUBLISH, FLUSHALL and FLUSHDB go to every shard. Other commands whose keys span shards are refused
+    with CROSSSLOT, like in Redis Cluster.
+*/
+class Shards {
+   public:
+    // A command sent to the shard that executes it
+    struct Part {
+        size_t shard;
+        DecodedMessage command;
+    };
+
+    // Where a command of a client of this shard runs: here when nothing is set
+    struct Plan {
+        bool wait = false;  // has to run here once the replies still due are back
+        std::string error;  // refused
+        std::vector<Part> parts;
+    };
+
+    // Starts server_info.shards servers, each on its own thread. Only returns if the calling thread's one fails.
+    static void serve(ServerInfo &&server_info);
+
+    static bool enabled() {
+        return Shards::count > 1;
+    }
+
+    static size_t shard_of(std::string_view key);
+
+    // Registers the shard running on the calling thread and watches its eventfd
+    static void attach(Server &server, Reactor &reactor);
+
+    // behind is set when replies of earlier commands of the client are still due, a command that runs here would
+    // reply before them. Those with keys of this shard are sent to it like to any other, the others wait.
+    static Plan plan(const Command &cmd, const DecodedMessage &command, bool behind);
+
+    // Sends the parts of a client's command to their shards. Their merged reply is appended to the client's reply
+    // buffer once those of its earlier commands were.
+    static void dispatch(int client_socket, Client &client, CommandType type, std::vector<Part> &&parts);
+
+    // Executes the requests other shards sent and completes the commands whose replies are back, once the eventfd
+    // of the calling thread's shard was signalled
+    static void drain();
+
+    // Wakes the shards sent messages during this event loop iteration, called once per iteration
+    static void flush();
+
+    // Messages that did not fit into a full queue, flush retries them
+    static bool has_backlog();
+
+   private:
+    struct Message {
+        enum class Kind { Request, Response };
+
+        Kind kind = Kind::Request;
+        size_t origin = 0;       // shard of the client
+        uint64_t gather_id = 0;  // the command at origin waiting for it
+        size_t part = 0;
+        DecodedMessage command;  // requests
+        std::string reply;       // responses
+    };
+
+    // A command whose reply has not been appended to its client's reply buffer yet
+    struct Gather {
+        int client_socket;
+        uint64_t client_id;  // the socket may belong to another client once it answers
+        CommandType type;
+        std::vector<std::string> replies;  // by part, merged into the first once all answered
+        size_t remaining;                  // parts that have not answered
+    };
+
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+
+    // Socket of the commands sent by other shards, not -1 which master_fd holds when there is no master
+    static constexpr int REMOTE_CLIENT = -2;
+
+    // Set up before the shards start, then only read
+    static size_t count;
+    static std::vector<std::unique_ptr<SpscQueue<Message>>> queues;  // from * count + to
+    static std::vector<int> eventfds;
+
+    // Per thread, each belongs to the shard running on it
+    static thread_local size_t index;
+    static thread_local Server *server;
+    static thread_local std::unordered_map<uint64_t, Gather> gathers;
+    static thread_local uint64_t next_gather_id;
+    static thread_local std::vector<std::deque<Message>> backlog;  // by destination
+    static thread_local std::vector<bool> woken;                   // by destination, sent to this iteration
+
+    static SpscQueue<Message> &queue(size_t from, size_t to) {
+        return *Shards::queues[from * Shards::count + to];
+    }
+
+    // Where the command runs regardless of the client's earlier commands
+    static Plan plan_command(const Command &cmd, const DecodedMessage &command);
+
+    static void send(size_t to, Message &&message);
+    static void execute(Message &request);
+    static void complete(Message &response);
+
+    // Builds the reply of the whole command out of those of its parts
+    static std::string merge(CommandType type, std::vector<std::string> &replies);
+};
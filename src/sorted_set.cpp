@@ -0,0 +1,161 @@
+#include "sorted_set.h"
+
+size_t SortedSet::max_listpack_entries = 128;
+size_t SortedSet::max_listpack_value = 64;
+
+SortedSet::SortedSet() = default;
+SortedSet::~SortedSet() = default;
+SortedSet::SortedSet(SortedSet &&) noexcept = default;
+SortedSet &SortedSet::operator=(SortedSet &&) noexcept = default;
+
+SortedSet::SortedSet(const SortedSet &other) : packed(other.packed), packed_entries(other.packed_entries) {
+    if (other.table) {
+        // The index points into the table it was built for, so it is rebuilt rather than copied
+        this->table = std::make_unique<Table>();
+        this->table->scores = other.table->scores;
+        for (const auto &[member, score] : this->table->scores) {
+            this->table->index.insert({score, member});
+        }
+    }
+}
+
+SortedSet &SortedSet::operator=(const SortedSet &other) {
+    if (this != &other) {
+        *this = SortedSet(other);
+    }
+    return *this;
+}
+
+bool SortedSet::add(std::string_view member, double score) {
+    if (!this->table) {
+        if (member.size() > max_listpack_value ||
+            (this->packed_entries >= max_listpack_entries && find_packed(member) == std::string::npos)) {
+            convert();
+        }
+    }
+
+    if (this->table) {
+        auto [it, inserted] = this->table->scores.try_emplace(std::string{member}, score);
+        if (!inserted) {
+            if (it->second == score) return false;
+            this->table->index.erase({it->second, it->first});
+            it->second = score;
+        }
+        this->table->index.insert({score, it->first});
+        return inserted;
+    }
+
+    const bool existed = erase(member);
+
+    // Entries stay ordered by (score, member)
+    size_t pos = 0;
+    while (pos < this->packed.size()) {
+        size_t next = pos;
+        const std::string_view other_member = Listpack::read_string(this->packed, next);
+        const double other_score = read_score(next);
+        if (score < other_score || (score == other_score && member < other_member)) break;
+        pos = next;
+    }
+
+    std::string entry;
+    Listpack::append_string(entry, member);
+    entry.append(reinterpret_cast<const char *>(&score), sizeof(score));
+    this->packed.insert(pos, entry);
+    this->packed_entries++;
+    return !existed;
+}
+
+std::optional<double> SortedSet::score(std::string_view member) const {
+    if (this->table) {
+        auto it = this->table->scores.find(member);
+        if (it == this->table->scores.end()) return std::nullopt;
+        return it->second;
+    }
+
+    size_t pos = find_packed(member);
+    if (pos == std::string::npos) return std::nullopt;
+    Listpack::read_string(this->packed, pos);
+    return read_score(pos);
+}
+
+bool SortedSet::erase(std::string_view member) {
+    if (this->table) {
+        auto it = this->table->scores.find(member);
+        if (it == this->table->scores.end()) return false;
+        this->table->index.erase({it->second, it->first});
+        this->table->scores.erase(it);
+        return true;
+    }
+
+    const size_t entry = find_packed(member);
+    if (entry == std::string::npos) return false;
+
+    size_t entry_end = entry;
+    Listpack::read_string(this->packed, entry_end);
+    entry_end += sizeof(double);
+    this->packed.erase(entry, entry_end - entry);
+    this->packed_entries--;
+    return true;
+}
+
+std::optional<size_t> SortedSet::rank(std::string_view member) const {
+    if (this->table) {
+        auto it = this->table->scores.find(member);
+        if (it == this->table->scores.end()) return std::nullopt;
+        return this->table->index.rank({it->second, it->first});
+    }
+
+    size_t pos = 0;
+    for (size_t rank = 0; pos < this->packed.size(); rank++) {
+        if (Listpack::read_string(this->packed, pos) == member) return rank;
+        pos += sizeof(double);
+    }
+    return std::nullopt;
+}
+
+size_t SortedSet::count_below(double score, bool inclusive) const {
+    if (this->table) {
+        return this->table->index.count_below(score, inclusive);
+    }
+
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos < this->packed.size()) {
+        Listpack::read_string(this->packed, pos);
+        const double other_score = read_score(pos);
+        if (inclusive ? other_score > score : other_score >= score) break;
+        count++;
+    }
+    return count;
+}
+
+size_t SortedSet::size() const {
+    return this->table ? this->table->scores.size() : this->packed_entries;
+}
+
+bool SortedSet::is_packed() const {
+    return !this->table;
+}
+
+size_t SortedSet::find_packed(std::string_view member) const {
+    size_t pos = 0;
+    while (pos < this->packed.size()) {
+        const size_t entry = pos;
+        if (Listpack::read_string(this->packed, pos) == member) return entry;
+        pos += sizeof(double);
+    }
+    return std::string::npos;
+}
+
+void SortedSet::convert() {
+    auto table = std::make_unique<Table>();
+    table->scores.reserve(this->packed_entries + 1);
+    for_range(0, this->packed_entries, [&table](std::string_view member, double score) {
+        auto [it, inserted] = table->scores.try_emplace(std::string{member}, score);
+        table->index.insert({score, it->first});
+    });
+
+    this->table = std::move(table);
+    std::string{}.swap(this->packed);
+    this->packed_entries = 0;
+}
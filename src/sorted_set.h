@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "listpack.h"
+#include "score_index.h"
+
+/**
+ * Members ordered by score, ties broken by member, behind the zset type.
+ *
+ * Small sets are packed into one buffer of [varint length][member][8 byte score] entries kept in order, so every
+ * operation is a short linear scan. Past max_listpack_entries members, or with a member longer than
+ * max_listpack_value bytes, the set is converted to a member-to-score table for O(1) ZSCORE plus a ScoreIndex
+ * B+tree for ordered and rank queries.
+ */
+class SortedSet {
+   public:
+    static size_t max_listpack_entries;  // zset-max-listpack-entries
+    static size_t max_listpack_value;    // zset-max-listpack-value, in bytes
+
+    SortedSet();
+    ~SortedSet();
+    SortedSet(const SortedSet &other);
+    SortedSet &operator=(const SortedSet &other);
+    SortedSet(SortedSet &&) noexcept;
+    SortedSet &operator=(SortedSet &&) noexcept;
+
+    // Sets the score of member. Returns true if member was added, false if it existed.
+    bool add(std::string_view member, double score);
+
+    std::optional<double> score(std::string_view member) const;
+
+    // Returns true if member existed
+    bool erase(std::string_view member);
+
+    // 0 based position of member in score order
+    std::optional<size_t> rank(std::string_view member) const;
+
+    // Number of members with a score below score, or not above it if inclusive
+    size_t count_below(double score, bool inclusive) const;
+
+    size_t size() const;
+
+    bool is_packed() const;
+
+    // Calls fn(member, score) for the members ranked [start, stop), in order
+    template <typename Fn>
+    void for_range(size_t start, size_t stop, Fn &&fn) const {
+        if (this->table) {
+            size_t rank = start;
+            for (ScoreIndex::Iterator it = this->table->index.at(start); it.valid() && rank < stop; ++it, rank++) {
+                fn((*it).member, (*it).score);
+            }
+            return;
+        }
+
+        size_t pos = 0;
+        for (size_t rank = 0; rank < stop && pos < this->packed.size(); rank++) {
+            const std::string_view member = Listpack::read_string(this->packed, pos);
+            const double score = read_score(pos);
+            if (rank >= start) fn(member, score);
+        }
+    }
+
+   private:
+    struct MemberHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view member) const {
+            return std::hash<std::string_view>{}(member);
+        }
+    };
+
+    struct Table {
+        // The index holds views of the member strings owned by scores
+        std::unordered_map<std::string, double, MemberHash, std::equal_to<>> scores;
+        ScoreIndex index;
+    };
+
+    std::string packed;
+    uint32_t packed_entries = 0;
+    std::unique_ptr<Table> table;  // set once converted, packed is empty from then on
+
+    double read_score(size_t &pos) const {
+        double score;
+        std::memcpy(&score, this->packed.data() + pos, sizeof(score));
+        pos += sizeof(score);
+        return score;
+    }
+
+    // Offset of the entry holding member in packed, or std::string::npos
+    size_t find_packed(std::string_view member) const;
+
+    void convert();
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+/*
+    Bounded lock-free queue between exactly one producer thread and one consumer thread.
+
+    The producer only writes tail and the consumer only writes head, each on its own cache line, so the two threads
+    never write to the same line. Each side also keeps the last value it saw of the other side's index and only
+    reloads it when the queue looks full or empty, which keeps the shared line from bouncing on every operation.
+*/
+template <typename T>
+class SpscQueue {
+   public:
+    // Capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) : slots(std::bit_ceil(capacity)), mask(std::bit_ceil(capacity) - 1) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer only. Returns false when the queue is full, item is left untouched then.
+    bool try_push(T &&item) {
+        const size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - this->cached_head == this->slots.size()) {
+            this->cached_head = this->head.load(std::memory_order_acquire);
+            if (tail - this->cached_head == this->slots.size()) return false;
+        }
+        this->slots[tail & this->mask] = std::move(item);
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false when the queue is empty.
+    bool try_pop(T &item) {
+        const size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == this->cached_tail) {
+            this->cached_tail = this->tail.load(std::memory_order_acquire);
+            if (head == this->cached_tail) return false;
+        }
+        item = std::move(this->slots[head & this->mask]);
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+   private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::vector<T> slots;
+    const size_t mask;
+
+    // Written by the consumer
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};
+    size_t cached_tail = 0;
+
+    // Written by the producer
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};
+    size_t cached_head = 0;
+};
@@ -0,0 +1,103 @@
+#include "stats.h"
+
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+uint64_t Stats::ops_samples[Stats::OPS_SAMPLES] = {};
+int Stats::ops_sample_index = 0;
+uint64_t Stats::last_sample_ops = 0;
+std::chrono::steady_clock::time_point Stats::last_sample_time = std::chrono::steady_clock::now();
+uint64_t Stats::peak_memory = 0;
+
+namespace {
+
+// Also guards the ops samples and peak memory, which the cron of shard 0 writes while INFO on any shard reads them
+std::mutex registry_mutex;
+
+// Counters outlive their thread so that what an exited thread counted is still included
+std::vector<std::shared_ptr<StatCounters>> &registry() {
+    static std::vector<std::shared_ptr<StatCounters>> counters;
+    return counters;
+}
+
+}  // namespace
+
+StatCounters &Stats::local() {
+    thread_local std::shared_ptr<StatCounters> counters = [] {
+        auto counters = std::make_shared<StatCounters>();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry().push_back(counters);
+        return counters;
+    }();
+    return *counters;
+}
+
+Stats::Totals Stats::aggregate() {
+    Totals totals;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const auto &counters : registry()) {
+        totals.total_connections_received += counters->total_connections_received.get();
+        totals.total_commands_processed += counters->total_commands_processed.get();
+        totals.net_input_bytes += counters->net_input_bytes.get();
+        totals.net_output_bytes += counters->net_output_bytes.get();
+        totals.net_repl_output_bytes += counters->net_repl_output_bytes.get();
+        totals.keyspace_hits += counters->keyspace_hits.get();
+        totals.keyspace_misses += counters->keyspace_misses.get();
+        totals.expired_keys += counters->expired_keys.get();
+        totals.client_output_buffer_limit_disconnections += counters->client_output_buffer_limit_disconnections.get();
+    }
+    return totals;
+}
+
+void Stats::sample_ops() {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t ops = aggregate().total_commands_processed;
+    const uint64_t memory = used_memory();
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    const auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_sample_time).count();
+
+    if (elapsed_ms > 0) {
+        ops_samples[ops_sample_index] = (ops - last_sample_ops) * 1000 / elapsed_ms;
+        ops_sample_index = (ops_sample_index + 1) % OPS_SAMPLES;
+    }
+    last_sample_ops = ops;
+    last_sample_time = now;
+
+    peak_memory = std::max(peak_memory, memory);
+}
+
+uint64_t Stats::instantaneous_ops_per_sec() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t sum = 0;
+    for (const uint64_t sample : ops_samples) sum += sample;
+    return sum / OPS_SAMPLES;
+}
+
+uint64_t Stats::used_memory() {
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+uint64_t Stats::used_memory_peak() {
+    const uint64_t memory = used_memory();
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    peak_memory = std::max(peak_memory, memory);
+    return peak_memory;
+}
+
+uint64_t Stats::used_memory_rss() {
+    // Second field of statm is the resident set size in pages
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
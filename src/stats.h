@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Counter written by a single thread. The relaxed load + store compiles to a plain add, unlike fetch_add, and still
+// lets other threads read it safely when aggregating.
+class StatCounter {
+   public:
+    void add(uint64_t n = 1) {
+        this->value.store(this->value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return this->value.load(std::memory_order_relaxed);
+    }
+
+   private:
+    std::atomic<uint64_t> value{0};
+};
+
+struct StatCounters {
+    StatCounter total_connections_received;
+    StatCounter total_commands_processed;
+    StatCounter net_input_bytes;
+    StatCounter net_output_bytes;
+    StatCounter net_repl_output_bytes;
+    StatCounter keyspace_hits;
+    StatCounter keyspace_misses;
+    StatCounter expired_keys;
+    StatCounter client_output_buffer_limit_disconnections;
+};
+
+/*
+    Server statistics for INFO.
+
+    Each thread bumps its own StatCounters, so the hot paths never share a cache line. The per-thread counters
+    are only summed up when INFO asks for them.
+*/
+class Stats {
+   public:
+    struct Totals {
+        uint64_t total_connections_received = 0;
+        uint64_t total_commands_processed = 0;
+        uint64_t net_input_bytes = 0;
+        uint64_t net_output_bytes = 0;
+        uint64_t net_repl_output_bytes = 0;
+        uint64_t keyspace_hits = 0;
+        uint64_t keyspace_misses = 0;
+        uint64_t expired_keys = 0;
+        uint64_t client_output_buffer_limit_disconnections = 0;
+    };
+
+    // Counters of the calling thread
+    static StatCounters &local();
+
+    static Totals aggregate();
+
+    // Called by the server cron, feeds instantaneous_ops_per_sec
+    static void sample_ops();
+    static uint64_t instantaneous_ops_per_sec();
+
+    // Heap currently handed out by malloc, and the highest value seen by the cron
+    static uint64_t used_memory();
+    static uint64_t used_memory_peak();
+    static uint64_t used_memory_rss();
+
+   private:
+    static constexpr int OPS_SAMPLES = 16;
+
+    // Guarded by the registry mutex of stats.cpp
+    static uint64_t ops_samples[OPS_SAMPLES];
+    static int ops_sample_index;
+    static uint64_t last_sample_ops;
+    static std::chrono::steady_clock::time_point last_sample_time;
+    static uint64_t peak_memory;
+};
@@ -1,5 +1,20 @@
 #include "storage.h"
 
+#include <algorithm>
+#include <utility>
+
+#include "cluster.h"
+#include "latency.h"
+#include "lazy_free.h"
+#include "mapped_snapshot.h"
+#include "stats.h"
+#include "tracking.h"
+
+Storage::Storage() = default;
+
+// Out of line, MappedSnapshot is incomplete in the header
+Storage::~Storage() = default;
+
 bool Storage::is_expired(const StorageValueVariants& val) const {
     return std::visit(
         [](const auto& v) -> bool {
@@ -9,36 +24,416 @@ bool Storage::is_expired(const StorageValueVariants& val) const {
         val);
 }
 
+bool Storage::has_expiry(const StorageValueVariants& val) {
+    return std::visit([](const auto& v) -> bool { return v.get_expiry().has_value(); }, val);
+}
+
 StorageValueVariants Storage::get(std::string_view key) {
-    auto it = this->store.find(std::string{key});
+    auto it = this->lookup(key);
     if (it == this->store.end()) {
+        Stats::local().keyspace_misses.add();
         throw std::out_of_range("Key not found");
     }
 
     if (is_expired(it->second)) {
-        this->store.erase(it);
+        this->expire(it);
+        Stats::local().keyspace_misses.add();
         throw std::out_of_range("Key expired");
     }
+    Stats::local().keyspace_hits.add();
     return it->second;
 };
 
+const StorageValueVariants* Storage::find(std::string_view key) {
+    auto it = this->lookup(key);
+    if (it == this->store.end()) {
+        Stats::local().keyspace_misses.add();
+        return nullptr;
+    }
+
+    if (is_expired(it->second)) {
+        this->expire(it);
+        Stats::local().keyspace_misses.add();
+        return nullptr;
+    }
+    Stats::local().keyspace_hits.add();
+    return &it->second;
+}
+
+StorageValueVariants* Storage::find_mutable(std::string_view key) {
+    auto it = this->lookup(key);
+    if (it == this->store.end()) {
+        return nullptr;
+    }
+
+    if (is_expired(it->second)) {
+        this->expire(it);
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void Storage::modified(std::string_view key) {
+    if (Tracking::active()) {
+        Tracking::invalidate_key(key);
+    }
+}
+
 void Storage::set(std::string_view key, StorageValueVariants&& value) {
-    this->store.insert_or_assign(std::string{key}, std::move(value));
+    // Growing the table rehashes every key at once, which shows up as a latency spike
+    const bool may_rehash = this->store.size() + 1 > this->store.bucket_count() * this->store.max_load_factor();
+    const auto start = may_rehash ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+
+    // The written value replaces the one in the snapshot, which is not worth decoding
+    if (this->snapshot) {
+        const size_t slot = this->snapshot->find(key);
+        if (slot != MappedSnapshot::NOT_FOUND) this->snapshot->remove(slot);
+    }
+
+    // try_emplace leaves value untouched if the key exists, so the old expiry can still be accounted for
+    auto [it, inserted] = this->store.try_emplace(std::string{key}, std::move(value));
+    if (!inserted) {
+        this->expires -= has_expiry(it->second);
+        if (LazyFree::lazy_server_del) {
+            LazyFree::free(std::exchange(it->second, std::move(value)));
+        } else {
+            it->second = std::move(value);
+        }
+    } else {
+        this->index_key(it);
+    }
+    this->expires += has_expiry(it->second);
+
+    if (Tracking::active()) {
+        Tracking::invalidate_key(it->first);
+    }
+
+    if (may_rehash) {
+        LatencyMonitor::add_sample("rehash", std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                 std::chrono::steady_clock::now() - start)
+                                                 .count());
+    }
 };
 
+bool Storage::erase(std::string_view key) {
+    auto it = this->store.find(key);
+    if (it == this->store.end()) {
+        return this->erase_mapped(key);
+    }
+
+    if (is_expired(it->second)) {
+        this->expire(it);
+        return false;
+    }
+    this->erase(it);
+    return true;
+}
+
+bool Storage::unlink(std::string_view key) {
+    auto it = this->store.find(key);
+    if (it == this->store.end()) {
+        return this->erase_mapped(key);
+    }
+
+    if (is_expired(it->second)) {
+        this->expire(it);
+        return false;
+    }
+    this->erase(it, true);
+    return true;
+}
+
+void Storage::flush(bool async) {
+    if (Tracking::active()) {
+        for (const auto& [k, v] : this->store) {
+            Tracking::invalidate_key(k);
+        }
+        if (this->snapshot) {
+            this->snapshot->for_each([](const MappedSnapshot::Entry& entry) { Tracking::invalidate_key(entry.key); });
+        }
+    }
+    // Unmapping is cheap, the pages are the page cache's
+    this->snapshot.reset();
+    // Views into the keys about to be freed
+    if (this->prefix_index) {
+        this->prefix_index->clear();
+    }
+    if (this->slot_index) {
+        for (auto& keys : *this->slot_index) keys.clear();
+    }
+    this->expires = 0;
+    this->expire_cursor = 0;
+    this->avg_ttl_ms = 0;
+
+    Store flushed;
+    flushed.swap(this->store);
+    if (async) {
+        LazyFree::free(std::move(flushed));
+    }
+}
+
+void Storage::prefetch(const std::vector<std::string>& keys) const {
+    this->prefetch_keys(keys);
+}
+
+void Storage::prefetch(const std::vector<std::string_view>& keys) const {
+    this->prefetch_keys(keys);
+}
+
+template <typename Keys>
+void Storage::prefetch_keys(const Keys& keys) const {
+    static thread_local std::vector<size_t> key_buckets;
+    key_buckets.clear();
+
+    // Same as store.bucket(key), which would need a std::string
+    const size_t bucket_count = this->store.bucket_count();
+    for (std::string_view key : keys) {
+        key_buckets.push_back(this->store.hash_function()(key) % bucket_count);
+    }
+
+    // The recorded array is stale after flush swapped the buckets out, until the store grows again
+    if (this->buckets.count == bucket_count) {
+        for (const size_t bucket : key_buckets) {
+            __builtin_prefetch(&this->buckets.slots[bucket]);
+        }
+        // A slot points to the node before the bucket's first one, or is null when the bucket is empty
+        for (const size_t bucket : key_buckets) {
+            if (const void* before = this->buckets.slots[bucket]) __builtin_prefetch(before);
+        }
+    }
+
+    // Lookups compare the hash code cached at the end of a node before its key
+    for (const size_t bucket : key_buckets) {
+        auto it = this->store.begin(bucket);
+        if (it != this->store.end(bucket)) {
+            __builtin_prefetch(&*it);
+            __builtin_prefetch(&*it + 1);
+        }
+    }
+}
+
 Storage::StoreView Storage::get_view() const {
     return this->store;
 }
 
 bool Storage::check_validity(std::string_view key) {
-    auto it = this->store.find(std::string{key});
+    auto it = this->lookup(key);
     if (it == this->store.end()) {
         return false;
     }
 
     if (is_expired(it->second)) {
-        this->store.erase(it);
+        this->expire(it);
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> Storage::keys(std::string_view prefix) const {
+    std::vector<std::string> res;
+
+    if (this->prefix_index) {
+        // Keys sharing a prefix are contiguous in the ordered index: O(log n + k)
+        for (auto it = this->prefix_index->lower_bound(prefix);
+             it != this->prefix_index->end() && it->starts_with(prefix); it++) {
+            if (!is_expired(this->store.find(*it)->second)) {
+                res.emplace_back(*it);
+            }
+        }
+    } else {
+        for (const auto& [k, v] : this->store) {
+            if (k.starts_with(prefix) && !is_expired(v)) {
+                res.push_back(k);
+            }
+        }
+    }
+
+    // The snapshot has no ordered index, its keys are always scanned
+    if (this->snapshot) {
+        const auto now = std::chrono::system_clock::now();
+        this->snapshot->for_each([&](const MappedSnapshot::Entry& entry) {
+            if (entry.key.starts_with(prefix) && (!entry.expiry.has_value() || now < entry.expiry.value())) {
+                res.emplace_back(entry.key);
+            }
+        });
+    }
+    return res;
+}
+
+void Storage::enable_prefix_index() {
+    if (this->prefix_index) return;
+
+    this->prefix_index = std::make_unique<PrefixIndex>();
+    for (const auto& [k, v] : this->store) {
+        this->prefix_index->insert(k);
+    }
+}
+
+void Storage::enable_slot_index() {
+    if (this->slot_index) return;
+
+    this->slot_index = std::make_unique<SlotIndex>(Cluster::SLOTS);
+    for (const auto& [k, v] : this->store) {
+        (*this->slot_index)[Cluster::key_hash_slot(k)].insert(k);
+    }
+}
+
+size_t Storage::count_keys_in_slot(int slot) const {
+    return (*this->slot_index)[slot].size();
+}
+
+std::vector<std::string> Storage::keys_in_slot(int slot, size_t count) const {
+    const auto& keys = (*this->slot_index)[slot];
+    std::vector<std::string> res;
+    res.reserve(std::min(count, keys.size()));
+    for (auto it = keys.begin(); it != keys.end() && res.size() < count; it++) {
+        res.emplace_back(*it);
+    }
+    return res;
+}
+
+size_t Storage::size() const {
+    return this->store.size() + (this->snapshot ? this->snapshot->size() : 0);
+}
+
+size_t Storage::expires_count() const {
+    return this->expires + (this->snapshot ? this->snapshot->expires_count() : 0);
+}
+
+uint64_t Storage::avg_ttl() const {
+    return this->avg_ttl_ms;
+}
+
+size_t Storage::expire_cycle(size_t max_keys) {
+    if (this->expires == 0) {
+        this->avg_ttl_ms = 0;
+        return 0;
+    }
+
+    // Collected first, since erasing while walking a bucket would invalidate the iteration
+    std::vector<std::string> expired;
+    size_t checked = 0;
+    uint64_t ttl_sum = 0;
+    size_t ttl_samples = 0;
+    const auto now = std::chrono::system_clock::now();
+    const size_t bucket_count = this->store.bucket_count();
+    for (size_t visited = 0; visited < bucket_count && checked < max_keys; visited++) {
+        const size_t bucket = this->expire_cursor++ % bucket_count;
+        for (auto it = this->store.begin(bucket); it != this->store.end(bucket); it++, checked++) {
+            const TimeStamp expiry = std::visit([](const auto& v) { return v.get_expiry(); }, it->second);
+            if (!expiry.has_value()) continue;
+
+            if (now >= *expiry) {
+                expired.push_back(it->first);
+            } else {
+                ttl_sum += std::chrono::duration_cast<std::chrono::milliseconds>(*expiry - now).count();
+                ttl_samples++;
+            }
+        }
+    }
+
+    // Like Redis, the average of one cycle only moves the estimate by 2%, so a few odd keys do not make it jump
+    if (ttl_samples > 0) {
+        const uint64_t cycle_avg = ttl_sum / ttl_samples;
+        this->avg_ttl_ms = this->avg_ttl_ms == 0 ? cycle_avg : this->avg_ttl_ms / 50 * 49 + cycle_avg / 50;
+    }
+
+    for (const std::string& key : expired) {
+        this->expire(this->store.find(key));
+    }
+    return expired.size();
+}
+
+void Storage::erase(Store::iterator it, bool lazy) {
+    if (Tracking::active()) {
+        Tracking::invalidate_key(it->first);
+    }
+    if (this->prefix_index) {
+        this->prefix_index->erase(it->first);
+    }
+    if (this->slot_index) {
+        (*this->slot_index)[Cluster::key_hash_slot(it->first)].erase(it->first);
+    }
+    this->expires -= has_expiry(it->second);
+    if (lazy) {
+        // Moved out first, the node itself is cheap to free
+        LazyFree::free(std::move(it->second));
+    }
+    this->store.erase(it);
+}
+
+void Storage::attach_snapshot(std::unique_ptr<MappedSnapshot> snapshot) {
+    this->snapshot = std::move(snapshot);
+}
+
+const MappedSnapshot* Storage::get_snapshot() const {
+    return this->snapshot.get();
+}
+
+std::optional<std::string_view> Storage::find_mapped_string(std::string_view key) {
+    if (!this->snapshot) return std::nullopt;
+
+    const size_t slot = this->snapshot->find(key);
+    if (slot == MappedSnapshot::NOT_FOUND) return std::nullopt;
+
+    // Other types and expired keys are left to find, which promotes them
+    const MappedSnapshot::Entry entry = this->snapshot->entry(slot);
+    if (entry.type != RDBParser::ValueType::STRING ||
+        (entry.expiry.has_value() && std::chrono::system_clock::now() >= entry.expiry.value())) {
+        return std::nullopt;
+    }
+    Stats::local().keyspace_hits.add();
+    return entry.value;
+}
+
+Storage::Store::iterator Storage::lookup(std::string_view key) {
+    auto it = this->store.find(key);
+    if (it == this->store.end() && this->snapshot) {
+        return this->promote(key);
+    }
+    return it;
+}
+
+Storage::Store::iterator Storage::promote(std::string_view key) {
+    const size_t slot = this->snapshot->find(key);
+    if (slot == MappedSnapshot::NOT_FOUND) return this->store.end();
+
+    // Expired keys too, the caller finds them expired and removes them as if they had always been in store
+    auto [it, inserted] = this->store.try_emplace(std::string{key}, this->snapshot->load(slot));
+    this->snapshot->remove(slot);
+    this->index_key(it);
+    this->expires += has_expiry(it->second);
+    return it;
+}
+
+bool Storage::erase_mapped(std::string_view key) {
+    if (!this->snapshot) return false;
+
+    const size_t slot = this->snapshot->find(key);
+    if (slot == MappedSnapshot::NOT_FOUND) return false;
+
+    const TimeStamp expiry = this->snapshot->entry(slot).expiry;
+    this->snapshot->remove(slot);
+    if (expiry.has_value() && std::chrono::system_clock::now() >= expiry.value()) {
+        Stats::local().expired_keys.add();
         return false;
     }
+    if (Tracking::active()) {
+        Tracking::invalidate_key(key);
+    }
     return true;
+}
+
+void Storage::index_key(Store::iterator it) {
+    if (this->prefix_index) {
+        this->prefix_index->insert(it->first);
+    }
+    if (this->slot_index) {
+        (*this->slot_index)[Cluster::key_hash_slot(it->first)].insert(it->first);
+    }
+}
+
+void Storage::expire(Store::iterator it) {
+    Stats::local().expired_keys.add();
+    this->erase(it, LazyFree::lazy_expire);
 }
\ No newline at end of file
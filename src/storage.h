@@ -3,12 +3,19 @@
 #include <chrono>
 #include <memory>
 #include <optional>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 
+#include "hash.h"
+#include "quicklist.h"
+#include "sorted_set.h"
+
 using TimeStamp = std::optional<std::chrono::time_point<std::chrono::system_clock>>;
 
 template <typename T>
@@ -20,6 +27,15 @@ class StorageValue {
         return this->value;
     };
 
+    const T& get_value_ref() const {
+        return this->value;
+    };
+
+    // For values modified in place, like hash fields
+    T& get_value_ref() {
+        return this->value;
+    };
+
     TimeStamp get_expiry() const {
         return this->expiry;
     };
@@ -34,26 +50,193 @@ using StringValue = StorageValue<std::string>;
 using Stream = std::vector<std::pair<std::string, std::string>>;
 using StreamValue = StorageValue<Stream>;
 
-using StorageValueVariants = std::variant<StringValue, StreamValue>;
+using HashValue = StorageValue<Hash>;
+using SortedSetValue = StorageValue<SortedSet>;
+using ListValue = StorageValue<QuickList>;
+
+using StorageValueVariants = std::variant<StringValue, StreamValue, HashValue, SortedSetValue, ListValue>;
 
 class Storage;
 using StoragePtr = std::shared_ptr<Storage>;
 
+class MappedSnapshot;
+
+// Lets the store be probed with a string_view without building a temporary std::string
+struct StoreKeyHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+// Where the bucket array of a store currently lives, see StoreAllocator
+struct BucketArray {
+    void* const* slots = nullptr;
+    size_t count = 0;
+};
+
+/**
+ * Allocates like std::allocator, and records every array of pointers it allocates in buckets. The bucket array is
+ * the only such array unordered_map allocates, so Storage::prefetch can find a bucket's slot without loading
+ * anything. All instances share the same heap, so they compare equal and swapping stores never swaps them.
+ */
+template <typename T>
+struct StoreAllocator {
+    using value_type = T;
+
+    BucketArray* buckets = nullptr;
+
+    StoreAllocator() = default;
+    explicit StoreAllocator(BucketArray* buckets) : buckets(buckets) {}
+    template <typename U>
+    StoreAllocator(const StoreAllocator<U>& other) : buckets(other.buckets) {}
+
+    T* allocate(size_t n) {
+        T* p = std::allocator<T>{}.allocate(n);
+        if constexpr (std::is_pointer_v<T>) {
+            if (this->buckets != nullptr) *this->buckets = {reinterpret_cast<void* const*>(p), n};
+        }
+        return p;
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>{}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const StoreAllocator<U>&) const {
+        return true;
+    }
+};
+
 class Storage {
    public:
-    using Store = std::unordered_map<std::string, std::variant<StringValue, StreamValue>>;
+    using Store = std::unordered_map<std::string, StorageValueVariants, StoreKeyHash, std::equal_to<>,
+                                     StoreAllocator<std::pair<const std::string, StorageValueVariants>>>;
     using StoreView = const Store&;
 
+    Storage();
+    ~Storage();
+
     StorageValueVariants get(std::string_view key);
 
+    // Like get, but without copying the value. Returns nullptr for missing and expired keys.
+    const StorageValueVariants* find(std::string_view key);
+
+    /**
+     * Like find, for values that are modified in place. Does not count towards keyspace hits and misses.
+     * The caller must call modified(key) once it is done changing the value.
+     */
+    StorageValueVariants* find_mutable(std::string_view key);
+
+    // Signals that the value at key was changed in place, so clients caching it are invalidated
+    void modified(std::string_view key);
+
     void set(std::string_view key, StorageValueVariants&& value);
 
+    // Returns true if an unexpired key was removed
+    bool erase(std::string_view key);
+
+    // Like erase, but a large value is freed on the lazy free thread
+    bool unlink(std::string_view key);
+
+    // Removes every key. With async the keys and values are freed on the lazy free thread.
+    void flush(bool async);
+
+    /**
+     * First pass of a multi-key operation: pulls what looking up keys will touch towards the cache, in three rounds
+     * over all of them. Their bucket array slots first, then the nodes the slots point to, then the first node of
+     * each bucket. Each round only loads lines the previous one prefetched, so the cache misses of all the keys
+     * overlap instead of being paid one by one.
+     */
+    void prefetch(const std::vector<std::string>& keys) const;
+    void prefetch(const std::vector<std::string_view>& keys) const;
+
     StoreView get_view() const;
 
     bool check_validity(std::string_view key);
 
+    /**
+     * Returns all unexpired keys starting with prefix.
+     * Uses the ordered prefix index when it is enabled, otherwise scans the whole store.
+     */
+    std::vector<std::string> keys(std::string_view prefix) const;
+
+    /**
+     * Builds an ordered index over the current keys and keeps it up to date on every insert and erase.
+     * Costs one tree node per key, so it is opt-in (--prefix-index yes).
+     */
+    void enable_prefix_index();
+
+    /**
+     * Indexes the keys by cluster hash slot and keeps the index up to date, for CLUSTER COUNTKEYSINSLOT and
+     * GETKEYSINSLOT. Costs an entry per key, so only cluster mode enables it.
+     */
+    void enable_slot_index();
+
+    // Keys in slot, including expired ones that have not been reclaimed yet. Needs the slot index.
+    size_t count_keys_in_slot(int slot) const;
+
+    // Up to count keys in slot. Needs the slot index.
+    std::vector<std::string> keys_in_slot(int slot, size_t count) const;
+
+    /**
+     * Serves the keys of snapshot until they are first used, see MappedSnapshot. Their values are moved into the
+     * store when a command other than GET and MGET looks them up, and dropped from the snapshot when overwritten.
+     */
+    void attach_snapshot(std::unique_ptr<MappedSnapshot> snapshot);
+
+    // nullptr if there is none or it was flushed
+    const MappedSnapshot* get_snapshot() const;
+
+    // The value of key if it is an unexpired string still in the snapshot, read in place without promoting it
+    std::optional<std::string_view> find_mapped_string(std::string_view key);
+
+    // Number of keys, including expired ones that have not been reclaimed yet
+    size_t size() const;
+
+    // Number of keys with an expiry set
+    size_t expires_count() const;
+
+    // Estimated average time to live of the keys with an expiry in milliseconds, from the keys expire_cycle checks
+    uint64_t avg_ttl() const;
+
+    /**
+     * Active expiry: checks up to max_keys keys, resuming where the previous call stopped, and removes the expired
+     * ones. Returns how many were removed. Without it, keys that are never accessed again are never reclaimed.
+     */
+    size_t expire_cycle(size_t max_keys);
+
    private:
-    Store store;
+    // Views point into the keys of store, which are stable since unordered_map never moves its nodes
+    using PrefixIndex = std::set<std::string_view>;
+    using SlotIndex = std::vector<std::unordered_set<std::string_view>>;  // by slot
+
+    BucketArray buckets;  // of store, recorded by its allocator
+    Store store{0, StoreKeyHash{}, std::equal_to<>{}, Store::allocator_type{&this->buckets}};
+    std::unique_ptr<PrefixIndex> prefix_index;
+    std::unique_ptr<SlotIndex> slot_index;
+    std::unique_ptr<MappedSnapshot> snapshot;
+    size_t expires = 0;        // of the keys in store
+    size_t expire_cursor = 0;  // next bucket for expire_cycle
+    uint64_t avg_ttl_ms = 0;   // moving average of the TTLs expire_cycle sees
 
     bool is_expired(const StorageValueVariants& val) const;
+
+    template <typename Keys>
+    void prefetch_keys(const Keys& keys) const;
+    static bool has_expiry(const StorageValueVariants& val);
+
+    // Finds key in store, or moves it there from the snapshot
+    Store::iterator lookup(std::string_view key);
+    Store::iterator promote(std::string_view key);
+
+    // Removes key from the snapshot without decoding its value, returns true if it was there and not expired
+    bool erase_mapped(std::string_view key);
+
+    // Adds a key just inserted into store to the indexes
+    void index_key(Store::iterator it);
+    void erase(Store::iterator it, bool lazy = false);
+    void expire(Store::iterator it);
 };
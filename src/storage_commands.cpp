@@ -1,8 +1,23 @@
 #include "storage_commands.h"
 
-#include <sys/socket.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <tuple>
+
+#include "cluster.h"
+#include "latency.h"
+#include "lazy_free.h"
 #include "logger.h"
+#include "mapped_snapshot.h"
+#include "pubsub.h"
+#include "rdb_writer.h"
+#include "replication.h"
+#include "stats.h"
+#include "tracking.h"
 
 StorageCommand::StorageCommand(CommandType type) : Command(type) {}
 
@@ -10,6 +25,230 @@ void StorageCommand::set_store_ref(StoragePtr storage_ptr) {
     this->storage_ptr = storage_ptr;
 }
 
+std::vector<std::string_view> StorageCommand::get_keys() const {
+    return {};
+}
+
+/**
+ * Looks up the value of type T at key for modification, creating an empty one first if create is set.
+ * Returns nullptr if there is none, check wrong_type to tell a missing key from one holding another type.
+ */
+template <typename T>
+static T *find_value_for_write(Storage &storage, std::string_view key, bool create, bool &wrong_type) {
+    StorageValueVariants *val = storage.find_mutable(key);
+    if (val == nullptr && create) {
+        storage.set(key, StorageValue<T>(T{}, std::nullopt));
+        val = storage.find_mutable(key);
+    }
+
+    wrong_type = val != nullptr && !std::holds_alternative<StorageValue<T>>(*val);
+    if (val == nullptr || wrong_type) {
+        return nullptr;
+    }
+    return &std::get<StorageValue<T>>(*val).get_value_ref();
+}
+
+// Like find_value_for_write, for commands that only read. Counts towards keyspace hits and misses.
+template <typename T>
+static const T *find_value(Storage &storage, std::string_view key, bool &wrong_type) {
+    const StorageValueVariants *val = storage.find(key);
+    const StorageValue<T> *typed_value = val != nullptr ? std::get_if<StorageValue<T>>(val) : nullptr;
+
+    wrong_type = val != nullptr && typed_value == nullptr;
+    return typed_value != nullptr ? &typed_value->get_value_ref() : nullptr;
+}
+
+// Parses the whole of s as a base 10 integer
+static bool parse_integer(std::string_view s, long long &num) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), num);
+    return ec == std::errc() && end == s.data() + s.size();
+}
+
+// Parses a sorted set score: a finite number, or +inf / -inf. NaN is rejected.
+static bool parse_score(std::string_view s, double &score) {
+    // from_chars reads "inf" and "-inf" but not a leading '+'
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') s.remove_prefix(1);
+
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), score);
+    return ec == std::errc() && end == s.data() + s.size() && !std::isnan(score);
+}
+
+// Scores are sent as bulk strings in their shortest round-tripping form, like Redis
+static void append_score(std::string &out, double score) {
+    char buf[32];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), score);
+    MessageParser::append_bulk_string(out, std::string_view(buf, end - buf));
+}
+
+InfoCommand::InfoCommand(std::vector<std::string> &&sections)
+    : StorageCommand(CommandType::Info), sections(std::move(sections)) {}
+
+/**
+ * Example: INFO [section ...]
+ *
+ * Sections: server, clients, memory, stats, replication, commandstats, cluster and keyspace.
+ * Without arguments every section except commandstats is returned, "all" returns everything.
+ */
+CommandPtr InfoCommand::parse(const DecodedMessage &decoded_msg) {
+    std::vector<std::string> sections(decoded_msg.begin() + 1, decoded_msg.end());
+    for (std::string &section : sections) {
+        std::transform(section.begin(), section.end(), section.begin(), tolower);
+    }
+    return std::make_unique<InfoCommand>(std::move(sections));
+}
+
+bool InfoCommand::wants(std::string_view section, bool in_default) const {
+    if (this->sections.empty()) return in_default;
+
+    for (const std::string &requested : this->sections) {
+        if (requested == section || requested == "all" || requested == "everything" ||
+            (requested == "default" && in_default)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string bytes_to_human(uint64_t bytes) {
+    constexpr const char *units[] = {"B", "K", "M", "G", "T"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.2f%s", value, units[unit]);
+    return buf;
+}
+
+void InfoCommand::execute(ServerInfo &server_info) {
+    std::vector<std::string> lines;
+    auto add_section = [&lines](std::string_view header) {
+        if (!lines.empty()) lines.emplace_back("");
+        lines.emplace_back(header);
+    };
+    auto add_field = [&lines](std::string_view name, const auto &value) {
+        std::string line{name};
+        line.push_back(':');
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(value)>>) {
+            line.append(std::to_string(value));
+        } else {
+            line.append(value);
+        }
+        lines.push_back(std::move(line));
+    };
+
+    if (wants("server", true)) {
+        const long uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() -
+                                                                             server_info.start_time)
+                                .count();
+        add_section("# Server");
+        add_field("process_id", getpid());
+        add_field("tcp_port", server_info.tcp_port);
+        add_field("uptime_in_seconds", uptime);
+        add_field("uptime_in_days", uptime / (24 * 60 * 60));
+        add_field("hz", server_info.hz);
+        add_field("multiplexing_api", Reactor::backend_name(server_info.io_backend));
+    }
+
+    if (wants("clients", true)) {
+        add_section("# Clients");
+        add_field("connected_clients", server_info.client_sockets.size());
+        add_field("blocked_clients", Blocking::get_blocked_count());
+        add_field("tracking_clients", Tracking::get_clients_count());
+        add_field("pubsub_clients", PubSub::get_client_count());
+    }
+
+    if (wants("memory", true)) {
+        const uint64_t used_memory = Stats::used_memory();
+        const uint64_t used_memory_peak = Stats::used_memory_peak();
+        add_section("# Memory");
+        add_field("used_memory", used_memory);
+        add_field("used_memory_human", bytes_to_human(used_memory));
+        add_field("used_memory_rss", Stats::used_memory_rss());
+        add_field("used_memory_peak", used_memory_peak);
+        add_field("used_memory_peak_human", bytes_to_human(used_memory_peak));
+        add_field("mem_allocator", "libc");
+        add_field("lazyfree_pending_objects", LazyFree::pending_objects());
+    }
+
+    if (wants("persistence", true)) {
+        const MappedSnapshot *snapshot = this->storage_ptr->get_snapshot();
+        add_section("# Persistence");
+        add_field("mmap_snapshot_keys", snapshot != nullptr ? snapshot->size() : 0);
+        add_field("mmap_snapshot_bytes", snapshot != nullptr ? snapshot->mapped_bytes() : 0);
+    }
+
+    if (wants("stats", true)) {
+        const Stats::Totals totals = Stats::aggregate();
+        add_section("# Stats");
+        add_field("total_connections_received", totals.total_connections_received);
+        add_field("total_commands_processed", totals.total_commands_processed);
+        add_field("instantaneous_ops_per_sec", Stats::instantaneous_ops_per_sec());
+        add_field("total_net_input_bytes", totals.net_input_bytes);
+        add_field("total_net_output_bytes", totals.net_output_bytes);
+        add_field("total_net_repl_output_bytes", totals.net_repl_output_bytes);
+        add_field("sync_full", Replication::full_syncs());
+        add_field("expired_keys", totals.expired_keys);
+        add_field("lazyfreed_objects", LazyFree::freed_objects());
+        add_field("keyspace_hits", totals.keyspace_hits);
+        add_field("keyspace_misses", totals.keyspace_misses);
+        add_field("tracking_total_keys", Tracking::get_keys_count());
+        add_field("tracking_total_items", Tracking::get_items_count());
+        add_field("tracking_total_prefixes", Tracking::get_prefixes_count());
+        add_field("pubsub_channels", PubSub::get_channel_count());
+        add_field("pubsub_patterns", PubSub::get_pattern_count());
+        add_field("client_output_buffer_limit_disconnections", totals.client_output_buffer_limit_disconnections);
+    }
+
+    if (wants("replication", true)) {
+        add_section("# Replication");
+        add_field("role", server_info.replication_info.master_port == -1 ? "master" : "slave");
+        add_field("connected_slaves", server_info.replication_info.replica_connections.size());
+        add_field("master_replid", server_info.replication_info.master_replid);
+        add_field("master_repl_offset", server_info.replication_info.master_repl_offset);
+        add_field("repl_diskless_sync_waiting", Replication::waiting_replicas());
+        add_field("repl_snapshots", Replication::snapshots());
+    }
+
+    if (wants("commandstats", false)) {
+        add_section("# Commandstats");
+        const auto &command_stats = LatencyMonitor::get_command_stats();
+        for (size_t i = 0; i < command_stats.size(); i++) {
+            if (command_stats[i].calls == 0) continue;
+
+            const uint64_t usec = command_stats[i].total_ns / 1000;
+            char buf[128];
+            snprintf(buf, sizeof(buf), "calls=%lu,usec=%lu,usec_per_call=%.2f", command_stats[i].calls, usec,
+                     static_cast<double>(command_stats[i].total_ns) / 1000 / command_stats[i].calls);
+            add_field("cmdstat_" + std::string{command_name(static_cast<CommandType>(i))}, std::string{buf});
+        }
+    }
+
+    if (wants("cluster", true)) {
+        add_section("# Cluster");
+        add_field("cluster_enabled", Cluster::enabled() ? 1 : 0);
+    }
+
+    if (wants("keyspace", true)) {
+        add_section("# Keyspace");
+        if (this->storage_ptr->size() > 0) {
+            add_field("db0", "keys=" + std::to_string(this->storage_ptr->size()) +
+                                 ",expires=" + std::to_string(this->storage_ptr->expires_count()) +
+                                 ",avg_ttl=" + std::to_string(this->storage_ptr->avg_ttl()));
+        }
+    }
+
+    std::string info;
+    for (const std::string &line : lines) {
+        info.append(line);
+        info.append("\r\n");
+    }
+    this->respond_bulk_string(info);
+}
+
 SetCommand::SetCommand(std::string &&key, std::string &&value, TimeStamp &&expire_time)
     : StorageCommand(CommandType::Set),
       key(std::move(key)),
@@ -36,8 +275,7 @@ CommandPtr SetCommand::parse(const DecodedMessage &decoded_msg) {
 
 void SetCommand::execute(ServerInfo &server_info) {
     if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
-        RESPMessage message = MessageParser::encode_simple_error("Cannot write to replica");
-        send(this->client_socket, message.c_str(), message.size(), 0);
+        this->respond_error("Cannot write to replica");
         return;
     }
 
@@ -45,11 +283,14 @@ void SetCommand::execute(ServerInfo &server_info) {
 
     // Replicas should not respond to master during SET propagation
     if (client_socket != server_info.replication_info.master_fd) {
-        RESPMessage message = MessageParser::encode_simple_string("OK");
-        send(this->client_socket, message.c_str(), message.size(), 0);
+        this->respond(SharedReplies::ok);
     }
 }
 
+std::vector<std::string_view> SetCommand::get_keys() const {
+    return {this->key};
+}
+
 GetCommand::GetCommand(std::string &&key) : StorageCommand(CommandType::Get), key(std::move(key)) {}
 
 // Example: GET <key>
@@ -62,71 +303,73 @@ CommandPtr GetCommand::parse(const DecodedMessage &decoded_msg) {
 }
 
 void GetCommand::execute(ServerInfo &server_info) {
-    RESPMessage message;
-
-    try {
-        StorageValueVariants val = this->storage_ptr->get(this->key);
-        message = std::visit(
-            [](const auto &v) -> RESPMessage {
-                using T = std::decay_t<decltype(v)>;
-                if constexpr (std::is_same_v<T, StringValue>) {
-                    return MessageParser::encode_bulk_string(v.get_value());
-                } else if constexpr (std::is_same_v<T, StreamValue>) {
-                    return MessageParser::encode_stream(v.get_value());
-                } else {
-                    static_assert(std::is_same_v<T, StringValue> || std::is_same_v<T, StreamValue>,
-                                  "Unhandled type in variant");
-                    throw std::runtime_error("Unreachable");
-                }
-            },
-            val);
-    } catch (const std::out_of_range &e) {
-        // Catches missing and expired keys
-        message = null_bulk_string;
+    // Strings still in a mapped snapshot are answered from the file, without being loaded
+    if (const std::optional<std::string_view> mapped = this->storage_ptr->find_mapped_string(this->key)) {
+        this->respond_bulk_string(*mapped);
+        return;
+    }
+
+    // Missing and expired keys
+    const StorageValueVariants *val = this->storage_ptr->find(this->key);
+    if (val == nullptr) {
+        this->respond(SharedReplies::null_bulk_string);
+        return;
     }
 
-    send(this->client_socket, message.c_str(), message.size(), 0);
+    std::visit(
+        [this](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, StringValue>) {
+                this->respond_bulk_string(v.get_value_ref());
+            } else if constexpr (std::is_same_v<T, StreamValue>) {
+                this->respond(MessageParser::encode_stream(v.get_value_ref()));
+            } else if constexpr (std::is_same_v<T, HashValue> || std::is_same_v<T, SortedSetValue> ||
+                                 std::is_same_v<T, ListValue>) {
+                this->respond(SharedReplies::wrong_type);
+            } else {
+                static_assert(std::is_same_v<T, StringValue> || std::is_same_v<T, StreamValue> ||
+                                  std::is_same_v<T, HashValue> || std::is_same_v<T, SortedSetValue> ||
+                                  std::is_same_v<T, ListValue>,
+                              "Unhandled type in variant");
+                throw std::runtime_error("Unreachable");
+            }
+        },
+        *val);
+}
+
+std::vector<std::string_view> GetCommand::get_keys() const {
+    return {this->key};
 }
 
-KeysCommand::KeysCommand(std::string &&pattern) : StorageCommand(CommandType::Keys), pattern(std::move(pattern)) {}
+KeysCommand::KeysCommand(GlobPattern &&pattern) : StorageCommand(CommandType::Keys), pattern(std::move(pattern)) {}
 
 /**
  * Example: KEYS <pattern>
  *
- * <pattern> should be "<some-prefix>*", where some-prefix can also be empty, i.e. "*"
+ * <pattern> is a glob pattern: *, ?, [abc], [^abc], [a-z] and \x escapes are supported
  */
 CommandPtr KeysCommand::parse(const DecodedMessage &decoded_msg) {
     if (decoded_msg.size() < 2) {
         throw CommandParseError("Insufficient arguments for KEYS command");
     }
-    std::string pattern = decoded_msg[1];
-    if (pattern.back() == '*') pattern.pop_back();
+    GlobPattern pattern(decoded_msg[1]);
     return std::make_unique<KeysCommand>(std::move(pattern));
 }
 
 void KeysCommand::execute(ServerInfo &server_info) {
-    std::vector<std::string> matching_values;
-    Storage::StoreView store_view = this->storage_ptr->get_view();
+    // Narrow down by the literal prefix first, which can use the prefix index. Expired keys are filtered out by the
+    // store.
+    std::vector<std::string> matching_values = this->storage_ptr->keys(this->pattern.get_literal_prefix());
 
-    for (auto [k, p] : store_view) {
-        // Also check if key has expired
-        if (this->storage_ptr->check_validity(k) && KeysCommand::match(k, this->pattern)) {
-            matching_values.push_back(k);
-        }
+    if (!this->pattern.is_prefix_only()) {
+        std::erase_if(matching_values, [this](const std::string &key) { return !this->pattern.match(key); });
     }
 
-    RESPMessage encoded_message = MessageParser::encode_array(matching_values);
-    send(client_socket, encoded_message.c_str(), encoded_message.size(), 0);
-}
-
-bool KeysCommand::match(const std::string &target, const std::string &pattern) {
-    return target.compare(0, pattern.size(), pattern) == 0;
+    this->respond_with([&matching_values](std::string &out) { MessageParser::append_array(out, matching_values); });
 }
 
 TypeCommand::TypeCommand(std::string &&key) : StorageCommand(CommandType::Type), key(std::move(key)) {}
 
-std::string TypeCommand::missing_key_type = MessageParser::encode_simple_string("none");
-
 // Example: TYPE <key>
 CommandPtr TypeCommand::parse(const DecodedMessage &decoded_msg) {
     if (decoded_msg.size() < 2) {
@@ -137,34 +380,38 @@ CommandPtr TypeCommand::parse(const DecodedMessage &decoded_msg) {
 }
 
 void TypeCommand::execute(ServerInfo &server_info) {
-    RESPMessage message;
-
-    if (!this->storage_ptr->check_validity(this->key)) {
-        message = TypeCommand::missing_key_type;
-    } else {
-        try {
-            StorageValueVariants val = this->storage_ptr->get(this->key);
-            message = std::visit(
-                [](const auto &v) -> RESPMessage {
-                    using T = std::decay_t<decltype(v)>;
-                    if constexpr (std::is_same_v<T, StringValue>) {
-                        return MessageParser::encode_simple_string("string");
-                    } else if constexpr (std::is_same_v<T, StreamValue>) {
-                        return MessageParser::encode_simple_string("stream");
-                    } else {
-                        static_assert(std::is_same_v<T, StringValue> || std::is_same_v<T, StreamValue>,
-                                      "Unhandled type in variant");
-                        throw std::runtime_error("Unreachable");
-                    }
-                },
-                val);
-        } catch (const std::out_of_range &e) {
-            ERROR("Error getting key from store" << e.what());
-            message = TypeCommand::missing_key_type;
-        }
+    const StorageValueVariants *val = this->storage_ptr->find(this->key);
+    if (val == nullptr) {
+        this->respond(TypeCommand::missing_key_type);
+        return;
     }
 
-    send(this->client_socket, message.c_str(), message.size(), 0);
+    std::visit(
+        [this](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, StringValue>) {
+                this->respond(TypeCommand::string_type);
+            } else if constexpr (std::is_same_v<T, StreamValue>) {
+                this->respond(TypeCommand::stream_type);
+            } else if constexpr (std::is_same_v<T, HashValue>) {
+                this->respond(TypeCommand::hash_type);
+            } else if constexpr (std::is_same_v<T, SortedSetValue>) {
+                this->respond(TypeCommand::zset_type);
+            } else if constexpr (std::is_same_v<T, ListValue>) {
+                this->respond(TypeCommand::list_type);
+            } else {
+                static_assert(std::is_same_v<T, StringValue> || std::is_same_v<T, StreamValue> ||
+                                  std::is_same_v<T, HashValue> || std::is_same_v<T, SortedSetValue> ||
+                                  std::is_same_v<T, ListValue>,
+                              "Unhandled type in variant");
+                throw std::runtime_error("Unreachable");
+            }
+        },
+        *val);
+}
+
+std::vector<std::string_view> TypeCommand::get_keys() const {
+    return {this->key};
 }
 
 XAddCommand::XAddCommand(std::string &&stream_key, std::string &&stream_id,
@@ -205,6 +452,1545 @@ CommandPtr XAddCommand::parse(const DecodedMessage &decoded_msg) {
 void XAddCommand::execute(ServerInfo &server_info) {
     this->storage_ptr->set(this->stream_key, StorageValue(this->stream, std::nullopt));
 
-    RESPMessage message = MessageParser::encode_bulk_string(this->stream_id);
-    send(this->client_socket, message.c_str(), message.size(), 0);
+    this->respond_bulk_string(this->stream_id);
+}
+
+std::vector<std::string_view> XAddCommand::get_keys() const {
+    return {this->stream_key};
+}
+
+MGetCommand::MGetCommand(std::vector<std::string> &&keys) : StorageCommand(CommandType::MGet), keys(std::move(keys)) {}
+
+// Example: MGET <key> [<key> ...]
+CommandPtr MGetCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for MGET command");
+    }
+    std::vector<std::string> keys(decoded_msg.begin() + 1, decoded_msg.end());
+    return std::make_unique<MGetCommand>(std::move(keys));
+}
+
+void MGetCommand::execute(ServerInfo &server_info) {
+    // Pass 1: hash all keys and prefetch their buckets
+    this->storage_ptr->prefetch(this->keys);
+
+    // Pass 2: look up every key, encoding each value straight into the reply buffer
+    this->respond_with([this](std::string &out) {
+        MessageParser::append_array_header(out, this->keys.size());
+        for (const std::string &key : this->keys) {
+            if (const std::optional<std::string_view> mapped = this->storage_ptr->find_mapped_string(key)) {
+                MessageParser::append_bulk_string(out, *mapped);
+                continue;
+            }
+            const StorageValueVariants *val = this->storage_ptr->find(key);
+            const StringValue *string_value = val != nullptr ? std::get_if<StringValue>(val) : nullptr;
+
+            // Non-string values are reported as missing, like Redis
+            if (string_value != nullptr) {
+                MessageParser::append_bulk_string(out, string_value->get_value_ref());
+            } else {
+                out.append(SharedReplies::null_bulk_string);
+            }
+        }
+    });
+}
+
+std::vector<std::string_view> MGetCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
+}
+
+MSetCommand::MSetCommand(std::vector<std::string> &&keys, std::vector<std::string> &&values)
+    : StorageCommand(CommandType::MSet), keys(std::move(keys)), values(std::move(values)) {}
+
+// Example: MSET <key> <value> [<key> <value> ...]
+CommandPtr MSetCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3 || decoded_msg.size() % 2 == 0) {
+        throw CommandParseError("Invalid number of key-value pair inputs to MSET command");
+    }
+
+    std::vector<std::string> keys, values;
+    keys.reserve(decoded_msg.size() / 2);
+    values.reserve(decoded_msg.size() / 2);
+    for (int i = 1; i < decoded_msg.size(); i += 2) {
+        keys.push_back(decoded_msg[i]);
+        values.push_back(decoded_msg[i + 1]);
+    }
+    return std::make_unique<MSetCommand>(std::move(keys), std::move(values));
+}
+
+void MSetCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    this->storage_ptr->prefetch(this->keys);
+
+    for (int i = 0; i < this->keys.size(); i++) {
+        this->storage_ptr->set(this->keys[i], StringValue(this->values[i], std::nullopt));
+    }
+
+    // Replicas should not respond to master during MSET propagation
+    if (client_socket != server_info.replication_info.master_fd) {
+        this->respond(SharedReplies::ok);
+    }
+}
+
+std::vector<std::string_view> MSetCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
+}
+
+DelCommand::DelCommand(CommandType type, std::vector<std::string> &&keys)
+    : StorageCommand(type), keys(std::move(keys)) {}
+
+// Example: DEL <key> [<key> ...], UNLINK <key> [<key> ...]
+CommandPtr DelCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for DEL command");
+    }
+
+    std::string command = decoded_msg[0];
+    std::transform(command.begin(), command.end(), command.begin(), toupper);
+    const CommandType type = command == "UNLINK" ? CommandType::Unlink : CommandType::Del;
+    std::vector<std::string> keys(decoded_msg.begin() + 1, decoded_msg.end());
+    return std::make_unique<DelCommand>(type, std::move(keys));
+}
+
+void DelCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    this->storage_ptr->prefetch(this->keys);
+
+    const bool lazy = this->type == CommandType::Unlink || LazyFree::lazy_user_del;
+    int deleted = 0;
+    for (const std::string &key : this->keys) {
+        deleted += lazy ? this->storage_ptr->unlink(key) : this->storage_ptr->erase(key);
+    }
+
+    // Replicas should not respond to master during DEL propagation
+    if (client_socket != server_info.replication_info.master_fd) {
+        this->respond_integer(deleted);
+    }
+}
+
+std::vector<std::string_view> DelCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
+}
+
+FlushCommand::FlushCommand(CommandType type, bool async) : StorageCommand(type), async(async) {}
+
+// Example: FLUSHALL [ASYNC | SYNC], FLUSHDB [ASYNC | SYNC]
+CommandPtr FlushCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() > 2) {
+        throw CommandParseError("Too many arguments for FLUSHALL command");
+    }
+
+    std::string command = decoded_msg[0];
+    std::transform(command.begin(), command.end(), command.begin(), toupper);
+    const CommandType type = command == "FLUSHDB" ? CommandType::FlushDb : CommandType::FlushAll;
+
+    bool async = LazyFree::lazy_user_flush;
+    if (decoded_msg.size() == 2) {
+        std::string mode = decoded_msg[1];
+        std::transform(mode.begin(), mode.end(), mode.begin(), toupper);
+        if (mode != "ASYNC" && mode != "SYNC") {
+            throw CommandParseError("syntax error");
+        }
+        async = mode == "ASYNC";
+    }
+    return std::make_unique<FlushCommand>(type, async);
+}
+
+void FlushCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    this->storage_ptr->flush(this->async);
+
+    if (client_socket != server_info.replication_info.master_fd) {
+        this->respond(SharedReplies::ok);
+    }
+}
+
+SaveCommand::SaveCommand() : StorageCommand(CommandType::Save) {}
+
+// Example: SAVE
+CommandPtr SaveCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() > 1) {
+        throw CommandParseError("Too many arguments for SAVE command");
+    }
+    return std::make_unique<SaveCommand>();
+}
+
+// Blocks the event loop until the file is written, like SAVE in Redis
+void SaveCommand::execute(ServerInfo &server_info) {
+    const long long saved =
+        server_info.mmap_snapshot.empty()
+            ? RDBWriter::save(*this->storage_ptr, server_info.data_path(server_info.rdb_filename()))
+            : MappedSnapshot::save(*this->storage_ptr, server_info.data_path(server_info.mmap_snapshot));
+    if (saved < 0) {
+        this->respond_error("ERR Failed to save, see the server log");
+        return;
+    }
+    this->respond(SharedReplies::ok);
+}
+
+ExistsCommand::ExistsCommand(std::vector<std::string> &&keys)
+    : StorageCommand(CommandType::Exists), keys(std::move(keys)) {}
+
+// Example: EXISTS <key> [<key> ...], a key given twice is counted twice
+CommandPtr ExistsCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for EXISTS command");
+    }
+    std::vector<std::string> keys(decoded_msg.begin() + 1, decoded_msg.end());
+    return std::make_unique<ExistsCommand>(std::move(keys));
+}
+
+void ExistsCommand::execute(ServerInfo &server_info) {
+    this->storage_ptr->prefetch(this->keys);
+
+    int found = 0;
+    for (const std::string &key : this->keys) {
+        found += this->storage_ptr->find(key) != nullptr;
+    }
+
+    this->respond_integer(found);
+}
+
+std::vector<std::string_view> ExistsCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
+}
+
+HSetCommand::HSetCommand(std::string &&key, std::vector<std::pair<std::string, std::string>> &&fields)
+    : StorageCommand(CommandType::HSet), key(std::move(key)), fields(std::move(fields)) {}
+
+// Example: HSET <key> <field> <value> [<field> <value> ...]
+CommandPtr HSetCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4 || decoded_msg.size() % 2 == 1) {
+        throw CommandParseError("Invalid number of field-value pair inputs to HSET command");
+    }
+
+    std::string key = decoded_msg[1];
+    std::vector<std::pair<std::string, std::string>> fields;
+    fields.reserve(decoded_msg.size() / 2 - 1);
+    for (int i = 2; i < decoded_msg.size(); i += 2) {
+        fields.emplace_back(decoded_msg[i], decoded_msg[i + 1]);
+    }
+    return std::make_unique<HSetCommand>(std::move(key), std::move(fields));
+}
+
+void HSetCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    Hash *hash = find_value_for_write<Hash>(*this->storage_ptr, this->key, true, wrong_type);
+    if (hash == nullptr) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    int added = 0;
+    for (const auto &[field, value] : this->fields) {
+        added += hash->set(field, value);
+    }
+    this->storage_ptr->modified(this->key);
+
+    // Replicas should not respond to master during HSET propagation
+    if (!from_master) {
+        this->respond_integer(added);
+    }
+}
+
+std::vector<std::string_view> HSetCommand::get_keys() const {
+    return {this->key};
+}
+
+HGetCommand::HGetCommand(std::string &&key, std::string &&field)
+    : StorageCommand(CommandType::HGet), key(std::move(key)), field(std::move(field)) {}
+
+// Example: HGET <key> <field>
+CommandPtr HGetCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for HGET command");
+    }
+    std::string key = decoded_msg[1];
+    std::string field = decoded_msg[2];
+    return std::make_unique<HGetCommand>(std::move(key), std::move(field));
+}
+
+void HGetCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const Hash *hash = find_value<Hash>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    const std::optional<std::string_view> value = hash != nullptr ? hash->get(this->field) : std::nullopt;
+    if (!value.has_value()) {
+        this->respond(SharedReplies::null_bulk_string);
+        return;
+    }
+    this->respond_bulk_string(*value);
+}
+
+std::vector<std::string_view> HGetCommand::get_keys() const {
+    return {this->key};
+}
+
+HMGetCommand::HMGetCommand(std::string &&key, std::vector<std::string> &&fields)
+    : StorageCommand(CommandType::HMGet), key(std::move(key)), fields(std::move(fields)) {}
+
+// Example: HMGET <key> <field> [<field> ...]
+CommandPtr HMGetCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for HMGET command");
+    }
+    std::string key = decoded_msg[1];
+    std::vector<std::string> fields(decoded_msg.begin() + 2, decoded_msg.end());
+    return std::make_unique<HMGetCommand>(std::move(key), std::move(fields));
+}
+
+void HMGetCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const Hash *hash = find_value<Hash>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    this->respond_with([this, hash](std::string &out) {
+        MessageParser::append_array_header(out, this->fields.size());
+        for (const std::string &field : this->fields) {
+            const std::optional<std::string_view> value = hash != nullptr ? hash->get(field) : std::nullopt;
+            if (value.has_value()) {
+                MessageParser::append_bulk_string(out, *value);
+            } else {
+                out.append(SharedReplies::null_bulk_string);
+            }
+        }
+    });
+}
+
+std::vector<std::string_view> HMGetCommand::get_keys() const {
+    return {this->key};
+}
+
+HDelCommand::HDelCommand(std::string &&key, std::vector<std::string> &&fields)
+    : StorageCommand(CommandType::HDel), key(std::move(key)), fields(std::move(fields)) {}
+
+// Example: HDEL <key> <field> [<field> ...]
+CommandPtr HDelCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for HDEL command");
+    }
+    std::string key = decoded_msg[1];
+    std::vector<std::string> fields(decoded_msg.begin() + 2, decoded_msg.end());
+    return std::make_unique<HDelCommand>(std::move(key), std::move(fields));
+}
+
+void HDelCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    Hash *hash = find_value_for_write<Hash>(*this->storage_ptr, this->key, false, wrong_type);
+    if (wrong_type) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    int deleted = 0;
+    if (hash != nullptr) {
+        for (const std::string &field : this->fields) {
+            deleted += hash->erase(field);
+        }
+
+        // Empty hashes do not exist, like in Redis
+        if (hash->size() == 0) {
+            this->storage_ptr->erase(this->key);
+        } else if (deleted > 0) {
+            this->storage_ptr->modified(this->key);
+        }
+    }
+
+    // Replicas should not respond to master during HDEL propagation
+    if (!from_master) {
+        this->respond_integer(deleted);
+    }
+}
+
+std::vector<std::string_view> HDelCommand::get_keys() const {
+    return {this->key};
+}
+
+HGetAllCommand::HGetAllCommand(std::string &&key) : StorageCommand(CommandType::HGetAll), key(std::move(key)) {}
+
+// Example: HGETALL <key>
+CommandPtr HGetAllCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for HGETALL command");
+    }
+    std::string key = decoded_msg[1];
+    return std::make_unique<HGetAllCommand>(std::move(key));
+}
+
+void HGetAllCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const Hash *hash = find_value<Hash>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+    if (hash == nullptr) {
+        this->respond(SharedReplies::empty_array);
+        return;
+    }
+
+    this->respond_with([hash](std::string &out) {
+        MessageParser::append_array_header(out, hash->size() * 2);
+        hash->for_each([&out](std::string_view field, std::string_view value) {
+            MessageParser::append_bulk_string(out, field);
+            MessageParser::append_bulk_string(out, value);
+        });
+    });
+}
+
+std::vector<std::string_view> HGetAllCommand::get_keys() const {
+    return {this->key};
+}
+
+HIncrByCommand::HIncrByCommand(std::string &&key, std::string &&field, long long increment)
+    : StorageCommand(CommandType::HIncrBy), key(std::move(key)), field(std::move(field)), increment(increment) {}
+
+// Example: HINCRBY <key> <field> <increment>
+CommandPtr HIncrByCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4) {
+        throw CommandParseError("Insufficient arguments for HINCRBY command");
+    }
+
+    long long increment;
+    if (!parse_integer(decoded_msg[3], increment)) {
+        throw CommandParseError("value is not an integer or out of range");
+    }
+
+    std::string key = decoded_msg[1];
+    std::string field = decoded_msg[2];
+    return std::make_unique<HIncrByCommand>(std::move(key), std::move(field), increment);
+}
+
+void HIncrByCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    Hash *hash = find_value_for_write<Hash>(*this->storage_ptr, this->key, true, wrong_type);
+    if (hash == nullptr) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    long long current = 0;
+    if (const std::optional<std::string_view> value = hash->get(this->field); value.has_value()) {
+        if (!parse_integer(*value, current)) {
+            if (!from_master) this->respond_error("ERR hash value is not an integer");
+            return;
+        }
+    }
+
+    long long updated;
+    if (__builtin_add_overflow(current, this->increment, &updated)) {
+        if (!from_master) this->respond_error("ERR increment or decrement would overflow");
+        return;
+    }
+
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), updated);
+    hash->set(this->field, std::string_view(buf, end - buf));
+    this->storage_ptr->modified(this->key);
+
+    // Replicas should not respond to master during HINCRBY propagation
+    if (!from_master) {
+        this->respond_integer(updated);
+    }
+}
+
+std::vector<std::string_view> HIncrByCommand::get_keys() const {
+    return {this->key};
+}
+
+ZAddCommand::ZAddCommand(std::string &&key, Options &&options, std::vector<std::pair<double, std::string>> &&members)
+    : StorageCommand(CommandType::ZAdd),
+      key(std::move(key)),
+      options(std::move(options)),
+      members(std::move(members)) {}
+
+// Example: ZADD <key> [NX | XX] [GT | LT] [CH] <score> <member> [<score> <member> ...]
+CommandPtr ZAddCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4) {
+        throw CommandParseError("Insufficient arguments for ZADD command");
+    }
+
+    std::string key = decoded_msg[1];
+    Options options;
+    int i = 2;
+    for (; i < decoded_msg.size(); i++) {
+        std::string option = decoded_msg[i];
+        std::transform(option.begin(), option.end(), option.begin(), toupper);
+        if (option == "NX") {
+            options.nx = true;
+        } else if (option == "XX") {
+            options.xx = true;
+        } else if (option == "GT") {
+            options.gt = true;
+        } else if (option == "LT") {
+            options.lt = true;
+        } else if (option == "CH") {
+            options.ch = true;
+        } else {
+            break;
+        }
+    }
+
+    if (options.nx && options.xx) {
+        throw CommandParseError("XX and NX options at the same time are not compatible");
+    }
+    if ((options.gt && options.lt) || (options.nx && (options.gt || options.lt))) {
+        throw CommandParseError("GT, LT, and/or NX options at the same time are not compatible");
+    }
+    if (i == decoded_msg.size() || (decoded_msg.size() - i) % 2 == 1) {
+        throw CommandParseError("Invalid number of score-member pair inputs to ZADD command");
+    }
+
+    std::vector<std::pair<double, std::string>> members;
+    members.reserve((decoded_msg.size() - i) / 2);
+    for (; i < decoded_msg.size(); i += 2) {
+        double score;
+        if (!parse_score(decoded_msg[i], score)) {
+            throw CommandParseError("value is not a valid float");
+        }
+        members.emplace_back(score, decoded_msg[i + 1]);
+    }
+    return std::make_unique<ZAddCommand>(std::move(key), std::move(options), std::move(members));
+}
+
+void ZAddCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    SortedSet *set = find_value_for_write<SortedSet>(*this->storage_ptr, this->key, !this->options.xx, wrong_type);
+    if (wrong_type) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    int added = 0, updated = 0;
+    if (set != nullptr) {
+        for (const auto &[score, member] : this->members) {
+            const std::optional<double> current = set->score(member);
+            if (current.has_value()) {
+                if (this->options.nx || *current == score) continue;
+                if ((this->options.gt && score < *current) || (this->options.lt && score > *current)) continue;
+                set->add(member, score);
+                updated++;
+            } else if (!this->options.xx) {
+                set->add(member, score);
+                added++;
+            }
+        }
+
+        if (added + updated > 0) {
+            this->storage_ptr->modified(this->key);
+        }
+    }
+
+    // Replicas should not respond to master during ZADD propagation
+    if (!from_master) {
+        this->respond_integer(this->options.ch ? added + updated : added);
+    }
+}
+
+std::vector<std::string_view> ZAddCommand::get_keys() const {
+    return {this->key};
+}
+
+ZScoreCommand::ZScoreCommand(std::string &&key, std::string &&member)
+    : StorageCommand(CommandType::ZScore), key(std::move(key)), member(std::move(member)) {}
+
+// Example: ZSCORE <key> <member>
+CommandPtr ZScoreCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for ZSCORE command");
+    }
+    std::string key = decoded_msg[1];
+    std::string member = decoded_msg[2];
+    return std::make_unique<ZScoreCommand>(std::move(key), std::move(member));
+}
+
+void ZScoreCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const SortedSet *set = find_value<SortedSet>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    const std::optional<double> score = set != nullptr ? set->score(this->member) : std::nullopt;
+    if (!score.has_value()) {
+        this->respond(SharedReplies::null_bulk_string);
+        return;
+    }
+    this->respond_with([&score](std::string &out) { append_score(out, *score); });
+}
+
+std::vector<std::string_view> ZScoreCommand::get_keys() const {
+    return {this->key};
+}
+
+ZRangeCommand::ZRangeCommand(std::string &&key, long long start, long long stop, bool with_scores)
+    : StorageCommand(CommandType::ZRange), key(std::move(key)), start(start), stop(stop), with_scores(with_scores) {}
+
+/**
+ * Example: ZRANGE <key> <start> <stop> [WITHSCORES]
+ *
+ * start and stop are inclusive ranks, negative ones count from the highest score (-1 is the last member)
+ */
+CommandPtr ZRangeCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4) {
+        throw CommandParseError("Insufficient arguments for ZRANGE command");
+    }
+
+    long long start, stop;
+    if (!parse_integer(decoded_msg[2], start) || !parse_integer(decoded_msg[3], stop)) {
+        throw CommandParseError("value is not an integer or out of range");
+    }
+
+    bool with_scores = false;
+    if (decoded_msg.size() > 4) {
+        std::string option = decoded_msg[4];
+        std::transform(option.begin(), option.end(), option.begin(), toupper);
+        if (option != "WITHSCORES" || decoded_msg.size() > 5) {
+            throw CommandParseError("Unsupported option for ZRANGE command");
+        }
+        with_scores = true;
+    }
+
+    std::string key = decoded_msg[1];
+    return std::make_unique<ZRangeCommand>(std::move(key), start, stop, with_scores);
+}
+
+void ZRangeCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const SortedSet *set = find_value<SortedSet>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    const long long size = set != nullptr ? set->size() : 0;
+    long long start = this->start < 0 ? this->start + size : this->start;
+    long long stop = this->stop < 0 ? this->stop + size : this->stop;
+    start = std::max(start, 0LL);
+    stop = std::min(stop, size - 1);
+    if (start > stop) {
+        this->respond(SharedReplies::empty_array);
+        return;
+    }
+
+    this->respond_with([this, set, start, stop](std::string &out) {
+        MessageParser::append_array_header(out, (stop - start + 1) * (this->with_scores ? 2 : 1));
+        set->for_range(start, stop + 1, [this, &out](std::string_view member, double score) {
+            MessageParser::append_bulk_string(out, member);
+            if (this->with_scores) append_score(out, score);
+        });
+    });
+}
+
+std::vector<std::string_view> ZRangeCommand::get_keys() const {
+    return {this->key};
+}
+
+ZRangeByScoreCommand::ZRangeByScoreCommand(std::string &&key, Bound min, Bound max, bool with_scores,
+                                           long long offset, long long count)
+    : StorageCommand(CommandType::ZRangeByScore),
+      key(std::move(key)),
+      min(min),
+      max(max),
+      with_scores(with_scores),
+      offset(offset),
+      count(count) {}
+
+/**
+ * Example: ZRANGEBYSCORE <key> <min> <max> [WITHSCORES] [LIMIT <offset> <count>]
+ *
+ * min and max are inclusive unless prefixed with '(', and can be -inf / +inf
+ */
+CommandPtr ZRangeByScoreCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4) {
+        throw CommandParseError("Insufficient arguments for ZRANGEBYSCORE command");
+    }
+
+    auto parse_bound = [](std::string_view arg) {
+        Bound bound{0, !arg.empty() && arg[0] == '('};
+        if (bound.exclusive) arg.remove_prefix(1);
+        if (!parse_score(arg, bound.score)) {
+            throw CommandParseError("min or max is not a float");
+        }
+        return bound;
+    };
+    const Bound min = parse_bound(decoded_msg[2]);
+    const Bound max = parse_bound(decoded_msg[3]);
+
+    bool with_scores = false;
+    long long offset = 0, count = -1;
+    for (int i = 4; i < decoded_msg.size(); i++) {
+        std::string option = decoded_msg[i];
+        std::transform(option.begin(), option.end(), option.begin(), toupper);
+        if (option == "WITHSCORES") {
+            with_scores = true;
+        } else if (option == "LIMIT" && i + 2 < decoded_msg.size()) {
+            if (!parse_integer(decoded_msg[i + 1], offset) || !parse_integer(decoded_msg[i + 2], count)) {
+                throw CommandParseError("value is not an integer or out of range");
+            }
+            i += 2;
+        } else {
+            throw CommandParseError("Unsupported option for ZRANGEBYSCORE command");
+        }
+    }
+
+    std::string key = decoded_msg[1];
+    return std::make_unique<ZRangeByScoreCommand>(std::move(key), min, max, with_scores, offset, count);
+}
+
+void ZRangeByScoreCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const SortedSet *set = find_value<SortedSet>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+    if (set == nullptr || this->offset < 0) {
+        this->respond(SharedReplies::empty_array);
+        return;
+    }
+
+    // Both ends are found by rank, so the reply size is known before walking the range
+    size_t start = set->count_below(this->min.score, this->min.exclusive);
+    size_t stop = set->count_below(this->max.score, !this->max.exclusive);
+    start += this->offset;
+    if (this->count >= 0) {
+        stop = std::min<size_t>(stop, start + this->count);
+    }
+    if (start >= stop) {
+        this->respond(SharedReplies::empty_array);
+        return;
+    }
+
+    this->respond_with([this, set, start, stop](std::string &out) {
+        MessageParser::append_array_header(out, (stop - start) * (this->with_scores ? 2 : 1));
+        set->for_range(start, stop, [this, &out](std::string_view member, double score) {
+            MessageParser::append_bulk_string(out, member);
+            if (this->with_scores) append_score(out, score);
+        });
+    });
+}
+
+std::vector<std::string_view> ZRangeByScoreCommand::get_keys() const {
+    return {this->key};
+}
+
+ZRankCommand::ZRankCommand(std::string &&key, std::string &&member)
+    : StorageCommand(CommandType::ZRank), key(std::move(key)), member(std::move(member)) {}
+
+// Example: ZRANK <key> <member>
+CommandPtr ZRankCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for ZRANK command");
+    }
+    std::string key = decoded_msg[1];
+    std::string member = decoded_msg[2];
+    return std::make_unique<ZRankCommand>(std::move(key), std::move(member));
+}
+
+void ZRankCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const SortedSet *set = find_value<SortedSet>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    const std::optional<size_t> rank = set != nullptr ? set->rank(this->member) : std::nullopt;
+    if (!rank.has_value()) {
+        this->respond(SharedReplies::null_bulk_string);
+        return;
+    }
+    this->respond_integer(*rank);
+}
+
+std::vector<std::string_view> ZRankCommand::get_keys() const {
+    return {this->key};
+}
+
+ZPopMinCommand::ZPopMinCommand(std::string &&key, long long count)
+    : StorageCommand(CommandType::ZPopMin), key(std::move(key)), count(count) {}
+
+// Example: ZPOPMIN <key> [count]
+CommandPtr ZPopMinCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for ZPOPMIN command");
+    }
+
+    long long count = 1;
+    if (decoded_msg.size() > 2 && (!parse_integer(decoded_msg[2], count) || count < 0)) {
+        throw CommandParseError("value is out of range, must be positive");
+    }
+
+    std::string key = decoded_msg[1];
+    return std::make_unique<ZPopMinCommand>(std::move(key), count);
+}
+
+void ZPopMinCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    SortedSet *set = find_value_for_write<SortedSet>(*this->storage_ptr, this->key, false, wrong_type);
+    if (wrong_type) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    // Copied out first, since erasing invalidates the views for_range hands out
+    std::vector<std::pair<std::string, double>> popped;
+    if (set != nullptr && this->count > 0) {
+        set->for_range(0, this->count, [&popped](std::string_view member, double score) {
+            popped.emplace_back(member, score);
+        });
+        for (const auto &[member, score] : popped) {
+            set->erase(member);
+        }
+
+        // Empty sorted sets do not exist, like in Redis
+        if (set->size() == 0) {
+            this->storage_ptr->erase(this->key);
+        } else {
+            this->storage_ptr->modified(this->key);
+        }
+    }
+
+    // Replicas should not respond to master during ZPOPMIN propagation
+    if (!from_master) {
+        this->respond_with([&popped](std::string &out) {
+            MessageParser::append_array_header(out, popped.size() * 2);
+            for (const auto &[member, score] : popped) {
+                MessageParser::append_bulk_string(out, member);
+                append_score(out, score);
+            }
+        });
+    }
+}
+
+std::vector<std::string_view> ZPopMinCommand::get_keys() const {
+    return {this->key};
+}
+
+ListPushCommand::ListPushCommand(CommandType type, std::string &&key, std::vector<std::string> &&elements)
+    : StorageCommand(type), key(std::move(key)), elements(std::move(elements)) {}
+
+// Example: LPUSH <key> <element> [<element> ...], or RPUSH
+CommandPtr ListPushCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for LPUSH/RPUSH command");
+    }
+
+    const CommandType type = toupper(decoded_msg[0][0]) == 'L' ? CommandType::LPush : CommandType::RPush;
+    std::string key = decoded_msg[1];
+    std::vector<std::string> elements(decoded_msg.begin() + 2, decoded_msg.end());
+    return std::make_unique<ListPushCommand>(type, std::move(key), std::move(elements));
+}
+
+void ListPushCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    QuickList *list = find_value_for_write<QuickList>(*this->storage_ptr, this->key, true, wrong_type);
+    if (list == nullptr) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    for (const std::string &element : this->elements) {
+        if (this->type == CommandType::LPush) {
+            list->push_front(element);
+        } else {
+            list->push_back(element);
+        }
+    }
+    const size_t size = list->size();
+    this->storage_ptr->modified(this->key);
+    Blocking::signal_key(this->key);
+
+    // Replicas should not respond to master during LPUSH/RPUSH propagation
+    if (!from_master) {
+        this->respond_integer(size);
+    }
+}
+
+std::vector<std::string_view> ListPushCommand::get_keys() const {
+    return {this->key};
+}
+
+ListPopCommand::ListPopCommand(CommandType type, std::string &&key, std::optional<long long> count)
+    : StorageCommand(type), key(std::move(key)), count(count) {}
+
+// Example: LPOP <key> [count], or RPOP
+CommandPtr ListPopCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for LPOP/RPOP command");
+    }
+
+    std::optional<long long> count;
+    if (decoded_msg.size() > 2) {
+        long long num;
+        if (!parse_integer(decoded_msg[2], num) || num < 0) {
+            throw CommandParseError("value is out of range, must be positive");
+        }
+        count = num;
+    }
+
+    const CommandType type = toupper(decoded_msg[0][0]) == 'L' ? CommandType::LPop : CommandType::RPop;
+    std::string key = decoded_msg[1];
+    return std::make_unique<ListPopCommand>(type, std::move(key), count);
+}
+
+void ListPopCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool from_master = this->client_socket == server_info.replication_info.master_fd;
+    bool wrong_type;
+    QuickList *list = find_value_for_write<QuickList>(*this->storage_ptr, this->key, false, wrong_type);
+    if (wrong_type) {
+        if (!from_master) this->respond(SharedReplies::wrong_type);
+        return;
+    }
+    if (list == nullptr) {
+        if (!from_master) {
+            this->respond(this->count.has_value() ? SharedReplies::null_array : SharedReplies::null_bulk_string);
+        }
+        return;
+    }
+
+    std::vector<std::string> popped;
+    for (long long i = 0; i < this->count.value_or(1) && list->size() > 0; i++) {
+        popped.push_back(this->type == CommandType::LPop ? *list->pop_front() : *list->pop_back());
+    }
+
+    // Empty lists do not exist, like in Redis
+    if (list->size() == 0) {
+        this->storage_ptr->erase(this->key);
+    } else if (!popped.empty()) {
+        this->storage_ptr->modified(this->key);
+    }
+
+    // Replicas should not respond to master during LPOP/RPOP propagation
+    if (from_master) return;
+    if (!this->count.has_value()) {
+        this->respond_bulk_string(popped.front());
+        return;
+    }
+    this->respond_with([&popped](std::string &out) { MessageParser::append_array(out, popped); });
+}
+
+std::vector<std::string_view> ListPopCommand::get_keys() const {
+    return {this->key};
+}
+
+BlockingListPopCommand::BlockingListPopCommand(CommandType type, std::vector<std::string> &&keys,
+                                               Blocking::Deadline deadline)
+    : StorageCommand(type), keys(std::move(keys)), deadline(deadline) {}
+
+/**
+ * Example: BLPOP <key> [<key> ...] <timeout>, or BRPOP
+ *
+ * timeout is in seconds and may be fractional, 0 blocks forever
+ */
+CommandPtr BlockingListPopCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 3) {
+        throw CommandParseError("Insufficient arguments for BLPOP/BRPOP command");
+    }
+
+    double timeout;
+    auto [end, ec] = std::from_chars(decoded_msg.back().data(), decoded_msg.back().data() + decoded_msg.back().size(),
+                                     timeout);
+    if (ec != std::errc() || end != decoded_msg.back().data() + decoded_msg.back().size() || !std::isfinite(timeout)) {
+        throw CommandParseError("timeout is not a float or out of range");
+    }
+    if (timeout < 0) {
+        throw CommandParseError("timeout is negative");
+    }
+
+    Blocking::Deadline deadline;
+    if (timeout > 0) {
+        const std::chrono::duration<double> seconds(timeout);
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(seconds);
+    }
+
+    const CommandType type = toupper(decoded_msg[0][1]) == 'L' ? CommandType::BLPop : CommandType::BRPop;
+    std::vector<std::string> keys(decoded_msg.begin() + 1, decoded_msg.end() - 1);
+    return std::make_unique<BlockingListPopCommand>(type, std::move(keys), deadline);
+}
+
+void BlockingListPopCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    const bool left = this->type == CommandType::BLPop;
+    for (const std::string &key : this->keys) {
+        bool wrong_type;
+        QuickList *list = find_value_for_write<QuickList>(*this->storage_ptr, key, false, wrong_type);
+        if (wrong_type) {
+            this->respond(SharedReplies::wrong_type);
+            return;
+        }
+        if (list == nullptr) continue;
+
+        const std::string element = left ? *list->pop_front() : *list->pop_back();
+        if (list->size() == 0) {
+            this->storage_ptr->erase(key);
+        } else {
+            this->storage_ptr->modified(key);
+        }
+
+        // Replicas only see the pop, they never block
+        propagate_command(MessageParser::encode_array({left ? "LPOP" : "RPOP", key}), server_info);
+        this->respond_with([&key, &element](std::string &out) {
+            MessageParser::append_array_header(out, 2);
+            MessageParser::append_bulk_string(out, key);
+            MessageParser::append_bulk_string(out, element);
+        });
+        return;
+    }
+
+    // The master link must never stop, replicas are sent the pops instead anyway
+    if (this->client_socket == server_info.replication_info.master_fd) return;
+
+    // The reply is sent once an element is pushed or the timeout passes
+    Blocking::block(this->client_socket, std::move(this->keys), left ? Blocking::Side::Left : Blocking::Side::Right,
+                    this->deadline);
+}
+
+std::vector<std::string_view> BlockingListPopCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
+}
+
+LRangeCommand::LRangeCommand(std::string &&key, long long start, long long stop)
+    : StorageCommand(CommandType::LRange), key(std::move(key)), start(start), stop(stop) {}
+
+/**
+ * Example: LRANGE <key> <start> <stop>
+ *
+ * start and stop are inclusive indexes, negative ones count from the tail (-1 is the last element)
+ */
+CommandPtr LRangeCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 4) {
+        throw CommandParseError("Insufficient arguments for LRANGE command");
+    }
+
+    long long start, stop;
+    if (!parse_integer(decoded_msg[2], start) || !parse_integer(decoded_msg[3], stop)) {
+        throw CommandParseError("value is not an integer or out of range");
+    }
+
+    std::string key = decoded_msg[1];
+    return std::make_unique<LRangeCommand>(std::move(key), start, stop);
+}
+
+void LRangeCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const QuickList *list = find_value<QuickList>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+
+    const long long size = list != nullptr ? list->size() : 0;
+    long long start = this->start < 0 ? this->start + size : this->start;
+    long long stop = this->stop < 0 ? this->stop + size : this->stop;
+    start = std::max(start, 0LL);
+    stop = std::min(stop, size - 1);
+    if (start > stop) {
+        this->respond(SharedReplies::empty_array);
+        return;
+    }
+
+    this->respond_with([list, start, stop](std::string &out) {
+        MessageParser::append_array_header(out, stop - start + 1);
+        list->for_range(start, stop + 1,
+                        [&out](std::string_view element) { MessageParser::append_bulk_string(out, element); });
+    });
+}
+
+std::vector<std::string_view> LRangeCommand::get_keys() const {
+    return {this->key};
+}
+
+LLenCommand::LLenCommand(std::string &&key) : StorageCommand(CommandType::LLen), key(std::move(key)) {}
+
+// Example: LLEN <key>
+CommandPtr LLenCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for LLEN command");
+    }
+    std::string key = decoded_msg[1];
+    return std::make_unique<LLenCommand>(std::move(key));
+}
+
+void LLenCommand::execute(ServerInfo &server_info) {
+    bool wrong_type;
+    const QuickList *list = find_value<QuickList>(*this->storage_ptr, this->key, wrong_type);
+    if (wrong_type) {
+        this->respond(SharedReplies::wrong_type);
+        return;
+    }
+    this->respond_integer(list != nullptr ? list->size() : 0);
+}
+
+std::vector<std::string_view> LLenCommand::get_keys() const {
+    return {this->key};
+}
+
+// Parses a cluster hash slot number
+static int parse_slot(std::string_view s) {
+    long long slot;
+    if (!parse_integer(s, slot) || slot < 0 || slot >= Cluster::SLOTS) {
+        throw CommandParseError("Invalid or out of range slot");
+    }
+    return slot;
+}
+
+// Parses <first> <last> pairs of slot numbers into every slot they cover
+static std::vector<int> parse_slot_ranges(const DecodedMessage &decoded_msg, size_t begin) {
+    if (begin >= decoded_msg.size() || (decoded_msg.size() - begin) % 2 != 0) {
+        throw CommandParseError("Invalid number of slot range arguments");
+    }
+
+    std::vector<int> slots;
+    for (size_t i = begin; i < decoded_msg.size(); i += 2) {
+        const int first = parse_slot(decoded_msg[i]);
+        const int last = parse_slot(decoded_msg[i + 1]);
+        if (first > last) {
+            throw CommandParseError("start slot number " + std::to_string(first) +
+                                    " is greater than end slot number " + std::to_string(last));
+        }
+        for (int slot = first; slot <= last; slot++) slots.push_back(slot);
+    }
+    return slots;
+}
+
+ClusterCommand::ClusterCommand(Subcommand subcommand, std::vector<std::string> &&args, std::vector<int> &&slots)
+    : StorageCommand(CommandType::Cluster), subcommand(subcommand), args(std::move(args)), slots(std::move(slots)) {}
+
+/**
+ * Example: CLUSTER <subcommand> [<arg> ...]
+ *
+ * INFO, MYID, NODES, SLOTS, SHARDS, KEYSLOT <key>, COUNTKEYSINSLOT <slot>, GETKEYSINSLOT <slot> <count>,
+ * ADDSLOTS <slot> [<slot> ...], ADDSLOTSRANGE <first> <last> [...], DELSLOTS <slot> [<slot> ...],
+ * DELSLOTSRANGE <first> <last> [...], SETSLOT <slot> IMPORTING|MIGRATING|NODE <node-id>, SETSLOT <slot> STABLE,
+ * MEET <ip> <port>
+ */
+CommandPtr ClusterCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 2) {
+        throw CommandParseError("Insufficient arguments for CLUSTER command");
+    }
+
+    std::string subcommand = decoded_msg[1];
+    std::transform(subcommand.begin(), subcommand.end(), subcommand.begin(), toupper);
+    const size_t arg_count = decoded_msg.size() - 2;
+    std::vector<std::string> args;
+    std::vector<int> slots;
+
+    if (subcommand == "INFO" && arg_count == 0) {
+        return std::make_unique<ClusterCommand>(Subcommand::Info, std::move(args), std::move(slots));
+    } else if (subcommand == "MYID" && arg_count == 0) {
+        return std::make_unique<ClusterCommand>(Subcommand::MyId, std::move(args), std::move(slots));
+    } else if (subcommand == "NODES" && arg_count == 0) {
+        return std::make_unique<ClusterCommand>(Subcommand::Nodes, std::move(args), std::move(slots));
+    } else if (subcommand == "SLOTS" && arg_count == 0) {
+        return std::make_unique<ClusterCommand>(Subcommand::Slots, std::move(args), std::move(slots));
+    } else if (subcommand == "SHARDS" && arg_count == 0) {
+        return std::make_unique<ClusterCommand>(Subcommand::Shards, std::move(args), std::move(slots));
+    } else if (subcommand == "KEYSLOT" && arg_count == 1) {
+        args.push_back(decoded_msg[2]);
+        return std::make_unique<ClusterCommand>(Subcommand::KeySlot, std::move(args), std::move(slots));
+    } else if (subcommand == "COUNTKEYSINSLOT" && arg_count == 1) {
+        slots.push_back(parse_slot(decoded_msg[2]));
+        return std::make_unique<ClusterCommand>(Subcommand::CountKeysInSlot, std::move(args), std::move(slots));
+    } else if (subcommand == "GETKEYSINSLOT" && arg_count == 2) {
+        slots.push_back(parse_slot(decoded_msg[2]));
+        long long count;
+        if (!parse_integer(decoded_msg[3], count) || count < 0) {
+            throw CommandParseError("Invalid number of keys");
+        }
+        args.push_back(decoded_msg[3]);
+        return std::make_unique<ClusterCommand>(Subcommand::GetKeysInSlot, std::move(args), std::move(slots));
+    } else if ((subcommand == "ADDSLOTS" || subcommand == "DELSLOTS") && arg_count >= 1) {
+        for (size_t i = 2; i < decoded_msg.size(); i++) {
+            slots.push_back(parse_slot(decoded_msg[i]));
+        }
+        const Subcommand type = subcommand == "ADDSLOTS" ? Subcommand::AddSlots : Subcommand::DelSlots;
+        return std::make_unique<ClusterCommand>(type, std::move(args), std::move(slots));
+    } else if (subcommand == "ADDSLOTSRANGE" || subcommand == "DELSLOTSRANGE") {
+        slots = parse_slot_ranges(decoded_msg, 2);
+        const Subcommand type = subcommand == "ADDSLOTSRANGE" ? Subcommand::AddSlots : Subcommand::DelSlots;
+        return std::make_unique<ClusterCommand>(type, std::move(args), std::move(slots));
+    } else if (subcommand == "SETSLOT" && arg_count >= 2) {
+        slots.push_back(parse_slot(decoded_msg[2]));
+        std::string state = decoded_msg[3];
+        std::transform(state.begin(), state.end(), state.begin(), toupper);
+        const bool takes_node = state == "IMPORTING" || state == "MIGRATING" || state == "NODE";
+        if (!(takes_node && arg_count == 3) && !(state == "STABLE" && arg_count == 2)) {
+            throw CommandParseError("Invalid CLUSTER SETSLOT action or number of arguments");
+        }
+        args.push_back(std::move(state));
+        if (takes_node) args.push_back(decoded_msg[4]);
+        return std::make_unique<ClusterCommand>(Subcommand::SetSlot, std::move(args), std::move(slots));
+    } else if (subcommand == "MEET" && arg_count == 2) {
+        long long port;
+        if (!parse_integer(decoded_msg[3], port) || port <= 0 || port > 65535) {
+            throw CommandParseError("Invalid TCP base port specified: " + decoded_msg[3]);
+        }
+        args = {decoded_msg[2] == "localhost" ? "127.0.0.1" : decoded_msg[2], decoded_msg[3]};
+        return std::make_unique<ClusterCommand>(Subcommand::Meet, std::move(args), std::move(slots));
+    }
+    throw CommandParseError("Unknown CLUSTER subcommand or wrong number of arguments");
+}
+
+void ClusterCommand::execute(ServerInfo &server_info) {
+    if (!Cluster::enabled()) {
+        this->respond_error("ERR This instance has cluster support disabled");
+        return;
+    }
+
+    const std::vector<Cluster::Node> &nodes = Cluster::get_nodes();
+    switch (this->subcommand) {
+        case Subcommand::Info:
+            this->respond_bulk_string(Cluster::describe_info());
+            break;
+        case Subcommand::MyId:
+            this->respond_bulk_string(nodes[0].id);
+            break;
+        case Subcommand::Nodes:
+            this->respond_bulk_string(Cluster::describe_nodes());
+            break;
+        case Subcommand::Slots: {
+            // [first, last, [ip, port, id]] for every range, in slot order
+            std::vector<std::tuple<int, int, int>> ranges;
+            for (size_t node = 0; node < nodes.size(); node++) {
+                for (const auto &[first, last] : Cluster::slot_ranges(node)) {
+                    ranges.emplace_back(first, last, node);
+                }
+            }
+            std::sort(ranges.begin(), ranges.end());
+
+            this->respond_with([&](std::string &out) {
+                MessageParser::append_array_header(out, ranges.size());
+                for (const auto &[first, last, node] : ranges) {
+                    MessageParser::append_array_header(out, 3);
+                    MessageParser::append_integer(out, first);
+                    MessageParser::append_integer(out, last);
+                    MessageParser::append_array_header(out, 3);
+                    MessageParser::append_bulk_string(out, nodes[node].ip);
+                    MessageParser::append_integer(out, nodes[node].port);
+                    MessageParser::append_bulk_string(out, nodes[node].id);
+                }
+            });
+            break;
+        }
+        case Subcommand::Shards:
+            // Every node is a shard of its own, without replicas
+            this->respond_with([&](std::string &out) {
+                MessageParser::append_array_header(out, nodes.size());
+                for (size_t node = 0; node < nodes.size(); node++) {
+                    const std::vector<std::pair<int, int>> ranges = Cluster::slot_ranges(node);
+                    MessageParser::append_array_header(out, 4);
+                    MessageParser::append_bulk_string(out, "slots");
+                    MessageParser::append_array_header(out, ranges.size() * 2);
+                    for (const auto &[first, last] : ranges) {
+                        MessageParser::append_integer(out, first);
+                        MessageParser::append_integer(out, last);
+                    }
+                    MessageParser::append_bulk_string(out, "nodes");
+                    MessageParser::append_array_header(out, 1);
+                    MessageParser::append_array_header(out, 14);
+                    MessageParser::append_bulk_string(out, "id");
+                    MessageParser::append_bulk_string(out, nodes[node].id);
+                    MessageParser::append_bulk_string(out, "port");
+                    MessageParser::append_integer(out, nodes[node].port);
+                    MessageParser::append_bulk_string(out, "ip");
+                    MessageParser::append_bulk_string(out, nodes[node].ip);
+                    MessageParser::append_bulk_string(out, "endpoint");
+                    MessageParser::append_bulk_string(out, nodes[node].ip);
+                    MessageParser::append_bulk_string(out, "role");
+                    MessageParser::append_bulk_string(out, "master");
+                    MessageParser::append_bulk_string(out, "replication-offset");
+                    MessageParser::append_integer(out, 0);
+                    MessageParser::append_bulk_string(out, "health");
+                    MessageParser::append_bulk_string(out, "online");
+                }
+            });
+            break;
+        case Subcommand::KeySlot:
+            this->respond_integer(Cluster::key_hash_slot(this->args[0]));
+            break;
+        case Subcommand::CountKeysInSlot:
+            this->respond_integer(this->storage_ptr->count_keys_in_slot(this->slots[0]));
+            break;
+        case Subcommand::GetKeysInSlot: {
+            const std::vector<std::string> keys =
+                this->storage_ptr->keys_in_slot(this->slots[0], std::stoull(this->args[0]));
+            this->respond_with([&keys](std::string &out) { MessageParser::append_array(out, keys); });
+            break;
+        }
+        case Subcommand::AddSlots:
+        case Subcommand::DelSlots:
+        case Subcommand::SetSlot:
+        case Subcommand::Meet: {
+            std::string error;
+            if (this->subcommand == Subcommand::AddSlots) {
+                error = Cluster::add_slots(this->slots);
+            } else if (this->subcommand == Subcommand::DelSlots) {
+                error = Cluster::del_slots(this->slots);
+            } else if (this->subcommand == Subcommand::SetSlot) {
+                const std::string_view node_id = this->args.size() > 1 ? std::string_view{this->args[1]} : "";
+                error = Cluster::set_slot(this->slots[0], this->args[0], node_id, *this->storage_ptr);
+            } else {
+                error = Cluster::meet(this->args[0], std::stoi(this->args[1]));
+            }
+
+            if (error.empty()) {
+                this->respond(SharedReplies::ok);
+            } else {
+                this->respond_error(error);
+            }
+            break;
+        }
+    }
+}
+
+MigrateCommand::MigrateCommand(std::string &&host, int port, std::chrono::milliseconds timeout, bool copy,
+                               bool replace, std::vector<std::string> &&keys)
+    : StorageCommand(CommandType::Migrate),
+      host(std::move(host)),
+      port(port),
+      timeout(timeout),
+      copy(copy),
+      replace(replace),
+      keys(std::move(keys)) {}
+
+/**
+ * Example: MIGRATE <host> <port> <key> | "" <destination-db> <timeout> [COPY] [REPLACE] [KEYS <key> [<key> ...]]
+ *
+ * There is only database 0. The timeout is in milliseconds and bounds every step talking to the target.
+ */
+CommandPtr MigrateCommand::parse(const DecodedMessage &decoded_msg) {
+    if (decoded_msg.size() < 6) {
+        throw CommandParseError("Insufficient arguments for MIGRATE command");
+    }
+
+    long long port, db, timeout;
+    if (!parse_integer(decoded_msg[2], port) || !parse_integer(decoded_msg[4], db) ||
+        !parse_integer(decoded_msg[5], timeout)) {
+        throw CommandParseError("value is not an integer or out of range");
+    }
+    if (db != 0) {
+        throw CommandParseError("ERR DB index is out of range");
+    }
+    if (timeout <= 0) {
+        timeout = 1000;
+    }
+
+    bool copy = false, replace = false;
+    std::vector<std::string> keys;
+    if (!decoded_msg[3].empty()) {
+        keys.push_back(decoded_msg[3]);
+    }
+    for (size_t i = 6; i < decoded_msg.size(); i++) {
+        std::string option = decoded_msg[i];
+        std::transform(option.begin(), option.end(), option.begin(), toupper);
+        if (option == "COPY") {
+            copy = true;
+        } else if (option == "REPLACE") {
+            replace = true;
+        } else if (option == "KEYS") {
+            if (!decoded_msg[3].empty()) {
+                throw CommandParseError(
+                    "When using MIGRATE KEYS option, the key argument must be set to the empty string");
+            }
+            keys.assign(decoded_msg.begin() + i + 1, decoded_msg.end());
+            break;
+        } else {
+            throw CommandParseError("syntax error");
+        }
+    }
+    if (keys.empty()) {
+        throw CommandParseError("syntax error");
+    }
+
+    std::string host = decoded_msg[1] == "localhost" ? "127.0.0.1" : decoded_msg[1];
+    return std::make_unique<MigrateCommand>(std::move(host), port, std::chrono::milliseconds(timeout), copy, replace,
+                                            std::move(keys));
+}
+
+// Commands rebuilding value at key, large values are split so that no single command gets too big. Only strings can
+// be given an expiry by a command, others lose theirs.
+static void append_restore_commands(std::string_view key, const StorageValueVariants &value,
+                                    std::vector<DecodedMessage> &commands) {
+    static constexpr size_t ELEMENTS_PER_COMMAND = 1024;
+
+    // Starts a new command once the last one is full, its first arguments are the name and the key
+    auto add = [&](std::string_view name, std::initializer_list<std::string_view> args) {
+        if (commands.empty() || commands.back()[0] != name || commands.back()[1] != key ||
+            commands.back().size() >= 2 + ELEMENTS_PER_COMMAND * 2) {
+            commands.push_back({std::string{name}, std::string{key}});
+        }
+        for (std::string_view arg : args) commands.back().emplace_back(arg);
+    };
+
+    std::visit(
+        [&](const auto &v) {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, StringValue>) {
+                commands.push_back({"SET", std::string{key}, v.get_value_ref()});
+                if (const TimeStamp expiry = v.get_expiry()) {
+                    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        expiry.value() - std::chrono::system_clock::now());
+                    commands.back().push_back("PX");
+                    commands.back().push_back(std::to_string(std::max<long long>(left.count(), 1)));
+                }
+            } else if constexpr (std::is_same_v<T, StreamValue>) {
+                commands.push_back({"XADD", std::string{key}, "0-1"});
+                for (const auto &[field, val] : v.get_value_ref()) {
+                    commands.back().push_back(field);
+                    commands.back().push_back(val);
+                }
+            } else if constexpr (std::is_same_v<T, HashValue>) {
+                v.get_value_ref().for_each(
+                    [&](std::string_view field, std::string_view val) { add("HSET", {field, val}); });
+            } else if constexpr (std::is_same_v<T, SortedSetValue>) {
+                const SortedSet &set = v.get_value_ref();
+                set.for_range(0, set.size(), [&](std::string_view member, double score) {
+                    char buf[32];
+                    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), score);
+                    add("ZADD", {std::string_view(buf, end - buf), member});
+                });
+            } else {
+                const QuickList &list = v.get_value_ref();
+                list.for_range(0, list.size(), [&](std::string_view element) { add("RPUSH", {element}); });
+            }
+        },
+        value);
+}
+
+void MigrateCommand::execute(ServerInfo &server_info) {
+    if (server_info.is_replica() && this->client_socket != server_info.replication_info.master_fd) {
+        this->respond_error("Cannot write to replica");
+        return;
+    }
+
+    std::vector<std::string> migrated;
+    std::vector<DecodedMessage> commands;
+    for (const std::string &key : this->keys) {
+        const StorageValueVariants *value = this->storage_ptr->find(key);
+        if (value == nullptr) continue;
+        if (this->replace) {
+            commands.push_back({"DEL", key});
+        }
+        append_restore_commands(key, *value, commands);
+        migrated.push_back(key);
+    }
+    if (migrated.empty()) {
+        this->respond_simple_string("NOKEY");
+        return;
+    }
+
+    std::vector<std::string> replies;
+    std::string error;
+    if (!this->replace) {
+        DecodedMessage exists = {"EXISTS"};
+        exists.insert(exists.end(), migrated.begin(), migrated.end());
+        const std::string check = MessageParser::encode_array({"ASKING"}) + MessageParser::encode_array(exists);
+        error = Cluster::exchange(this->host, this->port, this->timeout, check, 2, replies);
+        if (error.empty() && replies[1] != ":0\r\n") {
+            error = replies[1].starts_with('-') ? replies[1].substr(1, replies[1].size() - 3)
+                                                : "BUSYKEY Target key name already exists.";
+        }
+        replies.clear();
+    }
+
+    // A node importing the slot only takes the command right after ASKING
+    if (error.empty()) {
+        std::string pipeline;
+        for (const DecodedMessage &command : commands) {
+            MessageParser::append_array(pipeline, {"ASKING"});
+            MessageParser::append_array(pipeline, command);
+        }
+        error = Cluster::exchange(this->host, this->port, this->timeout, pipeline, commands.size() * 2, replies);
+    }
+    for (const std::string &reply : replies) {
+        if (error.empty() && reply.starts_with('-')) {
+            error = "ERR Target instance replied with error: " + reply.substr(1, reply.size() - 3);
+        }
+    }
+    if (!error.empty()) {
+        this->respond_error(error);
+        return;
+    }
+
+    if (!this->copy) {
+        DecodedMessage del = {"DEL"};
+        for (const std::string &key : migrated) {
+            this->storage_ptr->erase(key);
+            del.push_back(key);
+        }
+        propagate_command(MessageParser::encode_array(del), server_info);
+    }
+    this->respond(SharedReplies::ok);
+}
+
+std::vector<std::string_view> MigrateCommand::get_keys() const {
+    return {this->keys.begin(), this->keys.end()};
 }
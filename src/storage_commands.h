@@ -1,6 +1,8 @@
 #pragma once
 
+#include "blocking.h"
 #include "commands.h"
+#include "glob_pattern.h"
 #include "storage.h"
 
 /*
@@ -11,11 +13,28 @@ class StorageCommand : public Command {
    public:
     void set_store_ref(StoragePtr storage_ptr);
 
+    // Keys this command reads or writes
+    virtual std::vector<std::string_view> get_keys() const;
+
    protected:
     StorageCommand(CommandType type);
     StoragePtr storage_ptr;
 };
 
+class InfoCommand : public StorageCommand {
+   public:
+    InfoCommand(std::vector<std::string> &&sections);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    std::vector<std::string> sections;
+
+    bool wants(std::string_view section, bool in_default) const;
+};
+
 class SetCommand : public StorageCommand {
    public:
     SetCommand(std::string &&key, std::string &&value, TimeStamp &&expire_time);
@@ -24,6 +43,8 @@ class SetCommand : public StorageCommand {
 
     void execute(ServerInfo &server_info) override;
 
+    std::vector<std::string_view> get_keys() const override;
+
    private:
     std::string key;
     std::string value;
@@ -38,22 +59,22 @@ class GetCommand : public StorageCommand {
 
     void execute(ServerInfo &server_info) override;
 
+    std::vector<std::string_view> get_keys() const override;
+
    private:
     std::string key;
 };
 
 class KeysCommand : public StorageCommand {
    public:
-    KeysCommand(std::string &&pattern);
+    KeysCommand(GlobPattern &&pattern);
 
     static CommandPtr parse(const DecodedMessage &decoded_msg);
 
     void execute(ServerInfo &server_info) override;
 
    private:
-    std::string pattern;
-
-    bool match(const std::string &target, const std::string &pattern);
+    GlobPattern pattern;
 };
 
 class TypeCommand : public StorageCommand {
@@ -64,8 +85,15 @@ class TypeCommand : public StorageCommand {
 
     void execute(ServerInfo &server_info) override;
 
+    std::vector<std::string_view> get_keys() const override;
+
    private:
-    static std::string missing_key_type;
+    static constexpr std::string_view missing_key_type = "+none\r\n";
+    static constexpr std::string_view string_type = "+string\r\n";
+    static constexpr std::string_view stream_type = "+stream\r\n";
+    static constexpr std::string_view hash_type = "+hash\r\n";
+    static constexpr std::string_view zset_type = "+zset\r\n";
+    static constexpr std::string_view list_type = "+list\r\n";
 
     std::string key;
 };
@@ -79,8 +107,422 @@ class XAddCommand : public StorageCommand {
 
     void execute(ServerInfo &server_info) override;
 
+    std::vector<std::string_view> get_keys() const override;
+
    private:
     std::string stream_key;
     std::string stream_id;
     Stream stream;
-};
\ No newline at end of file
+};
+
+class MGetCommand : public StorageCommand {
+   public:
+    MGetCommand(std::vector<std::string> &&keys);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::vector<std::string> keys;
+};
+
+class MSetCommand : public StorageCommand {
+   public:
+    MSetCommand(std::vector<std::string> &&keys, std::vector<std::string> &&values);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+};
+
+// DEL and UNLINK, which frees large values on the lazy free thread
+class DelCommand : public StorageCommand {
+   public:
+    DelCommand(CommandType type, std::vector<std::string> &&keys);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::vector<std::string> keys;
+};
+
+// FLUSHALL and FLUSHDB, the same with a single database
+class FlushCommand : public StorageCommand {
+   public:
+    FlushCommand(CommandType type, bool async);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    bool async;
+};
+
+// Writes the keyspace to the --mmap-snapshot file when there is one, to the RDB file otherwise
+class SaveCommand : public StorageCommand {
+   public:
+    SaveCommand();
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+};
+
+class ExistsCommand : public StorageCommand {
+   public:
+    ExistsCommand(std::vector<std::string> &&keys);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::vector<std::string> keys;
+};
+
+class HSetCommand : public StorageCommand {
+   public:
+    HSetCommand(std::string &&key, std::vector<std::pair<std::string, std::string>> &&fields);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::vector<std::pair<std::string, std::string>> fields;
+};
+
+class HGetCommand : public StorageCommand {
+   public:
+    HGetCommand(std::string &&key, std::string &&field);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::string field;
+};
+
+class HMGetCommand : public StorageCommand {
+   public:
+    HMGetCommand(std::string &&key, std::vector<std::string> &&fields);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::vector<std::string> fields;
+};
+
+class HDelCommand : public StorageCommand {
+   public:
+    HDelCommand(std::string &&key, std::vector<std::string> &&fields);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::vector<std::string> fields;
+};
+
+class HGetAllCommand : public StorageCommand {
+   public:
+    HGetAllCommand(std::string &&key);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+};
+
+class HIncrByCommand : public StorageCommand {
+   public:
+    HIncrByCommand(std::string &&key, std::string &&field, long long increment);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::string field;
+    long long increment;
+};
+
+class ZAddCommand : public StorageCommand {
+   public:
+    struct Options {
+        bool nx = false;  // only add new members
+        bool xx = false;  // only update existing members
+        bool gt = false;  // only update to a greater score
+        bool lt = false;  // only update to a lower score
+        bool ch = false;  // reply with added + updated instead of added
+    };
+
+    ZAddCommand(std::string &&key, Options &&options, std::vector<std::pair<double, std::string>> &&members);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    Options options;
+    std::vector<std::pair<double, std::string>> members;
+};
+
+class ZScoreCommand : public StorageCommand {
+   public:
+    ZScoreCommand(std::string &&key, std::string &&member);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::string member;
+};
+
+class ZRangeCommand : public StorageCommand {
+   public:
+    ZRangeCommand(std::string &&key, long long start, long long stop, bool with_scores);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    long long start;
+    long long stop;
+    bool with_scores;
+};
+
+class ZRangeByScoreCommand : public StorageCommand {
+   public:
+    struct Bound {
+        double score;
+        bool exclusive;
+    };
+
+    ZRangeByScoreCommand(std::string &&key, Bound min, Bound max, bool with_scores, long long offset, long long count);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    Bound min;
+    Bound max;
+    bool with_scores;
+    long long offset;
+    long long count;  // negative for no limit
+};
+
+class ZRankCommand : public StorageCommand {
+   public:
+    ZRankCommand(std::string &&key, std::string &&member);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::string member;
+};
+
+class ZPopMinCommand : public StorageCommand {
+   public:
+    ZPopMinCommand(std::string &&key, long long count);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    long long count;
+};
+
+// LPUSH and RPUSH
+class ListPushCommand : public StorageCommand {
+   public:
+    ListPushCommand(CommandType type, std::string &&key, std::vector<std::string> &&elements);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::vector<std::string> elements;
+};
+
+// LPOP and RPOP
+class ListPopCommand : public StorageCommand {
+   public:
+    ListPopCommand(CommandType type, std::string &&key, std::optional<long long> count);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    std::optional<long long> count;  // none replies with a single element instead of an array
+};
+
+// BLPOP and BRPOP
+class BlockingListPopCommand : public StorageCommand {
+   public:
+    BlockingListPopCommand(CommandType type, std::vector<std::string> &&keys, Blocking::Deadline deadline);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::vector<std::string> keys;
+    Blocking::Deadline deadline;
+};
+
+class LRangeCommand : public StorageCommand {
+   public:
+    LRangeCommand(std::string &&key, long long start, long long stop);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+    long long start;
+    long long stop;
+};
+
+class LLenCommand : public StorageCommand {
+   public:
+    LLenCommand(std::string &&key);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string key;
+};
+
+class ClusterCommand : public StorageCommand {
+   public:
+    enum class Subcommand {
+        Info,
+        MyId,
+        Nodes,
+        Slots,
+        Shards,
+        KeySlot,
+        CountKeysInSlot,
+        GetKeysInSlot,
+        AddSlots,
+        DelSlots,
+        SetSlot,
+        Meet
+    };
+
+    ClusterCommand(Subcommand subcommand, std::vector<std::string> &&args, std::vector<int> &&slots);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+   private:
+    Subcommand subcommand;
+    std::vector<std::string> args;  // what follows the slots, if any
+    std::vector<int> slots;
+};
+
+/**
+ * Moves keys to another node, replaying each value there as the commands that build it, each after an ASKING so that
+ * a node importing the slot takes it. The keys are deleted here once the target took them all, unless COPY is given.
+ */
+class MigrateCommand : public StorageCommand {
+   public:
+    MigrateCommand(std::string &&host, int port, std::chrono::milliseconds timeout, bool copy, bool replace,
+                   std::vector<std::string> &&keys);
+
+    static CommandPtr parse(const DecodedMessage &decoded_msg);
+
+    void execute(ServerInfo &server_info) override;
+
+    std::vector<std::string_view> get_keys() const override;
+
+   private:
+    std::string host;
+    int port;
+    std::chrono::milliseconds timeout;
+    bool copy;
+    bool replace;
+    std::vector<std::string> keys;
+};
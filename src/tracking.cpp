@@ -0,0 +1,165 @@
+#include "tracking.h"
+
+#include "message_parser.h"
+#include "server.h"
+
+size_t Tracking::tracking_table_max_keys = 1000000;
+thread_local ServerInfo *Tracking::server_info = nullptr;
+thread_local std::unordered_map<uint64_t, Tracking::TrackedClient> Tracking::clients;
+thread_local Tracking::KeyTable Tracking::keys;
+thread_local size_t Tracking::items = 0;
+thread_local std::map<std::string, Tracking::Prefix, std::less<>> Tracking::prefixes;
+thread_local uint64_t Tracking::current_client = 0;
+
+void Tracking::attach(ServerInfo &server_info) {
+    Tracking::server_info = &server_info;
+}
+
+void Tracking::enable(uint64_t client_id, int client_socket, Options &&options) {
+    // Turning tracking on again replaces the previous options
+    disable(client_id);
+
+    if (options.bcast) {
+        if (options.prefixes.empty()) options.prefixes.emplace_back("");
+        for (const std::string &prefix : options.prefixes) {
+            Tracking::prefixes[prefix].clients.insert(client_id);
+        }
+    }
+    Tracking::clients[client_id] = {client_socket, std::move(options)};
+}
+
+void Tracking::disable(uint64_t client_id) {
+    auto it = Tracking::clients.find(client_id);
+    if (it == Tracking::clients.end()) return;
+
+    // Entries in the key table are dropped lazily, when the key is next invalidated
+    for (const std::string &prefix : it->second.options.prefixes) {
+        auto prefix_it = Tracking::prefixes.find(prefix);
+        if (prefix_it == Tracking::prefixes.end()) continue;
+
+        prefix_it->second.clients.erase(client_id);
+        if (prefix_it->second.clients.empty()) {
+            Tracking::prefixes.erase(prefix_it);
+        }
+    }
+    Tracking::clients.erase(it);
+}
+
+void Tracking::set_current_client(uint64_t client_id) {
+    Tracking::current_client = client_id;
+}
+
+void Tracking::remember_keys(uint64_t client_id, const std::vector<std::string_view> &keys) {
+    auto client_it = Tracking::clients.find(client_id);
+    if (client_it == Tracking::clients.end() || client_it->second.options.bcast) return;
+
+    for (std::string_view key : keys) {
+        auto it = Tracking::keys.find(key);
+        if (it == Tracking::keys.end()) {
+            // Make room first, so the key being added is never the one evicted
+            if (Tracking::tracking_table_max_keys > 0 && Tracking::keys.size() >= Tracking::tracking_table_max_keys) {
+                invalidate(Tracking::keys.begin(), false);
+            }
+            it = Tracking::keys.try_emplace(std::string{key}).first;
+        }
+        Tracking::items += it->second.insert(client_id).second;
+    }
+}
+
+void Tracking::invalidate_key(std::string_view key) {
+    auto it = Tracking::keys.find(key);
+    if (it != Tracking::keys.end()) {
+        invalidate(it, true);
+    }
+
+    for (auto &[prefix, state] : Tracking::prefixes) {
+        if (key.starts_with(prefix)) {
+            state.pending.emplace_back(key, Tracking::current_client);
+        }
+    }
+}
+
+void Tracking::flush_broadcasts() {
+    for (auto &[prefix, state] : Tracking::prefixes) {
+        if (state.pending.empty()) continue;
+
+        for (const uint64_t client_id : state.clients) {
+            const bool noloop = Tracking::clients.at(client_id).options.noloop;
+
+            std::vector<std::string_view> keys;
+            keys.reserve(state.pending.size());
+            for (const auto &[key, modified_by] : state.pending) {
+                if (!noloop || modified_by != client_id) keys.push_back(key);
+            }
+            if (!keys.empty()) {
+                send_invalidation(client_id, keys);
+            }
+        }
+        state.pending.clear();
+    }
+}
+
+size_t Tracking::get_clients_count() {
+    return Tracking::clients.size();
+}
+
+size_t Tracking::get_keys_count() {
+    return Tracking::keys.size();
+}
+
+size_t Tracking::get_items_count() {
+    return Tracking::items;
+}
+
+size_t Tracking::get_prefixes_count() {
+    return Tracking::prefixes.size();
+}
+
+// Tells every client that read the key it is no longer valid, and forgets the key
+void Tracking::invalidate(KeyTable::iterator it, bool skip_current_client) {
+    const std::vector<std::string_view> keys = {it->first};
+    for (const uint64_t client_id : it->second) {
+        if (skip_current_client && client_id == Tracking::current_client) {
+            auto client_it = Tracking::clients.find(client_id);
+            if (client_it != Tracking::clients.end() && client_it->second.options.noloop) continue;
+        }
+        send_invalidation(client_id, keys);
+    }
+
+    Tracking::items -= it->second.size();
+    Tracking::keys.erase(it);
+}
+
+void Tracking::send_invalidation(uint64_t client_id, const std::vector<std::string_view> &keys) {
+    // The client may have turned tracking off or disconnected since it read the key
+    auto client_it = Tracking::clients.find(client_id);
+    if (client_it == Tracking::clients.end() || Tracking::server_info == nullptr) return;
+
+    const Options &options = client_it->second.options;
+    const int target_socket = options.redirect != 0 ? options.redirect_socket : client_it->second.client_socket;
+
+    // A redirect client that disconnected may have had its socket reused by another connection
+    auto target_it = Tracking::server_info->clients.find(target_socket);
+    if (target_it == Tracking::server_info->clients.end() ||
+        (options.redirect != 0 && target_it->second.id != options.redirect)) {
+        return;
+    }
+    std::string &out = target_it->second.reply_buffer;
+
+    if (options.redirect != 0) {
+        // RESP2: a Pub/Sub message on the invalidation channel
+        MessageParser::append_array_header(out, 3);
+        MessageParser::append_bulk_string(out, "message");
+        MessageParser::append_bulk_string(out, "__redis__:invalidate");
+    } else {
+        // RESP3: >2 invalidate [keys]
+        MessageParser::append_push_header(out, 2);
+        MessageParser::append_bulk_string(out, "invalidate");
+    }
+    MessageParser::append_array_header(out, keys.size());
+    for (std::string_view key : keys) {
+        MessageParser::append_bulk_string(out, key);
+    }
+
+    Tracking::server_info->pending_writes.insert(target_socket);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "storage.h"
+
+struct ServerInfo;
+
+/*
+    Server-assisted client side caching, see CLIENT TRACKING.
+
+    In the default mode the server remembers which keys each tracking client has read. The next write, deletion or
+    expiry of such a key sends those clients an invalidation and forgets them, until they read the key again. The
+    key table is bounded by tracking_table_max_keys: past it, the oldest entries are invalidated early instead.
+
+    In BCAST mode nothing is remembered. Every client that registered a prefix matching a modified key is told, in one
+    message per prefix batched over each event loop iteration.
+
+    Invalidations are RESP3 push messages, or RESP2 Pub/Sub messages on __redis__:invalidate when they are redirected
+    to another connection. They are queued in the receiving client's reply buffer and sent by the event loop.
+    Everything here runs on the event loop thread.
+*/
+class Tracking {
+   public:
+    struct Options {
+        bool bcast = false;
+        bool noloop = false;                // no invalidations for keys the client modified itself
+        uint64_t redirect = 0;              // client id receiving the invalidations, 0 for the client itself
+        int redirect_socket = -1;           // socket of the redirect client when tracking was enabled
+        std::vector<std::string> prefixes;  // BCAST only, none means every key
+    };
+
+    static size_t tracking_table_max_keys;  // 0 for no limit
+
+    // Where clients and their reply buffers live, set once by the server
+    static void attach(ServerInfo &server_info);
+
+    static void enable(uint64_t client_id, int client_socket, Options &&options);
+    static void disable(uint64_t client_id);
+
+    // True if any client has tracking enabled, checked before doing any other work
+    static bool active() {
+        return !Tracking::clients.empty();
+    }
+
+    // Client whose command is executing, so NOLOOP clients are not told about their own writes
+    static void set_current_client(uint64_t client_id);
+
+    // Called after a read-only command, with the keys it read
+    static void remember_keys(uint64_t client_id, const std::vector<std::string_view> &keys);
+
+    // Called by Storage whenever a key is written, deleted or expires
+    static void invalidate_key(std::string_view key);
+
+    // Sends the BCAST invalidations collected since the last call
+    static void flush_broadcasts();
+
+    static size_t get_clients_count();
+    static size_t get_keys_count();
+    static size_t get_items_count();  // key, client pairs in the key table
+    static size_t get_prefixes_count();
+
+   private:
+    struct TrackedClient {
+        int client_socket;
+        Options options;
+    };
+
+    struct Prefix {
+        std::unordered_set<uint64_t> clients;
+        std::vector<std::pair<std::string, uint64_t>> pending;  // modified keys and the client that modified them
+    };
+
+    using KeyTable = std::unordered_map<std::string, std::unordered_set<uint64_t>, StoreKeyHash, std::equal_to<>>;
+
+    // One table per shard thread, keys are only written on the shard owning them
+    static thread_local ServerInfo *server_info;
+    static thread_local std::unordered_map<uint64_t, TrackedClient> clients;
+    static thread_local KeyTable keys;
+    static thread_local size_t items;
+    static thread_local std::map<std::string, Prefix, std::less<>> prefixes;
+    static thread_local uint64_t current_client;
+
+    static void invalidate(KeyTable::iterator it, bool skip_current_client);
+    static void send_invalidation(uint64_t client_id, const std::vector<std::string_view> &keys);
+};
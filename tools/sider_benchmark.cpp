@@ -0,0 +1,378 @@
+// Load generator for sider: drives N connections with a configurable command mix and reports throughput and an
+// HDR latency distribution. Run ./sider-benchmark --help for the options.
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/histogram.h"
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    std::string socket;  // connects to this unix socket instead of host:port when set
+    int clients = 50;
+    long requests = 100000;
+    int pipeline = 1;
+    int data_size = 3;
+    long keyspace = 0;  // 0 always uses the same key
+    int mget_keys = 10;
+    std::vector<std::string> tests = {"set", "get"};
+    std::vector<std::pair<std::string, int>> mix;  // weighted mix run as a single test
+};
+
+static void usage() {
+    std::cout << "Usage: sider-benchmark [options]\n"
+                 "  -h <host>          Server host (default 127.0.0.1)\n"
+                 "  -p <port>          Server port (default 6379)\n"
+                 "  -s <socket>        Server unix socket, overrides host and port\n"
+                 "  -c <clients>       Parallel connections (default 50)\n"
+                 "  -n <requests>      Total requests per test (default 100000)\n"
+                 "  -P <pipeline>      Requests in flight per connection (default 1)\n"
+                 "  -d <size>          Value size of SET and XADD in bytes (default 3)\n"
+                 "  -r <keyspace>      Use random keys in [0, keyspace) instead of a single key\n"
+                 "  -t <tests>         Comma separated tests: get,set,xadd,mget (default set,get)\n"
+                 "  --mget-keys <n>    Keys per MGET (default 10)\n"
+                 "  --mix <mix>        Run one weighted mix instead of -t, eg. get:90,set:10\n";
+}
+
+static std::vector<std::string> split(const std::string &s, char delim) {
+    std::vector<std::string> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, delim)) {
+        if (!item.empty()) res.push_back(item);
+    }
+    return res;
+}
+
+static Options parse_options(int argc, char **argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--help") {
+            usage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument(arg + " requires an argument");
+        }
+
+        const std::string value = argv[++i];
+        if (arg == "-h") {
+            options.host = value;
+        } else if (arg == "-p") {
+            options.port = std::stoi(value);
+        } else if (arg == "-s") {
+            options.socket = value;
+        } else if (arg == "-c") {
+            options.clients = std::max(1, std::stoi(value));
+        } else if (arg == "-n") {
+            options.requests = std::stol(value);
+        } else if (arg == "-P") {
+            options.pipeline = std::max(1, std::stoi(value));
+        } else if (arg == "-d") {
+            options.data_size = std::stoi(value);
+        } else if (arg == "-r") {
+            options.keyspace = std::stol(value);
+        } else if (arg == "-t") {
+            options.tests = split(value, ',');
+        } else if (arg == "--mget-keys") {
+            options.mget_keys = std::max(1, std::stoi(value));
+        } else if (arg == "--mix") {
+            for (const std::string &entry : split(value, ',')) {
+                const size_t colon = entry.find(':');
+                if (colon == std::string::npos) throw std::invalid_argument("--mix entries look like get:90");
+                options.mix.emplace_back(entry.substr(0, colon), std::stoi(entry.substr(colon + 1)));
+            }
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    return options;
+}
+
+static void append_bulk(std::string &out, std::string_view s) {
+    out.push_back('$');
+    out.append(std::to_string(s.size()));
+    out.append("\r\n");
+    out.append(s);
+    out.append("\r\n");
+}
+
+class RequestGenerator {
+   public:
+    RequestGenerator(const Options &options, uint64_t seed)
+        : options(options), rng(seed), value(options.data_size, 'x') {}
+
+    // Appends one request of the given test to out
+    void append(std::string &out, const std::string &test) {
+        if (test == "get") {
+            out.append("*2\r\n");
+            append_bulk(out, "GET");
+            append_bulk(out, next_key());
+        } else if (test == "set") {
+            out.append("*3\r\n");
+            append_bulk(out, "SET");
+            append_bulk(out, next_key());
+            append_bulk(out, this->value);
+        } else if (test == "xadd") {
+            out.append("*5\r\n");
+            append_bulk(out, "XADD");
+            append_bulk(out, "stream:" + next_key());
+            append_bulk(out, "*");
+            append_bulk(out, "field");
+            append_bulk(out, this->value);
+        } else if (test == "mget") {
+            out.append("*" + std::to_string(this->options.mget_keys + 1) + "\r\n");
+            append_bulk(out, "MGET");
+            for (int i = 0; i < this->options.mget_keys; i++) {
+                append_bulk(out, next_key());
+            }
+        } else {
+            throw std::invalid_argument("Unknown test " + test);
+        }
+    }
+
+   private:
+    const Options &options;
+    std::mt19937_64 rng;
+    std::string value;
+
+    std::string next_key() {
+        if (this->options.keyspace <= 0) return "key:__rand_int__";
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "key:%012lu", this->rng() % this->options.keyspace);
+        return buf;
+    }
+};
+
+// Length of the complete RESP reply at the start of data, or 0 if more bytes are needed
+static size_t reply_length(const char *data, size_t len) {
+    if (len == 0) return 0;
+    const char *crlf = static_cast<const char *>(memmem(data, len, "\r\n", 2));
+    if (crlf == nullptr) return 0;
+    const size_t header = crlf - data + 2;
+
+    switch (data[0]) {
+        case '$': {
+            const long size = std::atol(data + 1);
+            if (size < 0) return header;
+            return len >= header + size + 2 ? header + size + 2 : 0;
+        }
+        case '*': {
+            const long elements = std::atol(data + 1);
+            size_t total = header;
+            for (long i = 0; i < elements; i++) {
+                const size_t element = reply_length(data + total, len - total);
+                if (element == 0) return 0;
+                total += element;
+            }
+            return total;
+        }
+        default:
+            // +simple string, -error, :integer
+            return header;
+    }
+}
+
+static int connect_to_unix_socket(const Options &options) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (options.socket.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("Unix socket path is too long: " + options.socket);
+    }
+    options.socket.copy(addr.sun_path, options.socket.size());
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        throw std::runtime_error("Unable to connect to " + options.socket);
+    }
+    return fd;
+}
+
+static int connect_to(const Options &options) {
+    if (!options.socket.empty()) {
+        return connect_to_unix_socket(options);
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &res) != 0) {
+        throw std::runtime_error("Unable to resolve " + options.host);
+    }
+
+    const int fd = socket(res->ai_family, res->ai_socktype, 0);
+    const int connected = fd < 0 ? -1 : connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (connected != 0) {
+        throw std::runtime_error("Unable to connect to " + options.host + ":" + std::to_string(options.port));
+    }
+
+    const int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return fd;
+}
+
+struct ClientResult {
+    Histogram latency;  // nanoseconds per request
+    long errors = 0;
+    std::string failure;
+};
+
+static void run_client(int fd, const Options &options, const std::vector<std::string> &schedule,
+                       std::atomic<long> &remaining, uint64_t seed, ClientResult &result) {
+    try {
+        RequestGenerator generator(options, seed);
+        std::mt19937_64 rng(seed);
+        std::string out;
+        std::vector<char> in(64 * 1024);
+        size_t in_len = 0;
+
+        while (true) {
+            // Claim up to one pipeline worth of requests
+            long claimed = remaining.fetch_sub(options.pipeline);
+            if (claimed <= 0) break;
+            const int batch = std::min<long>(claimed, options.pipeline);
+
+            out.clear();
+            for (int i = 0; i < batch; i++) {
+                generator.append(out, schedule[rng() % schedule.size()]);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t sent = 0; sent < out.size();) {
+                const ssize_t n = send(fd, out.data() + sent, out.size() - sent, 0);
+                if (n <= 0) throw std::runtime_error("Connection lost while sending");
+                sent += n;
+            }
+
+            // Every reply's latency is measured from the moment its batch was sent
+            int replies = 0;
+            while (replies < batch) {
+                size_t offset = 0;
+                while (replies < batch) {
+                    const size_t length = reply_length(in.data() + offset, in_len - offset);
+                    if (length == 0) break;
+                    if (in[offset] == '-') result.errors++;
+                    offset += length;
+                    replies++;
+                    result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now() - start)
+                                              .count());
+                }
+                std::memmove(in.data(), in.data() + offset, in_len - offset);
+                in_len -= offset;
+                if (replies == batch) break;
+
+                if (in_len == in.size()) in.resize(in.size() * 2);
+                const ssize_t n = recv(fd, in.data() + in_len, in.size() - in_len, 0);
+                if (n <= 0) throw std::runtime_error("Connection lost while receiving");
+                in_len += n;
+            }
+        }
+    } catch (const std::exception &e) {
+        result.failure = e.what();
+    }
+}
+
+static void report(const std::string &name, const Options &options, double seconds, const Histogram &latency,
+                   long errors) {
+    auto ms = [](uint64_t ns) { return ns / 1e6; };
+
+    printf("====== %s ======\n", name.c_str());
+    printf("  %lu requests completed in %.2f seconds\n", latency.get_count(), seconds);
+    printf("  %d parallel clients, pipeline %d, %d bytes payload, keyspace %ld\n", options.clients, options.pipeline,
+           options.data_size, options.keyspace);
+    if (errors > 0) printf("  %ld error replies\n", errors);
+    printf("  throughput: %.2f requests per second\n", latency.get_count() / seconds);
+    printf("  latency (msec): min=%.3f p50=%.3f p95=%.3f p99=%.3f p99.9=%.3f max=%.3f\n", ms(latency.get_min()),
+           ms(latency.percentile(50)), ms(latency.percentile(95)), ms(latency.percentile(99)),
+           ms(latency.percentile(99.9)), ms(latency.get_max()));
+
+    printf("  latency distribution (msec):\n");
+    for (double p : {0.0, 50.0, 75.0, 90.0, 95.0, 99.0, 99.9, 99.99, 100.0}) {
+        const uint64_t value = p == 0.0 ? latency.get_min() : latency.percentile(p);
+        printf("    %7.3f%% <= %.3f\n", p, ms(value));
+    }
+    printf("\n");
+}
+
+static void run_test(const std::string &name, const std::vector<std::string> &schedule, const Options &options) {
+    std::atomic<long> remaining = options.requests;
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> threads;
+
+    // Connect everything up front so connection setup is not part of the measurement
+    std::vector<int> fds;
+    for (int i = 0; i < options.clients; i++) {
+        fds.push_back(connect_to(options));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.clients; i++) {
+        threads.emplace_back(run_client, fds[i], std::cref(options), std::cref(schedule), std::ref(remaining), i + 1,
+                             std::ref(results[i]));
+    }
+    for (std::thread &thread : threads) thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (int fd : fds) close(fd);
+
+    Histogram latency;
+    long errors = 0;
+    for (const ClientResult &result : results) {
+        if (!result.failure.empty()) {
+            throw std::runtime_error(result.failure);
+        }
+        latency.merge(result.latency);
+        errors += result.errors;
+    }
+    report(name, options, seconds, latency, errors);
+}
+
+int main(int argc, char **argv) {
+    try {
+        const Options options = parse_options(argc, argv);
+
+        if (!options.mix.empty()) {
+            // Weighted schedule: each entry appears weight times, requests pick from it uniformly
+            std::vector<std::string> schedule;
+            std::string name;
+            for (const auto &[test, weight] : options.mix) {
+                for (int i = 0; i < weight; i++) schedule.push_back(test);
+                name += (name.empty() ? "" : ",") + test + ":" + std::to_string(weight);
+            }
+            run_test("MIX " + name, schedule, options);
+            return 0;
+        }
+
+        for (const std::string &test : options.tests) {
+            std::string name = test;
+            for (char &ch : name) ch = toupper(ch);
+            run_test(name, {test}, options);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "sider-benchmark: " << e.what() << '\n';
+        return 1;
+    }
+    return 0;
+}